@@ -16,15 +16,24 @@
 #include <FreeRTOS.h>
 #include <task.h>
 
+#include "ble_events.hpp"
 #include "ble_peripheral.hpp"
 #include "ble_receiver.hpp"
+#include "board_telemetry.hpp"
+#include "drive_control.hpp"
 #include "es_fds.hpp"
 #include "hall_sensor.hpp"
+#include "link_watchdog.hpp"
 #include "logger.hpp"
+#include "settings.hpp"
 #include "util.hpp"
 
 // TODO(CMK) 08/01/20: move to a separate module
 static void handle_sensor_data(HallSensor::type sensor_data);
+static void on_connection_changed(ble_events::Event *event);
+static bool read_board_battery(ble_es_common::BatteryTelemetry *telemetry);
+static bool read_board_status(ble_es_common::StatusTelemetry *telemetry);
+static void on_drive_output(HallSensor::type throttle, const drive_control::State &state);
 
 int main() {
     /* Early init */
@@ -34,11 +43,16 @@ int main() {
     util::clock_init();
 
     /* Library and module initialization */
-    // TODO(CMK) 07/03/20: FDS
-    // es_fds::init();
+    es_fds::init();
+    settings::init();
 
     /* BLE initialization */
-    ble_receiver::init(handle_sensor_data);
+    drive_control::init(on_drive_output);
+    link_watchdog::init(drive_control::on_ramp_step);
+    ble_receiver::init(handle_sensor_data, drive_control::on_command);
+    board_telemetry::init(read_board_battery, read_board_status, ble_receiver::write_telemetry);
+    ble_events::register_event(ble_events::Events::CONNECTED, on_connection_changed);
+    ble_events::register_event(ble_events::Events::DISCONNECTED, on_connection_changed);
 
     /* FreeRTOS initialization */
     NRF_LOG_INFO("FreeRTOS Starting");
@@ -57,9 +71,63 @@ int main() {
 extern "C"
 void vApplicationIdleHook(void) {
     logger::idle();
+    es_fds::idle();
     // TODO(CMK) 06/19/20: enter power saving here?
 }
 
 static void handle_sensor_data(HallSensor::type sensor_data) {
     NRF_LOG_INFO("Recieved sensor data: 0x%04X", sensor_data);
+    drive_control::on_throttle(sensor_data);
+    board_telemetry::on_notification();
+}
+
+static void on_connection_changed(ble_events::Event *event) {
+    /* The remote streams throttle data whenever it's connected, so only collect flash garbage
+       while disconnected */
+    es_fds::set_gc_allowed(event->event == ble_events::Events::DISCONNECTED);
+
+    if (event->event == ble_events::Events::CONNECTED) {
+        board_telemetry::start();
+    } else {
+        board_telemetry::stop();
+
+        auto stats = board_telemetry::stats();
+        NRF_LOG_INFO("Telemetry: %u frames, %u bytes, ~%u us airtime per hour connected (est.)",
+                     stats.frames, stats.bytes, stats.airtime_us_per_hour);
+
+        drive_control::on_disconnected();
+
+        auto control = drive_control::stats();
+        NRF_LOG_INFO("Control: %u commands (%u resent), latency %u us (worst %u us)",
+                     control.commands, control.duplicates,
+                     control.last_latency_us, control.worst_latency_us);
+        NRF_LOG_INFO("Failsafe: %u disconnections, recovered in %u ms (worst %u ms)",
+                     control.failsafes, control.last_recovery_ms, control.worst_recovery_ms);
+
+        auto watchdog = link_watchdog::stats();
+        NRF_LOG_INFO("Watchdog: %u trips (%u resumed) after %u ms silent, longest gap %u ms",
+                     watchdog.trips, watchdog.resumed, watchdog.last_timeout_ms,
+                     watchdog.worst_gap_ms);
+    }
+}
+
+static bool read_board_battery(ble_es_common::BatteryTelemetry *telemetry) {
+    /* Inert until the receiver drives an ESC: the pack is only measured there, and the receiver
+       has no battery divider of its own (its supply is regulated from the pack) */
+    static_cast<void>(telemetry);
+    return false;
+}
+
+static bool read_board_status(ble_es_common::StatusTelemetry *telemetry) {
+    /* Speed, current, temperature and faults all come from the ESC as well */
+    static_cast<void>(telemetry);
+    return false;
+}
+
+static void on_drive_output(HallSensor::type throttle, const drive_control::State &state) {
+    /* Handed to the ESC once the receiver drives one */
+    NRF_LOG_DEBUG("Throttle 0x%04X, mode %u, cruise %u, brake curve %u",
+                  state.is_cruising ? state.cruise_throttle : throttle,
+                  static_cast<unsigned>(state.mode), state.is_cruising,
+                  static_cast<unsigned>(state.brake_curve));
 }
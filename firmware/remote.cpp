@@ -23,22 +23,39 @@
 #include <task.h>
 #include <timers.h>
 
+#include "battery.hpp"
 #include "ble_central.hpp"
+#include "ble_common.hpp"
+#include "ble_es_common.hpp"
 #include "ble_events.hpp"
 #include "ble_remote.hpp"
 #include "es_fds.hpp"
 #include "logger.hpp"
+#include "power_manager.hpp"
+#include "ride_recorder.hpp"
+#include "sample_rate.hpp"
+#include "sample_stream.hpp"
+#include "settings.hpp"
+#include "timestamp.hpp"
 #include "util.hpp"
 
 // TODO(CMK) 08/01/20: testing
 static void on_cccd_write(ble_events::Event *event);
+static void on_disconnected(ble_events::Event *event);
 static TimerHandle_t hall_sensor_timer;
 static HallSensor hallSensor {};
 static void hall_sensor_timeout_handler(TimerHandle_t xTimer);
+static void on_sample_rate_mode(sample_rate::Mode mode);
+static void record_ride_sample(HallSensor::type val);
+static std::uint32_t next_record_ms;
+static ble_es_common::StatusTelemetry board_status;
+static void on_sleep();
+static void on_telemetry(const std::uint8_t *data, std::size_t len);
 
 int main() {
     /* Early init */
     logger::init();
+    sample_stream::init();
 
     /* Stack guard - TODO - no? */
     NRF_STACK_GUARD_INIT();
@@ -47,19 +64,33 @@ int main() {
     util::clock_init();
 
     hallSensor.init();
+    hallSensor.set_battery_callback(battery::update);
+    battery::init(ble_remote::update_battery_level);
     APP_ERROR_CHECK(app_timer_init());
     hall_sensor_timer = xTimerCreate("Hall sens",
-                                     5000, /* interval, ms */
+                                     pdMS_TO_TICKS(SAMPLE_RATE_FAST_PERIOD_MS),
                                      pdTRUE, /* auto reload */
                                      nullptr, /* timer ID */
                                      hall_sensor_timeout_handler);
+    sample_rate::init(on_sample_rate_mode);
 
     /* Library and module initialization */
-    // TODO(CMK) 07/03/20: FDS
+    es_fds::init();
+    settings::init();
+    ride_recorder::init();
 
     /* BLE initialization */
     ble_remote::init();
+    ble_remote::register_telemetry_callback(on_telemetry);
     ble_events::register_event(ble_events::Events::CCCD_WRITE, on_cccd_write);
+    ble_events::register_event(ble_events::Events::DISCONNECTED, on_disconnected);
+
+    /* Power management */
+    power_manager::init({
+        .sleep          = on_sleep,
+        .wake           = ble_remote::wake,
+        .read_throttle  = [] { return hallSensor.read(); },
+    });
 
     /* FreeRTOS initialization */
     NRF_LOG_INFO("FreeRTOS Starting");
@@ -78,20 +109,115 @@ int main() {
 extern "C"
 void vApplicationIdleHook(void) {
     logger::idle();
-    // TODO(CMK) 06/19/20: enter power saving here?
+    es_fds::idle();
+    /* Tickless idle puts the CPU to sleep between ticks, power_manager handles longer sleeps */
 }
 
 static void on_cccd_write(ble_events::Event *event) {
     NRF_LOG_INFO("Connected callback, starting timer");
 
     if (event->data.cccd_write.notifications_enabled) {
-        xTimerStart(hall_sensor_timer, 0);
+        /* Changing the period also starts the timer */
+        xTimerChangePeriod(hall_sensor_timer, pdMS_TO_TICKS(sample_rate::start()), 0);
+        next_record_ms = 0;
+        ride_recorder::start(RIDE_RECORDER_PERIOD_MS);
     } else {
         xTimerStop(hall_sensor_timer, 0);
+        ride_recorder::stop();
+
+        auto stats = sample_rate::stats();
+        NRF_LOG_INFO("Sampling: %u samples, average %u mHz, worst response %u us",
+                     stats.samples, stats.average_rate_mhz, stats.worst_response_us);
     }
+
+    /* Flash garbage collection must not run while throttle data is streaming */
+    es_fds::set_gc_allowed(!event->data.cccd_write.notifications_enabled);
+}
+
+static void on_disconnected(ble_events::Event *event) {
+    es_fds::set_gc_allowed(true);
+    ride_recorder::record_event(ride_recorder::Event::DISCONNECTED,
+                                event->data.disconnected.reason);
+
+    auto latency = ble_remote::notification_latency();
+    NRF_LOG_INFO("Notification latency: %u us (%u), worst %u us",
+                 latency.average_us, latency.samples, latency.worst_us);
+    NRF_LOG_INFO("Notification queueing: %u us (%u)",
+                 latency.queue_average_us, latency.queued);
+
+    auto security = ble_common::security_stats();
+    NRF_LOG_INFO("Encrypted: bonded %u us (%u, worst %u us), paired %u us (%u), %u failures",
+                 security.bonded.last_us, security.bonded.links, security.bonded.worst_us,
+                 security.paired.last_us, security.paired.links, security.failures);
+
+    auto recovery = ble_remote::recovery_stats();
+    NRF_LOG_INFO("Recovery: %u links, last %u ms (worst %u ms), %u samples lost (%u total)",
+                 recovery.recoveries, recovery.last_recovery_ms, recovery.worst_recovery_ms,
+                 recovery.last_samples_lost, recovery.samples_lost);
+
+    auto scan = ble_central::scan_stats();
+    NRF_LOG_INFO("Scanning: connected in %u ms (worst %u ms, %u links), radio on %u ms (%u total)",
+                 scan.last_connect_ms, scan.worst_connect_ms, scan.connections,
+                 scan.last_radio_ms, scan.radio_ms);
 }
 
 static void hall_sensor_timeout_handler(TimerHandle_t xTimer) {
     auto val = hallSensor.read();
-    ble_remote::update_sensor_value(val);
+    sample_stream::write(sample_stream::Id::HALL_RAW, val);
+    record_ride_sample(val);
+    const bool is_sent = ble_remote::update_sensor_value(val);
+    power_manager::update_throttle(val);
+
+    /* Only a queued notification is radio activity */
+    if (is_sent) {
+        power_manager::notification_sent();
+    }
+
+    const TickType_t period = pdMS_TO_TICKS(sample_rate::update(val));
+    if (period != xTimerGetPeriod(xTimer)) {
+        xTimerChangePeriod(xTimer, period, 0);
+    }
+}
+
+static void on_sample_rate_mode(sample_rate::Mode mode) {
+    ble_remote::set_conn_profile(mode == sample_rate::Mode::MOVING ?
+                                 ble_central::ConnProfile::ACTIVE :
+                                 ble_central::ConnProfile::IDLE);
+}
+
+static void record_ride_sample(HallSensor::type val) {
+    const std::uint32_t now_ms = timestamp::now_ms();
+    const auto rssi = ble_remote::rssi();
+
+    if (next_record_ms == 0) {
+        next_record_ms = now_ms;
+    }
+
+    /* The recorder has a fixed period; while sampling slowly the throttle is steady, so the
+     * latest sample stands in for the ones in between */
+    while (static_cast<std::int32_t>(now_ms - next_record_ms) >= 0) {
+        ride_recorder::record_sample(val, rssi);
+        next_record_ms += RIDE_RECORDER_PERIOD_MS;
+    }
+}
+
+static void on_sleep() {
+    xTimerStop(hall_sensor_timer, 0);
+    ride_recorder::stop();
+    ble_remote::sleep();
+}
+
+static void on_telemetry(const std::uint8_t *data, std::size_t len) {
+    ble_es_common::BatteryTelemetry battery {};
+    ble_es_common::StatusTelemetry status {};
+
+    if (ble_es_common::decode(data, len, &battery)) {
+        NRF_LOG_INFO("Board battery %u mV (%u%%)", battery.pack_mv, battery.level);
+    } else if (ble_es_common::decode(data, len, &status)) {
+        if (status.faults != board_status.faults) {
+            NRF_LOG_WARNING("Board faults: 0x%02X", status.faults);
+        }
+
+        board_status = status;
+    }
 }
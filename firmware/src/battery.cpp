@@ -0,0 +1,142 @@
+/*
+ * battery.cpp - estimates the remote's battery state of charge.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "battery.hpp"
+
+#include <cstdlib>
+#include <iterator>
+
+#include "logger.hpp"
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace battery {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** A point on the discharge curve. */
+struct CurvePoint {
+    std::uint16_t millivolts;
+    std::uint8_t level;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Single-cell LiPo state of charge against resting voltage, by increasing voltage. */
+static constexpr CurvePoint DISCHARGE_CURVE[] = {
+    { 3300, 0 },
+    { 3500, 5 },
+    { 3600, 10 },
+    { 3700, 30 },
+    { 3750, 45 },
+    { 3800, 55 },
+    { 3850, 65 },
+    { 3900, 72 },
+    { 4000, 83 },
+    { 4100, 93 },
+    { 4200, 100 },
+};
+
+/**< Weight of each measurement in the smoothed voltage, as a power of 2 (1/4). */
+static constexpr std::uint32_t FILTER_SHIFT = { 2 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Looks up the state of charge for a battery voltage, interpolating along the discharge curve.
+ *
+ * @param[in] millivolts the battery voltage.
+ *
+ * @return the state of charge, in percent.
+ */
+static std::uint8_t level_for(std::uint32_t millivolts);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Called when the reported level changes. */
+static LevelCallback g_callback;
+
+/**< Smoothed battery voltage, scaled by 2^FILTER_SHIFT. 0 before the first measurement. */
+static std::uint32_t g_filtered;
+
+/**< The reported level. */
+static std::uint8_t g_level { 100 };
+
+/**< Whether or not a level has been reported yet. */
+static bool g_has_level;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init(LevelCallback callback) {
+    g_callback = callback;
+}
+
+void update(std::uint16_t millivolts) {
+    if (g_filtered == 0) {
+        g_filtered = static_cast<std::uint32_t>(millivolts) << FILTER_SHIFT;
+    } else {
+        g_filtered = g_filtered - (g_filtered >> FILTER_SHIFT) + millivolts;
+    }
+
+    const std::uint8_t level = level_for(g_filtered >> FILTER_SHIFT);
+
+    if (g_has_level && std::abs(level - g_level) < BATTERY_LEVEL_HYSTERESIS) {
+        return;
+    }
+
+    g_level = level;
+    g_has_level = true;
+
+    logger::log<Level::INFO>("Battery %u mV (%u%%)"_fmt, g_filtered >> FILTER_SHIFT, level);
+
+    if (g_callback != nullptr) {
+        g_callback(level);
+    }
+}
+
+std::uint16_t millivolts() {
+    return static_cast<std::uint16_t>(g_filtered >> FILTER_SHIFT);
+}
+
+std::uint8_t level() {
+    return g_level;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::uint8_t level_for(std::uint32_t millivolts) {
+    const auto *point = DISCHARGE_CURVE;
+
+    if (millivolts <= point->millivolts) {
+        return point->level;
+    }
+
+    for (++point; point != std::end(DISCHARGE_CURVE); ++point) {
+        if (millivolts <= point->millivolts) {
+            const auto *below = point - 1;
+
+            return static_cast<std::uint8_t>(below->level +
+                ((millivolts - below->millivolts) * (point->level - below->level)) /
+                (point->millivolts - below->millivolts));
+        }
+    }
+
+    return 100;
+}
+
+}  // namespace battery
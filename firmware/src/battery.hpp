@@ -0,0 +1,59 @@
+/*
+ * battery.hpp - estimates the remote's battery state of charge.
+ *
+ * Battery voltages measured alongside the Hall sensor (see HallSensor::set_battery_callback())
+ * are smoothed and mapped to a state of charge along a single-cell LiPo discharge curve. A new
+ * level is only reported once it moves BATTERY_LEVEL_HYSTERESIS away from the last one, so noise
+ * and load sag don't keep the Battery Service notifying.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "config/app_config.h"
+
+namespace battery {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Called when the reported battery level changes.
+ *
+ * @param[in] level the new level, in percent.
+ */
+using LevelCallback = void (*)(std::uint8_t level);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initializes the estimator.
+ *
+ * @param[in] callback called from the caller of update() when the level changes.
+ */
+void init(LevelCallback callback);
+
+/**
+ * Feeds a battery voltage measurement to the estimator.
+ *
+ * @param[in] millivolts the battery voltage.
+ */
+void update(std::uint16_t millivolts);
+
+/**
+ * Returns the smoothed battery voltage in mV, 0 before the first measurement.
+ */
+std::uint16_t millivolts();
+
+/**
+ * Returns the reported battery level in percent, 100 before the first measurement.
+ */
+std::uint8_t level();
+
+}  // namespace battery
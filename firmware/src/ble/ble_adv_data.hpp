@@ -0,0 +1,163 @@
+/*
+ * ble_adv_data.hpp - zero-copy iteration over the AD structures of advertising data.
+ *
+ * Advertising and scan response data is a sequence of AD structures, each a length byte followed
+ * by the AD type and length - 1 bytes of data. Fields walks it once and yields each structure as
+ * a type and a view into the report; nothing is copied, so views are only valid as long as the
+ * report buffer. Iteration stops at a zero length (the end of the significant part) or at a
+ * structure running past the end of the data, which ble_advdata_search() would also skip.
+ *
+ * Everything is constexpr and needs no SDK headers, so it can be checked at compile time and built
+ * on the host (see tools/adv_bench).
+ *
+ * Usage:
+ *     for (const auto &field : ble_adv_data::Fields(data->p_data, data->len)) {
+ *         switch (field.type) { ... }
+ *     }
+ *
+ *     auto name = ble_adv_data::Fields(p_data, len).find(BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME);
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ble_adv_data {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** An AD structure, viewed in place. */
+struct Field {
+    std::uint8_t type;                      /**< AD type (BLE_GAP_AD_TYPE_*). */
+    std::uint8_t len;                       /**< Length of the data. */
+    const std::uint8_t *data;               /**< The data, nullptr if the field wasn't found. */
+
+    /** Whether or not the field was found. */
+    constexpr bool is_present() const {
+        return data != nullptr;
+    }
+
+    /**
+     * Whether or not the field, a list of UUIDs or other fixed-size values, contains a value.
+     *
+     * @param[in] value     the value, in the same (little-endian) byte order as the field.
+     * @param[in] value_len the size of each value in the list.
+     */
+    constexpr bool contains(const std::uint8_t *value, std::size_t value_len) const {
+        for (std::size_t offset = 0; offset + value_len <= len; offset += value_len) {
+            std::size_t i = { 0 };
+
+            while (i < value_len && data[offset + i] == value[i]) {
+                ++i;
+            }
+
+            if (i == value_len) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+/** Forward iterator over the AD structures of advertising data. */
+class Iterator {
+ private:
+    /**< Start of the current structure, _end once iteration is over. */
+    const std::uint8_t *_pos;
+    /**< End of the advertising data. */
+    const std::uint8_t *_end;
+    /**< The current structure. */
+    Field _field {};
+
+ public:
+    constexpr Iterator(const std::uint8_t *pos, const std::uint8_t *end) : _pos(pos), _end(end) {
+        load();
+    }
+
+    constexpr const Field &operator*() const {
+        return _field;
+    }
+
+    constexpr const Field *operator->() const {
+        return &_field;
+    }
+
+    constexpr Iterator &operator++() {
+        _pos += 1 + _pos[0];
+        load();
+        return *this;
+    }
+
+    constexpr bool operator==(const Iterator &other) const {
+        return _pos == other._pos;
+    }
+
+    constexpr bool operator!=(const Iterator &other) const {
+        return _pos != other._pos;
+    }
+
+ private:
+    /**
+     * Reads the structure at _pos, or ends iteration if there is none.
+     */
+    constexpr void load() {
+        const std::size_t remaining = static_cast<std::size_t>(_end - _pos);
+
+        /* The length covers the type and the data, not itself */
+        if (remaining < 2 || _pos[0] == 0 || _pos[0] >= remaining) {
+            _pos = _end;
+            return;
+        }
+
+        _field = { _pos[1], static_cast<std::uint8_t>(_pos[0] - 1), _pos + 2 };
+    }
+};
+
+/** The AD structures of advertising data, as a range. */
+class Fields {
+ private:
+    /**< The advertising data. */
+    const std::uint8_t *_data;
+    /**< Length of the advertising data. */
+    std::size_t _len;
+
+ public:
+    /**
+     * @param[in] data the advertising data (e.g. ble_gap_evt_adv_report_t::data.p_data).
+     * @param[in] len  the length of the advertising data.
+     */
+    constexpr Fields(const std::uint8_t *data, std::size_t len) : _data(data), _len(len) {}
+
+    constexpr Iterator begin() const {
+        return { _data, _data + _len };
+    }
+
+    constexpr Iterator end() const {
+        return { _data + _len, _data + _len };
+    }
+
+    /**
+     * Finds the first structure of a type. To look for several types, iterate once instead.
+     *
+     * @param[in] type the AD type.
+     *
+     * @return the structure, not present if there is none.
+     */
+    constexpr Field find(std::uint8_t type) const {
+        for (const auto &field : *this) {
+            if (field.type == type) {
+                return field;
+            }
+        }
+
+        return {};
+    }
+};
+
+}  // namespace ble_adv_data
@@ -12,17 +12,41 @@
 
 #include "ble_central.hpp"
 
+#include <app_util.h>
 #include <nrf_assert.h>
 #include <nrf_ble_gatt.h>
 #include <nrf_ble_gq.h>
 #include <nrf_ble_scan.h>
 
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "ble_adv_data.hpp"
 #include "logger.hpp"
+#include "timestamp.hpp"
+#include "util.hpp"
 
 using logger::Level;
+using logger::operator""_fmt;
 
 namespace ble_central {
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Scan scheduler phases. */
+enum class ScanPhase {
+    STOPPED,        /**< Not scanning, until begin_scanning(). */
+    FAST,           /**< Scanning continuously, after boot, wake or a disconnection. */
+    SLOW,           /**< Scanning at a low duty cycle, once the fast scan has timed out. */
+    CONNECTING,     /**< Found the receiver, connecting to it. */
+    CONNECTED,      /**< Connected, scanning resumes on disconnection. */
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Private Prototypes
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -34,6 +58,71 @@ namespace ble_central {
  */
 static void scan_init(nrf_ble_scan_evt_handler_t handler);
 
+/**
+ * Scanning module event handler, matches reports against the UUID and appearance filter and
+ * passes events on to the application's handler.
+ *
+ * @param[in] p_scan_evt the scan event.
+ */
+static void scan_event_handler(scan_evt_t const *p_scan_evt);
+
+/**
+ * Checks an advertising report against the UUID and appearance filter.
+ *
+ * @param[in] data the report's advertising data.
+ *
+ * @return true if the report advertises both the UUID and the appearance.
+ */
+static bool is_uuid_appearance_match(const ble_data_t &data);
+
+/**
+ * Checks whether an advertiser is the bonded receiver. Only it advertises directed at this remote
+ * (see ble_peripheral's BLE_ADV_EVT_PEER_ADDR_REQUEST), neither side uses private addresses.
+ *
+ * @param[in] addr the advertiser's address.
+ *
+ * @return true if the address is the bonded peer's identity address.
+ */
+static bool is_bonded_peer(const ble_gap_addr_t &addr);
+
+/**
+ * Connects to a report matching the UUID and appearance filter, or directed at this device, and
+ * reports the match.
+ *
+ * @param[in] p_scan_evt the scan event of the report.
+ */
+static void connect_on_match(scan_evt_t const *p_scan_evt);
+
+/**
+ * Enters a scanning phase and starts scanning with its parameters.
+ *
+ * @param[in] phase FAST or SLOW.
+ */
+static void start_scan(ScanPhase phase);
+
+/**
+ * Enters a phase, accounting the radio-on time of the phase being left.
+ *
+ * @param[in] phase  the phase.
+ * @param[in] params the parameters the radio scans or connects with in the phase, nullptr if it
+ *                   isn't used.
+ */
+static void enter_phase(ScanPhase phase, const ble_gap_scan_params_t *params);
+
+/**
+ * Returns the scan parameters for a scanning phase.
+ *
+ * @param[in] phase FAST or SLOW.
+ */
+static ble_gap_scan_params_t scan_params(ScanPhase phase);
+
+/**
+ * Returns the connection parameters for a profile.
+ *
+ * @param[in] profile the profile.
+ */
+static ble_gap_conn_params_t profile_params(ConnProfile profile);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Private Data
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -42,6 +131,33 @@ static void scan_init(nrf_ble_scan_evt_handler_t handler);
 static nrf_ble_gatt_t *g_gatt;
 /**< nRF BLE scanner instance. */
 static nrf_ble_scan_t *g_scan;
+/**< The application's scan event handler. */
+static nrf_ble_scan_evt_handler_t g_scan_handler;
+
+/**< Whether or not reports are matched against the UUID and appearance filter. */
+static bool g_is_uuid_appearance_filter;
+/**< The UUID filtered for, as it is advertised (little-endian), and its length. */
+static std::uint8_t g_filter_uuid[util::UUID128_LEN];
+static std::uint8_t g_filter_uuid_len;
+/**< The appearance filtered for. */
+static std::uint16_t g_filter_appearance;
+
+/**< The current connection parameter profile. */
+static ConnProfile g_conn_profile { ConnProfile::ACTIVE };
+
+/**< The scan scheduler's phase, when it was entered, and the scan window and interval the radio is
+     used with in it (0 if it isn't used). */
+static ScanPhase g_scan_phase { ScanPhase::STOPPED };
+static std::uint32_t g_phase_start_ms;
+static std::uint16_t g_phase_window;
+static std::uint16_t g_phase_interval;
+
+/**< When scanning for the next connection began, and the radio-on time since. */
+static std::uint32_t g_attempt_start_ms;
+static std::uint32_t g_attempt_radio_ms;
+
+/**< Scanning statistics. */
+static ScanStats g_scan_stats;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
@@ -62,6 +178,7 @@ void init(const ble_common::Data &data) {
 
 void set_addr_scan_filter(const ble_gap_addr_t &addr) {
     ASSERT(g_scan != nullptr);
+    g_is_uuid_appearance_filter = false;
     APP_ERROR_CHECK(nrf_ble_scan_filters_disable(g_scan));
     APP_ERROR_CHECK(nrf_ble_scan_all_filter_remove(g_scan));
     APP_ERROR_CHECK(nrf_ble_scan_filters_enable(g_scan, NRF_BLE_SCAN_ADDR_FILTER, true));
@@ -69,30 +186,120 @@ void set_addr_scan_filter(const ble_gap_addr_t &addr) {
     /* SCAN_ADDR_FILTER takes a (uint8_t *) */
     nrf_ble_scan_filter_set(g_scan, SCAN_ADDR_FILTER, addr.addr);
 
-    logger::log<Level::INFO>("Scan filter addr");
+    logger::log<Level::INFO>("Scan filter addr"_fmt);
 }
 
 void set_uuid_appearance_scan_filter(const ble_uuid_t &uuid, std::uint16_t appearance) {
     ASSERT(g_scan != nullptr);
 
+    /* With the scanning module's filters off every report comes as NRF_BLE_SCAN_EVT_NOT_FOUND */
     APP_ERROR_CHECK(nrf_ble_scan_filters_disable(g_scan));
     APP_ERROR_CHECK(nrf_ble_scan_all_filter_remove(g_scan));
 
-    APP_ERROR_CHECK(nrf_ble_scan_filters_enable(g_scan,
-                    (NRF_BLE_SCAN_UUID_FILTER | NRF_BLE_SCAN_APPEARANCE_FILTER), true));
+    /* Left as is by disabling, and with no filters enabled "all" of them match every report */
+    g_scan->scan_filters.all_filters_mode = false;
 
-    /* SCAN_UUID_FILTER takes a (ble_uuid_t *) */
-    nrf_ble_scan_filter_set(g_scan, SCAN_UUID_FILTER, &uuid);
-    /* SCAN_APPEARANCE_FILTER takes a (uint16_t *) */
-    nrf_ble_scan_filter_set(g_scan, SCAN_APPEARANCE_FILTER, &appearance);
+    APP_ERROR_CHECK(sd_ble_uuid_encode(&uuid, &g_filter_uuid_len, g_filter_uuid));
+    g_filter_appearance = appearance;
+    g_is_uuid_appearance_filter = true;
 
-    logger::log<Level::INFO>("Scan filter UUID + appearance");
+    logger::log<Level::INFO>("Scan filter UUID + appearance"_fmt);
 }
 
 void begin_scanning() {
     ASSERT(g_scan != nullptr);
-    APP_ERROR_CHECK(nrf_ble_scan_start(g_scan));
-    logger::log<Level::INFO>("%s", __func__);
+
+    g_attempt_start_ms = timestamp::now_ms();
+    g_attempt_radio_ms = 0;
+    start_scan(ScanPhase::FAST);
+
+    logger::log<Level::INFO>("%s (%u us after boot)"_fmt, __func__, timestamp::now());
+}
+
+void stop_scanning() {
+    ASSERT(g_scan != nullptr);
+
+    const bool is_connecting = (g_scan_phase == ScanPhase::CONNECTING);
+
+    enter_phase(ScanPhase::STOPPED, nullptr);
+    nrf_ble_scan_stop();
+
+    if (is_connecting) {
+        const ret_code_t ret_code = sd_ble_gap_connect_cancel();
+
+        /* The connection may have just been made, the caller disconnects it */
+        if (ret_code != NRF_ERROR_INVALID_STATE) {
+            APP_ERROR_CHECK(ret_code);
+        }
+    }
+}
+
+void on_connected() {
+    /* Connected to after scanning was stopped, it isn't resumed when the link drops */
+    if (g_scan_phase == ScanPhase::STOPPED || g_scan_phase == ScanPhase::CONNECTED) {
+        return;
+    }
+
+    enter_phase(ScanPhase::CONNECTED, nullptr);
+
+    const std::uint32_t connect_ms = g_phase_start_ms - g_attempt_start_ms;
+
+    taskENTER_CRITICAL();
+    ++g_scan_stats.connections;
+    g_scan_stats.last_connect_ms = connect_ms;
+    g_scan_stats.worst_connect_ms = std::max(g_scan_stats.worst_connect_ms, connect_ms);
+    g_scan_stats.last_radio_ms = g_attempt_radio_ms;
+    taskEXIT_CRITICAL();
+
+    logger::log<Level::INFO>("Connected %u ms after scanning began (radio on %u ms)"_fmt,
+                             connect_ms, g_attempt_radio_ms);
+}
+
+void on_disconnected() {
+    if (g_scan_phase == ScanPhase::CONNECTED) {
+        begin_scanning();
+    }
+}
+
+void on_connect_timeout() {
+    /* Still the same attempt, the time to connect counts from when it began */
+    if (g_scan_phase == ScanPhase::CONNECTING) {
+        start_scan(ScanPhase::FAST);
+    }
+}
+
+ScanStats scan_stats() {
+    taskENTER_CRITICAL();
+    ScanStats stats = g_scan_stats;
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
+void set_conn_profile(std::uint16_t conn_handle, ConnProfile profile) {
+    g_conn_profile = profile;
+
+    const ble_gap_conn_params_t params = profile_params(profile);
+
+    /* Busy while an update is in progress, on_conn_params_updated() retries once it completes */
+    const ret_code_t ret_code = sd_ble_gap_conn_param_update(conn_handle, &params);
+
+    if (ret_code != NRF_SUCCESS && ret_code != NRF_ERROR_BUSY) {
+        logger::log<Level::INFO>("%s: 0x%X"_fmt, __func__, ret_code);
+    }
+}
+
+ConnProfile conn_profile() {
+    return g_conn_profile;
+}
+
+void on_conn_params_updated(std::uint16_t conn_handle, const ble_gap_conn_params_t &params) {
+    const ble_gap_conn_params_t wanted = profile_params(g_conn_profile);
+
+    if (params.max_conn_interval < wanted.min_conn_interval ||
+        params.max_conn_interval > wanted.max_conn_interval) {
+        set_conn_profile(conn_handle, g_conn_profile);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -100,14 +307,210 @@ void begin_scanning() {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void scan_init(nrf_ble_scan_evt_handler_t handler) {
+    g_scan_handler = handler;
+
+    const ble_gap_scan_params_t params = scan_params(ScanPhase::FAST);
+
     nrf_ble_scan_init_t init_scan = {
-        .p_scan_param = nullptr,   /** Use default scan parameters. */
+        .p_scan_param = &params,   /** Start with fast scanning. */
         .connect_if_match = true,  /** Connect once a filter match is found. */
         .p_conn_param = nullptr,   /** Use default connection parameters. */
         .conn_cfg_tag = BLE_COMMON_CONN_CFG_TAG,
     };
 
-    APP_ERROR_CHECK(nrf_ble_scan_init(g_scan, &init_scan, handler));
+    APP_ERROR_CHECK(nrf_ble_scan_init(g_scan, &init_scan, scan_event_handler));
+}
+
+static void scan_event_handler(scan_evt_t const *p_scan_evt) {
+    switch (p_scan_evt->scan_evt_id) {
+        case NRF_BLE_SCAN_EVT_NOT_FOUND: {
+            const ble_gap_evt_adv_report_t *p_adv_report = p_scan_evt->params.p_not_found;
+
+            /* Directed advertising is only reported if it's aimed at this remote and has no data
+               to match. Anything can advertise directed at a known address, so only the bonded
+               receiver reconnecting is accepted */
+            const bool is_directed = p_adv_report->type.directed &&
+                                     p_adv_report->type.connectable &&
+                                     is_bonded_peer(p_adv_report->peer_addr);
+
+            if (g_is_uuid_appearance_filter &&
+                (is_directed || is_uuid_appearance_match(p_adv_report->data))) {
+                connect_on_match(p_scan_evt);
+                return;
+            }
+        } break;
+
+        case NRF_BLE_SCAN_EVT_FILTER_MATCH: {
+            /* The scanning module is connecting, with the scan parameters */
+            enter_phase(ScanPhase::CONNECTING, &g_scan->scan_params);
+        } break;
+
+        case NRF_BLE_SCAN_EVT_SCAN_TIMEOUT: {
+            /* BLE_GAP_EVT_TIMEOUT (BLE_GAP_TIMEOUT_SRC_SCAN): the fast scan backs off, and a slow
+               scan with a timeout starts over */
+            if (g_scan_phase == ScanPhase::FAST || g_scan_phase == ScanPhase::SLOW) {
+                logger::log<Level::INFO>("Scan timed out, scanning slowly"_fmt);
+                start_scan(ScanPhase::SLOW);
+            }
+        } break;
+
+        default:
+            break;
+    }
+
+    if (g_scan_handler != nullptr) {
+        g_scan_handler(p_scan_evt);
+    }
+}
+
+static bool is_uuid_appearance_match(const ble_data_t &data) {
+    const bool is_uuid16 = (g_filter_uuid_len == util::UUID16_LEN);
+    bool has_uuid = { false };
+    bool has_appearance = { false };
+
+    for (const auto &field : ble_adv_data::Fields(data.p_data, data.len)) {
+        switch (field.type) {
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE:
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE: {
+                const bool is_uuid16_list =
+                    (field.type == BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE ||
+                     field.type == BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE);
+
+                if (is_uuid16_list == is_uuid16 &&
+                    field.contains(g_filter_uuid, g_filter_uuid_len)) {
+                    has_uuid = true;
+                }
+            } break;
+
+            case BLE_GAP_AD_TYPE_APPEARANCE: {
+                has_appearance = (field.len == sizeof(g_filter_appearance) &&
+                                  uint16_decode(field.data) == g_filter_appearance);
+            } break;
+        }
+    }
+
+    return has_uuid && has_appearance;
+}
+
+static bool is_bonded_peer(const ble_gap_addr_t &addr) {
+    ble_gap_addr_t bonded_addr {};
+
+    return ble_common::bonded_peer_addr(&bonded_addr) &&
+           addr.addr_type == bonded_addr.addr_type &&
+           memcmp(addr.addr, bonded_addr.addr, sizeof(addr.addr)) == 0;
+}
+
+static void connect_on_match(scan_evt_t const *p_scan_evt) {
+    const ble_gap_evt_adv_report_t *p_adv_report = p_scan_evt->params.p_not_found;
+
+    /* The same as the scanning module does on a match of its own filters, except that it
+       connects scanning continuously whichever phase found the receiver */
+    nrf_ble_scan_stop();
+
+    ble_gap_scan_params_t params = scan_params(ScanPhase::FAST);
+    params.timeout = BLE_CENTRAL_CONNECT_TIMEOUT;
+
+    const ret_code_t ret_code = sd_ble_gap_connect(&p_adv_report->peer_addr,
+                                                   &params,
+                                                   &g_scan->conn_params,
+                                                   g_scan->conn_cfg_tag);
+
+    if (ret_code == NRF_SUCCESS) {
+        enter_phase(ScanPhase::CONNECTING, &params);
+    } else {
+        start_scan(ScanPhase::FAST);
+    }
+
+    scan_evt_t scan_evt = {
+        .scan_evt_id = NRF_BLE_SCAN_EVT_FILTER_MATCH,
+        .p_scan_params = p_scan_evt->p_scan_params,
+    };
+    scan_evt.params.filter_match.p_adv_report = p_adv_report;
+    scan_evt.params.filter_match.filter_match.uuid_filter_match = !p_adv_report->type.directed;
+    scan_evt.params.filter_match.filter_match.appearance_filter_match =
+        !p_adv_report->type.directed;
+
+    if (g_scan_handler == nullptr) {
+        return;
+    }
+
+    g_scan_handler(&scan_evt);
+
+    if (ret_code != NRF_SUCCESS) {
+        scan_evt.scan_evt_id = NRF_BLE_SCAN_EVT_CONNECTING_ERROR;
+        scan_evt.params.connecting_err.err_code = ret_code;
+        g_scan_handler(&scan_evt);
+    }
+}
+
+static void start_scan(ScanPhase phase) {
+    const ble_gap_scan_params_t params = scan_params(phase);
+
+    enter_phase(phase, &params);
+
+    /* Stops any scan in progress first */
+    APP_ERROR_CHECK(nrf_ble_scan_params_set(g_scan, &params));
+    APP_ERROR_CHECK(nrf_ble_scan_start(g_scan));
+}
+
+static void enter_phase(ScanPhase phase, const ble_gap_scan_params_t *params) {
+    const std::uint32_t now = timestamp::now_ms();
+
+    /* Estimated from the duty cycle, the radio listens for one window every interval */
+    if (g_phase_interval != 0) {
+        const std::uint32_t radio_ms = static_cast<std::uint32_t>(
+            (static_cast<std::uint64_t>(now - g_phase_start_ms) * g_phase_window) /
+            g_phase_interval);
+
+        g_attempt_radio_ms += radio_ms;
+
+        taskENTER_CRITICAL();
+        g_scan_stats.radio_ms += radio_ms;
+        taskEXIT_CRITICAL();
+    }
+
+    g_scan_phase = phase;
+    g_phase_start_ms = now;
+    g_phase_window = (params != nullptr) ? params->window : 0;
+    g_phase_interval = (params != nullptr) ? params->interval : 0;
+}
+
+static ble_gap_scan_params_t scan_params(ScanPhase phase) {
+    /* As the scanning module's defaults, apart from the timing */
+    ble_gap_scan_params_t params = {
+        .active         = 1,
+        .filter_policy  = BLE_GAP_SCAN_FP_ACCEPT_ALL,
+        .scan_phys      = BLE_GAP_PHY_1MBPS,
+        .interval       = BLE_CENTRAL_FAST_SCAN_INTERVAL,
+        .window         = BLE_CENTRAL_FAST_SCAN_WINDOW,
+        .timeout        = BLE_CENTRAL_FAST_SCAN_TIMEOUT,
+    };
+
+    if (phase == ScanPhase::SLOW) {
+        params.interval = BLE_CENTRAL_SLOW_SCAN_INTERVAL;
+        params.window   = BLE_CENTRAL_SLOW_SCAN_WINDOW;
+        params.timeout  = BLE_CENTRAL_SLOW_SCAN_TIMEOUT;
+    }
+
+    return params;
+}
+
+static ble_gap_conn_params_t profile_params(ConnProfile profile) {
+    ble_gap_conn_params_t params = {
+        .min_conn_interval = BLE_CENTRAL_MIN_CONN_INTERVAL,
+        .max_conn_interval = BLE_CENTRAL_MAX_CONN_INTERVAL,
+        .slave_latency     = BLE_CENTRAL_SLAVE_LATENCY,
+        .conn_sup_timeout  = BLE_CENTRAL_SUPERVISION_TIMEOUT,
+    };
+
+    if (profile == ConnProfile::IDLE) {
+        params.min_conn_interval = BLE_CENTRAL_IDLE_MIN_CONN_INTERVAL;
+        params.max_conn_interval = BLE_CENTRAL_IDLE_MAX_CONN_INTERVAL;
+    }
+
+    return params;
 }
 
 }  // namespace ble_central
@@ -6,6 +6,11 @@
  * The electric skatebaord remote shall act primarily as a BLE central. It will find and connect to
  * the electric skateboard receiver, and serve sensor data to it so it can set speed accordingly.
  *
+ * Scanning is duty-cycled: after boot, wake or a disconnection it scans continuously for
+ * BLE_CENTRAL_FAST_SCAN_TIMEOUT to reconnect quickly, then backs off to the slow window and
+ * interval until the receiver is found. Radio-on time is estimated from the duty cycle of each
+ * phase, and reported together with the time to connect for each connection (see scan_stats()).
+ *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
  */
@@ -21,6 +26,24 @@
 #include <cstdint>
 
 namespace ble_central {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Connection parameter profiles, traded off between latency and power. */
+enum class ConnProfile {
+    ACTIVE,     /**< Short interval, while the throttle is moving (the connection default). */
+    IDLE,       /**< Longer interval, while the throttle is steady. */
+};
+
+/** Scanning statistics since boot. */
+struct ScanStats {
+    std::uint32_t connections;              /**< Connections made by scanning. */
+    std::uint32_t last_connect_ms;          /**< Latest time from starting to scan to connecting. */
+    std::uint32_t worst_connect_ms;         /**< Longest time to connect. */
+    std::uint32_t last_radio_ms;            /**< Radio-on time of the latest connection's scan. */
+    std::uint32_t radio_ms;                 /**< Radio-on time scanning and connecting. */
+};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Functions
@@ -41,16 +64,72 @@ void init(const ble_common::Data &data);
 void set_addr_scan_filter(const ble_gap_addr_t &addr);
 
 /**
- * Sets the filter for the scanning module.
+ * Sets the filter for the scanning module. Reports are matched by ble_central in a single pass
+ * over their AD structures, rather than by the scanning module's UUID and appearance filters
+ * which search the report once per AD type. A match is reported as NRF_BLE_SCAN_EVT_FILTER_MATCH
+ * and connected to, as with the scanning module's filters. Directed advertising aimed at this
+ * device matches too if it comes from the bonded receiver, so it can reconnect with it.
  *
- * @param[in] uuid       the BLE UUID to filter for.
+ * @param[in] uuid       the BLE UUID to filter for, its vendor-specific base must be registered.
  * @param[in] appearance the BLE appearance to filter for.
  */
 void set_uuid_appearance_scan_filter(const ble_uuid_t &uuid, std::uint16_t appearance);
 
 /**
- * Begins scanning for BLE devices.
+ * Begins scanning for BLE devices, fast at first.
  */
 void begin_scanning();
 
+/**
+ * Stops scanning for BLE devices, and cancels connecting to one. Scanning isn't resumed on
+ * disconnection until begin_scanning() is called again.
+ */
+void stop_scanning();
+
+/**
+ * Records the time to connect and the radio-on time of the scan. Must be called from the
+ * SoftDevice task on BLE_GAP_EVT_CONNECTED.
+ */
+void on_connected();
+
+/**
+ * Resumes fast scanning, unless scanning was stopped. Must be called from the SoftDevice task on
+ * BLE_GAP_EVT_DISCONNECTED.
+ */
+void on_disconnected();
+
+/**
+ * Resumes fast scanning after failing to connect. Must be called from the SoftDevice task on
+ * BLE_GAP_EVT_TIMEOUT with BLE_GAP_TIMEOUT_SRC_CONN.
+ */
+void on_connect_timeout();
+
+/**
+ * Returns scanning statistics since boot.
+ */
+ScanStats scan_stats();
+
+/**
+ * Switches a connection to a connection parameter profile. The new parameters take effect a few
+ * connection events later.
+ *
+ * @param[in] conn_handle the connection.
+ * @param[in] profile     the profile.
+ */
+void set_conn_profile(std::uint16_t conn_handle, ConnProfile profile);
+
+/**
+ * Returns the profile last set with set_conn_profile(), ACTIVE if none has been set.
+ */
+ConnProfile conn_profile();
+
+/**
+ * Handles a completed connection parameter update, switching back to the current profile if the
+ * new parameters don't fit it (e.g. the switch was busy, or the peripheral asked for others).
+ *
+ * @param[in] conn_handle the connection.
+ * @param[in] params      the new connection parameters.
+ */
+void on_conn_params_updated(std::uint16_t conn_handle, const ble_gap_conn_params_t &params);
+
 }  // namespace ble_central
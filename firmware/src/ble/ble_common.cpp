@@ -1,7 +1,7 @@
 /*
  * ble_common.cpp - Common BLE functions.
  *
- * Contains common BLE functions, such as setting up the BLE stack.
+ * Contains common BLE functions, such as setting up the BLE stack and the peer manager.
  *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
@@ -9,14 +9,25 @@
 
 #include "ble_common.hpp"
 
+#include <ble_conn_state.h>
 #include <nrf_sdh.h>
 #include <nrf_sdh_ble.h>
 #include <peer_manager.h>
 #include <peer_manager_handler.h>
 
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
 #include <cstdint>
 
 #include "config/app_config.h"
+#include "es_fds.hpp"
+#include "logger.hpp"
+#include "timestamp.hpp"
+
+using logger::Level;
+using logger::operator""_fmt;
 
 namespace ble_common {
 
@@ -30,13 +41,76 @@ static void ble_stack_init();
 /** Configures and initializes the peer manager (for handling security). */
 static void peer_manager_init();
 
+/**
+ * Security task: loads the bonds at boot, once FDS is ready, then secures any link waiting on it.
+ *
+ * @param[in] arg unused.
+ */
+static void security_thread(void *arg);
+
+/**
+ * Secures the link secure() deferred, if there is one. Must be called with the scheduler
+ * suspended, the peer manager isn't thread safe.
+ */
+static void secure_pending();
+
+/**
+ * Starts the security procedure on a link, dropping the link if it can't be secured.
+ *
+ * @param[in] conn_handle     the connection handle.
+ * @param[in] force_repairing whether to pair again even if the peer is bonded.
+ */
+static void conn_secure(std::uint16_t conn_handle, bool force_repairing);
+
+/**
+ * Checks whether a new bond may be made: while no peer is bonded, or in the pairing window after
+ * boot (BLE_COMMON_PAIRING_WINDOW_MS).
+ */
+static bool is_pairing_allowed();
+
+/**
+ * Checks whether the pairing window after boot is still open.
+ */
+static bool is_pairing_window_open();
+
+/**
+ * BLE event handler.
+ *
+ * @param[in] p_ble_evt the BLE event.
+ * @param[in] p_context context passed when this handler is registered (nullptr).
+ */
+static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context);
+
+/**
+ * Peer manager event handler.
+ *
+ * @param[in] p_evt the peer manager event.
+ */
+static void pm_event_handler(pm_evt_t const *p_evt);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Private Data
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/** Register security BLE event handler. */
+NRF_SDH_BLE_OBSERVER(g_ble_observer, BLE_COMMON_OBSERVER_PRIO,
+                     ble_event_handler, nullptr);
+
 /**< Whether or not the common BLE init has already taken place. */
 static bool g_initialized { false };
 
+/**< Whether or not the peer manager has loaded the bonds. */
+static volatile bool g_is_pm_ready;
+
+/**< A link secure() deferred until the peer manager is ready. */
+static std::uint16_t g_pending_conn_handle { BLE_CONN_HANDLE_INVALID };
+
+/**< When the current link was connected (timestamp::now()). */
+static std::uint32_t g_connected_us;
+
+/**< Security statistics. */
+static SecurityStats g_stats;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -51,9 +125,58 @@ void init(const Data &data) {
     // TODO(CMK) 06/19/20: GATT event handler (?)
     APP_ERROR_CHECK(nrf_ble_gatt_init(data.gatt, nullptr));
 
+    /* Lowest priority: loading bonds waits on FDS, which shouldn't hold up advertising, scanning
+       or sampling */
+    if (pdPASS != xTaskCreate(security_thread, "Security", 768, nullptr, 1, nullptr)) {
+        APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
+    }
+
     g_initialized = true;
 }
 
+void secure(std::uint16_t conn_handle) {
+    /* The security task has a lower priority, so it can't become ready halfway through this */
+    if (g_is_pm_ready) {
+        conn_secure(conn_handle, false);
+    } else {
+        g_pending_conn_handle = conn_handle;
+    }
+}
+
+bool is_peer_manager_ready() {
+    return g_is_pm_ready;
+}
+
+bool bonded_peer_addr(ble_gap_addr_t *addr) {
+    if (!g_is_pm_ready) {
+        return false;
+    }
+
+    pm_peer_id_t peer_id = { PM_PEER_ID_INVALID };
+
+    if (pm_peer_ranks_get(&peer_id, nullptr, nullptr, nullptr) != NRF_SUCCESS) {
+        peer_id = pm_next_peer_id_get(PM_PEER_ID_INVALID);
+    }
+
+    pm_peer_data_bonding_t bonding_data {};
+
+    if (peer_id == PM_PEER_ID_INVALID ||
+        pm_peer_data_bonding_load(peer_id, &bonding_data) != NRF_SUCCESS) {
+        return false;
+    }
+
+    *addr = bonding_data.peer_ble_id.id_addr_info;
+    return true;
+}
+
+SecurityStats security_stats() {
+    taskENTER_CRITICAL();
+    SecurityStats stats = g_stats;
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Private Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -64,10 +187,15 @@ static void ble_stack_init() {
     std::uint32_t ram_start = {};
     APP_ERROR_CHECK(nrf_sdh_ble_default_cfg_set(BLE_COMMON_CONN_CFG_TAG, &ram_start));
 
+    /* Queue several notifications per connection event for bulk downloads */
+    ble_cfg_t ble_cfg = {};
+    ble_cfg.conn_cfg.conn_cfg_tag = BLE_COMMON_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = BLE_COMMON_HVN_TX_QUEUE_SIZE;
+    APP_ERROR_CHECK(sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &ble_cfg, ram_start));
+
     APP_ERROR_CHECK(nrf_sdh_ble_enable(&ram_start));
 }
 
-// TODO(CMK) 07/31/20: implement
 static void peer_manager_init() {
     ble_gap_sec_params_t sec_param;
     ret_code_t           err_code;
@@ -93,8 +221,156 @@ static void peer_manager_init() {
     err_code = pm_sec_params_set(&sec_param);
     APP_ERROR_CHECK(err_code);
 
-    // TODO(CMK) 06/19/20: event handler
-    APP_ERROR_CHECK(pm_register(nullptr));
+    APP_ERROR_CHECK(pm_register(pm_event_handler));
+}
+
+static void security_thread(void *arg) {
+    es_fds::wait_until_ready();
+
+    /* Suspended so the SoftDevice task never sees the peer manager half initialized */
+    vTaskSuspendAll();
+    peer_manager_init();
+    g_is_pm_ready = true;
+    secure_pending();
+    xTaskResumeAll();
+
+    /* Pairing and encryption are handled by the SoftDevice from here on */
+    vTaskDelete(nullptr);
+}
+
+static void secure_pending() {
+    const std::uint16_t conn_handle = g_pending_conn_handle;
+
+    if (conn_handle == BLE_CONN_HANDLE_INVALID) {
+        return;
+    }
+
+    g_pending_conn_handle = BLE_CONN_HANDLE_INVALID;
+    conn_secure(conn_handle, false);
+}
+
+static void conn_secure(std::uint16_t conn_handle, bool force_repairing) {
+    const ret_code_t ret_code = pm_conn_secure(conn_handle, force_repairing);
+
+    /* Busy if the peer already started, and the link may have gone down in the meantime */
+    if (ret_code == NRF_SUCCESS ||
+        ret_code == NRF_ERROR_BUSY ||
+        ret_code == BLE_ERROR_INVALID_CONN_HANDLE) {
+        return;
+    }
+
+    /* e.g. an earlier SMP timeout, nothing more can be done on this link */
+    logger::log<Level::WARNING>("Securing 0x%X failed: 0x%X"_fmt, conn_handle, ret_code);
+    (void) sd_ble_gap_disconnect(conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+}
+
+static bool is_pairing_allowed() {
+    return pm_peer_count() == 0 || is_pairing_window_open();
+}
+
+static bool is_pairing_window_open() {
+    /* The scheduler starts right after boot, so the tick count is the time since boot */
+    return timestamp::now_ms() < BLE_COMMON_PAIRING_WINDOW_MS;
+}
+
+static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
+    const auto &gap_evt = p_ble_evt->evt.gap_evt;
+
+    switch (p_ble_evt->header.evt_id) {
+        case BLE_GAP_EVT_CONNECTED:
+            g_connected_us = timestamp::now();
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            if (g_pending_conn_handle == gap_evt.conn_handle) {
+                g_pending_conn_handle = BLE_CONN_HANDLE_INVALID;
+            }
+            break;
+
+        case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
+            /* The peer manager answers once it is up, until then fail fast rather than time out */
+            if (!g_is_pm_ready) {
+                APP_ERROR_CHECK(sd_ble_gap_sec_params_reply(gap_evt.conn_handle,
+                                BLE_GAP_SEC_STATUS_UNSPECIFIED, nullptr, nullptr));
+            }
+            break;
+    }
+}
+
+static void pm_event_handler(pm_evt_t const *p_evt) {
+    pm_handler_pm_evt_log(p_evt);
+
+    switch (p_evt->evt_id) {
+        case PM_EVT_CONN_SEC_SUCCEEDED:
+        {
+            const bool is_bonded =
+                p_evt->params.conn_sec_succeeded.procedure == PM_CONN_SEC_PROCEDURE_ENCRYPTION;
+            const std::uint32_t elapsed_us = timestamp::now() - g_connected_us;
+
+            taskENTER_CRITICAL();
+            EncryptionTiming &timing = is_bonded ? g_stats.bonded : g_stats.paired;
+            ++timing.links;
+            timing.last_us = elapsed_us;
+            timing.worst_us = std::max(timing.worst_us, elapsed_us);
+            taskEXIT_CRITICAL();
+
+            logger::log<Level::INFO>("Link encrypted %u us after connecting (%s)"_fmt,
+                                     elapsed_us, is_bonded ? "bonded" : "paired");
+
+            /* Ranks the peer for bonded_peer_addr(), only written to flash when the peer changes.
+               Best effort: if flash is busy or full the previous peer stays ranked */
+            const ret_code_t ret_code = pm_peer_rank_highest(p_evt->peer_id);
+
+            if (ret_code != NRF_SUCCESS && ret_code != NRF_ERROR_BUSY &&
+                ret_code != NRF_ERROR_STORAGE_FULL && ret_code != NRF_ERROR_RESOURCES) {
+                logger::log<Level::WARNING>("Peer rank: 0x%X"_fmt, ret_code);
+            }
+        } break;
+
+        case PM_EVT_CONN_SEC_FAILED:
+        {
+            const auto &failed = p_evt->params.conn_sec_failed;
+
+            taskENTER_CRITICAL();
+            ++g_stats.failures;
+            taskEXIT_CRITICAL();
+
+            /* The peer lost its bond (e.g. its flash was erased), pair again rather than give up,
+               but only in the pairing window: an impostor can claim to have lost it too */
+            if (failed.procedure == PM_CONN_SEC_PROCEDURE_ENCRYPTION &&
+                failed.error == PM_CONN_SEC_ERROR_PIN_OR_KEY_MISSING &&
+                ble_conn_state_role(p_evt->conn_handle) == BLE_GAP_ROLE_CENTRAL &&
+                is_pairing_window_open()) {
+                conn_secure(p_evt->conn_handle, true);
+            } else {
+                pm_handler_disconnect_on_sec_failure(p_evt);
+            }
+        } break;
+
+        case PM_EVT_CONN_SEC_CONFIG_REQ:
+        {
+            /* Just Works can't tell a bonded peer that lost its keys from an impostor using its
+               address, so pairing again is only allowed in the pairing window */
+            pm_conn_sec_config_t config = { .allow_repairing = is_pairing_window_open() };
+            pm_conn_sec_config_reply(p_evt->conn_handle, &config);
+        } break;
+
+        case PM_EVT_CONN_SEC_PARAMS_REQ:
+        {
+            if (!is_pairing_allowed()) {
+                logger::log<Level::WARNING>("Pairing rejected, a peer is already bonded"_fmt);
+                APP_ERROR_CHECK(pm_conn_sec_params_reply(p_evt->conn_handle, nullptr,
+                                p_evt->params.conn_sec_params_req.p_context));
+            }
+        } break;
+
+        case PM_EVT_ERROR_UNEXPECTED:
+            APP_ERROR_CHECK(p_evt->params.error_unexpected.error);
+            break;
+
+        default:
+            break;
+    }
 }
 
 }  // namespace ble_common
@@ -1,7 +1,19 @@
 /*
  * ble_common.hpp - Common BLE functions.
  *
- * Contains common BLE functions, such as setting up the BLE stack.
+ * Contains common BLE functions, such as setting up the BLE stack and the peer manager.
+ *
+ * Links are bonded with legacy Just Works pairing (neither side has a display or keys), which the
+ * SoftDevice handles without a crypto library. A low priority task loads the stored bonds at boot,
+ * so it doesn't delay advertising or scanning. The central secures each link with secure() as soon
+ * as it connects: a bonded peer is encrypted with its stored LTK in a single encryption request,
+ * without pairing again, while a new peer pairs.
+ *
+ * Just Works accepts any peer, so pairing is only allowed while no peer is bonded, or within
+ * BLE_COMMON_PAIRING_WINDOW_MS of boot. Outside that window a bonded peer can't pair again and
+ * other peers can't pair at all.
+ *
+ * The time from connection to an encrypted link is measured for both cases (security_stats()).
  *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
@@ -17,6 +29,9 @@
 #include <nrf_sdh_ble.h>
 #include <sdk_errors.h>
 
+#include <cstdint>
+
+#include "config/app_config.h"
 #include "util.hpp"
 
 namespace ble_common {
@@ -49,6 +64,20 @@ struct Data {
 
 SUPPRESS_WARNING_END()
 
+/** Times from connection to an encrypted link. */
+struct EncryptionTiming {
+    std::uint32_t links;                    /**< Links encrypted. */
+    std::uint32_t last_us;                  /**< Latest time to encryption. */
+    std::uint32_t worst_us;                 /**< Worst time to encryption. */
+};
+
+/** Security statistics since boot. */
+struct SecurityStats {
+    EncryptionTiming bonded;                /**< Bonded peers, encrypted with the stored LTK. */
+    EncryptionTiming paired;                /**< New peers, paired and bonded. */
+    std::uint32_t failures;                 /**< Failed security procedures. */
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -60,4 +89,35 @@ SUPPRESS_WARNING_END()
  */
 void init(const Data &data);
 
+/**
+ * Encrypts a new link (central only), with the stored LTK if the peer is bonded or by pairing
+ * if it isn't. Deferred until the peer manager has loaded the bonds, if it hasn't yet.
+ * Must be called from the SoftDevice task.
+ *
+ * @param[in] conn_handle the connection handle.
+ */
+void secure(std::uint16_t conn_handle);
+
+/**
+ * Checks whether the peer manager has loaded the stored bonds and is handling security.
+ *
+ * @return true if the peer manager is ready, else false.
+ */
+bool is_peer_manager_ready();
+
+/**
+ * Looks up the identity address of the bonded peer to reconnect to: the one most recently
+ * secured, or the first bond if none has been ranked yet. Must be called from the SoftDevice task.
+ *
+ * @param[out] addr the peer's address.
+ *
+ * @return true if there is a bonded peer, false if there is none or the bonds aren't loaded yet.
+ */
+bool bonded_peer_addr(ble_gap_addr_t *addr);
+
+/**
+ * Returns security statistics since boot.
+ */
+SecurityStats security_stats();
+
 }  // namespace ble_common
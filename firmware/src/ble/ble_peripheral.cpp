@@ -21,8 +21,6 @@
 #include <ble_advertising.h>
 #include <ble_conn_params.h>
 #include <ble_dis.h>
-// TODO(CMK) 06/21/20: implement battery service client
-#include <ble_bas_c.h>
 // TODO(CMK) 06/21/20: implement current time client for phone connection?
 // #include <ble_cts_c.h>
 #include <bsp.h>
@@ -30,12 +28,17 @@
 #include <nrf_sdh.h>
 #include <nrf_sdh_ble.h>
 
+#include <algorithm>
+#include <cstddef>
+
 #include "ble_es_common.hpp"
 #include "config/app_config.h"
 #include "logger.hpp"
+#include "timestamp.hpp"
 #include "util.hpp"
 
 using logger::Level;
+using logger::operator""_fmt;
 
 namespace ble_peripheral {
 
@@ -53,6 +56,28 @@ static void gap_init();
 /** Configures and initializes BLE advertising. */
 static void advertising_init();
 
+/**
+ * Advertising module event handler, answers with the bonded remote's address for directed
+ * advertising and keeps track of the advertising mode.
+ *
+ * @param[in] adv_evt the advertising event.
+ */
+static void advertising_event_handler(ble_adv_evt_t adv_evt);
+
+/**
+ * Returns the median of the recent discovery latencies in an advertising mode.
+ *
+ * @param[in] mode the advertising mode, with at least one latency recorded.
+ */
+static std::uint32_t median_latency_ms(ble_adv_mode_t mode);
+
+/**
+ * Returns the name of an advertising mode, for logging.
+ *
+ * @param[in] mode the advertising mode.
+ */
+static const char *adv_mode_name(ble_adv_mode_t mode);
+
 /** Configures and initializes connection parameters. */
 static void conn_params_init();
 
@@ -76,6 +101,18 @@ static ble_db_discovery_t *g_discovery;
 /**< nRF GATT queue instance. */
 static nrf_ble_gq_t *g_gatt_queue;
 
+/**< The remote directed advertising is aimed at when none is bonded, if one has been set. */
+static ble_gap_addr_t g_peer_addr;
+static bool g_has_peer_addr;
+
+/**< The current advertising mode, and when it started. */
+static ble_adv_mode_t g_adv_mode { BLE_ADV_MODE_IDLE };
+static std::uint32_t g_adv_mode_start_ms;
+
+/**< Recent discovery latencies per advertising mode (circular), and the number recorded. */
+static std::uint32_t g_latency_ms[BLE_ADV_MODES][BLE_PERIPHERAL_ADV_LATENCY_SAMPLES];
+static std::uint32_t g_latency_count[BLE_ADV_MODES];
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -107,7 +144,7 @@ void advertise_name() {
 
     APP_ERROR_CHECK(ble_advertising_advdata_update(g_advertising, &advdata, nullptr));
 
-    logger::log<Level::INFO>("advertising name");
+    logger::log<Level::INFO>("advertising name"_fmt);
 }
 
 void advertise_uuid_appearance(ble_uuid_t *uuid) {
@@ -121,13 +158,38 @@ void advertise_uuid_appearance(ble_uuid_t *uuid) {
 
     APP_ERROR_CHECK(ble_advertising_advdata_update(g_advertising, &advdata, nullptr));
 
-    logger::log<Level::INFO>("advertising UUID + appearance");
+    logger::log<Level::INFO>("advertising UUID + appearance"_fmt);
+}
+
+void set_peer_addr(const ble_gap_addr_t &addr) {
+    g_peer_addr = addr;
+    g_has_peer_addr = true;
 }
 
 void start_advertising() {
-    APP_ERROR_CHECK(ble_advertising_start(g_advertising, BLE_ADV_MODE_FAST));
+    APP_ERROR_CHECK(ble_advertising_start(g_advertising, BLE_ADV_MODE_DIRECTED_HIGH_DUTY));
+
+    logger::log<Level::INFO>("%s (%u us after boot)"_fmt, __func__, timestamp::now());
+}
+
+void on_connected() {
+    const ble_adv_mode_t mode = g_adv_mode;
 
-    logger::log<Level::INFO>("%s", __func__);
+    if (mode == BLE_ADV_MODE_IDLE) {
+        return;
+    }
+
+    /* Advertising stops on connection, the module doesn't report that as an event */
+    g_adv_mode = BLE_ADV_MODE_IDLE;
+
+    const std::uint32_t latency_ms = timestamp::now_ms() - g_adv_mode_start_ms;
+    const std::uint32_t count = g_latency_count[mode]++;
+    g_latency_ms[mode][count % BLE_PERIPHERAL_ADV_LATENCY_SAMPLES] = latency_ms;
+
+    logger::log<Level::INFO>("Discovered %u ms into %s advertising (median %u ms of %u)"_fmt,
+                             latency_ms, adv_mode_name(mode), median_latency_ms(mode),
+                             std::min<std::uint32_t>(count + 1,
+                                                     BLE_PERIPHERAL_ADV_LATENCY_SAMPLES));
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -158,13 +220,20 @@ static void gap_init() {
 static void advertising_init() {
     ble_advertising_init_t adv_init = {
         .config = {
-            .ble_adv_fast_enabled  = true,
-            .ble_adv_fast_interval = BLE_PERIPHERAL_ADV_INTERVAL,
-            .ble_adv_fast_timeout  = BLE_PERIPHERAL_ADV_DURATION,
+            .ble_adv_on_disconnect_disabled     = false,
+            .ble_adv_directed_high_duty_enabled = BLE_PERIPHERAL_ADV_DIRECTED_ENABLED,
+            .ble_adv_fast_enabled               = true,
+            .ble_adv_slow_enabled               = true,
+            .ble_adv_fast_interval              = BLE_PERIPHERAL_FAST_ADV_INTERVAL,
+            .ble_adv_fast_timeout               = BLE_PERIPHERAL_FAST_ADV_DURATION,
+            .ble_adv_slow_interval              = BLE_PERIPHERAL_SLOW_ADV_INTERVAL,
+            .ble_adv_slow_timeout               = BLE_PERIPHERAL_SLOW_ADV_DURATION,
+        },
+        .evt_handler = advertising_event_handler,
+        /* Failing to move on to the next mode would leave the receiver silent */
+        .error_handler = [](std::uint32_t nrf_error) {
+            APP_ERROR_HANDLER(nrf_error);
         },
-        // TODO(CMK) 06/19/20: advertising event handler
-        .evt_handler = nullptr,
-        .error_handler = nullptr,
     };
 
     APP_ERROR_CHECK(ble_advertising_init(g_advertising, &adv_init));
@@ -172,6 +241,57 @@ static void advertising_init() {
     ble_advertising_conn_cfg_tag_set(g_advertising, BLE_COMMON_CONN_CFG_TAG);
 }
 
+static void advertising_event_handler(ble_adv_evt_t adv_evt) {
+    switch (adv_evt) {
+        case BLE_ADV_EVT_PEER_ADDR_REQUEST: {
+            ble_gap_addr_t addr {};
+
+            /* Without an answer directed advertising is skipped, e.g. nothing is paired yet */
+            if (ble_common::bonded_peer_addr(&addr)) {
+                APP_ERROR_CHECK(ble_advertising_peer_addr_reply(g_advertising, &addr));
+            } else if (g_has_peer_addr) {
+                addr = g_peer_addr;
+                APP_ERROR_CHECK(ble_advertising_peer_addr_reply(g_advertising, &addr));
+            }
+        } break;
+
+        case BLE_ADV_EVT_IDLE:
+        case BLE_ADV_EVT_DIRECTED_HIGH_DUTY:
+        case BLE_ADV_EVT_DIRECTED:
+        case BLE_ADV_EVT_FAST:
+        case BLE_ADV_EVT_SLOW: {
+            g_adv_mode = g_advertising->adv_mode_current;
+            g_adv_mode_start_ms = timestamp::now_ms();
+
+            logger::log<Level::INFO>("Advertising: %s"_fmt, adv_mode_name(g_adv_mode));
+        } break;
+
+        default:
+            break;
+    }
+}
+
+static std::uint32_t median_latency_ms(ble_adv_mode_t mode) {
+    const std::size_t count = std::min<std::size_t>(g_latency_count[mode],
+                                                    BLE_PERIPHERAL_ADV_LATENCY_SAMPLES);
+    std::uint32_t sorted[BLE_PERIPHERAL_ADV_LATENCY_SAMPLES];
+
+    std::copy_n(g_latency_ms[mode], count, sorted);
+    std::nth_element(sorted, sorted + count / 2, sorted + count);
+
+    return sorted[count / 2];
+}
+
+static const char *adv_mode_name(ble_adv_mode_t mode) {
+    switch (mode) {
+        case BLE_ADV_MODE_DIRECTED_HIGH_DUTY:   return "directed";
+        case BLE_ADV_MODE_DIRECTED:             return "directed (low duty)";
+        case BLE_ADV_MODE_FAST:                 return "fast";
+        case BLE_ADV_MODE_SLOW:                 return "slow";
+        default:                                return "idle";
+    }
+}
+
 static void conn_params_init() {
     ble_conn_params_init_t cp_init = {
         .p_conn_params                  = nullptr,
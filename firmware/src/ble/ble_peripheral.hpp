@@ -11,6 +11,13 @@
  * It will connect to a mobile phone to get useful info that might be displayed on the remote,
  * such as date-time, directions, etc.
  *
+ * Advertising steps down through the advertising module's modes: high duty directed advertising
+ * at the bonded (or else paired) remote, then fast and slow undirected advertising. Slow
+ * advertising carries on until the remote connects, as nothing on the receiver could restart it
+ * from idle. It starts over from directed advertising on disconnection. The time into a mode at
+ * which the remote connects is its discovery latency in that mode, and the median of the recent
+ * ones is logged.
+ *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
  */
@@ -49,8 +56,22 @@ void advertise_name();
 void advertise_uuid_appearance(ble_uuid_t *uuid);
 
 /**
-  * Starts advertising.
+ * Sets the remote directed advertising is aimed at when none is bonded, e.g. the paired address
+ * stored in the settings while links aren't encrypted.
+ *
+ * @param[in] addr the remote's address.
+ */
+void set_peer_addr(const ble_gap_addr_t &addr);
+
+/**
+  * Starts advertising, directed at the bonded (or else paired) remote first.
   */
 void start_advertising();
 
+/**
+ * Records the discovery latency of the advertising mode the remote connected in. Must be called
+ * from the SoftDevice task on BLE_GAP_EVT_CONNECTED.
+ */
+void on_connected();
+
 }  // namespace ble_peripheral
@@ -18,18 +18,17 @@
 #include <nrf_sdh_ble.h>
 #include <nrf_sdh_freertos.h>
 
-#include <cstring>
-
 #include "ble_common.hpp"
 #include "ble_es_client.hpp"
 #include "ble_events.hpp"
 #include "ble_peripheral.hpp"
 #include "config/app_config.h"
-#include "es_fds.hpp"
 #include "logger.hpp"
+#include "settings.hpp"
 #include "util.hpp"
 
 using logger::Level;
+using logger::operator""_fmt;
 
 namespace ble_receiver {
 
@@ -37,9 +36,18 @@ namespace ble_receiver {
 // Private Prototypes
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-/** Checks FDS to see if a paired address is stored, and reads it into g_paired_addr if so. */
+/**
+ * Reads the stored paired address into g_paired_addr and starts advertising, directed at that
+ * remote first if one is stored. Called once the settings are loaded.
+ */
 static void init_paired_addr();
 
+/**
+ * Stores g_paired_addr in the settings, so the link is reconnected to after a reset. Only writes
+ * to flash if the address changed.
+ */
+static void store_paired_addr();
+
 /**
  * BLE event handler.
  *
@@ -90,7 +98,7 @@ static ble_gap_addr_t g_paired_addr;
 // Public Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void init(SensorCallback sensor_callback) {
+void init(SensorCallback sensor_callback, ControlCallback control_callback) {
     auto data = ble_common::Data {
         .gatt                   = &g_gatt,
         .gatt_queue             = &g_gatt_queue,
@@ -103,23 +111,25 @@ void init(SensorCallback sensor_callback) {
 
     ble_peripheral::init(data);
 
-    init_paired_addr();
+    settings::on_loaded(init_paired_addr);
 
     g_es_client.init(&g_gatt_queue);
     g_es_client.register_sensor_data_callback(sensor_callback);
+    g_es_client.register_control_callback(control_callback);
 
     ble_uuid_t uuid {
         .uuid = ble_es_common::UUID_SERVICE,
         .type = ble_es_common::uuid_type(),
     };
 
-    // TODO(CMK) 07/27/20: choose what kind of advertising based on if g_paired_addr is found
     ble_peripheral::advertise_uuid_appearance(&uuid);
 
-    /* Setup the SDH thread to start scanning */
-    nrf_sdh_freertos_init([](void *ignored) {
-        ble_peripheral::start_advertising();
-    }, nullptr);
+    /* Advertising starts once the stored paired address is known (see init_paired_addr()) */
+    nrf_sdh_freertos_init(nullptr, nullptr);
+}
+
+bool write_telemetry(const std::uint8_t *data, std::uint16_t len) {
+    return g_es_client.write_telemetry(data, len);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -127,20 +137,26 @@ void init(SensorCallback sensor_callback) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void init_paired_addr() {
-#if 0  // TODO(CMK) 07/01/20: init paired addr w/ FDS
-    fds_record_desc_t desc = {};
-
-    if (es_fds::record_is_present(BLE_COMMON_FDS_ADDR_FILE_ID,
-                                    BLE_COMMON_FDS_ADDR_RECORD_KEY, &desc)) {
-        if (es_fds::read_record(&desc, reinterpret_cast<std::uint8_t *>(&g_paired_addr),
-                sizeof(g_paired_addr)) == NRF_SUCCESS) {
-            return;
-        }
+    /* All zeros if none is stored, or the record was corrupted */
+    g_paired_addr = settings::paired_addr();
+
+    if (settings::is_paired()) {
+        ble_peripheral::set_peer_addr(g_paired_addr);
     }
 
-    /* Either record was missing or corrupted, start anew. */
-    memset(&g_paired_addr, 0, sizeof(g_paired_addr));
-#endif
+    ble_peripheral::start_advertising();
+}
+
+static void store_paired_addr() {
+    settings::set_paired_addr(g_paired_addr);
+    ble_peripheral::set_peer_addr(g_paired_addr);
+
+    /* e.g. the settings aren't loaded yet, it's stored again on the next secured link */
+    const ret_code_t ret_code = settings::commit();
+
+    if (ret_code != NRF_SUCCESS) {
+        logger::log<Level::WARNING>("Storing the paired address: 0x%X"_fmt, ret_code);
+    }
 }
 
 static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
@@ -155,15 +171,22 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gap_evt = p_ble_evt->evt.gap_evt;
             const auto &connected_evt = gap_evt.params.connected;
 
-            logger::log<Level::INFO>("Connected to " MAC_FMT,
+            logger::log<Level::INFO>("Connected to " MAC_FMT ""_fmt,
                                      MAC_ARGS(connected_evt.peer_addr.addr));
-            logger::log<Level::INFO>("Connection handle 0x%X. Starting DB discovery",
+            logger::log<Level::INFO>("Connection handle 0x%X. Starting DB discovery"_fmt,
                                      gap_evt.conn_handle);
 
             APP_ERROR_CHECK(ble_db_discovery_start(&g_db_discovery, gap_evt.conn_handle));
 
             g_paired_addr = connected_evt.peer_addr;
 
+            /* With encrypted links it's stored once the remote has secured the link */
+            if (!BLE_ES_ENCRYPTED_LINK) {
+                store_paired_addr();
+            }
+
+            ble_peripheral::on_connected();
+
             event.event = Events::CONNECTED;
             event.data.connected.address = connected_evt.peer_addr.addr;
             trigger_event(&event);
@@ -176,7 +199,7 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gap_evt = p_ble_evt->evt.gap_evt;
             const auto &disconnected_evt = gap_evt.params.disconnected;
 
-            logger::log<Level::INFO>("Disconnected from 0x%X (reason: 0x%X)",
+            logger::log<Level::INFO>("Disconnected from 0x%X (reason: 0x%X)"_fmt,
                                      gap_evt.conn_handle, disconnected_evt.reason);
 
             event.event = Events::DISCONNECTED;
@@ -185,7 +208,17 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
 
             trigger_event(&event);
 
-            // TODO(CMK) 07/11/20: more disconnection handling? start scanning?
+            /* The advertising module restarts advertising, directed at the remote first */
+        } break;
+
+        case BLE_GAP_EVT_CONN_SEC_UPDATE:
+        {
+            const auto &sec_mode = p_ble_evt->evt.gap_evt.params.conn_sec_update.conn_sec.sec_mode;
+
+            /* Security mode 1 level 2 and up are encrypted, i.e. the peer is bonded */
+            if (BLE_ES_ENCRYPTED_LINK && sec_mode.lv >= 2) {
+                store_paired_addr();
+            }
         } break;
 
         case BLE_GAP_EVT_TIMEOUT:
@@ -195,7 +228,7 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
 
             /* Handle connection timeout */
             if (timeout_evt.src == BLE_GAP_TIMEOUT_SRC_CONN) {
-                logger::log<Level::INFO>("Timed out connecting");
+                logger::log<Level::INFO>("Timed out connecting"_fmt);
                 // TODO(CMK) 07/11/20: retry connection?
             }
         } break;
@@ -223,7 +256,7 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gattc_evt = p_ble_evt->evt.gattc_evt;
 
             /* Lost communication to peripheral */
-            logger::log<Level::INFO>("GATTC timeout");
+            logger::log<Level::INFO>("GATTC timeout"_fmt);
             APP_ERROR_CHECK(sd_ble_gap_disconnect(gattc_evt.conn_handle,
                              BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION));
         } break;
@@ -235,7 +268,7 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gatts_evt = p_ble_evt->evt.gatts_evt;
 
             /* Lost communication to peripheral */
-            logger::log<Level::INFO>("GATTS timeout");
+            logger::log<Level::INFO>("GATTS timeout"_fmt);
             APP_ERROR_CHECK(sd_ble_gap_disconnect(gatts_evt.conn_handle,
                              BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION));
         } break;
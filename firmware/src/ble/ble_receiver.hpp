@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #include "hall_sensor.hpp"
@@ -16,6 +17,7 @@
 namespace ble_receiver {
 
 using SensorCallback = void (*)(HallSensor::type);
+using ControlCallback = void (*)(const std::uint8_t *data, std::size_t len);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Functions
@@ -24,8 +26,19 @@ using SensorCallback = void (*)(HallSensor::type);
 /**
  * Initializes the BLE stack and starts advertising.
  *
- * @param[in] sensor_callback a function to be called whenever new sensor data comes in.
+ * @param[in] sensor_callback  a function to be called whenever new sensor data comes in.
+ * @param[in] control_callback a function to be called whenever a control command comes in.
  */
-void init(SensorCallback sensor_callback);
+void init(SensorCallback sensor_callback, ControlCallback control_callback);
+
+/**
+ * Queues a telemetry frame to the remote as a write without response.
+ *
+ * @param[in] data the frame (see ble_es_common::encode).
+ * @param[in] len  the length of the frame.
+ *
+ * @return true if the frame was queued.
+ */
+bool write_telemetry(const std::uint8_t *data, std::uint16_t len);
 
 }  // namespace ble_receiver
@@ -9,6 +9,7 @@
 
 #include "ble_remote.hpp"
 
+#include <ble_bas.h>
 #include <ble_srv_common.h>
 #include <nrf_ble_gatt.h>
 #include <nrf_ble_gq.h>
@@ -16,18 +17,25 @@
 #include <nrf_sdh_ble.h>
 #include <nrf_sdh_freertos.h>
 
-#include <cstring>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
 
 #include "ble_central.hpp"
 #include "ble_common.hpp"
 #include "ble_es_server.hpp"
 #include "ble_events.hpp"
 #include "config/app_config.h"
-#include "es_fds.hpp"
 #include "logger.hpp"
+#include "logger_flash.hpp"
+#include "ride_recorder.hpp"
+#include "settings.hpp"
+#include "timestamp.hpp"
 #include "util.hpp"
 
 using logger::Level;
+using logger::operator""_fmt;
 
 namespace ble_remote {
 
@@ -35,9 +43,23 @@ namespace ble_remote {
 // Private Prototypes
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-/** Checks FDS to see if a paired address is stored, and reads it into g_paired_addr if so. */
+/**
+ * Reads the stored paired address into g_paired_addr and starts scanning: for that receiver by its
+ * address if one is stored, for any receiver otherwise. Called once the settings are loaded.
+ */
 static void init_paired_addr();
 
+/**
+ * Stores g_paired_addr in the settings, so the link is reconnected to after a reset. Only writes
+ * to flash if the address changed.
+ */
+static void store_paired_addr();
+
+/**
+ * Sets the scan filter to find any receiver, by the ES service UUID and appearance.
+ */
+static void scan_for_any_receiver();
+
 /**
  * BLE scan event handler.
  *
@@ -75,9 +97,30 @@ NRF_BLE_GQ_DEF(g_gatt_queue,
 /**< Custom electric skateboard server instance. */
 BLE_ES_SERVER_DEF(g_es_server);
 
+/**< Battery Service instance. */
+BLE_BAS_DEF(g_bas);
+
 /**< The BLE address of the paired receiver. Set to 0 when no receiver is paired. */
 static ble_gap_addr_t g_paired_addr;
 
+/**< Handle for the connection to the receiver. */
+static std::uint16_t g_conn_handle { BLE_CONN_HANDLE_INVALID };
+
+/**< Sequence number of the next control command. */
+static std::uint8_t g_control_sequence;
+
+/**< Whether or not the remote is asleep, a link dropped to sleep isn't recovered. */
+static volatile bool g_is_asleep;
+
+/**< Whether or not a dropped link is being recovered, when it dropped (timestamp::now_ms()), and
+     the samples lost since. */
+static bool g_is_recovering;
+static std::uint32_t g_link_lost_ms;
+static std::uint32_t g_samples_lost;
+
+/**< Link recovery statistics. */
+static RecoveryStats g_recovery_stats;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -95,26 +138,144 @@ void init() {
 
     ble_central::init(data);
 
-    init_paired_addr();
+    settings::on_loaded(init_paired_addr);
 
     g_es_server.init();
+    g_es_server.register_log_read_callback(logger::flash::read);
+    g_es_server.register_ride_read_callback(ride_recorder::read);
+
+    ble_bas_init_t bas_init = {
+        .evt_handler            = nullptr,
+        .support_notification   = true,
+        .p_report_ref           = nullptr,
+        .initial_batt_level     = 100,
+        .bl_rd_sec              = SEC_OPEN,
+        .bl_cccd_wr_sec         = SEC_OPEN,
+        .bl_report_rd_sec       = SEC_OPEN,
+    };
+    APP_ERROR_CHECK(ble_bas_init(&g_bas, &bas_init));
 
-    ble_uuid_t uuid = {
-        .uuid = ble_es_common::UUID_SERVICE,
-        .type = ble_es_common::uuid_type(),
+    /* Scanning starts once the stored paired address is known (see init_paired_addr()) */
+    nrf_sdh_freertos_init(nullptr, nullptr);
+}
+
+bool update_sensor_value(HallSensor::type value) {
+    const bool is_sent = g_es_server.update_sensor_value(value);
+    bool is_recovered = { false };
+    std::uint32_t recovery_ms = { 0 };
+    std::uint32_t samples_lost = { 0 };
+
+    taskENTER_CRITICAL();
+    if (g_is_recovering && !is_sent) {
+        ++g_samples_lost;
+    } else if (g_is_recovering) {
+        is_recovered = true;
+        recovery_ms = timestamp::now_ms() - g_link_lost_ms;
+        samples_lost = g_samples_lost;
+        g_is_recovering = false;
+
+        ++g_recovery_stats.recoveries;
+        g_recovery_stats.last_recovery_ms = recovery_ms;
+        g_recovery_stats.worst_recovery_ms = std::max(g_recovery_stats.worst_recovery_ms,
+                                                      recovery_ms);
+        g_recovery_stats.last_samples_lost = samples_lost;
+        g_recovery_stats.samples_lost += samples_lost;
+    }
+    taskEXIT_CRITICAL();
+
+    if (is_recovered) {
+        logger::log<Level::INFO>("Link recovered in %u ms, %u samples lost"_fmt,
+                                 recovery_ms, samples_lost);
+    }
+
+    return is_sent;
+}
+
+void update_battery_level(std::uint8_t level) {
+    const ret_code_t ret_code = ble_bas_battery_level_update(&g_bas, level, BLE_CONN_HANDLE_ALL);
+
+    /* The value is stored either way, it just isn't notified if nobody is subscribed */
+    if (ret_code != NRF_SUCCESS &&
+        ret_code != NRF_ERROR_INVALID_STATE &&
+        ret_code != NRF_ERROR_RESOURCES &&
+        ret_code != BLE_ERROR_GATTS_SYS_ATTR_MISSING) {
+        APP_ERROR_CHECK(ret_code);
+    }
+}
+
+void register_telemetry_callback(TelemetryCallback callback) {
+    g_es_server.register_telemetry_callback(callback);
+}
+
+bool send_control(ble_es_common::ControlOpcode opcode, std::uint8_t argument) {
+    const ble_es_common::ControlCommand command = {
+        .opcode     = opcode,
+        .sequence   = g_control_sequence,
+        .argument   = argument,
     };
 
-    // TODO(CMK) 07/01/20: choose what kind of scanning based on if g_paired_addr is found
-    ble_central::set_uuid_appearance_scan_filter(uuid, ble_es_common::APPEARANCE);
+    if (!g_es_server.send_control(command)) {
+        return false;
+    }
 
-    /* Setup the SDH thread to start scanning */
-    nrf_sdh_freertos_init([](void *ignored) {
-        ble_central::begin_scanning();
-    }, nullptr);
+    ++g_control_sequence;
+    return true;
+}
+
+BLEESServer::LatencyStats notification_latency() {
+    return g_es_server.latency_stats();
+}
+
+std::int8_t rssi() {
+    std::int8_t rssi = { 0 };
+    std::uint8_t channel = {};
+
+    if (g_conn_handle == BLE_CONN_HANDLE_INVALID ||
+        sd_ble_gap_rssi_get(g_conn_handle, &rssi, &channel) != NRF_SUCCESS) {
+        return 0;
+    }
+
+    return rssi;
+}
+
+void set_conn_profile(ble_central::ConnProfile profile) {
+    if (g_conn_handle != BLE_CONN_HANDLE_INVALID) {
+        ble_central::set_conn_profile(g_conn_handle, profile);
+    }
+}
+
+RecoveryStats recovery_stats() {
+    taskENTER_CRITICAL();
+    RecoveryStats stats = g_recovery_stats;
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
+void sleep() {
+    g_is_asleep = true;
+
+    /* The receiver holds neutral while the link is down, asleep is no outage */
+    taskENTER_CRITICAL();
+    g_is_recovering = false;
+    taskEXIT_CRITICAL();
+
+    ble_central::stop_scanning();
+
+    if (g_conn_handle != BLE_CONN_HANDLE_INVALID) {
+        const ret_code_t ret_code = sd_ble_gap_disconnect(g_conn_handle,
+                                        BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+
+        /* The link may already be going down */
+        if (ret_code != NRF_ERROR_INVALID_STATE) {
+            APP_ERROR_CHECK(ret_code);
+        }
+    }
 }
 
-void update_sensor_value(HallSensor::type value) {
-    g_es_server.update_sensor_value(value);
+void wake() {
+    g_is_asleep = false;
+    ble_central::begin_scanning();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -122,20 +283,40 @@ void update_sensor_value(HallSensor::type value) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void init_paired_addr() {
-#if 0  // TODO(CMK) 07/01/20: init paired addr w/ FDS
-    fds_record_desc_t desc = {};
-
-    if (es_fds::record_is_present(BLE_COMMON_FDS_ADDR_FILE_ID,
-                                    BLE_COMMON_FDS_ADDR_RECORD_KEY, &desc)) {
-        if (es_fds::read_record(&desc, reinterpret_cast<std::uint8_t *>(&g_paired_addr),
-                sizeof(g_paired_addr)) == NRF_SUCCESS) {
-            return;
-        }
+    /* All zeros if none is stored, or the record was corrupted */
+    g_paired_addr = settings::paired_addr();
+
+    /* If the paired receiver isn't found by the end of the fast scan it may have been replaced,
+       and the scan timeout switches to any receiver */
+    if (settings::is_paired()) {
+        ble_central::set_addr_scan_filter(g_paired_addr);
+    } else {
+        scan_for_any_receiver();
     }
 
-    /* Either record was missing or corrupted, start anew. */
-    memset(&g_paired_addr, 0, sizeof(g_paired_addr));
-#endif
+    if (!g_is_asleep) {
+        ble_central::begin_scanning();
+    }
+}
+
+static void store_paired_addr() {
+    settings::set_paired_addr(g_paired_addr);
+
+    /* e.g. the settings aren't loaded yet, it's stored again on the next secured link */
+    const ret_code_t ret_code = settings::commit();
+
+    if (ret_code != NRF_SUCCESS) {
+        logger::log<Level::WARNING>("Storing the paired address: 0x%X"_fmt, ret_code);
+    }
+}
+
+static void scan_for_any_receiver() {
+    ble_uuid_t uuid = {
+        .uuid = ble_es_common::UUID_SERVICE,
+        .type = ble_es_common::uuid_type(),
+    };
+
+    ble_central::set_uuid_appearance_scan_filter(uuid, ble_es_common::APPEARANCE);
 }
 
 static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
@@ -149,18 +330,31 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gap_evt = p_ble_evt->evt.gap_evt;
             const auto &connected_evt = gap_evt.params.connected;
 
-            logger::log<Level::INFO>("Connected to " MAC_FMT,
+            logger::log<Level::INFO>("Connected to " MAC_FMT ""_fmt,
                                      MAC_ARGS(connected_evt.peer_addr.addr));
-            logger::log<Level::INFO>("Connection handle 0x%X", gap_evt.conn_handle);
+            logger::log<Level::INFO>("Connection handle 0x%X"_fmt, gap_evt.conn_handle);
 
             g_paired_addr = connected_evt.peer_addr;
+            g_conn_handle = gap_evt.conn_handle;
+
+            /* Keep a running RSSI measurement for the ride recorder, without RSSI events */
+            APP_ERROR_CHECK(sd_ble_gap_rssi_start(g_conn_handle,
+                                                  BLE_GAP_RSSI_THRESHOLD_INVALID, 0));
+
+            /* Straight away: a bonded receiver is encrypted with its LTK before the first
+               throttle sample is due */
+            if (BLE_ES_ENCRYPTED_LINK) {
+                ble_common::secure(g_conn_handle);
+            } else {
+                store_paired_addr();
+            }
 
             event.event = ble_events::Events::CONNECTED;
             event.data.connected.address = connected_evt.peer_addr.addr;
 
             ble_events::trigger_event(&event);
 
-            // TODO(CMK) 07/11/20: more connection handling?
+            ble_central::on_connected();
         } break;
 
         case BLE_GAP_EVT_DISCONNECTED:
@@ -168,16 +362,42 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gap_evt = p_ble_evt->evt.gap_evt;
             const auto &disconnected_evt = gap_evt.params.disconnected;
 
-            logger::log<Level::INFO>("Disconnected from 0x%X (reason: 0x%X)",
+            logger::log<Level::INFO>("Disconnected from 0x%X (reason: 0x%X)"_fmt,
                                      gap_evt.conn_handle, disconnected_evt.reason);
 
+            g_conn_handle = BLE_CONN_HANDLE_INVALID;
+
             event.event = ble_events::Events::DISCONNECTED;
             event.data.disconnected.address = g_paired_addr.addr;
             event.data.disconnected.reason = disconnected_evt.reason;
 
             ble_events::trigger_event(&event);
 
-            // TODO(CMK) 07/11/20: more disconnection handling? start scanning?
+            /* Unless the link was dropped to sleep, reconnect to the same receiver by its address
+               (it advertises directed at this remote first) */
+            if (!g_is_asleep) {
+                ble_central::set_addr_scan_filter(g_paired_addr);
+
+                taskENTER_CRITICAL();
+                if (!g_is_recovering) {
+                    g_is_recovering = true;
+                    g_link_lost_ms = timestamp::now_ms();
+                    g_samples_lost = 0;
+                }
+                taskEXIT_CRITICAL();
+            }
+
+            ble_central::on_disconnected();
+        } break;
+
+        case BLE_GAP_EVT_CONN_SEC_UPDATE:
+        {
+            const auto &sec_mode = p_ble_evt->evt.gap_evt.params.conn_sec_update.conn_sec.sec_mode;
+
+            /* Security mode 1 level 2 and up are encrypted, i.e. the peer is bonded */
+            if (BLE_ES_ENCRYPTED_LINK && sec_mode.lv >= 2) {
+                store_paired_addr();
+            }
         } break;
 
         case BLE_GAP_EVT_TIMEOUT:
@@ -187,17 +407,28 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
 
             /* Handle connection timeout */
             if (timeout_evt.src == BLE_GAP_TIMEOUT_SRC_CONN) {
-                logger::log<Level::INFO>("Timed out connecting");
-                // TODO(CMK) 07/11/20: retry connection?
+                logger::log<Level::INFO>("Timed out connecting"_fmt);
+                ble_central::on_connect_timeout();
             }
         } break;
 
         case BLE_GAP_EVT_CONN_PARAM_UPDATE_REQUEST:
         {
             const auto &gap_evt = p_ble_evt->evt.gap_evt;
-            const auto &conn_params = gap_evt.params.conn_param_update_request.conn_params;
 
-            APP_ERROR_CHECK(sd_ble_gap_conn_param_update(gap_evt.conn_handle, &conn_params));
+            /* Throttle latency comes first, answer with the current profile's parameters */
+            ble_central::set_conn_profile(gap_evt.conn_handle, ble_central::conn_profile());
+        } break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        {
+            const auto &gap_evt = p_ble_evt->evt.gap_evt;
+            const auto &conn_params = gap_evt.params.conn_param_update.conn_params;
+
+            logger::log<Level::INFO>("Connection interval %u x 1.25 ms"_fmt,
+                                     conn_params.max_conn_interval);
+
+            ble_central::on_conn_params_updated(gap_evt.conn_handle, conn_params);
         } break;
 
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
@@ -215,7 +446,7 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gattc_evt = p_ble_evt->evt.gattc_evt;
 
             /* Lost communication to peripheral */
-            logger::log<Level::INFO>("GATTC timeout");
+            logger::log<Level::INFO>("GATTC timeout"_fmt);
             APP_ERROR_CHECK(sd_ble_gap_disconnect(gattc_evt.conn_handle,
                              BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION));
         } break;
@@ -227,7 +458,7 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             const auto &gatts_evt = p_ble_evt->evt.gatts_evt;
 
             /* Lost communication to peripheral */
-            logger::log<Level::INFO>("GATTS timeout");
+            logger::log<Level::INFO>("GATTS timeout"_fmt);
             APP_ERROR_CHECK(sd_ble_gap_disconnect(gatts_evt.conn_handle,
                              BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION));
         } break;
@@ -239,7 +470,7 @@ static void scan_event_handler(scan_evt_t const *p_scan_evt) {
         case NRF_BLE_SCAN_EVT_FILTER_MATCH:
             {
                 auto *adv_report = p_scan_evt->params.filter_match.p_adv_report;
-                logger::log<Level::INFO>("SCANNED: " MAC_FMT,
+                logger::log<Level::INFO>("SCANNED: " MAC_FMT ""_fmt,
                                          MAC_ARGS(adv_report->peer_addr.addr));
                 util::log_ble_data(&adv_report->data);
             }
@@ -248,6 +479,11 @@ static void scan_event_handler(scan_evt_t const *p_scan_evt) {
         case NRF_BLE_SCAN_EVT_CONNECTING_ERROR: /* Error while trying to connect. */
             APP_ERROR_CHECK(p_scan_evt->params.connecting_err.err_code);
             break;
+
+        case NRF_BLE_SCAN_EVT_SCAN_TIMEOUT:
+            /* The receiver didn't come back during the fast scan, it may have been replaced */
+            scan_for_any_receiver();
+            break;
     }
 }
 
@@ -3,17 +3,46 @@
  *
  * The primary module for the electric skateboard remote's BLE functionality.
  *
+ * A link that drops while awake is recovered straight away: the remote scans fast for the same
+ * receiver by address, and falls back to looking for any receiver once the fast scan times out.
+ * The link counts as recovered when the first throttle sample goes out again, and the samples
+ * dropped until then are counted as lost.
+ *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
  */
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
+#include "ble_central.hpp"
+#include "ble_es_server.hpp"
 #include "hall_sensor.hpp"
 
 namespace ble_remote {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Called with each telemetry frame written by the receiver.
+ *
+ * @param[in] data the frame (see ble_es_common::decode).
+ * @param[in] len  the length of the frame.
+ */
+using TelemetryCallback = void (*)(const std::uint8_t *data, std::size_t len);
+
+/** Link recovery statistics since boot. */
+struct RecoveryStats {
+    std::uint32_t recoveries;               /**< Dropped links recovered. */
+    std::uint32_t last_recovery_ms;         /**< Latest time from disconnection to a sample sent. */
+    std::uint32_t worst_recovery_ms;        /**< Worst time from disconnection to a sample sent. */
+    std::uint32_t last_samples_lost;        /**< Samples lost during the latest recovery. */
+    std::uint32_t samples_lost;             /**< Samples lost during all recoveries. */
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -22,10 +51,69 @@ namespace ble_remote {
 void init();
 
 /**
- * Updates the sensor value in the GATT server.
+ * Updates the sensor value in the GATT server, counting it as lost if a dropped link is being
+ * recovered and it can't be sent.
  *
  * @param[in] value the new sensor value.
+ *
+ * @return true if the notification was queued.
  */
-void update_sensor_value(HallSensor::type value);
+bool update_sensor_value(HallSensor::type value);
+
+/**
+ * Updates the battery level in the Battery Service, notifying it if enabled.
+ *
+ * @param[in] level the battery level, in percent.
+ */
+void update_battery_level(std::uint8_t level);
+
+/**
+ * Registers a callback for telemetry frames from the receiver, called from the SoftDevice task.
+ *
+ * @param[in] callback the function called with each frame.
+ */
+void register_telemetry_callback(TelemetryCallback callback);
+
+/**
+ * Sends a control command to the receiver as a notification, with the next sequence number.
+ *
+ * @param[in] opcode   the command.
+ * @param[in] argument the command's argument (see ble_es_common::ControlOpcode).
+ *
+ * @return true if the command was queued. If not, it can be sent again with the same result: the
+ *         sequence number only moves on once a command is queued.
+ */
+bool send_control(ble_es_common::ControlOpcode opcode, std::uint8_t argument);
+
+/**
+ * Returns sensor notification latency statistics, with and without telemetry from the receiver
+ * (see BLEESServer::latency_stats()). Must be called from the SoftDevice task.
+ */
+BLEESServer::LatencyStats notification_latency();
+
+/**
+ * Returns the RSSI of the connection to the receiver.
+ *
+ * @return the latest RSSI in dBm, or 0 if not connected.
+ */
+std::int8_t rssi();
+
+/**
+ * Switches the connection to the receiver to a connection parameter profile, if connected.
+ *
+ * @param[in] profile the profile.
+ */
+void set_conn_profile(ble_central::ConnProfile profile);
+
+/**
+ * Returns link recovery statistics since boot.
+ */
+RecoveryStats recovery_stats();
+
+/** Stops scanning and disconnects from the receiver, so the radio stays off. */
+void sleep();
+
+/** Starts scanning for the receiver again after sleep(). */
+void wake();
 
 }  // namespace ble_remote
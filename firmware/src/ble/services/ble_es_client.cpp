@@ -9,8 +9,11 @@
 
 #include <ble_srv_common.h>
 
+#include "link_watchdog.hpp"
 #include "logger.hpp"
+#include "logger_tokenized.hpp"
 using logger::Level;
+using logger::operator""_fmt;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
@@ -20,8 +23,14 @@ void BLEESClient::init(nrf_ble_gq_t *gatt_queue) {
     /* Default init member variables */
     _es_hall_handle = BLE_GATT_HANDLE_INVALID;
     _es_hall_cccd_handle = BLE_GATT_HANDLE_INVALID;
+    _es_telemetry_handle = BLE_GATT_HANDLE_INVALID;
+    _es_control_handle = BLE_GATT_HANDLE_INVALID;
+    _es_control_cccd_handle = BLE_GATT_HANDLE_INVALID;
     _conn_handle = BLE_CONN_HANDLE_INVALID;
+    _is_encrypted = false;
+    _is_subscription_pending = false;
     _callback = {};
+    _control_callback = {};
     _gatt_queue = gatt_queue;
 
     ble_es_common::init();
@@ -44,10 +53,34 @@ void BLEESClient::event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
             _this->_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
             APP_ERROR_CHECK(
                 nrf_ble_gq_conn_handle_register(_this->_gatt_queue, _this->_conn_handle));
+
+            link_watchdog::set_conn_interval(conn_interval_ms(
+                p_ble_evt->evt.gap_evt.params.connected.conn_params.max_conn_interval));
+        } break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE: {
+            link_watchdog::set_conn_interval(conn_interval_ms(
+                p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval));
         } break;
 
         case BLE_GAP_EVT_DISCONNECTED: {
             _this->_conn_handle = BLE_CONN_HANDLE_INVALID;
+            _this->_is_encrypted = false;
+            _this->_is_subscription_pending = false;
+            _this->_es_hall_cccd_handle = BLE_GATT_HANDLE_INVALID;
+            _this->_es_telemetry_handle = BLE_GATT_HANDLE_INVALID;
+            _this->_es_control_cccd_handle = BLE_GATT_HANDLE_INVALID;
+
+            /* The drive_control failsafe takes over from any ramp */
+            link_watchdog::stop();
+        } break;
+
+        case BLE_GAP_EVT_CONN_SEC_UPDATE: {
+            const auto &sec_mode = p_ble_evt->evt.gap_evt.params.conn_sec_update.conn_sec.sec_mode;
+
+            /* Security mode 1 level 2 and up are encrypted */
+            _this->_is_encrypted = (sec_mode.lv >= 2);
+            _this->subscribe_when_ready();
         } break;
 
         case BLE_GATTC_EVT_HVX: {
@@ -58,22 +91,69 @@ void BLEESClient::event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
                 APP_ERROR_HANDLER(gattc_evt.gatt_status);
             }
 
-            logger::log<Level::INFO>("Recieved notification handle %04X", hvx_evt.handle);
+            LOGGER_TOKENIZED(Level::INFO, "Recieved notification handle %04X", hvx_evt.handle);
+
+            /* Only a whole sample shows the remote is still there, the watchdog is fed before
+               the sample is queued so no ramp step can follow it */
+            if (hvx_evt.handle == _this->_es_hall_handle &&
+                hvx_evt.len == sizeof(HallSensor::type)) {
+                link_watchdog::feed();
 
-            if (hvx_evt.handle == _this->_es_hall_handle) {
                 if (_this->_callback) {
                     _this->_callback(HallSensor::from_bytes(hvx_evt.data));
                 }
             }
 
+            if (hvx_evt.handle == _this->_es_control_handle) {
+                if (_this->_control_callback) {
+                    _this->_control_callback(hvx_evt.data, hvx_evt.len);
+                }
+            }
+
             auto ret = sd_ble_gattc_hv_confirm(gattc_evt.conn_handle, hvx_evt.handle);
             if (ret != NRF_SUCCESS) {
-                logger::log<Level::INFO>("%s::sd_ble_gattc_hv_confirm: 0x%08X", ret);
+                logger::log<Level::INFO>("%s::sd_ble_gattc_hv_confirm: 0x%08X"_fmt,
+                                         __func__, ret);
             }
         } break;
     }
 }
 
+bool BLEESClient::write_telemetry(const std::uint8_t *data, std::uint16_t len) {
+    if (_conn_handle == BLE_CONN_HANDLE_INVALID ||
+        _es_telemetry_handle == BLE_GATT_HANDLE_INVALID) {
+        return false;
+    }
+
+    /* The GATT queue copies the frame if it can't be handed to the SoftDevice right away */
+    nrf_ble_gq_req_t write_req = {
+        .type = NRF_BLE_GQ_REQ_GATTC_WRITE,
+        .p_mem_obj = nullptr,
+        .error_handler {
+            .cb = nullptr,
+            .p_ctx = nullptr
+        },
+        .params {
+            .gattc_write = {
+                .write_op = BLE_GATT_OP_WRITE_CMD,
+                .flags = 0,
+                .handle = _es_telemetry_handle,
+                .offset = 0,
+                .len = len,
+                .p_value = data,
+            }
+        }
+    };
+
+    auto ret = nrf_ble_gq_item_add(_gatt_queue, &write_req, _conn_handle);
+    if (ret != NRF_SUCCESS) {
+        logger::log<Level::INFO>("%s::nrf_ble_gq_item_add: 0x%08X"_fmt, __func__, ret);
+        return false;
+    }
+
+    return true;
+}
+
 void BLEESClient::on_db_discovery_evt(const ble_db_discovery_evt_t *p_evt) {
     switch (p_evt->evt_type) {
         case BLE_DB_DISCOVERY_COMPLETE: {
@@ -82,7 +162,7 @@ void BLEESClient::on_db_discovery_evt(const ble_db_discovery_evt_t *p_evt) {
             if (discovered_db.srv_uuid.uuid == ble_es_common::UUID_SERVICE &&
                 discovered_db.srv_uuid.type == ble_es_common::uuid_type())
             { // NOLINT
-                logger::log<Level::DBG>("DB discovery complete");
+                logger::log<Level::DBG>("DB discovery complete"_fmt);
                 const auto &characteristics = discovered_db.charateristics;
 
                 for (unsigned i = 0; i < discovered_db.char_count; ++i) {
@@ -92,9 +172,19 @@ void BLEESClient::on_db_discovery_evt(const ble_db_discovery_evt_t *p_evt) {
                         _es_hall_handle = characteristics[i].characteristic.handle_value;
                         _es_hall_cccd_handle = characteristics[i].cccd_handle;
                     }
+
+                    if (uuid == ble_es_common::UUID_TELEMETRY_CHAR) {
+                        _es_telemetry_handle = characteristics[i].characteristic.handle_value;
+                    }
+
+                    if (uuid == ble_es_common::UUID_CONTROL_CHAR) {
+                        _es_control_handle = characteristics[i].characteristic.handle_value;
+                        _es_control_cccd_handle = characteristics[i].cccd_handle;
+                    }
                 }
 
-                subscribe_to_notifications();
+                _is_subscription_pending = true;
+                subscribe_when_ready();
             }
         } break;
     }
@@ -104,8 +194,23 @@ void BLEESClient::on_db_discovery_evt(const ble_db_discovery_evt_t *p_evt) {
 // Private Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void BLEESClient::subscribe_to_notifications() {
-    ASSERT(_es_hall_cccd_handle != BLE_GATT_HANDLE_INVALID &&
+void BLEESClient::subscribe_when_ready() {
+    if (!_is_subscription_pending || (BLE_ES_ENCRYPTED_LINK && !_is_encrypted)) {
+        return;
+    }
+
+    _is_subscription_pending = false;
+
+    /* Commands first, so none are missed once the throttle starts streaming */
+    if (_es_control_cccd_handle != BLE_GATT_HANDLE_INVALID) {
+        subscribe_to_notifications(_es_control_cccd_handle);
+    }
+
+    subscribe_to_notifications(_es_hall_cccd_handle);
+}
+
+void BLEESClient::subscribe_to_notifications(std::uint16_t cccd_handle) {
+    ASSERT(cccd_handle != BLE_GATT_HANDLE_INVALID &&
            _gatt_queue != nullptr &&
            _conn_handle != BLE_CONN_HANDLE_INVALID);
 
@@ -125,7 +230,7 @@ void BLEESClient::subscribe_to_notifications() {
             .gattc_write = {
                 .write_op = BLE_GATT_OP_WRITE_REQ,
                 .flags = BLE_GATT_EXEC_WRITE_FLAG_PREPARED_WRITE,
-                .handle = _es_hall_cccd_handle,
+                .handle = cccd_handle,
                 .offset = 0,
                 .len = BLE_CCCD_VALUE_LEN,
                 .p_value = cccd,
@@ -135,8 +240,12 @@ void BLEESClient::subscribe_to_notifications() {
 
     auto ret = nrf_ble_gq_item_add(_gatt_queue, &cccd_req, _conn_handle);
     if (ret != NRF_SUCCESS) {
-        logger::log<Level::INFO>("%s::nrf_ble_gq_item_add: 0x%08X", __func__, ret);
+        logger::log<Level::INFO>("%s::nrf_ble_gq_item_add: 0x%08X"_fmt, __func__, ret);
     }
 
-    logger::log<Level::DBG>("Subscribed to CCCD notifications");
+    logger::log<Level::DBG>("Subscribed to CCCD notifications"_fmt);
+}
+
+std::uint32_t BLEESClient::conn_interval_ms(std::uint16_t interval) {
+    return (static_cast<std::uint32_t>(interval) * 5 + 3) / 4;
 }
@@ -9,11 +9,13 @@
 
 #include "ble_es_common.hpp"
 
+#include <app_config.h>
 #include <ble_db_discovery.h>
 #include <nrf_ble_gq.h>
 #include <nrf_sdh_ble.h>
 #include <sdk_errors.h>
 
+#include <cstddef>
 #include <cstdint>
 
 #include "hall_sensor.hpp"
@@ -21,16 +23,30 @@
 class BLEESClient {
     /**< Callback for when sensor data comes in. */
     using SensorCallback = void (*)(HallSensor::type);
+    /**< Callback for when a control command comes in (see ble_es_common::decode). */
+    using ControlCallback = void (*)(const std::uint8_t *data, std::size_t len);
 
  private:
     /**< Handle to ES server's Hall sensor char. */
     std::uint16_t _es_hall_handle {};
     /**< Handle to ES server's Hall sensor CCCD. */
     std::uint16_t _es_hall_cccd_handle {};
+    /**< Handle to ES server's telemetry char, invalid until discovered. */
+    std::uint16_t _es_telemetry_handle { BLE_GATT_HANDLE_INVALID };
+    /**< Handle to ES server's control char. */
+    std::uint16_t _es_control_handle {};
+    /**< Handle to ES server's control CCCD. */
+    std::uint16_t _es_control_cccd_handle {};
     /**< Connection handle to the remote. */
     std::uint16_t _conn_handle { BLE_CONN_HANDLE_INVALID };
+    /**< Whether or not the connection to the remote is encrypted. */
+    bool _is_encrypted {};
+    /**< Whether or not the service has been discovered but not yet subscribed to. */
+    bool _is_subscription_pending {};
     /**< Callback for when new sensor data comes in. */
     SensorCallback _callback {};
+    /**< Callback for when a control command comes in. */
+    ControlCallback _control_callback {};
     /**< Pointer to GATT queue instance. */
     nrf_ble_gq_t *_gatt_queue {};
 
@@ -65,6 +81,29 @@ class BLEESClient {
         _callback = callback;
     }
 
+    /**
+     * Register an application callback for control command notifications.
+     *
+     * @param[in] callback the function to be called when a control command is received.
+     */
+    void register_control_callback(ControlCallback callback) {
+        _control_callback = callback;
+    }
+
+    /**
+     * Queues a telemetry frame as a write without response.
+     *
+     * Write commands have no response to wait for, so the SoftDevice sends them in the next
+     * connection event with the link's regular traffic rather than scheduling one of its own.
+     *
+     * @param[in] data the frame (see ble_es_common::encode).
+     * @param[in] len  the length of the frame.
+     *
+     * @return true if the frame was queued, false if not connected or the characteristic
+     *         hasn't been discovered.
+     */
+    bool write_telemetry(const std::uint8_t *data, std::uint16_t len);
+
     /**
      * Callback for DB discovery events.
      *
@@ -85,7 +124,23 @@ class BLEESClient {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
  private:
     /**
-     * Subscribes to notifications from the ES server upon DB discovery completion.
+     * Subscribes to the control and Hall sensor notifications once the service has been discovered
+     * and, if BLE_ES_ENCRYPTED_LINK, the link is encrypted: the server rejects CCCD writes over an
+     * unencrypted link, and discovery usually finishes before a first pairing does.
+     */
+    void subscribe_when_ready();
+
+    /**
+     * Subscribes to notifications from the ES server.
+     *
+     * @param[in] cccd_handle the handle of the characteristic's CCCD.
+     */
+    void subscribe_to_notifications(std::uint16_t cccd_handle);
+
+    /**
+     * Converts a connection interval to milliseconds, rounding up.
+     *
+     * @param[in] interval the connection interval, in 1.25 ms units.
      */
-    void subscribe_to_notifications();
+    static std::uint32_t conn_interval_ms(std::uint16_t interval);
 };  // class BLEESClient
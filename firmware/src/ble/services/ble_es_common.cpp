@@ -8,6 +8,7 @@
 #include "ble_es_common.hpp"
 
 #include <app_error.h>
+#include <app_util.h>
 #include <ble.h>
 
 namespace ble_es_common {
@@ -31,4 +32,82 @@ std::uint8_t uuid_type() {
     return g_uuid_type;
 }
 
+std::size_t encode(const BatteryTelemetry &telemetry, std::uint8_t *buffer) {
+    buffer[0] = static_cast<std::uint8_t>(TelemetryType::BATTERY);
+    uint16_encode(telemetry.pack_mv, &buffer[1]);
+    buffer[3] = telemetry.level;
+
+    return BATTERY_TELEMETRY_LEN;
+}
+
+std::size_t encode(const StatusTelemetry &telemetry, std::uint8_t *buffer) {
+    buffer[0] = static_cast<std::uint8_t>(TelemetryType::STATUS);
+    uint16_encode(telemetry.speed, &buffer[1]);
+    uint16_encode(static_cast<std::uint16_t>(telemetry.current), &buffer[3]);
+    uint16_encode(static_cast<std::uint16_t>(telemetry.temperature), &buffer[5]);
+    buffer[7] = telemetry.faults;
+
+    return STATUS_TELEMETRY_LEN;
+}
+
+std::uint8_t telemetry_type(const std::uint8_t *data, std::size_t len) {
+    return (len > 0) ? data[0] : 0;
+}
+
+bool decode(const std::uint8_t *data, std::size_t len, BatteryTelemetry *telemetry) {
+    if (len != BATTERY_TELEMETRY_LEN ||
+        telemetry_type(data, len) != static_cast<std::uint8_t>(TelemetryType::BATTERY)) {
+        return false;
+    }
+
+    telemetry->pack_mv = uint16_decode(&data[1]);
+    telemetry->level = data[3];
+
+    return true;
+}
+
+bool decode(const std::uint8_t *data, std::size_t len, StatusTelemetry *telemetry) {
+    if (len != STATUS_TELEMETRY_LEN ||
+        telemetry_type(data, len) != static_cast<std::uint8_t>(TelemetryType::STATUS)) {
+        return false;
+    }
+
+    telemetry->speed = uint16_decode(&data[1]);
+    telemetry->current = static_cast<std::int16_t>(uint16_decode(&data[3]));
+    telemetry->temperature = static_cast<std::int16_t>(uint16_decode(&data[5]));
+    telemetry->faults = data[7];
+
+    return true;
+}
+
+std::size_t encode(const ControlCommand &command, std::uint8_t *buffer) {
+    buffer[0] = static_cast<std::uint8_t>(command.opcode);
+    buffer[1] = command.sequence;
+    buffer[2] = command.argument;
+
+    return CONTROL_COMMAND_LEN;
+}
+
+bool decode(const std::uint8_t *data, std::size_t len, ControlCommand *command) {
+    if (len != CONTROL_COMMAND_LEN) {
+        return false;
+    }
+
+    switch (static_cast<ControlOpcode>(data[0])) {
+        case ControlOpcode::SET_RIDE_MODE:
+        case ControlOpcode::SET_CRUISE:
+        case ControlOpcode::SET_BRAKE_CURVE:
+            break;
+
+        default:
+            return false;
+    }
+
+    command->opcode = static_cast<ControlOpcode>(data[0]);
+    command->sequence = data[1];
+    command->argument = data[2];
+
+    return true;
+}
+
 }  // namespace ble_es_common
@@ -9,6 +9,7 @@
 
 #include <ble_types.h>
 
+#include <cstddef>
 #include <cstdint>
 
 namespace ble_es_common {
@@ -31,9 +32,93 @@ inline constexpr std::uint16_t UUID_SERVICE = { 0x0001 };
 /**< UUID for Hall effect sensor data.
      E44D0002-8112-44A6-B41C-73BA7EFA957C */
 inline constexpr std::uint16_t UUID_SENSOR_CHAR = { 0x0002 };
+/**< UUID for bulk-reading the persistent log.
+     E44D0003-8112-44A6-B41C-73BA7EFA957C */
+inline constexpr std::uint16_t UUID_LOG_CHAR = { 0x0003 };
+/**< UUID for bulk-downloading recorded rides.
+     E44D0004-8112-44A6-B41C-73BA7EFA957C */
+inline constexpr std::uint16_t UUID_RIDE_CHAR = { 0x0004 };
+/**< UUID for telemetry frames written by the receiver.
+     E44D0005-8112-44A6-B41C-73BA7EFA957C */
+inline constexpr std::uint16_t UUID_TELEMETRY_CHAR = { 0x0005 };
+/**< UUID for control commands notified to the receiver.
+     E44D0006-8112-44A6-B41C-73BA7EFA957C */
+inline constexpr std::uint16_t UUID_CONTROL_CHAR = { 0x0006 };
 /**< Randomly generated appearance for the remote. */
 inline constexpr std::uint16_t APPEARANCE = { 0xFA66 };
 
+/**< Length of an encoded battery telemetry frame. */
+inline constexpr std::size_t BATTERY_TELEMETRY_LEN = { 4 };
+/**< Length of an encoded status telemetry frame. */
+inline constexpr std::size_t STATUS_TELEMETRY_LEN = { 8 };
+/**< Length of the longest telemetry frame. */
+inline constexpr std::size_t TELEMETRY_MAX_LEN = { STATUS_TELEMETRY_LEN };
+
+/**< Length of an encoded control command. */
+inline constexpr std::size_t CONTROL_COMMAND_LEN = { 3 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Telemetry frame types, the first byte of every write to the telemetry characteristic. */
+enum class TelemetryType : std::uint8_t {
+    BATTERY = 0x01,     /**< Board battery, see BatteryTelemetry. */
+    STATUS  = 0x02,     /**< Drive status, see StatusTelemetry. */
+};
+
+/**< Fault flags reported in StatusTelemetry::faults. */
+enum class Fault : std::uint8_t {
+    OVER_CURRENT        = 1 << 0,
+    OVER_TEMPERATURE    = 1 << 1,
+    UNDER_VOLTAGE       = 1 << 2,
+    OVER_VOLTAGE        = 1 << 3,
+    ESC                 = 1 << 4,   /**< Any other fault reported by the ESC. */
+};
+
+/**< Control command opcodes. Every command sets state outright rather than toggling it, so
+     applying one twice has the same effect as applying it once. */
+enum class ControlOpcode : std::uint8_t {
+    SET_RIDE_MODE   = 0x01,     /**< Argument: RideMode. */
+    SET_CRUISE      = 0x02,     /**< Argument: 1 to engage at the current throttle, 0 to release. */
+    SET_BRAKE_CURVE = 0x03,     /**< Argument: BrakeCurve. */
+};
+
+/**< Ride modes, limiting how hard the board accelerates. */
+enum class RideMode : std::uint8_t {
+    ECO,
+    NORMAL,
+    SPORT,
+};
+
+/**< Brake curves, mapping the brake throttle to braking current. */
+enum class BrakeCurve : std::uint8_t {
+    LINEAR,
+    SOFT,       /**< Gentle at first, full braking only at full throttle. */
+    HARD,       /**< Strong at first. */
+};
+
+/**< Control command, encoded as opcode, sequence and argument bytes. */
+struct ControlCommand {
+    ControlOpcode opcode;
+    std::uint8_t sequence;      /**< Incremented for each new command, repeated on a resend. */
+    std::uint8_t argument;
+};
+
+/**< Board battery telemetry, encoded little-endian after the type. */
+struct BatteryTelemetry {
+    std::uint16_t pack_mv;      /**< Pack voltage in mV. */
+    std::uint8_t level;         /**< State of charge in percent. */
+};
+
+/**< Drive status telemetry, encoded little-endian after the type. */
+struct StatusTelemetry {
+    std::uint16_t speed;        /**< Board speed in 0.1 km/h. */
+    std::int16_t current;       /**< Motor current in 0.1 A, negative while braking. */
+    std::int16_t temperature;   /**< ESC temperature in 0.1 degrees C. */
+    std::uint8_t faults;        /**< Active faults, a combination of Fault flags. */
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -44,4 +129,75 @@ void init();
 /**< Returns the UUID type provided by the BLE stack. */
 std::uint8_t uuid_type();
 
+/**
+ * Encodes a battery telemetry frame.
+ *
+ * @param[in]  telemetry the board battery telemetry.
+ * @param[out] buffer    the frame, at least BATTERY_TELEMETRY_LEN bytes.
+ *
+ * @return the length of the frame.
+ */
+std::size_t encode(const BatteryTelemetry &telemetry, std::uint8_t *buffer);
+
+/**
+ * Encodes a status telemetry frame.
+ *
+ * @param[in]  telemetry the drive status telemetry.
+ * @param[out] buffer    the frame, at least STATUS_TELEMETRY_LEN bytes.
+ *
+ * @return the length of the frame.
+ */
+std::size_t encode(const StatusTelemetry &telemetry, std::uint8_t *buffer);
+
+/**
+ * Returns the type of a telemetry frame, or 0 if it is empty.
+ *
+ * @param[in] data the frame.
+ * @param[in] len  the length of the frame.
+ */
+std::uint8_t telemetry_type(const std::uint8_t *data, std::size_t len);
+
+/**
+ * Decodes a battery telemetry frame.
+ *
+ * @param[in]  data      the frame.
+ * @param[in]  len       the length of the frame.
+ * @param[out] telemetry the board battery telemetry.
+ *
+ * @return true if the frame was a battery frame of the right length.
+ */
+bool decode(const std::uint8_t *data, std::size_t len, BatteryTelemetry *telemetry);
+
+/**
+ * Decodes a status telemetry frame.
+ *
+ * @param[in]  data      the frame.
+ * @param[in]  len       the length of the frame.
+ * @param[out] telemetry the drive status telemetry.
+ *
+ * @return true if the frame was a status frame of the right length.
+ */
+bool decode(const std::uint8_t *data, std::size_t len, StatusTelemetry *telemetry);
+
+/**
+ * Encodes a control command.
+ *
+ * @param[in]  command the command.
+ * @param[out] buffer  the encoded command, at least CONTROL_COMMAND_LEN bytes.
+ *
+ * @return the length of the encoded command.
+ */
+std::size_t encode(const ControlCommand &command, std::uint8_t *buffer);
+
+/**
+ * Decodes a control command. The argument is not checked against the opcode.
+ *
+ * @param[in]  data    the encoded command.
+ * @param[in]  len     the length of the encoded command.
+ * @param[out] command the command.
+ *
+ * @return true if the command has the right length and a known opcode.
+ */
+bool decode(const std::uint8_t *data, std::size_t len, ControlCommand *command);
+
 };  // namespace ble_es_common
@@ -12,11 +12,25 @@
 #include <ble_gatts.h>
 #include <ble_srv_common.h>
 #include <ble_types.h>
+#include <sdk_config.h>
 
+#include <algorithm>
+#include <cstring>
+
+#include "ble_common.hpp"
 #include "ble_events.hpp"
 #include "logger.hpp"
+#include "logger_tokenized.hpp"
+#include "timestamp.hpp"
 
 using logger::Level;
+using logger::operator""_fmt;
+
+/**< Access to every characteristic: the throttle and control commands move the board, and the
+     log, ride and telemetry characteristics expose or feed its data. */
+static constexpr security_req_t DRIVE_ACCESS = {
+    BLE_ES_ENCRYPTED_LINK ? SEC_JUST_WORKS : SEC_OPEN
+};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
@@ -63,10 +77,10 @@ void BLEESServer::init() {
     add_char_params.is_defered_read  = { false };
     add_char_params.is_defered_write = { false };
 
-    /* TODO(CMK) 06/22/20: security */
-    add_char_params.read_access       = { SEC_OPEN };
+    /* Encrypted links only (see BLE_ES_ENCRYPTED_LINK) */
+    add_char_params.read_access       = { DRIVE_ACCESS };
     add_char_params.write_access      = { SEC_NO_ACCESS };  // no writing
-    add_char_params.cccd_write_access = { SEC_OPEN };
+    add_char_params.cccd_write_access = { DRIVE_ACCESS };
 
     /* TODO(CMK) 06/22/20: once sensor module is developed - easier to use
                            local mem? */
@@ -80,21 +94,31 @@ void BLEESServer::init() {
 
     APP_ERROR_CHECK(
         characteristic_add(_service_handle, &add_char_params, &_sensor_char_handles));
+
+    add_log_char();
+    add_ride_char();
+    add_telemetry_char();
+    add_control_char();
 }
 
 // TODO(CMK) 07/27/20: verify sd_ble_gatts_hvx both updates the value and issues the notification
-void BLEESServer::update_sensor_value(HallSensor::type new_value) {
+bool BLEESServer::update_sensor_value(HallSensor::type new_value) {
+    /* Sampling carries on through a dropped link, the caller counts the samples lost */
     if (_conn_handle == BLE_CONN_HANDLE_INVALID) {
-        logger::log<Level::WARNING>("Attempted update sensor char while disconnected");
-        return;
+        return false;
     }
 
     if (!_notifications_enabled) {
-        logger::log<Level::WARNING>("Attempted update sensor char before updates are enabled");
-        return;
+        logger::log<Level::WARNING>("Attempted update sensor char before updates are enabled"_fmt);
+        return false;
     }
 
-    logger::log<Level::INFO>("%s: 0x%04X", __func__, new_value);
+    /* A bonded receiver's CCCD outlives the connection, so wait for the new link's encryption */
+    if (BLE_ES_ENCRYPTED_LINK && !_is_encrypted) {
+        return false;
+    }
+
+    LOGGER_TOKENIZED(Level::INFO, "update_sensor_value: 0x%04X", new_value);
 
     std::uint16_t len = { sizeof(new_value) };
     std::uint8_t bytes[sizeof(new_value)];
@@ -108,10 +132,60 @@ void BLEESServer::update_sensor_value(HallSensor::type new_value) {
         .p_data = bytes,
     };
 
+    const std::uint32_t start_us = timestamp::now();
+    auto ret = sd_ble_gatts_hvx(_conn_handle, &params);
+    const std::uint32_t queue_us = timestamp::now() - start_us;
+
+    if (ret != NRF_SUCCESS) {
+        logger::log<Level::INFO>("%s::sd_ble_gatts_hvx: 0x%08X"_fmt, __func__, ret);
+        return false;
+    }
+
+    ++_latency.queued;
+    _queue_total_us += queue_us;
+
+    on_notification_queued(true);
+    return true;
+}
+
+bool BLEESServer::send_control(const ble_es_common::ControlCommand &command) {
+    if (_conn_handle == BLE_CONN_HANDLE_INVALID || !_control_enabled) {
+        return false;
+    }
+
+    std::uint8_t data[ble_es_common::CONTROL_COMMAND_LEN];
+    std::uint16_t len = { static_cast<std::uint16_t>(ble_es_common::encode(command, data)) };
+
+    ble_gatts_hvx_params_t params = {
+        .handle = _control_char_handles.value_handle,
+        .type   = BLE_GATT_HVX_NOTIFICATION,
+        .offset = 0,
+        .p_len  = &len,
+        .p_data = data,
+    };
+
     auto ret = sd_ble_gatts_hvx(_conn_handle, &params);
     if (ret != NRF_SUCCESS) {
-        logger::log<Level::INFO>("%s::sd_ble_gatts_hvx: 0x%08X", __func__, ret);
+        logger::log<Level::INFO>("%s::sd_ble_gatts_hvx: 0x%08X"_fmt, __func__, ret);
+        return false;
     }
+
+    on_notification_queued(false);
+    return true;
+}
+
+BLEESServer::LatencyStats BLEESServer::latency_stats() const {
+    LatencyStats stats = _latency;
+
+    if (stats.queued > 0) {
+        stats.queue_average_us = static_cast<std::uint32_t>(_queue_total_us / stats.queued);
+    }
+
+    if (stats.samples > 0) {
+        stats.average_us = static_cast<std::uint32_t>(_latency_total_us / stats.samples);
+    }
+
+    return stats;
 }
 
 void BLEESServer::event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
@@ -127,17 +201,66 @@ void BLEESServer::event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
 
         case BLE_GAP_EVT_DISCONNECTED: {
             _this->_conn_handle = BLE_CONN_HANDLE_INVALID;
+            _this->_is_encrypted = false;
+            _this->_att_mtu = BLE_GATT_ATT_MTU_DEFAULT;
+            _this->_is_ride_streaming = false;
+            _this->_queued_count = 0;
+            _this->_in_flight = 0;
+            _this->_control_enabled = false;
+        } break;
+
+        case BLE_GAP_EVT_CONN_SEC_UPDATE: {
+            const auto &sec_mode = p_ble_evt->evt.gap_evt.params.conn_sec_update.conn_sec.sec_mode;
+
+            /* Security mode 1 level 2 and up are encrypted */
+            _this->_is_encrypted = (sec_mode.lv >= 2);
+        } break;
+
+        /** GATT Client Events **/
+
+        case BLE_GATTC_EVT_EXCHANGE_MTU_RSP: {
+            const auto &rsp = p_ble_evt->evt.gattc_evt.params.exchange_mtu_rsp;
+            _this->_att_mtu = std::min<std::uint16_t>(rsp.server_rx_mtu,
+                                                      NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
         } break;
 
         /** GATT Server Events **/
 
+        case BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST: {
+            const auto &req = p_ble_evt->evt.gatts_evt.params.exchange_mtu_request;
+            _this->_att_mtu = std::min<std::uint16_t>(req.client_rx_mtu,
+                                                      NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
+        } break;
+
         case BLE_GATTS_EVT_WRITE: {
             const auto &write_evt = p_ble_evt->evt.gatts_evt.params.write;
 
+            if (write_evt.handle == _this->_log_char_handles.value_handle &&
+                write_evt.len == sizeof(_this->_log_read_offset)) {
+                _this->_log_read_offset = uint32_decode(write_evt.data);
+                logger::log<Level::DBG>("Log read offset: %u"_fmt, _this->_log_read_offset);
+            }
+
+            if (write_evt.handle == _this->_ride_char_handles.value_handle &&
+                write_evt.len == sizeof(_this->_ride_read_offset)) {
+                _this->_ride_read_offset = uint32_decode(write_evt.data);
+                _this->_ride_start_offset = _this->_ride_read_offset;
+                _this->_ride_start_us = timestamp::now();
+                _this->_is_ride_streaming = true;
+                logger::log<Level::INFO>("Ride download from offset %u"_fmt,
+                                         _this->_ride_read_offset);
+                _this->send_ride_data();
+            }
+
+            if (write_evt.handle == _this->_telemetry_char_handles.value_handle &&
+                _this->_telemetry_callback) {
+                _this->_telemetry_callback(write_evt.data, write_evt.len);
+            }
+
             if (write_evt.handle == _this->_sensor_char_handles.cccd_handle &&
                 write_evt.len == 2) {
                 _this->_notifications_enabled = ble_srv_is_notification_enabled(write_evt.data);
-                logger::log<Level::DBG>("CCCD written - notifications enabled: %d",
+                logger::log<Level::DBG>("CCCD written - notifications enabled: %d"_fmt,
                                           _this->_notifications_enabled);
 
                 using ble_events::Events;
@@ -151,12 +274,263 @@ void BLEESServer::event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
                 };
                 trigger_event(&event);
             }
+
+            if (write_evt.handle == _this->_control_char_handles.cccd_handle &&
+                write_evt.len == 2) {
+                _this->_control_enabled = ble_srv_is_notification_enabled(write_evt.data);
+                logger::log<Level::DBG>("Control notifications enabled: %d"_fmt,
+                                        _this->_control_enabled);
+            }
+        } break;
+
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE: {
+            _this->on_notifications_complete(p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count);
+
+            /* Room in the SoftDevice's queue again, keep the download going */
+            if (_this->_is_ride_streaming) {
+                _this->send_ride_data();
+            }
+        } break;
+
+        case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST: {
+            const auto &auth_req = p_ble_evt->evt.gatts_evt.params.authorize_request;
+
+            if (auth_req.type == BLE_GATTS_AUTHORIZE_TYPE_READ &&
+                auth_req.request.read.handle == _this->_log_char_handles.value_handle) {
+                _this->on_log_read();
+            }
         } break;
 
         case BLE_GATTS_EVT_SYS_ATTR_MISSING: {
+            /* The peer manager restores a bonded peer's CCCDs, this only covers boot until the
+               bonds are loaded */
+            if (ble_common::is_peer_manager_ready()) {
+                break;
+            }
+
             APP_ERROR_CHECK(sd_ble_gatts_sys_attr_set(_this->_conn_handle, nullptr, 0,
                 BLE_GATTS_SYS_ATTR_FLAG_SYS_SRVCS | BLE_GATTS_SYS_ATTR_FLAG_USR_SRVCS));
-            logger::log<Level::DBG>("Updated sys attr");
+            logger::log<Level::DBG>("Updated sys attr"_fmt);
         } break;
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BLEESServer::add_log_char() {
+    ble_add_char_params_t add_char_params = {};
+
+    add_char_params.uuid      = { ble_es_common::UUID_LOG_CHAR };
+    add_char_params.uuid_type = { ble_es_common::uuid_type() };
+
+    /* Variable length, filled in on each read */
+    add_char_params.max_len    = { NRF_SDH_BLE_GATT_MAX_MTU_SIZE };
+    add_char_params.init_len   = { 0 };
+    add_char_params.is_var_len = { true };
+
+    /* Read the next block of the log, write to set the read offset */
+    add_char_params.char_props.read  = { true };
+    add_char_params.char_props.write = { true };
+
+    /* Reads are answered from flash on demand */
+    add_char_params.is_defered_read  = { true };
+    add_char_params.is_defered_write = { false };
+
+    /* Encrypted links only (see BLE_ES_ENCRYPTED_LINK) */
+    add_char_params.read_access  = { DRIVE_ACCESS };
+    add_char_params.write_access = { DRIVE_ACCESS };
+
+    APP_ERROR_CHECK(
+        characteristic_add(_service_handle, &add_char_params, &_log_char_handles));
+}
+
+void BLEESServer::on_log_read() {
+    std::uint8_t data[NRF_SDH_BLE_GATT_MAX_MTU_SIZE] = {};
+
+    /* Stay one byte short of a full ATT_MTU - 1 response so clients don't follow up with Read
+       Blob requests; each new read returns the next block instead. */
+    std::size_t len = _att_mtu - 2;
+
+    if (_log_read_callback) {
+        len = _log_read_callback(_log_read_offset, data, len);
+    } else {
+        len = 0;
+    }
+
+    _log_read_offset += len;
+
+    ble_gatts_rw_authorize_reply_params_t reply = {
+        .type = BLE_GATTS_AUTHORIZE_TYPE_READ,
+        .params = {
+            .read = {
+                .gatt_status = BLE_GATT_STATUS_SUCCESS,
+                .update      = 1,
+                .offset      = 0,
+                .len         = static_cast<std::uint16_t>(len),
+                .p_data      = data,
+            }
+        }
+    };
+
+    auto ret = sd_ble_gatts_rw_authorize_reply(_conn_handle, &reply);
+    if (ret != NRF_SUCCESS) {
+        logger::log<Level::INFO>("%s::sd_ble_gatts_rw_authorize_reply: 0x%08X"_fmt, __func__, ret);
+    }
+}
+
+void BLEESServer::add_ride_char() {
+    ble_add_char_params_t add_char_params = {};
+
+    add_char_params.uuid      = { ble_es_common::UUID_RIDE_CHAR };
+    add_char_params.uuid_type = { ble_es_common::uuid_type() };
+
+    /* Variable length, only used for notifications and offset writes */
+    add_char_params.max_len    = { NRF_SDH_BLE_GATT_MAX_MTU_SIZE };
+    add_char_params.init_len   = { 0 };
+    add_char_params.is_var_len = { true };
+
+    /* Write an offset to start a download, data is sent as notifications */
+    add_char_params.char_props.write  = { true };
+    add_char_params.char_props.notify = { true };
+
+    /* Encrypted links only (see BLE_ES_ENCRYPTED_LINK) */
+    add_char_params.read_access       = { SEC_NO_ACCESS };
+    add_char_params.write_access      = { DRIVE_ACCESS };
+    add_char_params.cccd_write_access = { DRIVE_ACCESS };
+
+    APP_ERROR_CHECK(
+        characteristic_add(_service_handle, &add_char_params, &_ride_char_handles));
+}
+
+void BLEESServer::add_telemetry_char() {
+    ble_add_char_params_t add_char_params = {};
+
+    add_char_params.uuid      = { ble_es_common::UUID_TELEMETRY_CHAR };
+    add_char_params.uuid_type = { ble_es_common::uuid_type() };
+
+    /* Variable length, one frame per write */
+    add_char_params.max_len    = { ble_es_common::TELEMETRY_MAX_LEN };
+    add_char_params.init_len   = { 0 };
+    add_char_params.is_var_len = { true };
+
+    /* Write without response only, so frames never need a connection event of their own */
+    add_char_params.char_props.write_wo_resp = { true };
+
+    /* Encrypted links only (see BLE_ES_ENCRYPTED_LINK) */
+    add_char_params.read_access  = { SEC_NO_ACCESS };
+    add_char_params.write_access = { DRIVE_ACCESS };
+
+    APP_ERROR_CHECK(
+        characteristic_add(_service_handle, &add_char_params, &_telemetry_char_handles));
+}
+
+void BLEESServer::add_control_char() {
+    ble_add_char_params_t add_char_params = {};
+
+    add_char_params.uuid      = { ble_es_common::UUID_CONTROL_CHAR };
+    add_char_params.uuid_type = { ble_es_common::uuid_type() };
+
+    /* Only used for notifications, nothing is stored */
+    add_char_params.max_len    = { ble_es_common::CONTROL_COMMAND_LEN };
+    add_char_params.init_len   = { 0 };
+    add_char_params.is_var_len = { true };
+
+    add_char_params.char_props.notify = { true };
+
+    add_char_params.read_access       = { SEC_NO_ACCESS };
+    add_char_params.write_access      = { SEC_NO_ACCESS };
+    add_char_params.cccd_write_access = { DRIVE_ACCESS };
+
+    APP_ERROR_CHECK(
+        characteristic_add(_service_handle, &add_char_params, &_control_char_handles));
+}
+
+void BLEESServer::on_notification_queued(bool is_sensor) {
+    ++_in_flight;
+
+    if (_queued_count < BLE_COMMON_HVN_TX_QUEUE_SIZE) {
+        _queued[_queued_count++] = { timestamp::now(), is_sensor };
+    }
+}
+
+void BLEESServer::on_notifications_complete(std::uint8_t count) {
+    /* The count includes other services' notifications (e.g. the battery level), which can only
+       make this undercount for a moment */
+    _in_flight -= std::min(count, _in_flight);
+
+    /* Ride downloads fill the queue too, so completions can't be matched to notifications */
+    if (_is_ride_streaming) {
+        _queued_count = 0;
+        return;
+    }
+
+    const std::uint32_t now = timestamp::now();
+    const std::uint8_t completed = std::min(count, _queued_count);
+
+    for (std::uint8_t i = 0; i < completed; ++i) {
+        if (!_queued[i].is_sensor) {
+            continue;
+        }
+
+        const std::uint32_t latency_us = now - _queued[i].queued_us;
+
+        ++_latency.samples;
+        _latency_total_us += latency_us;
+        _latency.worst_us = std::max(_latency.worst_us, latency_us);
+    }
+
+    _queued_count -= completed;
+    std::copy_n(&_queued[completed], _queued_count, _queued);
+}
+
+void BLEESServer::send_ride_data() {
+    std::uint8_t data[NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3];
+
+    /* Sensor notifications share the queue, keep a slot free for the next one */
+    while (_is_ride_streaming && _in_flight < BLE_COMMON_HVN_TX_QUEUE_SIZE - 1) {
+        std::size_t len = { 0 };
+
+        if (_ride_read_callback) {
+            len = _ride_read_callback(_ride_read_offset, data, _att_mtu - 3);
+        }
+
+        std::uint16_t hvx_len = { static_cast<std::uint16_t>(len) };
+
+        ble_gatts_hvx_params_t params = {
+            .handle = _ride_char_handles.value_handle,
+            .type   = BLE_GATT_HVX_NOTIFICATION,
+            .offset = 0,
+            .p_len  = &hvx_len,
+            .p_data = data,
+        };
+
+        auto ret = sd_ble_gatts_hvx(_conn_handle, &params);
+        if (ret == NRF_ERROR_RESOURCES) {
+            /* Queue is full; resumed on BLE_GATTS_EVT_HVN_TX_COMPLETE */
+            return;
+        }
+
+        if (ret != NRF_SUCCESS) {
+            logger::log<Level::INFO>("%s::sd_ble_gatts_hvx: 0x%08X"_fmt, __func__, ret);
+            _is_ride_streaming = false;
+            return;
+        }
+
+        ++_in_flight;
+        _ride_read_offset += len;
+
+        if (len == 0) {
+            const std::uint32_t elapsed_us = timestamp::now() - _ride_start_us;
+            const std::uint32_t bytes = _ride_read_offset - _ride_start_offset;
+            const std::uint32_t bytes_per_s = (elapsed_us == 0) ? 0 : static_cast<std::uint32_t>(
+                (static_cast<std::uint64_t>(bytes) * 1000000) / elapsed_us);
+
+            logger::log<Level::INFO>("Ride download complete at offset %u"_fmt, _ride_read_offset);
+            logger::log<Level::INFO>("%u bytes in %u us, %u B/s (encrypted: %u)"_fmt,
+                                     bytes, elapsed_us, bytes_per_s, _is_encrypted);
+            _is_ride_streaming = false;
+        }
+    }
+}
@@ -19,13 +19,73 @@
 #include "hall_sensor.hpp"
 
 class BLEESServer {
+    /**< Callback for reading recorded data (see logger::flash::read, ride_recorder::read). */
+    using ReadCallback = std::size_t (*)(std::uint32_t offset, std::uint8_t *buffer,
+                                            std::size_t len);
+    /**< Callback for telemetry frames written by the receiver (see ble_es_common::decode). */
+    using TelemetryCallback = void (*)(const std::uint8_t *data, std::size_t len);
+
+ public:
+    /**< Sensor notification latency, from queueing to the receiver's acknowledgement. */
+    struct LatencyStats {
+        std::uint32_t queued;                   /**< Notifications queued. */
+        std::uint32_t queue_average_us;         /**< Average CPU time to queue one. */
+        std::uint32_t samples;                  /**< Notifications acknowledged. */
+        std::uint32_t average_us;               /**< Average latency of those. */
+        std::uint32_t worst_us;                 /**< Worst latency of those. */
+    };
+
  private:
     /**< Service handle for this service (provided by BLE stack). */
     std::uint16_t _service_handle {};
     /**< Handles for the sensor characteristic. */
     ble_gatts_char_handles_t _sensor_char_handles {};
+    /**< Handles for the log characteristic. */
+    ble_gatts_char_handles_t _log_char_handles {};
+    /**< Callback for reading log data. */
+    ReadCallback _log_read_callback {};
+    /**< Offset of the next log read, set by writing the log characteristic. */
+    std::uint32_t _log_read_offset {};
+    /**< Handles for the ride characteristic. */
+    ble_gatts_char_handles_t _ride_char_handles {};
+    /**< Callback for reading recorded rides. */
+    ReadCallback _ride_read_callback {};
+    /**< Offset of the next ride notification, set by writing the ride characteristic. */
+    std::uint32_t _ride_read_offset {};
+    /**< Whether or not a ride download is in progress. */
+    bool _is_ride_streaming {};
+    /**< When the current ride download started, and from which offset. */
+    std::uint32_t _ride_start_us {};
+    std::uint32_t _ride_start_offset {};
+    /**< Handles for the telemetry characteristic. */
+    ble_gatts_char_handles_t _telemetry_char_handles {};
+    /**< Callback for telemetry frames. */
+    TelemetryCallback _telemetry_callback {};
+    /**< Notifications queued and not yet acknowledged, oldest first. */
+    struct {
+        std::uint32_t queued_us;    /**< When it was queued. */
+        bool is_sensor;             /**< Whether or not it was a sensor notification. */
+    } _queued[BLE_COMMON_HVN_TX_QUEUE_SIZE] {};
+    /**< Number of entries in _queued. */
+    std::uint8_t _queued_count {};
+    /**< Notifications of any characteristic of this service in the SoftDevice's queue. */
+    std::uint8_t _in_flight {};
+    /**< Total CPU time spent queueing sensor notifications. */
+    std::uint64_t _queue_total_us {};
+    /**< Total latency of acknowledged notifications. */
+    std::uint64_t _latency_total_us {};
+    /**< Latency statistics, other than the averages. */
+    LatencyStats _latency {};
+    /**< Handles for the control characteristic. */
+    ble_gatts_char_handles_t _control_char_handles {};
+    /**< Whether or not the receiver has enabled control notifications. */
+    bool _control_enabled {};
+    /**< ATT MTU of the current connection. */
+    std::uint16_t _att_mtu { BLE_GATT_ATT_MTU_DEFAULT };
     /**< Handle for the connection to the receiver. */
     std::uint16_t _conn_handle { BLE_CONN_HANDLE_INVALID };
+    /**< Whether or not the current connection is encrypted. */
+    bool _is_encrypted {};
     /**< Whether or not notifications have been enalbed (CCCD written). */
     bool _notifications_enabled {};
 
@@ -52,9 +112,78 @@ class BLEESServer {
     /**
      * Update the sensor value.
      *
+     * Nothing is sent until the receiver has enabled notifications and, if BLE_ES_ENCRYPTED_LINK,
+     * the link is encrypted. Encryption is the link layer's (AES-CCM in the radio), so each
+     * sample costs the same to queue either way.
+     *
      * @param[in] new_value the new sensor value to send to the client.
+     *
+     * @return true if the notification was queued, false if the sample was dropped.
+     */
+    bool update_sensor_value(HallSensor::type new_value);
+
+    /**
+     * Notifies a control command to the receiver.
+     *
+     * Notifications are the server's unacknowledged writes: they go out in the next connection
+     * event alongside the sensor notifications, with nothing to wait for.
+     *
+     * @param[in] command the command.
+     *
+     * @return true if the command was queued, false if the receiver hasn't enabled control
+     *         notifications or the SoftDevice's queue is full (resend with the same sequence).
+     */
+    bool send_control(const ble_es_common::ControlCommand &command);
+
+    /**
+     * Register a callback that supplies data for reads of the log characteristic.
+     *
+     * Each read of the characteristic returns the next block of log data, an empty read means
+     * everything has been read. Writing a 4-byte offset to the characteristic restarts reading
+     * from that offset.
+     *
+     * @param[in] callback the function called to read log data.
+     */
+    void register_log_read_callback(ReadCallback callback) {
+        _log_read_callback = callback;
+    }
+
+    /**
+     * Register a callback that supplies data for downloads from the ride characteristic.
+     *
+     * Writing a 4-byte offset to the characteristic starts a download from that offset: the data
+     * is sent as back-to-back notifications of ATT_MTU - 3 bytes, as fast as the SoftDevice can
+     * queue them, and an empty notification marks the end. Notifications must be enabled first.
+     *
+     * @param[in] callback the function called to read ride data.
+     */
+    void register_ride_read_callback(ReadCallback callback) {
+        _ride_read_callback = callback;
+    }
+
+    /**
+     * Register a callback for telemetry frames written by the receiver.
+     *
+     * The receiver writes frames without response, so they ride in connection events that
+     * happen anyway. The callback is called from the SoftDevice task.
+     *
+     * @param[in] callback the function called with each frame.
+     */
+    void register_telemetry_callback(TelemetryCallback callback) {
+        _telemetry_callback = callback;
+    }
+
+    /**
+     * Returns sensor notification latency statistics since boot. Must be called from the
+     * SoftDevice task.
+     *
+     * Latency is measured from queueing a notification to BLE_GATTS_EVT_HVN_TX_COMPLETE, i.e. a
+     * round trip: the receiver acknowledges it in its reply. The CPU time to queue a notification
+     * is measured separately, it is all the app spends per sample. What telemetry writes add to
+     * the latency isn't measured: the receiver has no source to send telemetry from yet (see
+     * board_telemetry), so there is nothing to compare against.
      */
-    void update_sensor_value(HallSensor::type new_value);
+    LatencyStats latency_stats() const;
 
     /**
      * BLE event handler for this service.
@@ -63,4 +192,55 @@ class BLEESServer {
      * @param[in] p_context context passed when this handler is registered (pointer to "this").
      */
     static void event_handler(ble_evt_t const *p_ble_evt, void *p_context);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+ private:
+    /**
+     * Adds the log characteristic to the service.
+     */
+    void add_log_char();
+
+    /**
+     * Replies to a read of the log characteristic with the next block of log data.
+     */
+    void on_log_read();
+
+    /**
+     * Adds the ride characteristic to the service.
+     */
+    void add_ride_char();
+
+    /**
+     * Queues ride data notifications until all but one slot of the SoftDevice's queue are taken or
+     * the download ends. The last slot is left for the next sensor notification, so a download
+     * never delays the throttle.
+     */
+    void send_ride_data();
+
+    /**
+     * Adds the telemetry characteristic to the service.
+     */
+    void add_telemetry_char();
+
+    /**
+     * Adds the control characteristic to the service.
+     */
+    void add_control_char();
+
+    /**
+     * Remembers a queued notification for on_notifications_complete().
+     *
+     * @param[in] is_sensor whether or not it was a sensor notification.
+     */
+    void on_notification_queued(bool is_sensor);
+
+    /**
+     * Accounts for acknowledged sensor notifications.
+     *
+     * @param[in] count the number of notifications the SoftDevice completed (of any
+     *                  characteristic).
+     */
+    void on_notifications_complete(std::uint8_t count);
 };  // class BLEESServer
@@ -0,0 +1,175 @@
+/*
+ * board_telemetry.cpp - sends the board's telemetry from the receiver back to the remote.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "board_telemetry.hpp"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "timestamp.hpp"
+
+namespace board_telemetry {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Bytes a write command adds to a data PDU: L2CAP header (4), ATT opcode (1) and handle (2). */
+static constexpr std::uint32_t WRITE_CMD_OVERHEAD = { 7 };
+
+/**< Airtime of a byte at 1M PHY. */
+static constexpr std::uint32_t US_PER_BYTE = { 8 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Reads, encodes and sends a frame if it is due.
+ *
+ * @param[in]     now       the time in ms.
+ * @param[in]     period_ms the period of the frame.
+ * @param[in,out] next_ms   the time the frame is due, moved on once it has been queued.
+ * @param[in]     source    reads the telemetry.
+ */
+template <typename Telemetry>
+static void send_if_due(std::uint32_t now, std::uint32_t period_ms, std::uint32_t *next_ms,
+                        bool (*source)(Telemetry *telemetry));
+
+/**
+ * Queues a frame and accounts for it.
+ *
+ * @param[in] data the frame.
+ * @param[in] len  the length of the frame.
+ *
+ * @return true if the frame was queued.
+ */
+static bool send(const std::uint8_t *data, std::size_t len);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Reads the board battery. */
+static BatterySource g_battery_source;
+
+/**< Reads the drive status. */
+static StatusSource g_status_source;
+
+/**< Queues frames to the remote. */
+static WriteCallback g_write;
+
+/**< Whether or not telemetry is being sent. */
+static bool g_is_started;
+
+/**< Time of the connection, for the connected time. */
+static std::uint32_t g_start_ms;
+
+/**< Time the next battery frame is due. */
+static std::uint32_t g_next_battery_ms;
+
+/**< Time the next status frame is due. */
+static std::uint32_t g_next_status_ms;
+
+/**< Telemetry statistics, other than the connected time of the current connection. */
+static Stats g_stats;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init(BatterySource battery_source, StatusSource status_source, WriteCallback write) {
+    g_battery_source = battery_source;
+    g_status_source = status_source;
+    g_write = write;
+}
+
+void start() {
+    g_is_started = true;
+    g_start_ms = timestamp::now_ms();
+    g_next_battery_ms = g_start_ms;
+    g_next_status_ms = g_start_ms;
+}
+
+void stop() {
+    if (!g_is_started) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    g_is_started = false;
+    g_stats.connected_ms += timestamp::now_ms() - g_start_ms;
+    taskEXIT_CRITICAL();
+}
+
+void on_notification() {
+    if (!g_is_started) {
+        return;
+    }
+
+    const std::uint32_t now = timestamp::now_ms();
+
+    send_if_due(now, BOARD_TELEMETRY_STATUS_PERIOD_MS, &g_next_status_ms, g_status_source);
+    send_if_due(now, BOARD_TELEMETRY_BATTERY_PERIOD_MS, &g_next_battery_ms, g_battery_source);
+}
+
+Stats stats() {
+    taskENTER_CRITICAL();
+
+    Stats stats = g_stats;
+
+    if (g_is_started) {
+        stats.connected_ms += timestamp::now_ms() - g_start_ms;
+    }
+
+    taskEXIT_CRITICAL();
+
+    if (stats.connected_ms > 0) {
+        stats.airtime_us_per_hour = static_cast<std::uint32_t>(
+            (static_cast<std::uint64_t>(stats.airtime_us) * 3600000) / stats.connected_ms);
+    }
+
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename Telemetry>
+static void send_if_due(std::uint32_t now, std::uint32_t period_ms, std::uint32_t *next_ms,
+                        bool (*source)(Telemetry *telemetry)) {
+    if (static_cast<std::int32_t>(now - *next_ms) < 0) {
+        return;
+    }
+
+    Telemetry telemetry = {};
+    std::uint8_t frame[ble_es_common::TELEMETRY_MAX_LEN];
+
+    /* Retried with the next notification if it can't be read or queued */
+    if (source != nullptr && source(&telemetry) &&
+        send(frame, ble_es_common::encode(telemetry, frame))) {
+        *next_ms = now + period_ms;
+    }
+}
+
+static bool send(const std::uint8_t *data, std::size_t len) {
+    if (g_write == nullptr || !g_write(data, static_cast<std::uint16_t>(len))) {
+        return false;
+    }
+
+    /* The frame replaces an empty PDU the link would have sent anyway, so only its own bytes
+       cost airtime; the preamble, access address, header and CRC were already on the air */
+    taskENTER_CRITICAL();
+    ++g_stats.frames;
+    g_stats.bytes += len;
+    g_stats.airtime_us += (WRITE_CMD_OVERHEAD + len) * US_PER_BYTE;
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+}  // namespace board_telemetry
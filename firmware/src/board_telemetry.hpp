@@ -0,0 +1,107 @@
+/*
+ * board_telemetry.hpp - sends the board's telemetry from the receiver back to the remote.
+ *
+ * Frames are written without response to the remote's telemetry characteristic (see
+ * ble_es_common::TelemetryType): the drive status every BOARD_TELEMETRY_STATUS_PERIOD_MS and the
+ * board battery every BOARD_TELEMETRY_BATTERY_PERIOD_MS. Rather than running a timer of its own,
+ * a frame is only queued when a throttle notification arrives and its period has passed: the
+ * remote is mid connection event then, and the write command goes out in that event or the next
+ * one, so telemetry never adds a radio wakeup on either side.
+ *
+ * The added airtime is estimated, not measured: each frame is counted as the bytes it adds to a
+ * data PDU that would otherwise have been empty, at 1M PHY (half that at 2M), and reported per
+ * hour connected.
+ * Periods are only as fine as the notifications: while the throttle is steady the remote
+ * notifies every SAMPLE_RATE_SLOW_PERIOD_MS, and telemetry slows down with it.
+ *
+ * Usage:
+ *     board_telemetry::init(read_battery, read_status, ble_receiver::write_telemetry);
+ *
+ *     board_telemetry::start();             // on connection
+ *     board_telemetry::on_notification();   // on each throttle notification
+ *     board_telemetry::stop();              // on disconnection
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "ble_es_common.hpp"
+#include "config/app_config.h"
+
+namespace board_telemetry {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Telemetry statistics since boot. */
+struct Stats {
+    std::uint32_t frames;                   /**< Frames queued. */
+    std::uint32_t bytes;                    /**< Frame bytes queued. */
+    std::uint32_t airtime_us;               /**< Estimated airtime added to connection events. */
+    std::uint32_t connected_ms;             /**< Time connected. */
+    std::uint32_t airtime_us_per_hour;      /**< Estimated airtime added per hour connected. */
+};
+
+/**
+ * Reads the board battery.
+ *
+ * @param[out] telemetry the board battery telemetry.
+ *
+ * @return true if a measurement is available.
+ */
+using BatterySource = bool (*)(ble_es_common::BatteryTelemetry *telemetry);
+
+/**
+ * Reads the drive status.
+ *
+ * @param[out] telemetry the drive status telemetry.
+ *
+ * @return true if a measurement is available.
+ */
+using StatusSource = bool (*)(ble_es_common::StatusTelemetry *telemetry);
+
+/**
+ * Queues a frame as a write without response.
+ *
+ * @param[in] data the frame.
+ * @param[in] len  the length of the frame.
+ *
+ * @return true if the frame was queued.
+ */
+using WriteCallback = bool (*)(const std::uint8_t *data, std::uint16_t len);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initializes the module.
+ *
+ * @param[in] battery_source reads the board battery.
+ * @param[in] status_source  reads the drive status.
+ * @param[in] write          queues frames to the remote.
+ */
+void init(BatterySource battery_source, StatusSource status_source, WriteCallback write);
+
+/** Starts sending telemetry, the first frames go out with the next notification. */
+void start();
+
+/** Stops sending telemetry. */
+void stop();
+
+/**
+ * Sends any telemetry that is due. Must be called from the SoftDevice task on each throttle
+ * notification from the remote.
+ */
+void on_notification();
+
+/**
+ * Returns telemetry statistics since boot.
+ */
+Stats stats();
+
+}  // namespace board_telemetry
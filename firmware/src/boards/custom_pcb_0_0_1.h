@@ -64,9 +64,11 @@ extern "C" {
 
 /* Battery divider analog in */
 #define VBAT_PIN                _nRF_GPIO_PIN_MAP(0, 31) /* A8 */
+#define VBAT_AIN                7                        /* P0.31 is AIN7 */
 
 /* Hall sensor analog in */
 #define HALL_SENSE_PIN          _nRF_GPIO_PIN_MAP(0, 5) /* K2 */
+#define HALL_SENSE_AIN          3                       /* P0.05 is AIN3 */
 
 #ifdef __cplusplus
 }
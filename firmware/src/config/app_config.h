@@ -19,6 +19,11 @@
 /**< Priority for BLE events to be dispatched to custom electric skateboard service. */
 #define BLE_ES_OBSERVER_PRIO 2
 
+/**< Whether or not every characteristic of the ES service (throttle, control, log, ride and
+     telemetry) requires an encrypted link. Only disable to benchmark the link without encryption,
+     anything in range can then drive the board and read its logs. */
+#define BLE_ES_ENCRYPTED_LINK true
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // BLE Common Definitions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -32,10 +37,10 @@
 /**< Perform bonding. */
 #define BLE_COMMON_SEC_PARAM_BOND true
 
-/**< Man In The Middle protection. */
+/**< Man In The Middle protection, impossible without I/O capabilities (Just Works). */
 #define BLE_COMMON_SEC_PARAM_MITM false
 
-/**< LE Secure Connections. */
+/**< LE Secure Connections, off: no ECC library (CC310, Oberon or micro-ecc) is in the tree. */
 #define BLE_COMMON_SEC_PARAM_LESC false
 
 /**< Keypress notifications. */
@@ -53,11 +58,13 @@
 /**< Maximum encryption key size. */
 #define BLE_COMMON_SEC_PARAM_MAX_KEY_SIZE 16
 
-/**< The FDS file ID for the paired device address file. */
-#define BLE_COMMON_FDS_ADDR_FILE_ID 0x0001
+/**< Time after boot during which a peer may pair although a peer is already bonded, or pair again
+     after losing its bond. Just Works can't authenticate a peer, so power cycling the device is
+     what authorizes a new bond. */
+#define BLE_COMMON_PAIRING_WINDOW_MS 30000
 
-/**< The FDS record key for the paired device address. */
-#define BLE_COMMON_FDS_ADDR_RECORD_KEY 0x0001
+/**< Number of notifications the SoftDevice can queue per connection (bulk ride downloads) */
+#define BLE_COMMON_HVN_TX_QUEUE_SIZE 4
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // BLE Peripheral Definitions
@@ -69,11 +76,20 @@
 /**< Manufacturer. Will be passed to Device Information Service. */
 #define BLE_PERIPHERAL_MANUFACTURER_NAME "N/A"
 
-/**< The advertising interval. */
-#define BLE_PERIPHERAL_ADV_INTERVAL ((uint32_t) MSEC_TO_UNITS(187.5, UNIT_0_625_MS))
+/**< Whether or not to advertise directed at the bonded remote first, at high duty (1.28 s). */
+#define BLE_PERIPHERAL_ADV_DIRECTED_ENABLED true
+
+/**< Fast advertising interval and duration, undirected. */
+#define BLE_PERIPHERAL_FAST_ADV_INTERVAL ((uint32_t) MSEC_TO_UNITS(187.5, UNIT_0_625_MS))
+#define BLE_PERIPHERAL_FAST_ADV_DURATION ((uint32_t) MSEC_TO_UNITS(30000, UNIT_10_MS))
 
-/**< The advertising duration. */
-#define BLE_PERIPHERAL_ADV_DURATION ((uint32_t) MSEC_TO_UNITS(180000, UNIT_10_MS))
+/**< Slow advertising interval and duration. Unlimited (0): the receiver has no local event to
+     wake advertising with, so idle would leave it unreachable until power cycled. */
+#define BLE_PERIPHERAL_SLOW_ADV_INTERVAL ((uint32_t) MSEC_TO_UNITS(1000, UNIT_0_625_MS))
+#define BLE_PERIPHERAL_SLOW_ADV_DURATION 0
+
+/**< Number of discovery latencies kept per advertising mode, for the median. */
+#define BLE_PERIPHERAL_ADV_LATENCY_SAMPLES 15
 
 /**< Minimum acceptable connection interval (0.4 seconds). */
 #define BLE_PERIPHERAL_MIN_CONN_INTERVAL ((uint32_t) MSEC_TO_UNITS(400, UNIT_1_25_MS))
@@ -100,11 +116,25 @@
 // BLE Central Definitions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-/**< Scan interval. */
-#define BLE_CENTRAL_SCAN_INTERVAL ((uint32_t) MSEC_TO_UNITS(100, UNIT_0_625_MS))
+/**< Scan interval and window after boot, wake or a disconnection: scanning continuously. */
+#define BLE_CENTRAL_FAST_SCAN_INTERVAL ((uint32_t) MSEC_TO_UNITS(100, UNIT_0_625_MS))
+#define BLE_CENTRAL_FAST_SCAN_WINDOW ((uint32_t) MSEC_TO_UNITS(100, UNIT_0_625_MS))
+
+/**< How long to scan continuously before backing off. */
+#define BLE_CENTRAL_FAST_SCAN_TIMEOUT ((uint32_t) MSEC_TO_UNITS(10000, UNIT_10_MS))
 
-/**< Scan window. */
-#define BLE_CENTRAL_SCAN_WINDOW ((uint32_t) MSEC_TO_UNITS(50, UNIT_0_625_MS))
+/**< Scan interval and window once backed off (~10%). The window is longer than the receiver's
+     slow advertising interval plus its random delay (up to 10 ms), so each one catches an
+     advertisement whichever mode the receiver is in. The interval is the longest allowed, so
+     backed off the receiver is found at worst 10.24 s after it starts advertising. */
+#define BLE_CENTRAL_SLOW_SCAN_INTERVAL ((uint32_t) MSEC_TO_UNITS(10240, UNIT_0_625_MS))
+#define BLE_CENTRAL_SLOW_SCAN_WINDOW ((uint32_t) MSEC_TO_UNITS(1100, UNIT_0_625_MS))
+
+/**< How long to scan backed off before the scan is restarted (0 for no limit). */
+#define BLE_CENTRAL_SLOW_SCAN_TIMEOUT 0
+
+/**< How long to try connecting once the receiver is found, scanning continuously. */
+#define BLE_CENTRAL_CONNECT_TIMEOUT ((uint32_t) MSEC_TO_UNITS(2000, UNIT_10_MS))
 
 /**< Minimum connection interval. */
 #define BLE_CENTRAL_MIN_CONN_INTERVAL ((uint32_t) MSEC_TO_UNITS(7.5, UNIT_1_25_MS))
@@ -118,12 +148,225 @@
 /**< Supervision timeout. */
 #define BLE_CENTRAL_SUPERVISION_TIMEOUT ((uint32_t) MSEC_TO_UNITS(4000, UNIT_10_MS))
 
+/**< Minimum connection interval while the throttle is steady (ConnProfile::IDLE). */
+#define BLE_CENTRAL_IDLE_MIN_CONN_INTERVAL ((uint32_t) MSEC_TO_UNITS(50, UNIT_1_25_MS))
+
+/**< Maximum connection interval while the throttle is steady (ConnProfile::IDLE). */
+#define BLE_CENTRAL_IDLE_MAX_CONN_INTERVAL ((uint32_t) MSEC_TO_UNITS(100, UNIT_1_25_MS))
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// FDS Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< First address of the FDS pages, which fds.c puts at the end of flash as there's no bootloader */
+#define ES_FDS_START_ADDR (0x100000 - (FDS_VIRTUAL_PAGES * FDS_VIRTUAL_PAGE_SIZE * 4))
+
+/**< Number of callbacks that can be registered with es_fds::on_ready() */
+#define ES_FDS_READY_CALLBACKS 4
+
+/**< Number of asynchronous writes that can be staged at once */
+#define ES_FDS_WRITE_SLOTS 4
+
+/**< Largest record (in bytes) that can be written asynchronously, a whole number of words */
+#define ES_FDS_MAX_RECORD_SIZE 64
+
+/**< How long (in ms) a write waits for further writes to the same record before being issued */
+#define ES_FDS_COALESCE_DELAY_MS 500
+
+/**< How often (in ms) the idle hook checks fds_stat to decide if garbage collection is needed */
+#define ES_FDS_GC_CHECK_INTERVAL_MS 10000
+
+/**< Run garbage collection once at least this many words can be reclaimed (a virtual page) */
+#define ES_FDS_GC_FREEABLE_WORDS 1024
+
+/**< Run garbage collection if the largest free space (in words) drops below this */
+#define ES_FDS_GC_MIN_FREE_WORDS 256
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Settings Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< The FDS file ID for the settings record (the paired address record's, which it replaced) */
+#define SETTINGS_FDS_FILE_ID 0x0001
+
+/**< The FDS record key for the settings record */
+#define SETTINGS_FDS_RECORD_KEY 0x0001
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Power Manager Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< How long (in ms) the throttle must be left alone before the remote goes to sleep */
+#define POWER_MANAGER_INACTIVITY_TIMEOUT_MS 60000
+
+/**< Change in throttle reading that counts as activity and keeps the remote awake */
+#define POWER_MANAGER_ACTIVITY_DELTA 32
+
+/**< Furthest the throttle reading can be from DRIVE_CONTROL_NEUTRAL_THROTTLE and still be at rest;
+     a throttle held anywhere else (e.g. a steady cruise) keeps the remote awake */
+#define POWER_MANAGER_REST_DELTA 64
+
+/**< Minimum rise in throttle reading above rest that wakes the remote (above LPCOMP's hysteresis) */
+#define POWER_MANAGER_WAKE_DELTA 128
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hall Sensor Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< If Hall sensor readings should be simulated (sensorsim) instead of read with the SAADC */
+#define HALL_SENSOR_SIMULATED false
+
+/**< The battery divider is only scanned with every Nth Hall reading, as its 40 us acquisition
+     dominates the scan; the battery voltage changes far slower than the throttle */
+#define HALL_SENSOR_BATTERY_DECIMATION 8
+
+/**< Number of battery readings averaged into each battery measurement (every 2.56 s at the fast
+     sample rate) */
+#define HALL_SENSOR_BATTERY_OVERSAMPLE 64
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Battery Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Ratio of the battery voltage to the voltage at VBAT_PIN (the board's divider) */
+#define BATTERY_DIVIDER_RATIO 2
+
+/**< Change in state of charge (in percent) before a new battery level is reported */
+#define BATTERY_LEVEL_HYSTERESIS 2
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Board Telemetry Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Period of board battery frames sent from the receiver to the remote. */
+#define BOARD_TELEMETRY_BATTERY_PERIOD_MS 10000
+
+/**< Period of drive status frames (speed, current, temperature and faults). */
+#define BOARD_TELEMETRY_STATUS_PERIOD_MS 100
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Drive Control Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Throttle samples and commands queued for the control task, one is reserved for commands. */
+#define DRIVE_CONTROL_QUEUE_LENGTH 8
+
+/**< Throttle output while the remote is disconnected: the Hall reading at rest, mid-scale, with
+     acceleration above and braking below it. */
+#define DRIVE_CONTROL_NEUTRAL_THROTTLE 0x0800
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Link Watchdog Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Expected intervals between throttle samples that can pass without one before the watchdog
+     trips and ramps the throttle down */
+#define LINK_WATCHDOG_MISSED_INTERVALS 4
+
+/**< Shortest silence (in ms) that trips the watchdog, however fast samples were arriving */
+#define LINK_WATCHDOG_MIN_TIMEOUT_MS 100
+
+/**< Time (in ms) a ramp takes from the throttle when the watchdog tripped down to neutral */
+#define LINK_WATCHDOG_RAMP_MS 1000
+
+/**< Period (in ms) of the throttle steps output during a ramp */
+#define LINK_WATCHDOG_RAMP_STEP_MS 20
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sample Rate Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Hall sensor sample period while the throttle is moving (200 Hz) */
+#define SAMPLE_RATE_FAST_PERIOD_MS 5
+
+/**< Hall sensor sample period once the throttle has settled (4 Hz) */
+#define SAMPLE_RATE_SLOW_PERIOD_MS 250
+
+/**< How long (in ms) the throttle must be steady before sampling slows down */
+#define SAMPLE_RATE_HOLD_MS 500
+
+/**< Weight of each sample in the motion filter, as a power of 2 (2 = 1/4) */
+#define SAMPLE_RATE_FILTER_SHIFT 2
+
+/**< Change in the filtered throttle between samples that counts as motion */
+#define SAMPLE_RATE_MOTION_DELTA 4
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Timestamp Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< If microsecond timestamps are enabled (the TIMER keeps the HFCLK running while asleep) */
+#define TIMESTAMP_ENABLED true
+
+/**< TIMER counting microseconds between RTC ticks (TIMER0 is used by the SoftDevice) */
+#define TIMESTAMP_TIMER NRF_TIMER1
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Logger Definitions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**< If the logger should use the flash backend in addition to UART */
-#define LOGGER_USE_FLASH_BACKEND false
+#define LOGGER_USE_FLASH_BACKEND true
+
+/**< Number of flash pages in the persistent log ring */
+#define LOGGER_FLASH_PAGES 8
+
+/**< The log ring sits directly below the FDS pages at the end of flash */
+#define LOGGER_FLASH_START_ADDR \
+    (0x100000 - ((FDS_VIRTUAL_PAGES + LOGGER_FLASH_PAGES) * 0x1000))
+
+/**< Size (in bytes) of each write to the log ring, must evenly divide a flash page */
+#define LOGGER_FLASH_CHUNK_SIZE 256
+
+/**< Size (in bytes) of the buffer log entries are formatted into before being staged */
+#define LOGGER_FLASH_STRING_BUFFER_SIZE 64
+
+/**< If LOGGER_TOKENIZED logs should be tokenized and sent over RTT instead of formatted on-device */
+#define LOGGER_USE_TOKENIZED_BACKEND true
+
+/**< Lowest level (logger::Level as an integer, 0 = DBG) that is queued by the tokenized backend */
+#define LOGGER_TOKENIZED_MIN_LEVEL 0
+
+/**< Size (in 32-bit words) of the tokenized backend's ring buffer */
+#define LOGGER_TOKENIZED_BUFFER_WORDS 256
+
+/**< RTT up-channel the tokenized backend writes frames to */
+#define LOGGER_TOKENIZED_RTT_CHANNEL 1
+
+/**< Size (in bytes) of the tokenized backend's RTT up-buffer */
+#define LOGGER_TOKENIZED_RTT_BUFFER_SIZE 512
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sample Stream Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< If samples should be streamed over RTT for bench tuning (costs the RTT buffer's RAM) */
+#define SAMPLE_STREAM_ENABLED false
+
+/**< RTT up-channel the sample stream writes records to */
+#define SAMPLE_STREAM_RTT_CHANNEL 2
+
+/**< Size (in bytes) of the sample stream's RTT up-buffer (256 records) */
+#define SAMPLE_STREAM_RTT_BUFFER_SIZE 2048
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ride Recorder Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< If throttle traces, RSSI and connection events should be recorded to flash during rides */
+#define RIDE_RECORDER_ENABLED true
+
+/**< Number of flash pages in the ride ring */
+#define RIDE_RECORDER_PAGES 32
+
+/**< The ride ring sits directly below the log ring */
+#define RIDE_RECORDER_START_ADDR (LOGGER_FLASH_START_ADDR - (RIDE_RECORDER_PAGES * 0x1000))
+
+/**< Size (in bytes) of each write to the ride ring, must evenly divide a flash page */
+#define RIDE_RECORDER_CHUNK_SIZE 256
+
+/**< Interval (in ms) between recorded samples, independent of the adaptive sample rate */
+#define RIDE_RECORDER_PERIOD_MS 20
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // SDK Config Definitions
@@ -135,4 +378,50 @@
 #endif
 #define NRF_LOG_BACKEND_UART_TX_PIN TX_PIN_NUMBER
 
+/**< RTT up-buffers: 0 for the terminal, plus the tokenized log and sample stream channels */
+#ifdef SEGGER_RTT_CONFIG_MAX_NUM_UP_BUFFERS
+#   undef SEGGER_RTT_CONFIG_MAX_NUM_UP_BUFFERS
+#endif
+#define SEGGER_RTT_CONFIG_MAX_NUM_UP_BUFFERS 3
+
+/**< Timestamp nRF logs with timestamp::now() (1 MHz), needs TIMESTAMP_ENABLED */
+#ifdef NRF_LOG_USES_TIMESTAMP
+#   undef NRF_LOG_USES_TIMESTAMP
+#endif
+#define NRF_LOG_USES_TIMESTAMP 1
+
+#ifdef NRF_LOG_TIMESTAMP_DEFAULT_FREQUENCY
+#   undef NRF_LOG_TIMESTAMP_DEFAULT_FREQUENCY
+#endif
+#define NRF_LOG_TIMESTAMP_DEFAULT_FREQUENCY 1000000
+
+/**< Battery Service, so the receiver or a phone can read the remote's battery level */
+#ifdef BLE_BAS_ENABLED
+#   undef BLE_BAS_ENABLED
+#endif
+#define BLE_BAS_ENABLED 1
+
+/**< ble_central matches UUID and appearance itself, in one pass (see ble_adv_data.hpp) */
+#ifdef NRF_BLE_SCAN_UUID_CNT
+#   undef NRF_BLE_SCAN_UUID_CNT
+#endif
+#define NRF_BLE_SCAN_UUID_CNT 0
+
+#ifdef NRF_BLE_SCAN_APPEARANCE_CNT
+#   undef NRF_BLE_SCAN_APPEARANCE_CNT
+#endif
+#define NRF_BLE_SCAN_APPEARANCE_CNT 0
+
+/**< Largest ATT MTU, so ride downloads fill each notification (needs more SoftDevice RAM) */
+#ifdef NRF_SDH_BLE_GATT_MAX_MTU_SIZE
+#   undef NRF_SDH_BLE_GATT_MAX_MTU_SIZE
+#endif
+#define NRF_SDH_BLE_GATT_MAX_MTU_SIZE 247
+
+/**< Data length extension, so a full ATT MTU fits in one link-layer packet */
+#ifdef NRF_SDH_BLE_GAP_DATA_LENGTH
+#   undef NRF_SDH_BLE_GAP_DATA_LENGTH
+#endif
+#define NRF_SDH_BLE_GAP_DATA_LENGTH 251
+
 #endif // APP_CONFIG_H
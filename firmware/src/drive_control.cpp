@@ -0,0 +1,367 @@
+/*
+ * drive_control.cpp - applies the remote's control commands to the throttle stream.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "drive_control.hpp"
+
+#include <app_error.h>
+#include <sdk_errors.h>
+
+#include <FreeRTOS.h>
+#include <queue.h>
+#include <task.h>
+
+#include <algorithm>
+
+#include "link_watchdog.hpp"
+#include "logger.hpp"
+#include "timestamp.hpp"
+
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace drive_control {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Kinds of queued items. */
+enum class ItemType : std::uint8_t {
+    THROTTLE,
+    COMMAND,
+    RESET,
+    RAMP,
+};
+
+/** An item queued for the control task. */
+struct Item {
+    ItemType type;
+    std::uint32_t received_us;              /**< When it was queued (timestamp::now()). */
+    union {
+        HallSensor::type throttle;
+        ble_es_common::ControlCommand command;
+        std::uint32_t elapsed_ms;           /**< Time since the link_watchdog tripped. */
+    };
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Control task, applies queued items in order.
+ *
+ * @param[in] arg unused.
+ */
+static void control_thread(void *arg);
+
+/**
+ * Queues an item for the control task, counting it as dropped if the queue is full. Throttle
+ * samples leave the last slot free, so a command is never lost to a backlog of samples.
+ *
+ * @param[in] item the item.
+ */
+static void send(const Item &item);
+
+/**
+ * Queues an item for the control task from an interrupt, leaving the last slot free like send().
+ *
+ * @param[in] item the item.
+ */
+static void send_from_isr(const Item &item);
+
+/**
+ * Applies a command to the state.
+ *
+ * @param[in] command the command.
+ *
+ * @return true if the command was applied, false if its argument is invalid.
+ */
+static bool apply(const ble_es_common::ControlCommand &command);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Called with each throttle sample. */
+static OutputCallback g_output;
+
+/**< Items for the control task. */
+static QueueHandle_t g_queue;
+
+/**< FreeRTOS handle for the control task. */
+static TaskHandle_t g_control_thandle;
+
+/**< State set by commands, only accessed by the control task. */
+static State g_state { .mode = ble_es_common::RideMode::NORMAL };
+
+/**< Latest throttle sample, held when cruise control is engaged. */
+static HallSensor::type g_throttle;
+
+/**< Sequence number of the last command, valid if g_has_sequence. */
+static std::uint8_t g_sequence;
+static bool g_has_sequence;
+
+/**< Arrival of the oldest command not yet output with a sample, valid if g_is_effect_pending. */
+static std::uint32_t g_pending_us;
+static bool g_is_effect_pending;
+
+/**< Throttle output when the link_watchdog tripped, valid if g_is_ramping. */
+static HallSensor::type g_ramp_from;
+static bool g_is_ramping;
+
+/**< When the failsafe was engaged (timestamp::now_ms()), valid if g_is_failsafe. */
+static std::uint32_t g_failsafe_ms;
+static bool g_is_failsafe;
+
+/**< Command statistics. */
+static Stats g_stats;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init(OutputCallback output) {
+    g_output = output;
+    g_queue = xQueueCreate(DRIVE_CONTROL_QUEUE_LENGTH, sizeof(Item));
+
+    if (g_queue == nullptr ||
+        pdPASS != xTaskCreate(control_thread, "Control", 256, nullptr, 2, &g_control_thandle)) {
+        APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
+    }
+}
+
+void on_throttle(HallSensor::type throttle) {
+    Item item { .type = ItemType::THROTTLE, .received_us = timestamp::now() };
+    item.throttle = throttle;
+    send(item);
+}
+
+void on_command(const std::uint8_t *data, std::size_t len) {
+    Item item { .type = ItemType::COMMAND, .received_us = timestamp::now() };
+
+    if (!ble_es_common::decode(data, len, &item.command)) {
+        taskENTER_CRITICAL();
+        ++g_stats.rejected;
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    send(item);
+}
+
+void on_ramp_step(std::uint32_t elapsed_ms) {
+    Item item { .type = ItemType::RAMP, .received_us = timestamp::now() };
+    item.elapsed_ms = elapsed_ms;
+    send_from_isr(item);
+}
+
+void on_disconnected() {
+    send({ .type = ItemType::RESET, .received_us = timestamp::now() });
+}
+
+Stats stats() {
+    taskENTER_CRITICAL();
+    Stats stats = g_stats;
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void control_thread(void *arg) {
+    Item item;
+
+    while (true) {
+        xQueueReceive(g_queue, &item, portMAX_DELAY);
+
+        switch (item.type) {
+            case ItemType::THROTTLE: {
+                g_throttle = item.throttle;
+                g_is_ramping = false;
+
+                /* The remote is back, the link recovered with its first sample */
+                if (g_is_failsafe) {
+                    const std::uint32_t recovery_ms = timestamp::now_ms() - g_failsafe_ms;
+                    g_is_failsafe = false;
+
+                    taskENTER_CRITICAL();
+                    g_stats.last_recovery_ms = recovery_ms;
+                    g_stats.worst_recovery_ms = std::max(g_stats.worst_recovery_ms, recovery_ms);
+                    taskEXIT_CRITICAL();
+
+                    logger::log<Level::INFO>("Throttle restored %u ms after disconnection"_fmt,
+                                             recovery_ms);
+                }
+
+                if (g_output != nullptr) {
+                    g_output(g_throttle, g_state);
+                }
+
+                /* The first sample output with a command applied is where it takes effect */
+                if (g_is_effect_pending) {
+                    const std::uint32_t latency_us = timestamp::now() - g_pending_us;
+                    g_is_effect_pending = false;
+
+                    taskENTER_CRITICAL();
+                    g_stats.last_latency_us = latency_us;
+                    g_stats.worst_latency_us = std::max(g_stats.worst_latency_us, latency_us);
+                    taskEXIT_CRITICAL();
+                }
+            } break;
+
+            case ItemType::COMMAND: {
+                const auto &command = item.command;
+
+                if (g_has_sequence && command.sequence == g_sequence) {
+                    taskENTER_CRITICAL();
+                    ++g_stats.duplicates;
+                    taskEXIT_CRITICAL();
+                    break;
+                }
+
+                const bool is_valid = apply(command);
+
+                taskENTER_CRITICAL();
+                if (is_valid) {
+                    ++g_stats.commands;
+                } else {
+                    ++g_stats.rejected;
+                }
+                taskEXIT_CRITICAL();
+
+                if (!is_valid) {
+                    logger::log<Level::WARNING>("Invalid control command 0x%02X (%u)"_fmt,
+                                                static_cast<unsigned>(command.opcode),
+                                                command.argument);
+                    break;
+                }
+
+                g_sequence = command.sequence;
+                g_has_sequence = true;
+
+                if (!g_is_effect_pending) {
+                    g_pending_us = item.received_us;
+                    g_is_effect_pending = true;
+                }
+            } break;
+
+            case ItemType::RESET: {
+                g_is_ramping = false;
+                g_state.is_cruising = false;
+                g_has_sequence = false;
+                g_is_effect_pending = false;
+
+                /* Nothing more arrives until the remote reconnects, so this is held until then */
+                g_throttle = DRIVE_CONTROL_NEUTRAL_THROTTLE;
+
+                if (g_output != nullptr) {
+                    g_output(g_throttle, g_state);
+                }
+
+                if (!g_is_failsafe) {
+                    g_failsafe_ms = timestamp::now_ms();
+                    g_is_failsafe = true;
+
+                    taskENTER_CRITICAL();
+                    ++g_stats.failsafes;
+                    taskEXIT_CRITICAL();
+                }
+            } break;
+
+            case ItemType::RAMP: {
+                /* A step queued just before the disconnection, the failsafe already holds */
+                if (g_is_failsafe) {
+                    break;
+                }
+
+                /* The first step ramps from whatever was being output when the samples stopped */
+                if (!g_is_ramping) {
+                    g_ramp_from = g_state.is_cruising ? g_state.cruise_throttle : g_throttle;
+                    g_is_ramping = true;
+                    g_state.is_cruising = false;
+                }
+
+                g_throttle = link_watchdog::ramp_throttle(g_ramp_from, item.elapsed_ms);
+
+                if (g_output != nullptr) {
+                    g_output(g_throttle, g_state);
+                }
+            } break;
+        }
+    }
+}
+
+static void send(const Item &item) {
+    const bool is_full = (item.type == ItemType::THROTTLE) ?
+                         uxQueueSpacesAvailable(g_queue) <= 1 :
+                         uxQueueSpacesAvailable(g_queue) == 0;
+
+    if (is_full || xQueueSend(g_queue, &item, 0) != pdPASS) {
+        taskENTER_CRITICAL();
+        ++g_stats.dropped;
+        taskEXIT_CRITICAL();
+    }
+}
+
+static void send_from_isr(const Item &item) {
+    const UBaseType_t spaces =
+        DRIVE_CONTROL_QUEUE_LENGTH - uxQueueMessagesWaitingFromISR(g_queue);
+    BaseType_t higher_priority_task_woken = pdFALSE;
+
+    if (spaces <= 1 ||
+        xQueueSendFromISR(g_queue, &item, &higher_priority_task_woken) != pdPASS) {
+        const UBaseType_t saved_interrupt_status = taskENTER_CRITICAL_FROM_ISR();
+        ++g_stats.dropped;
+        taskEXIT_CRITICAL_FROM_ISR(saved_interrupt_status);
+    }
+
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+static bool apply(const ble_es_common::ControlCommand &command) {
+    using ble_es_common::BrakeCurve;
+    using ble_es_common::ControlOpcode;
+    using ble_es_common::RideMode;
+
+    switch (command.opcode) {
+        case ControlOpcode::SET_RIDE_MODE: {
+            if (command.argument > static_cast<std::uint8_t>(RideMode::SPORT)) {
+                return false;
+            }
+
+            g_state.mode = static_cast<RideMode>(command.argument);
+        } break;
+
+        case ControlOpcode::SET_CRUISE: {
+            if (command.argument > 1) {
+                return false;
+            }
+
+            /* Engaging again while cruising keeps the held throttle, so a resend is harmless */
+            if (command.argument == 1 && !g_state.is_cruising) {
+                g_state.cruise_throttle = g_throttle;
+            }
+
+            g_state.is_cruising = (command.argument == 1);
+        } break;
+
+        case ControlOpcode::SET_BRAKE_CURVE: {
+            if (command.argument > static_cast<std::uint8_t>(BrakeCurve::HARD)) {
+                return false;
+            }
+
+            g_state.brake_curve = static_cast<BrakeCurve>(command.argument);
+        } break;
+    }
+
+    return true;
+}
+
+}  // namespace drive_control
@@ -0,0 +1,123 @@
+/*
+ * drive_control.hpp - applies the remote's control commands to the throttle stream.
+ *
+ * Throttle samples and control commands are queued in the order they arrive, and a single control
+ * task applies them in that order. Each sample is output together with the state every command
+ * before it produced, so a command takes effect between two samples and never halfway through one.
+ *
+ * Commands set state outright (see ble_es_common::ControlOpcode), and a command repeating the
+ * previous one's sequence number is a resend and is dropped. The latency of a command is measured
+ * from its arrival over BLE to the first sample output with it applied; it is bounded by the queue
+ * (DRIVE_CONTROL_QUEUE_LENGTH items) plus the gap to the next throttle notification.
+ *
+ * When the remote disconnects, the failsafe outputs DRIVE_CONTROL_NEUTRAL_THROTTLE with cruise
+ * control released, and holds it until the first sample after the remote reconnects. The time
+ * until then is the recovery time of the link.
+ *
+ * Before that, when samples stop arriving the link_watchdog queues ramp steps, which release
+ * cruise control and output link_watchdog::ramp_throttle() from the throttle that was being
+ * output, until the next sample ends the ramp. Cruise control stays released until the remote
+ * engages it again.
+ *
+ * Usage:
+ *     drive_control::init(on_output);
+ *
+ *     drive_control::on_throttle(sample);      // on each throttle notification
+ *     drive_control::on_command(data, len);    // on each control notification
+ *     drive_control::on_ramp_step(elapsed_ms); // from the link_watchdog's RTC interrupt
+ *     drive_control::on_disconnected();        // holds neutral until the next sample
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ble_es_common.hpp"
+#include "config/app_config.h"
+#include "hall_sensor.hpp"
+
+namespace drive_control {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** State set by control commands. */
+struct State {
+    ble_es_common::RideMode mode;           /**< Ride mode. */
+    ble_es_common::BrakeCurve brake_curve;  /**< Brake curve. */
+    bool is_cruising;                       /**< Whether or not cruise control is engaged. */
+    HallSensor::type cruise_throttle;       /**< Throttle held by cruise control. */
+};
+
+/** Command statistics since boot. */
+struct Stats {
+    std::uint32_t commands;                 /**< Commands applied. */
+    std::uint32_t duplicates;               /**< Resent commands dropped. */
+    std::uint32_t rejected;                 /**< Malformed commands or invalid arguments. */
+    std::uint32_t dropped;                  /**< Samples or commands lost to a full queue. */
+    std::uint32_t last_latency_us;          /**< Latest command-to-effect latency. */
+    std::uint32_t worst_latency_us;         /**< Worst command-to-effect latency. */
+    std::uint32_t failsafes;                /**< Disconnections that engaged the failsafe. */
+    std::uint32_t last_recovery_ms;         /**< Latest time from disconnection to throttle. */
+    std::uint32_t worst_recovery_ms;        /**< Worst time from disconnection to throttle. */
+};
+
+/**
+ * Called from the control task with each throttle sample and the state to apply it with.
+ *
+ * @param[in] throttle the throttle sample.
+ * @param[in] state    the state.
+ */
+using OutputCallback = void (*)(HallSensor::type throttle, const State &state);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Creates the control task.
+ *
+ * @param[in] output called with each throttle sample.
+ */
+void init(OutputCallback output);
+
+/**
+ * Queues a throttle sample. Must be called from a task.
+ *
+ * @param[in] throttle the throttle sample.
+ */
+void on_throttle(HallSensor::type throttle);
+
+/**
+ * Queues a control command. Must be called from a task.
+ *
+ * @param[in] data the encoded command (see ble_es_common::decode).
+ * @param[in] len  the length of the encoded command.
+ */
+void on_command(const std::uint8_t *data, std::size_t len);
+
+/**
+ * Queues a step of a link_watchdog ramp, counting it as dropped if the queue is full. Must be
+ * called from an interrupt.
+ *
+ * @param[in] elapsed_ms the time since the watchdog tripped.
+ */
+void on_ramp_step(std::uint32_t elapsed_ms);
+
+/**
+ * Queues a reset: engages the failsafe, which releases cruise control and outputs neutral until
+ * the next throttle sample, and forgets the last sequence number, since the remote may have
+ * restarted by the time it reconnects. Must be called from a task.
+ */
+void on_disconnected();
+
+/**
+ * Returns command statistics since boot.
+ */
+Stats stats();
+
+}  // namespace drive_control
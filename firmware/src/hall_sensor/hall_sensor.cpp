@@ -0,0 +1,183 @@
+/*
+ * hall_sensor.cpp - Drives readings from the analog Hall effect sensor.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "hall_sensor.hpp"
+
+#if !HALL_SENSOR_SIMULATED
+
+#include <nrf_saadc.h>
+
+#include <algorithm>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Scan channels, converted in this order into the result buffer. */
+static constexpr std::uint8_t HALL_CHANNEL = 0;
+static constexpr std::uint8_t BATTERY_CHANNEL = 1;
+static constexpr std::uint8_t CHANNEL_COUNT = 2;
+
+/** Number of bits used per measurement. */
+static constexpr auto MEASUREMENT_BITS = 12;
+
+/** Battery channel full scale: internal 0.6 V reference over a gain of 1/6. */
+static constexpr std::uint32_t BATTERY_FULL_SCALE_MV = 3600;
+
+/** Hall sensor: gain 1/4 of a VDD/4 reference, so readings are relative to VDD. */
+static constexpr nrf_saadc_channel_config_t HALL_CHANNEL_CONFIG = {
+    .resistor_p = NRF_SAADC_RESISTOR_DISABLED,
+    .resistor_n = NRF_SAADC_RESISTOR_DISABLED,
+    .gain       = NRF_SAADC_GAIN1_4,
+    .reference  = NRF_SAADC_REFERENCE_VDD4,
+    .acq_time   = NRF_SAADC_ACQTIME_10US,
+    .mode       = NRF_SAADC_MODE_SINGLE_ENDED,
+    .burst      = NRF_SAADC_BURST_DISABLED,
+    .pin_p      = static_cast<nrf_saadc_input_t>(NRF_SAADC_INPUT_AIN0 + HALL_SENSE_AIN),
+    .pin_n      = NRF_SAADC_INPUT_DISABLED,
+};
+
+/** Battery divider: the internal reference, and a long acquisition for the divider's impedance. */
+static constexpr nrf_saadc_channel_config_t BATTERY_CHANNEL_CONFIG = {
+    .resistor_p = NRF_SAADC_RESISTOR_DISABLED,
+    .resistor_n = NRF_SAADC_RESISTOR_DISABLED,
+    .gain       = NRF_SAADC_GAIN1_6,
+    .reference  = NRF_SAADC_REFERENCE_INTERNAL,
+    .acq_time   = NRF_SAADC_ACQTIME_40US,
+    .mode       = NRF_SAADC_MODE_SINGLE_ENDED,
+    .burst      = NRF_SAADC_BURST_DISABLED,
+    .pin_p      = static_cast<nrf_saadc_input_t>(NRF_SAADC_INPUT_AIN0 + VBAT_AIN),
+    .pin_n      = NRF_SAADC_INPUT_DISABLED,
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Triggers a task and waits for the event it ends with.
+ *
+ * @param[in] task  the task.
+ * @param[in] event the event.
+ */
+static void run_task(nrf_saadc_task_t task, nrf_saadc_event_t event);
+
+/**
+ * Handles a completed scan: returns the Hall reading and accumulates the battery reading.
+ *
+ * @param[in] is_battery_scan whether or not the battery channel was scanned.
+ */
+static HallSensor::type on_scan_done(bool is_battery_scan);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Result buffer the SAADC writes each scan to. */
+static nrf_saadc_value_t g_buffer[CHANNEL_COUNT];
+
+/** Called with each averaged battery measurement. */
+static HallSensor::BatteryCallback g_battery_callback;
+
+/** Sum and number of battery readings since the last measurement. */
+static std::uint32_t g_battery_sum;
+static std::uint32_t g_battery_count;
+
+/** Reads left until the battery channel is scanned again. */
+static std::uint32_t g_battery_countdown;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void HallSensor::init() {
+    nrf_saadc_resolution_set(NRF_SAADC_RESOLUTION_12BIT);
+
+    /* Hardware oversampling can't be used with more than one channel, battery is averaged below */
+    nrf_saadc_oversample_set(NRF_SAADC_OVERSAMPLE_DISABLED);
+
+    nrf_saadc_channel_init(HALL_CHANNEL, &HALL_CHANNEL_CONFIG);
+    nrf_saadc_channel_init(BATTERY_CHANNEL, &BATTERY_CHANNEL_CONFIG);
+
+    nrf_saadc_enable();
+    run_task(NRF_SAADC_TASK_CALIBRATEOFFSET, NRF_SAADC_EVENT_CALIBRATEDONE);
+    nrf_saadc_disable();
+}
+
+HallSensor::type HallSensor::read() {
+    const bool is_battery_scan = (g_battery_countdown == 0);
+    g_battery_countdown = is_battery_scan ? HALL_SENSOR_BATTERY_DECIMATION - 1 :
+                                            g_battery_countdown - 1;
+
+    /* Only channels with an input are scanned, so disconnecting the battery's skips it */
+    nrf_saadc_channel_input_set(BATTERY_CHANNEL,
+                                is_battery_scan ? BATTERY_CHANNEL_CONFIG.pin_p :
+                                                  NRF_SAADC_INPUT_DISABLED,
+                                NRF_SAADC_INPUT_DISABLED);
+
+    /* The SAADC is only enabled for the scan, so it draws nothing in between */
+    nrf_saadc_enable();
+    nrf_saadc_buffer_init(g_buffer, is_battery_scan ? CHANNEL_COUNT : 1);
+
+    run_task(NRF_SAADC_TASK_START, NRF_SAADC_EVENT_STARTED);
+    run_task(NRF_SAADC_TASK_SAMPLE, NRF_SAADC_EVENT_END);
+    run_task(NRF_SAADC_TASK_STOP, NRF_SAADC_EVENT_STOPPED);
+
+    nrf_saadc_disable();
+
+    return on_scan_done(is_battery_scan);
+}
+
+void HallSensor::set_battery_callback(BatteryCallback callback) {
+    g_battery_callback = callback;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void run_task(nrf_saadc_task_t task, nrf_saadc_event_t event) {
+    nrf_saadc_event_clear(event);
+    nrf_saadc_task_trigger(task);
+
+    /* A full scan takes ~60 us (both acquisitions plus conversions), ~12 us without the battery */
+    while (!nrf_saadc_event_check(event)) {
+    }
+
+    nrf_saadc_event_clear(event);
+}
+
+static HallSensor::type on_scan_done(bool is_battery_scan) {
+    /* Single-ended readings can dip just below 0 */
+    const auto hall = static_cast<HallSensor::type>(
+        std::max<nrf_saadc_value_t>(g_buffer[HALL_CHANNEL], 0));
+
+    if (!is_battery_scan) {
+        return hall;
+    }
+
+    g_battery_sum += std::max<nrf_saadc_value_t>(g_buffer[BATTERY_CHANNEL], 0);
+    ++g_battery_count;
+
+    if (g_battery_count == HALL_SENSOR_BATTERY_OVERSAMPLE) {
+        const std::uint32_t millivolts = static_cast<std::uint32_t>(
+            (static_cast<std::uint64_t>(g_battery_sum) * BATTERY_FULL_SCALE_MV *
+             BATTERY_DIVIDER_RATIO) / (g_battery_count << MEASUREMENT_BITS));
+
+        g_battery_sum = 0;
+        g_battery_count = 0;
+
+        if (g_battery_callback != nullptr) {
+            g_battery_callback(static_cast<std::uint16_t>(millivolts));
+        }
+    }
+
+    return hall;
+}
+
+#endif  // !HALL_SENSOR_SIMULATED
@@ -1,6 +1,14 @@
 /*
  * hall_sensor.hpp - Drives readings from the analog Hall effect sensor.
  *
+ * The SAADC scans the Hall sensor on every read(), and the battery divider along with it (in the
+ * same EasyDMA transaction) on every HALL_SENSOR_BATTERY_DECIMATION-th read. Battery samples are
+ * averaged over HALL_SENSOR_BATTERY_OVERSAMPLE of those and passed to the battery callback, so
+ * battery monitoring costs no extra SAADC wakeups.
+ *
+ * With HALL_SENSOR_SIMULATED, readings come from a simulated sensor and there are no battery
+ * measurements.
+ *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
  */
@@ -9,6 +17,8 @@
 
 #include <cstdint>
 
+#include "config/app_config.h"
+
 struct HallSensor {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Types
@@ -16,6 +26,9 @@ struct HallSensor {
     /** Return type of the Hall sensor ADC reading. */
     using type = std::uint16_t;
 
+    /** Called with each averaged battery voltage, in mV. */
+    using BatteryCallback = void (*)(std::uint16_t millivolts);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -24,12 +37,21 @@ struct HallSensor {
     void init();
 
     /**
-     * Returns the most recently read value from the ADC connected to the Hall effect sensor.
+     * Samples the Hall effect sensor (and the battery) and returns the reading. Readings are
+     * 12-bit, relative to VDD. Must be called from a thread.
      *
-     * @return the most recently read sample.
+     * @return the sample.
      */
     type read();
 
+    /**
+     * Registers a callback for battery measurements.
+     *
+     * @param[in] callback the callback, called from read() once every
+     *                     HALL_SENSOR_BATTERY_OVERSAMPLE * HALL_SENSOR_BATTERY_DECIMATION reads.
+     */
+    void set_battery_callback(BatteryCallback callback);
+
     /**
      * Converts a sensor type to a 2-byte buffer.
      *
@@ -1,5 +1,5 @@
 /*
- * hall_sensor.cpp - Drives readings from the analog Hall effect sensor.
+ * hall_sensor_sim.cpp - Simulated readings from the analog Hall effect sensor (sensorsim).
  *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
@@ -7,6 +7,8 @@
 
 #include "hall_sensor.hpp"
 
+#if HALL_SENSOR_SIMULATED
+
 #include <sensorsim.h>
 
 #include <cstdint>
@@ -52,3 +54,9 @@ HallSensor::type HallSensor::read() {
     HallSensor::type sensor_value = sensorsim_measure(&sim_state, &sim_cfg);
     return sensor_value;
 }
+
+void HallSensor::set_battery_callback(BatteryCallback callback) {
+    /* No battery to simulate */
+}
+
+#endif  // HALL_SENSOR_SIMULATED
@@ -0,0 +1,165 @@
+/*
+ * sample_rate.cpp - adapts the Hall sensor sampling rate to throttle motion.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "sample_rate.hpp"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "sample_stream.hpp"
+#include "timestamp.hpp"
+
+namespace sample_rate {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static_assert(SAMPLE_RATE_FAST_PERIOD_MS > 0 &&
+              SAMPLE_RATE_FAST_PERIOD_MS <= SAMPLE_RATE_SLOW_PERIOD_MS,
+              "The fast period must be no longer than the slow period");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Called when the mode changes. */
+static ModeCallback g_callback;
+
+/**< The current mode. */
+static Mode g_mode { Mode::MOVING };
+
+/**< The current sample period. */
+static std::uint32_t g_period_ms { SAMPLE_RATE_FAST_PERIOD_MS };
+
+/**< Time the throttle has been steady. */
+static std::uint32_t g_steady_ms;
+
+/**< Whether or not the throttle moved at the previous sample. */
+static bool g_was_moving;
+
+/**< Filtered throttle, scaled by 2^SAMPLE_RATE_FILTER_SHIFT. */
+static std::int32_t g_filtered;
+
+/**< Whether or not the filter has seen a sample since start(). */
+static bool g_is_filtering;
+
+/**< Timestamp of the previous sample (or of start()). */
+static std::uint32_t g_last_time;
+
+/**< Time covered by samples since boot, for the average rate. */
+static std::uint64_t g_sampled_us;
+
+/**< Sampling statistics, other than the average rate. */
+static Stats g_stats;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init(ModeCallback callback) {
+    g_callback = callback;
+}
+
+std::uint32_t start() {
+    g_period_ms = SAMPLE_RATE_FAST_PERIOD_MS;
+    g_steady_ms = 0;
+    g_was_moving = true;
+    g_is_filtering = false;
+    g_last_time = timestamp::now();
+
+    g_mode = Mode::MOVING;
+    if (g_callback != nullptr) {
+        g_callback(g_mode);
+    }
+
+    return g_period_ms;
+}
+
+std::uint32_t update(HallSensor::type value) {
+    const std::uint32_t now = timestamp::now();
+    const std::uint32_t elapsed_us = now - g_last_time;
+    g_last_time = now;
+
+    /* Exponential moving average: filtered += (value - filtered) / 2^shift */
+    const std::int32_t previous = g_filtered;
+    const bool was_filtering = g_is_filtering;
+
+    if (!g_is_filtering) {
+        g_filtered = static_cast<std::int32_t>(value) << SAMPLE_RATE_FILTER_SHIFT;
+        g_is_filtering = true;
+    } else {
+        g_filtered += value - (g_filtered >> SAMPLE_RATE_FILTER_SHIFT);
+    }
+
+    sample_stream::write(sample_stream::Id::HALL_FILTERED,
+                         static_cast<std::uint16_t>(g_filtered >> SAMPLE_RATE_FILTER_SHIFT));
+
+    const std::int32_t motion = (g_filtered - previous) >> SAMPLE_RATE_FILTER_SHIFT;
+    const bool is_moving = (was_filtering && std::abs(motion) > SAMPLE_RATE_MOTION_DELTA);
+
+    taskENTER_CRITICAL();
+
+    ++g_stats.samples;
+    g_sampled_us += elapsed_us;
+
+    if (is_moving && !g_was_moving) {
+        g_stats.last_response_us = elapsed_us;
+        g_stats.worst_response_us = std::max(g_stats.worst_response_us, elapsed_us);
+    }
+
+    taskEXIT_CRITICAL();
+
+    g_was_moving = is_moving;
+    Mode mode = g_mode;
+
+    if (is_moving) {
+        g_period_ms = SAMPLE_RATE_FAST_PERIOD_MS;
+        g_steady_ms = 0;
+        mode = Mode::MOVING;
+    } else {
+        g_steady_ms += g_period_ms;
+
+        /* Back off gradually, so a brief pause doesn't cost a whole slow period */
+        if (g_steady_ms >= SAMPLE_RATE_HOLD_MS) {
+            g_period_ms = std::min<std::uint32_t>(g_period_ms * 2, SAMPLE_RATE_SLOW_PERIOD_MS);
+        }
+
+        if (g_period_ms == SAMPLE_RATE_SLOW_PERIOD_MS) {
+            mode = Mode::STEADY;
+        }
+    }
+
+    if (mode != g_mode) {
+        g_mode = mode;
+
+        if (g_callback != nullptr) {
+            g_callback(g_mode);
+        }
+    }
+
+    return g_period_ms;
+}
+
+Stats stats() {
+    taskENTER_CRITICAL();
+
+    Stats stats = g_stats;
+
+    if (g_sampled_us > 0) {
+        stats.average_rate_mhz = static_cast<std::uint32_t>(
+            (static_cast<std::uint64_t>(g_stats.samples) * 1000000000) / g_sampled_us);
+    }
+
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
+}  // namespace sample_rate
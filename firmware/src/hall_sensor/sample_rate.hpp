@@ -0,0 +1,90 @@
+/*
+ * sample_rate.hpp - adapts the Hall sensor sampling rate to throttle motion.
+ *
+ * Each sample is low-pass filtered, and the change in the filtered value since the previous
+ * sample is the throttle's motion. While it moves by more than SAMPLE_RATE_MOTION_DELTA the
+ * sensor is sampled every SAMPLE_RATE_FAST_PERIOD_MS. Once it has been steady for
+ * SAMPLE_RATE_HOLD_MS the period doubles with every steady sample, up to
+ * SAMPLE_RATE_SLOW_PERIOD_MS. A slow drift still counts as motion once the longer period lets it
+ * build up past the threshold. The filtered value is written to the sample stream as
+ * sample_stream::Id::HALL_FILTERED, next to the raw reading.
+ *
+ * Switching between moving and steady is reported to a callback, so the connection parameters
+ * can follow (see ble_central::ConnProfile).
+ *
+ * Usage:
+ *     sample_rate::init(on_mode_changed);
+ *
+ *     period_ms = sample_rate::start();           // when sampling starts
+ *     period_ms = sample_rate::update(sample);    // after every sample
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "config/app_config.h"
+#include "hall_sensor.hpp"
+
+namespace sample_rate {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class Mode {
+    MOVING,     /**< Sampling at the fast rate. */
+    STEADY,     /**< Decayed to the slow rate. */
+};
+
+/** Sampling statistics since boot. */
+struct Stats {
+    std::uint32_t samples;                  /**< Samples taken. */
+    std::uint32_t average_rate_mhz;         /**< Time-weighted average sample rate, in mHz. */
+    std::uint32_t last_response_us;         /**< Latest delay from a steady sample to motion. */
+    std::uint32_t worst_response_us;        /**< Worst delay from a steady sample to motion. */
+};
+
+/**
+ * Called when the throttle starts moving or has settled.
+ *
+ * @param[in] mode the new mode.
+ */
+using ModeCallback = void (*)(Mode mode);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initializes the controller.
+ *
+ * @param[in] callback called from the sampling task whenever the mode changes.
+ */
+void init(ModeCallback callback);
+
+/**
+ * Starts sampling at the fast rate, as if the throttle had just moved.
+ *
+ * @return the period until the first sample, in ms.
+ */
+std::uint32_t start();
+
+/**
+ * Feeds a sample to the controller. Must be called from the sampling task.
+ *
+ * @param[in] value the sample.
+ *
+ * @return the period until the next sample, in ms.
+ */
+std::uint32_t update(HallSensor::type value);
+
+/**
+ * Returns sampling statistics since boot. Response latency is the time between the last steady
+ * sample and the sample which saw the throttle move, i.e. how late motion can be noticed.
+ */
+Stats stats();
+
+}  // namespace sample_rate
@@ -9,14 +9,75 @@
 
 #include "es_fds.hpp"
 
+#include <FreeRTOS.h>
+#include <event_groups.h>
+#include <semphr.h>
+#include <task.h>
+
+#include <app_error.h>
 #include <fds.h>
+#include <fds_internal_defs.h>
+#include <nrf_fstorage_sd.h>
 #include <nrf_strerror.h>
 
+#include <algorithm>
+#include <cstring>
+
+#include "config/app_config.h"
 #include "logger.hpp"
+#include "timestamp.hpp"
 using logger::Level;
+using logger::operator""_fmt;
 
 namespace es_fds {
 
+static_assert(ES_FDS_MAX_RECORD_SIZE % sizeof(std::uint32_t) == 0,
+              "ES_FDS_MAX_RECORD_SIZE must be a whole number of words");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** State of a write staging slot. */
+enum class SlotState {
+    FREE,       /**< Unused */
+    PENDING,    /**< Waiting for the coalescing delay, data can still be replaced */
+    IN_FLIGHT,  /**< Handed to FDS, data must not be touched */
+    DONE,       /**< FDS reported the result, callback not yet called */
+};
+
+/** A write staged for the FDS thread. */
+struct Slot {
+    SlotState state;
+    std::uint16_t file_id;
+    std::uint16_t record_key;
+    std::uint16_t length_words;
+    ret_code_t result;
+    WriteCallback callback;
+    std::uint32_t data[ES_FDS_MAX_RECORD_SIZE / sizeof(std::uint32_t)];
+};
+
+/** Notification bits for the FDS thread. */
+enum Notify : std::uint32_t {
+    NOTIFY_WRITE    = 1 << 0,   /**< A write was staged */
+    NOTIFY_DONE     = 1 << 1,   /**< FDS completed a write */
+    NOTIFY_READY    = 1 << 2,   /**< A ready callback was registered after FDS became ready */
+};
+
+/** Bits in the FDS event group. */
+enum Event : EventBits_t {
+    EVENT_READY     = 1 << 0,   /**< FDS is initialized */
+    EVENT_ERASED    = 1 << 1,   /**< A page erased by recover_pages() is done */
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Size of an FDS page in words, and in bytes. */
+static constexpr std::uint32_t PAGE_WORDS = { FDS_VIRTUAL_PAGE_SIZE };
+static constexpr std::uint32_t PAGE_SIZE = { PAGE_WORDS * sizeof(std::uint32_t) };
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Private Prototypes
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -28,28 +89,189 @@ namespace es_fds {
  */
 static void event_handler(fds_evt_t const *p_evt);
 
+/**
+ * Thread that initializes FDS, then issues staged writes once the coalescing delay has passed and
+ * calls the write callbacks once FDS reports the results.
+ *
+ * @param[in] arg context passed to the thread (nullptr).
+ */
+static void fds_thread(void *arg);
+
+/**
+ * Erases every FDS page that FDS would neither use nor tag as a new page (see pages_init() in
+ * fds.c), which is what a page erase cut short by a reset leaves behind. Without this, losing
+ * power while GC erases a page can leave FDS without enough pages, and fds_init() fails with
+ * FDS_ERR_NO_PAGES on every boot after. Only the interrupted page's contents are lost, and GC had
+ * already copied its valid records to the swap page.
+ */
+static void recover_pages();
+
+/**
+ * Checks whether FDS can use a page as it is: tagged as a data or swap page, or erased apart from
+ * the first word of a tag (see page_can_tag() in fds.c).
+ *
+ * @param[in] page the page's words.
+ */
+static bool is_page_usable(const std::uint32_t *page);
+
+/**
+ * Event handler for the fstorage instance recover_pages() erases through.
+ *
+ * @param[in] p_evt the fstorage event.
+ */
+static void fstorage_evt_handler(nrf_fstorage_evt_t *p_evt);
+
+/**
+ * Calls every ready callback that hasn't been called yet.
+ */
+static void call_ready_callbacks();
+
+/**
+ * Hands every pending write to FDS. Writes FDS can't queue right now stay pending.
+ *
+ * @return true if any writes are still pending, else false.
+ */
+static bool issue_writes();
+
+/**
+ * Frees every completed slot and calls its callback.
+ *
+ * @return true if any writes are pending, else false.
+ */
+static bool complete_writes();
+
+/**
+ * Checks fds_stat to see if garbage collection would be worthwhile.
+ *
+ * @param[out] stat the current statistics.
+ *
+ * @return true if garbage collection should run, else false.
+ */
+static bool gc_is_needed(fds_stat_t *stat);
+
+/**
+ * Finds the slot in the given state for a record.
+ *
+ * @return the slot, or nullptr if there is none.
+ */
+static Slot *find_slot(SlotState state, std::uint16_t file_id, std::uint16_t record_key);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Private Data
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-/**< Whether or not the library is initialzied yet. */
-static volatile bool g_is_initialized { false };
+/**< Event group holding EVENT_READY once the library is initialized. */
+static EventGroupHandle_t g_events;
+
+/**< Callbacks to call once the library is initialized, guarded by a critical section. */
+static ReadyCallback g_ready_callbacks[ES_FDS_READY_CALLBACKS];
+
+/**< Number of registered ready callbacks. */
+static std::size_t g_ready_callback_count;
+
+/**< Write staging slots, guarded by g_slots_mutex. */
+static Slot g_slots[ES_FDS_WRITE_SLOTS];
+
+/**< Recursive, FDS may call event_handler() from within fds_record_write() when the SoftDevice
+     is disabled. */
+static SemaphoreHandle_t g_slots_mutex;
+
+/**< FreeRTOS handle for the FDS thread. */
+static TaskHandle_t g_fds_thandle;
+
+/**< Number of writes that replaced a pending write instead of using another flash operation. */
+static volatile std::uint32_t g_coalesced_writes;
+
+/**< Whether or not the app allows garbage collection to start. */
+static volatile bool g_is_gc_allowed { true };
+
+/**< Set when a write failed for lack of space, forces garbage collection at the next chance. */
+static volatile bool g_is_gc_requested;
+
+/**< Whether or not garbage collection is running. */
+static volatile bool g_is_gc_running;
+
+/**< When garbage collection started (timestamp::now()). */
+static std::uint32_t g_gc_start_time;
+
+/**< Words used by FDS when garbage collection started. */
+static std::uint16_t g_gc_start_words_used;
+
+/**< Tick of the last fds_stat check in idle(). */
+static TickType_t g_gc_check_tick;
+
+/**< fstorage instance covering the FDS pages, only used to erase unusable ones. */
+NRF_FSTORAGE_DEF(static nrf_fstorage_t g_fstorage) = {
+    .evt_handler = fstorage_evt_handler,
+    .start_addr  = ES_FDS_START_ADDR,
+    .end_addr    = ES_FDS_START_ADDR + (FDS_VIRTUAL_PAGES * PAGE_SIZE),
+};
+
+/**< Result of the latest erase by recover_pages(). */
+static volatile ret_code_t g_erase_result;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void init() {
-    APP_ERROR_CHECK(fds_register(event_handler));
-    APP_ERROR_CHECK(fds_init());
+    g_events = xEventGroupCreate();
+    g_slots_mutex = xSemaphoreCreateRecursiveMutex();
 
-    while (!g_is_initialized) {
-        /* Await initialization success */
+    if (g_events == nullptr || g_slots_mutex == nullptr ||
+        pdPASS != xTaskCreate(fds_thread, "FDS", 256, nullptr, 2, &g_fds_thandle)) {
+        APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
     }
 }
 
-bool record_is_present(std::uint16_t file_id, std::uint16_t record_key, fds_record_desc_t *p_desc) {
+bool is_ready() {
+    return g_events != nullptr && (xEventGroupGetBits(g_events) & EVENT_READY) != 0;
+}
+
+bool wait_until_ready(TickType_t timeout) {
+    const EventBits_t bits = xEventGroupWaitBits(g_events, EVENT_READY, pdFALSE, pdTRUE, timeout);
+    return (bits & EVENT_READY) != 0;
+}
+
+void on_ready(ReadyCallback callback) {
+    taskENTER_CRITICAL();
+
+    const bool has_room = g_ready_callback_count < ES_FDS_READY_CALLBACKS;
+
+    if (has_room) {
+        g_ready_callbacks[g_ready_callback_count++] = callback;
+    }
+
+    taskEXIT_CRITICAL();
+
+    if (!has_room) {
+        APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
+    }
+
+    /* Otherwise the FDS thread calls it once initialization completes */
+    if (is_ready()) {
+        xTaskNotify(g_fds_thandle, NOTIFY_READY, eSetBits);
+    }
+}
+
+ret_code_t find_record(std::uint16_t file_id, std::uint16_t record_key, fds_record_desc_t *p_desc) {
     fds_find_token_t tok = {};
-    auto ret_code = fds_record_find(file_id, record_key, p_desc, &tok);
+    fds_record_desc_t desc = {};
+    bool is_found = false;
+    ret_code_t ret_code;
+
+    while ((ret_code = fds_record_find(file_id, record_key, &desc, &tok)) == NRF_SUCCESS) {
+        /* Record IDs only ever increase, the newest copy has the highest */
+        if (!is_found || desc.record_id > p_desc->record_id) {
+            *p_desc = desc;
+            is_found = true;
+        }
+    }
+
+    return (is_found && ret_code == FDS_ERR_NOT_FOUND) ? NRF_SUCCESS : ret_code;
+}
+
+bool record_is_present(std::uint16_t file_id, std::uint16_t record_key, fds_record_desc_t *p_desc) {
+    auto ret_code = find_record(file_id, record_key, p_desc);
 
     switch (ret_code) {
         case NRF_SUCCESS:
@@ -67,7 +289,7 @@ ret_code_t read_record(fds_record_desc_t *desc, std::uint8_t *buffer, size_t buf
     fds_flash_record_t config = {};
 
     if (auto ret_code = fds_record_open(desc, &config); ret_code != NRF_SUCCESS) {
-        logger::log<Level::WARNING>("%s::fds_record_open failed: %s",
+        logger::log<Level::WARNING>("%s::fds_record_open failed: %s"_fmt,
                                     __func__, nrf_strerror_get(ret_code));
         return ret_code;
     }
@@ -75,7 +297,7 @@ ret_code_t read_record(fds_record_desc_t *desc, std::uint8_t *buffer, size_t buf
     memcpy(buffer, config.p_data, buffer_len);
 
     if (auto ret_code = fds_record_close(desc); ret_code != NRF_SUCCESS) {
-        logger::log<Level::WARNING>("%s::fds_record_close failed: %s",
+        logger::log<Level::WARNING>("%s::fds_record_close failed: %s"_fmt,
                                     __func__, nrf_strerror_get(ret_code));
         return ret_code;
     }
@@ -83,8 +305,92 @@ ret_code_t read_record(fds_record_desc_t *desc, std::uint8_t *buffer, size_t buf
     return NRF_SUCCESS;
 }
 
+ret_code_t write_record(std::uint16_t file_id, std::uint16_t record_key,
+                        const void *data, std::size_t data_len, WriteCallback callback) {
+    if (data_len == 0 || data_len > ES_FDS_MAX_RECORD_SIZE) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    xSemaphoreTakeRecursive(g_slots_mutex, portMAX_DELAY);
+
+    /* Replace a write that hasn't been issued yet, otherwise stage a new one. A write that is
+       already in flight is left alone, the new one is issued after it completes. */
+    Slot *slot = find_slot(SlotState::PENDING, file_id, record_key);
+
+    if (slot != nullptr) {
+        ++g_coalesced_writes;
+    } else {
+        slot = find_slot(SlotState::FREE, 0, 0);
+    }
+
+    if (slot == nullptr) {
+        xSemaphoreGiveRecursive(g_slots_mutex);
+        return NRF_ERROR_NO_MEM;
+    }
+
+    slot->state = SlotState::PENDING;
+    slot->file_id = file_id;
+    slot->record_key = record_key;
+    slot->length_words = (data_len + sizeof(std::uint32_t) - 1) / sizeof(std::uint32_t);
+    slot->callback = callback;
+
+    /* Zero the padding so the record reads back the same every time */
+    memset(slot->data, 0, slot->length_words * sizeof(std::uint32_t));
+    memcpy(slot->data, data, data_len);
+
+    xSemaphoreGiveRecursive(g_slots_mutex);
+
+    xTaskNotify(g_fds_thandle, NOTIFY_WRITE, eSetBits);
+
+    return NRF_SUCCESS;
+}
+
+std::uint32_t coalesced_writes() {
+    return g_coalesced_writes;
+}
+
+void set_gc_allowed(bool allowed) {
+    g_is_gc_allowed = allowed;
+}
+
 void idle() {
-    // TODO(CMK) 06/29/20: implement garbage collection
+    if (!g_is_gc_allowed || g_is_gc_running || !is_ready()) {
+        return;
+    }
+
+    /* fds_stat walks every page, don't do it on every pass of the idle task */
+    const TickType_t now = xTaskGetTickCount();
+
+    if (!g_is_gc_requested &&
+        now - g_gc_check_tick < pdMS_TO_TICKS(ES_FDS_GC_CHECK_INTERVAL_MS)) {
+        return;
+    }
+
+    g_gc_check_tick = now;
+
+    fds_stat_t stat = {};
+
+    if (!gc_is_needed(&stat)) {
+        g_is_gc_requested = false;
+        return;
+    }
+
+    g_is_gc_running = true;
+    g_gc_start_time = timestamp::now();
+    g_gc_start_words_used = stat.words_used;
+
+    if (auto ret_code = fds_gc(); ret_code != NRF_SUCCESS) {
+        /* Likely a full operation queue, try again on the next check */
+        g_is_gc_running = false;
+        logger::log<Level::WARNING>("%s::fds_gc failed: %s"_fmt,
+                                    __func__, nrf_strerror_get(ret_code));
+        return;
+    }
+
+    g_is_gc_requested = false;
+
+    logger::log<Level::INFO>("FDS GC started (%u dirty records, %u freeable words)"_fmt,
+                             stat.dirty_records, stat.freeable_words);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -93,26 +399,44 @@ void idle() {
 
 static void event_handler(fds_evt_t const *p_evt) {
     if (NRF_SUCCESS == p_evt->result) {
-        logger::log<Level::INFO>("%s successful event: %d", __FILE__, p_evt->id);
+        logger::log<Level::INFO>("%s successful event: %d"_fmt, __FILE__, p_evt->id);
     } else {
-        logger::log<Level::WARNING>("%s unsuccessful event: %d %s",
+        logger::log<Level::WARNING>("%s unsuccessful event: %d %s"_fmt,
                                     __FILE__, p_evt->id, nrf_strerror_get(p_evt->result));
     }
 
     switch (p_evt->id) {
         case FDS_EVT_INIT:
             if (NRF_SUCCESS == p_evt->result) {
-                g_is_initialized = true;
+                xEventGroupSetBits(g_events, EVENT_READY);
             } else {
                 APP_ERROR_HANDLER(p_evt->result);
             }
             break;
 
         case FDS_EVT_WRITE:
-            break;
+            [[fallthrough]];
 
         case FDS_EVT_UPDATE:
-            break;
+        {
+            /* FDS events are dispatched from the SoftDevice thread, so the FDS thread is woken
+               with a notification to call the callback in its own context */
+            xSemaphoreTakeRecursive(g_slots_mutex, portMAX_DELAY);
+
+            Slot *slot = find_slot(SlotState::IN_FLIGHT, p_evt->write.file_id,
+                                   p_evt->write.record_key);
+
+            if (slot != nullptr) {
+                slot->state = SlotState::DONE;
+                slot->result = p_evt->result;
+            }
+
+            xSemaphoreGiveRecursive(g_slots_mutex);
+
+            if (slot != nullptr) {
+                xTaskNotify(g_fds_thandle, NOTIFY_DONE, eSetBits);
+            }
+        } break;
 
         case FDS_EVT_DEL_RECORD:
             break;
@@ -121,8 +445,278 @@ static void event_handler(fds_evt_t const *p_evt) {
             break;
 
         case FDS_EVT_GC:
-            break;
+        {
+            fds_stat_t stat = {};
+            fds_stat(&stat);
+
+            const std::uint32_t duration = timestamp::now() - g_gc_start_time;
+            const unsigned reclaimed = (g_gc_start_words_used > stat.words_used) ?
+                                       g_gc_start_words_used - stat.words_used : 0;
+
+            logger::log<Level::INFO>("FDS GC took %u us, reclaimed %u words (%u free)"_fmt,
+                                     duration, reclaimed, stat.largest_contig);
+
+            g_is_gc_running = false;
+        } break;
+    }
+}
+
+static void fds_thread(void *arg) {
+    UNUSED_PARAMETER(arg);
+
+    /* Initialized here rather than in init() so the SoftDevice is enabled by now, and FDS's flash
+       operations (formatting pages on a cold boot) run in the background instead of blocking */
+    APP_ERROR_CHECK(fds_register(event_handler));
+
+    /* fds_init() can't be retried once it has failed, so pages it can't use are dealt with first */
+    recover_pages();
+    APP_ERROR_CHECK(fds_init());
+
+    /* Writes staged in the meantime keep their notification until the loop below */
+    xEventGroupWaitBits(g_events, EVENT_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+    logger::log<Level::INFO>("FDS ready %u us after boot"_fmt, timestamp::now());
+
+    call_ready_callbacks();
+
+    const TickType_t coalesce_ticks = pdMS_TO_TICKS(ES_FDS_COALESCE_DELAY_MS);
+    bool is_pending = false;
+    TickType_t issue_tick = 0;
+
+    while (true) {
+        TickType_t timeout = portMAX_DELAY;
+
+        if (is_pending) {
+            const auto remaining = static_cast<std::int32_t>(issue_tick - xTaskGetTickCount());
+            timeout = (remaining > 0) ? remaining : 0;
+        }
+
+        std::uint32_t notifications = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notifications, timeout);
+
+        /* A write (or a completion unblocking a write to the same record) starts the coalescing
+           delay, further writes within it are merged */
+        bool has_pending = (notifications & NOTIFY_WRITE) != 0;
+
+        if (notifications & NOTIFY_READY) {
+            call_ready_callbacks();
+        }
+
+        if (notifications & NOTIFY_DONE) {
+            has_pending |= complete_writes();
+        }
+
+        if (has_pending && !is_pending) {
+            is_pending = true;
+            issue_tick = xTaskGetTickCount() + coalesce_ticks;
+        }
+
+        if (is_pending && static_cast<std::int32_t>(xTaskGetTickCount() - issue_tick) >= 0) {
+            is_pending = issue_writes();
+            issue_tick = xTaskGetTickCount() + coalesce_ticks;
+        }
+    }
+}
+
+static void recover_pages() {
+    APP_ERROR_CHECK(nrf_fstorage_init(&g_fstorage, &nrf_fstorage_sd, nullptr));
+
+    for (std::uint32_t addr = g_fstorage.start_addr; addr < g_fstorage.end_addr;
+         addr += PAGE_SIZE) {
+        if (is_page_usable(reinterpret_cast<const std::uint32_t *>(addr))) {
+            continue;
+        }
+
+        logger::log<Level::WARNING>("FDS page 0x%X is unusable, erasing it"_fmt, addr);
+
+        ret_code_t ret_code;
+
+        while ((ret_code = nrf_fstorage_erase(&g_fstorage, addr, 1, nullptr)) ==
+               NRF_ERROR_NO_MEM) {
+            vTaskDelay(1);
+        }
+
+        APP_ERROR_CHECK(ret_code);
+        xEventGroupWaitBits(g_events, EVENT_ERASED, pdTRUE, pdTRUE, portMAX_DELAY);
+        APP_ERROR_CHECK(g_erase_result);
+    }
+}
+
+static bool is_page_usable(const std::uint32_t *page) {
+    if (page[FDS_PAGE_TAG_WORD_0] == FDS_PAGE_TAG_MAGIC &&
+        (page[FDS_PAGE_TAG_WORD_1] == FDS_PAGE_TAG_DATA ||
+         page[FDS_PAGE_TAG_WORD_1] == FDS_PAGE_TAG_SWAP)) {
+        return true;
+    }
+
+    if (page[FDS_PAGE_TAG_WORD_0] != FDS_ERASED_WORD &&
+        page[FDS_PAGE_TAG_WORD_0] != FDS_PAGE_TAG_MAGIC) {
+        return false;
+    }
+
+    return std::all_of(&page[FDS_PAGE_TAG_WORD_1], &page[PAGE_WORDS],
+                       [](std::uint32_t word) { return word == FDS_ERASED_WORD; });
+}
+
+static void fstorage_evt_handler(nrf_fstorage_evt_t *p_evt) {
+    if (p_evt->id != NRF_FSTORAGE_EVT_ERASE_RESULT) {
+        return;
     }
+
+    g_erase_result = p_evt->result;
+    xEventGroupSetBits(g_events, EVENT_ERASED);
+}
+
+static void call_ready_callbacks() {
+    /* Only touched by the FDS thread */
+    static std::size_t called_count = 0;
+
+    while (true) {
+        ReadyCallback callback = nullptr;
+
+        taskENTER_CRITICAL();
+
+        if (called_count < g_ready_callback_count) {
+            callback = g_ready_callbacks[called_count++];
+        }
+
+        taskEXIT_CRITICAL();
+
+        if (callback == nullptr) {
+            return;
+        }
+
+        callback();
+    }
+}
+
+static bool issue_writes() {
+    bool is_pending = false;
+
+    xSemaphoreTakeRecursive(g_slots_mutex, portMAX_DELAY);
+
+    for (auto &slot : g_slots) {
+        if (slot.state != SlotState::PENDING) {
+            continue;
+        }
+
+        /* Keep writes to the same record in order */
+        if (find_slot(SlotState::IN_FLIGHT, slot.file_id, slot.record_key) != nullptr ||
+            find_slot(SlotState::DONE, slot.file_id, slot.record_key) != nullptr) {
+            is_pending = true;
+            continue;
+        }
+
+        const fds_record_t record = {
+            .file_id = slot.file_id,
+            .key = slot.record_key,
+            .data = {
+                .p_data = slot.data,
+                .length_words = slot.length_words,
+            },
+        };
+
+        fds_record_desc_t desc = {};
+        const bool is_present = find_record(slot.file_id, slot.record_key, &desc) == NRF_SUCCESS;
+
+        /* Set before handing the data to FDS, its event can arrive before the call returns */
+        slot.state = SlotState::IN_FLIGHT;
+
+        const ret_code_t ret_code = is_present ? fds_record_update(&desc, &record) :
+                                                 fds_record_write(nullptr, &record);
+
+        switch (ret_code) {
+            case NRF_SUCCESS:
+                break;
+
+            case FDS_ERR_NO_SPACE_IN_QUEUES:
+            case FDS_ERR_BUSY:
+                /* Retry after another coalescing delay */
+                slot.state = SlotState::PENDING;
+                is_pending = true;
+                break;
+
+            case FDS_ERR_NO_SPACE_IN_FLASH:
+                /* Fail the write but have idle() collect garbage, so a retry can succeed */
+                g_is_gc_requested = true;
+                [[fallthrough]];
+
+            default:
+                logger::log<Level::WARNING>("%s::write 0x%X/0x%X failed: %s"_fmt, __func__,
+                                            slot.file_id, slot.record_key,
+                                            nrf_strerror_get(ret_code));
+                slot.state = SlotState::DONE;
+                slot.result = ret_code;
+                xTaskNotify(g_fds_thandle, NOTIFY_DONE, eSetBits);
+                break;
+        }
+    }
+
+    xSemaphoreGiveRecursive(g_slots_mutex);
+
+    return is_pending;
+}
+
+static bool complete_writes() {
+    struct Completion {
+        WriteCallback callback;
+        std::uint16_t file_id;
+        std::uint16_t record_key;
+        ret_code_t result;
+    };
+
+    Completion completions[ES_FDS_WRITE_SLOTS];
+    std::size_t count = 0;
+    bool is_pending = false;
+
+    xSemaphoreTakeRecursive(g_slots_mutex, portMAX_DELAY);
+
+    for (auto &slot : g_slots) {
+        if (slot.state == SlotState::DONE) {
+            completions[count++] = { slot.callback, slot.file_id, slot.record_key, slot.result };
+            slot.state = SlotState::FREE;
+        } else if (slot.state == SlotState::PENDING) {
+            is_pending = true;
+        }
+    }
+
+    xSemaphoreGiveRecursive(g_slots_mutex);
+
+    /* Call back without the mutex held, so callbacks can stage further writes */
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto &completion = completions[i];
+
+        logger::log<Level::DBG>("FDS write 0x%X/0x%X done (%u writes coalesced)"_fmt,
+                                completion.file_id, completion.record_key,
+                                static_cast<unsigned>(g_coalesced_writes));
+
+        if (completion.callback != nullptr) {
+            completion.callback(completion.file_id, completion.record_key, completion.result);
+        }
+    }
+
+    return is_pending;
+}
+
+static bool gc_is_needed(fds_stat_t *stat) {
+    if (fds_stat(stat) != NRF_SUCCESS || stat->dirty_records == 0) {
+        return false;
+    }
+
+    return g_is_gc_requested || stat->corruption ||
+           stat->freeable_words >= ES_FDS_GC_FREEABLE_WORDS ||
+           stat->largest_contig < ES_FDS_GC_MIN_FREE_WORDS;
+}
+
+static Slot *find_slot(SlotState state, std::uint16_t file_id, std::uint16_t record_key) {
+    for (auto &slot : g_slots) {
+        if (slot.state == state &&
+            (state == SlotState::FREE ||
+             (slot.file_id == file_id && slot.record_key == record_key))) {
+            return &slot;
+        }
+    }
+
+    return nullptr;
 }
 
 }  // namespace es_fds
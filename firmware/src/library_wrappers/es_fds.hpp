@@ -3,29 +3,103 @@
  *
  * Performs initialization of FDS and handles FDS events.
  *
+ * Initialization doesn't block: FDS is initialized from the FDS thread once the scheduler is
+ * running, so BLE can start advertising/scanning right away. Code that needs stored data either
+ * registers an on_ready() callback or blocks in wait_until_ready(). Before initializing FDS, the
+ * FDS thread erases pages left unusable by a page erase cut short by a reset, which would otherwise
+ * stop FDS from initializing on every boot after.
+ *
+ * Writes are asynchronous: write_record() copies the data into one of a few staging slots and
+ * returns, and the FDS thread issues the flash operation after a short coalescing delay. Repeated
+ * writes to the same record within that delay (e.g. calibration tweaks, odometer updates) replace
+ * the staged data and become a single flash operation.
+ *
+ * Garbage collection runs from the idle hook, only while the app allows it (set_gc_allowed()) and
+ * fds_stat shows it is worthwhile: enough freeable words, or too little free space left.
+ *
  * Copyright (c) 2020 Cameron Kluza
  * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
  */
 
 #pragma once
 
+#include <FreeRTOS.h>
+
 #include <fds.h>
 #include <sdk_errors.h>
 
+#include <cstddef>
 #include <cstdint>
 
 namespace es_fds {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Called from the FDS thread once an asynchronous write has completed.
+ *
+ * @param[in] file_id    the FDS file ID.
+ * @param[in] record_key the FDS record key.
+ * @param[in] result     NRF_SUCCESS if the record was written, or an error code.
+ */
+using WriteCallback = void (*)(std::uint16_t file_id, std::uint16_t record_key,
+                               ret_code_t result);
+
+/**
+ * Called from the FDS thread once FDS is initialized.
+ */
+using ReadyCallback = void (*)();
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
- * Initializes the FDS library.
+ * Creates the FDS thread, which initializes the FDS library once the scheduler starts. Returns
+ * immediately.
  */
 void init();
 
 /**
- * Checks to see if the given record is stored in flash.
+ * Checks whether FDS has finished initializing.
+ *
+ * @return true if stored records can be accessed, else false.
+ */
+bool is_ready();
+
+/**
+ * Blocks the calling thread until FDS has finished initializing. Must not be called before the
+ * scheduler starts.
+ *
+ * @param[in] timeout how long to wait, in ticks.
+ *
+ * @return true if FDS is ready, false if the timeout expired.
+ */
+bool wait_until_ready(TickType_t timeout = portMAX_DELAY);
+
+/**
+ * Registers a callback to be called once FDS has finished initializing (straight away if it
+ * already has). Can be called before init().
+ *
+ * @param[in] callback the callback, called from the FDS thread.
+ */
+void on_ready(ReadyCallback callback);
+
+/**
+ * Finds the newest copy of a record. An update cut short by a reset can leave the old copy valid
+ * next to the new one, which fds_record_find() alone may return first. FDS must be ready.
+ *
+ * @param[in]  file_id    the FDS file ID.
+ * @param[in]  record_key the FDS record key.
+ * @param[out] desc       the record descriptor filled in if the record is present.
+ *
+ * @return NRF_SUCCESS if the record is present, FDS_ERR_NOT_FOUND if not, or another error code.
+ */
+ret_code_t find_record(std::uint16_t file_id, std::uint16_t record_key, fds_record_desc_t *desc);
+
+/**
+ * Checks to see if the given record is stored in flash (see find_record()). FDS must be ready.
  *
  * @param[in]  file_id the FDS file ID.
  * @param[in]  record_key the FDS record key.
@@ -37,7 +111,7 @@ bool record_is_present(std::uint16_t file_id, std::uint16_t record_key,
                        fds_record_desc_t *desc);
 
 /**
- * Reads data from an FDS record.
+ * Reads data from an FDS record. FDS must be ready.
  *
  * @param[in]  desc       the record descriptor to be read.
  * @param[out] buffer     pointer to be written to.
@@ -48,7 +122,41 @@ bool record_is_present(std::uint16_t file_id, std::uint16_t record_key,
 ret_code_t read_record(fds_record_desc_t *desc, std::uint8_t *buffer, size_t buffer_len);
 
 /**
- * Performs the idle task for FDS.
+ * Asynchronously writes a record, updating it if it is already stored in flash. The data is
+ * copied, so the buffer can be reused as soon as this returns. Must be called from a thread
+ * after init(), writes staged before FDS is ready are issued once it is.
+ *
+ * If the record already has a write waiting to be issued, the new data replaces it and only the
+ * latest callback is called.
+ *
+ * @param[in] file_id    the FDS file ID.
+ * @param[in] record_key the FDS record key.
+ * @param[in] data       the data to be written.
+ * @param[in] data_len   size of the data, at most ES_FDS_MAX_RECORD_SIZE.
+ * @param[in] callback   called once the write has completed (optional).
+ *
+ * @return NRF_SUCCESS if the write was staged, NRF_ERROR_INVALID_LENGTH if the data is empty or
+ *         too large, or NRF_ERROR_NO_MEM if all staging slots are in use.
+ */
+ret_code_t write_record(std::uint16_t file_id, std::uint16_t record_key,
+                        const void *data, std::size_t data_len, WriteCallback callback = nullptr);
+
+/**
+ * Returns the number of flash writes saved by coalescing since boot.
+ */
+std::uint32_t coalesced_writes();
+
+/**
+ * Allows or blocks garbage collection, e.g. blocked while connected and streaming throttle data.
+ * A garbage collection that is already running can't be stopped.
+ *
+ * @param[in] allowed whether or not garbage collection may start.
+ */
+void set_gc_allowed(bool allowed);
+
+/**
+ * Performs the idle task for FDS: starts garbage collection if it is allowed and needed. Never
+ * blocks, called from the FreeRTOS idle hook.
  */
 void idle();
 
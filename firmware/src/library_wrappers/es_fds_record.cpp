@@ -0,0 +1,59 @@
+/*
+ * es_fds_record.cpp - Typed, CRC-protected, versioned FDS records.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "es_fds_record.hpp"
+
+#include <crc16.h>
+#include <nrf_strerror.h>
+
+#include "logger.hpp"
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace es_fds {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::uint16_t record_crc(std::uint16_t version, const void *data, std::size_t size) {
+    const std::uint16_t crc = crc16_compute(reinterpret_cast<const std::uint8_t *>(&version),
+                                            sizeof(version), nullptr);
+
+    return crc16_compute(static_cast<const std::uint8_t *>(data), size, &crc);
+}
+
+ret_code_t open_verified_record(std::uint16_t file_id, std::uint16_t record_key,
+                                fds_record_desc_t *desc, const RecordHeader **header) {
+    if (auto ret_code = find_record(file_id, record_key, desc); ret_code != NRF_SUCCESS) {
+        return ret_code;
+    }
+
+    fds_flash_record_t record = {};
+
+    if (auto ret_code = fds_record_open(desc, &record); ret_code != NRF_SUCCESS) {
+        logger::log<Level::WARNING>("%s::fds_record_open failed: %s"_fmt,
+                                    __func__, nrf_strerror_get(ret_code));
+        return ret_code;
+    }
+
+    const std::size_t length = record.p_header->length_words * sizeof(std::uint32_t);
+    const auto *p_header = static_cast<const RecordHeader *>(record.p_data);
+
+    if (length < sizeof(RecordHeader) || length - sizeof(RecordHeader) < p_header->size ||
+        p_header->crc != record_crc(p_header->version, p_header + 1, p_header->size)) {
+        logger::log<Level::WARNING>("%s: record 0x%X/0x%X is corrupt"_fmt,
+                                    __func__, file_id, record_key);
+        fds_record_close(desc);
+        return FDS_ERR_CRC_CHECK_FAILED;
+    }
+
+    *header = p_header;
+
+    return NRF_SUCCESS;
+}
+
+}  // namespace es_fds
@@ -0,0 +1,255 @@
+/*
+ * es_fds_record.hpp - Typed, CRC-protected, versioned FDS records.
+ *
+ * A Record stores a trivially-copyable struct behind a small header:
+ *
+ *     [0..1] version: the record's layout version
+ *     [2..3] size:    size of the struct in bytes
+ *     [4..5] crc:     CRC16 (CCITT) of the version followed by the struct
+ *     [6..7] reserved
+ *     [8..]  the struct, padded to a whole number of words
+ *
+ * Usage:
+ *     using PairedAddr = es_fds::Record<ble_gap_addr_t, FILE_ID, RECORD_KEY, 1>;
+ *
+ *     ble_gap_addr_t addr;
+ *     if (PairedAddr::read(&addr) == NRF_SUCCESS) { ... }
+ *
+ *     if (auto view = PairedAddr::open()) {
+ *         use(view->addr);  // points into flash, valid until view goes out of scope
+ *     }
+ *
+ *     PairedAddr::write(addr);
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <fds.h>
+#include <sdk_errors.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "config/app_config.h"
+#include "es_fds.hpp"
+
+namespace es_fds {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Header stored in front of every Record. */
+struct RecordHeader {
+    std::uint16_t version;
+    std::uint16_t size;
+    std::uint16_t crc;
+    std::uint16_t reserved;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Computes the CRC stored in a RecordHeader.
+ *
+ * @param[in] version the record's version.
+ * @param[in] data    the record's data.
+ * @param[in] size    size of the data.
+ *
+ * @return the CRC16 of the version followed by the data.
+ */
+std::uint16_t record_crc(std::uint16_t version, const void *data, std::size_t size);
+
+/**
+ * Finds and opens a record written by Record, and checks its header and CRC. FDS must be ready.
+ *
+ * @param[in]  file_id    the FDS file ID.
+ * @param[in]  record_key the FDS record key.
+ * @param[out] desc       the record descriptor, left open on success.
+ * @param[out] header     the record's header in flash, followed by its data.
+ *
+ * @return NRF_SUCCESS if the record is open (close it with fds_record_close()),
+ *         FDS_ERR_NOT_FOUND if there is no such record, FDS_ERR_CRC_CHECK_FAILED if the header
+ *         or CRC doesn't match the data, or another error code.
+ */
+ret_code_t open_verified_record(std::uint16_t file_id, std::uint16_t record_key,
+                                fds_record_desc_t *desc, const RecordHeader **header);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Record
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A struct stored in FDS.
+ *
+ * @tparam T       type of the stored struct, must be trivially copyable.
+ * @tparam FileId  the FDS file ID.
+ * @tparam Key     the FDS record key.
+ * @tparam Version layout version of T, bump it whenever T changes.
+ */
+template<typename T, std::uint16_t FileId, std::uint16_t Key, std::uint16_t Version>
+class Record {
+    static_assert(std::is_trivially_copyable_v<T>, "Records must be trivially copyable");
+    static_assert(alignof(T) <= sizeof(std::uint32_t), "Records in flash are only word aligned");
+    static_assert(sizeof(RecordHeader) + sizeof(T) <= ES_FDS_MAX_RECORD_SIZE,
+                  "Record is too large, increase ES_FDS_MAX_RECORD_SIZE");
+    static_assert(FileId != FDS_FILE_ID_INVALID, "Invalid FDS file ID");
+    static_assert(Key != FDS_RECORD_KEY_DIRTY, "Invalid FDS record key");
+
+ public:
+    /**
+     * Converts a record stored with an older version into the current T.
+     *
+     * @param[in]  version the stored version.
+     * @param[in]  data    the stored data.
+     * @param[in]  size    size of the stored data.
+     * @param[out] value   the converted value.
+     *
+     * @return true if the record was converted, false if it should be treated as missing.
+     */
+    using Migrate = bool (*)(std::uint16_t version, const void *data, std::size_t size, T *value);
+
+    /**
+     * Zero-copy view of the record in flash, keeps the record open (so garbage collection can't
+     * move it) until it is destroyed.
+     */
+    class View {
+     private:
+        /**< Descriptor of the open record. */
+        fds_record_desc_t _desc {};
+        /**< The record's data in flash, or nullptr if the view is empty. */
+        const T *_value {};
+
+     public:
+        View() = default;
+        View(const View &) = delete;
+        View &operator=(const View &) = delete;
+
+        View(View &&other) : _desc(other._desc), _value(std::exchange(other._value, nullptr)) {}
+
+        View &operator=(View &&other) {
+            close();
+            _desc = other._desc;
+            _value = std::exchange(other._value, nullptr);
+            return *this;
+        }
+
+        ~View() {
+            close();
+        }
+
+        /** Whether or not the view points to a valid record. */
+        explicit operator bool() const { return _value != nullptr; }
+
+        const T &operator*() const { return *_value; }
+        const T *operator->() const { return _value; }
+
+     private:
+        friend class Record;
+
+        View(const fds_record_desc_t &desc, const T *value) : _desc(desc), _value(value) {}
+
+        void close() {
+            if (_value != nullptr) {
+                fds_record_close(&_desc);
+                _value = nullptr;
+            }
+        }
+    };
+
+    /**
+     * Opens the record for reading in place. FDS must be ready.
+     *
+     * @return a view of the record, empty if it is missing, corrupt or stored with another
+     *         version.
+     */
+    static View open() {
+        fds_record_desc_t desc {};
+        const RecordHeader *header {};
+
+        if (open_verified_record(FileId, Key, &desc, &header) != NRF_SUCCESS) {
+            return {};
+        }
+
+        if (header->version != Version || header->size != sizeof(T)) {
+            fds_record_close(&desc);
+            return {};
+        }
+
+        return View(desc, reinterpret_cast<const T *>(header + 1));
+    }
+
+    /**
+     * Copies the record out of flash. FDS must be ready.
+     *
+     * A record stored with an older version is converted with migrate and written back in the
+     * current version.
+     *
+     * @param[out] value   the record.
+     * @param[in]  migrate converts older versions (optional).
+     *
+     * @return NRF_SUCCESS if value was read, FDS_ERR_NOT_FOUND if the record is missing,
+     *         FDS_ERR_CRC_CHECK_FAILED if it is corrupt, NRF_ERROR_INVALID_DATA if it is stored
+     *         with a version that can't be converted, or another error code.
+     */
+    static ret_code_t read(T *value, Migrate migrate = nullptr) {
+        fds_record_desc_t desc {};
+        const RecordHeader *header {};
+
+        if (auto ret_code = open_verified_record(FileId, Key, &desc, &header);
+                ret_code != NRF_SUCCESS) {
+            return ret_code;
+        }
+
+        ret_code_t ret_code = NRF_SUCCESS;
+        bool is_migrated = false;
+
+        if (header->version == Version && header->size == sizeof(T)) {
+            memcpy(value, header + 1, sizeof(T));
+        } else if (header->version < Version && migrate != nullptr &&
+                   migrate(header->version, header + 1, header->size, value)) {
+            is_migrated = true;
+        } else {
+            ret_code = NRF_ERROR_INVALID_DATA;
+        }
+
+        fds_record_close(&desc);
+
+        if (is_migrated) {
+            write(*value);
+        }
+
+        return ret_code;
+    }
+
+    /**
+     * Writes the record asynchronously (see es_fds::write_record()).
+     *
+     * @param[in] value    the new value.
+     * @param[in] callback called once the write has completed (optional).
+     *
+     * @return NRF_SUCCESS if the write was staged, or an error code.
+     */
+    static ret_code_t write(const T &value, WriteCallback callback = nullptr) {
+        struct {
+            RecordHeader header;
+            T value;
+        } record {};
+
+        record.header.version = Version;
+        record.header.size = sizeof(T);
+        record.header.crc = record_crc(Version, &value, sizeof(T));
+        memcpy(&record.value, &value, sizeof(T));
+
+        return write_record(FileId, Key, &record, sizeof(record), callback);
+    }
+};
+
+}  // namespace es_fds
@@ -0,0 +1,215 @@
+/*
+ * link_watchdog.cpp - ramps the throttle down when the remote's samples stop arriving.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "link_watchdog.hpp"
+
+#include <app_util_platform.h>
+#include <nrf.h>
+#include <nrf_rtc.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "logger.hpp"
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace link_watchdog {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Unused by the SoftDevice (RTC0) and the FreeRTOS tick (RTC1). */
+static NRF_RTC_Type *const g_rtc = { NRF_RTC2 };
+
+/**< The RTC's COUNTER register is 24 bits wide, it wraps every 4.5 hours at RTC_FREQUENCY. */
+static constexpr std::uint32_t RTC_COUNTER_MASK = { 0x00FFFFFF };
+
+/**< RTC ticks per second, about a millisecond each. */
+static constexpr std::uint32_t RTC_FREQUENCY = { 1024 };
+
+/**< Divides the 32.768 kHz LFCLK down to RTC_FREQUENCY. */
+static constexpr std::uint32_t RTC_PRESCALER = { 32768 / RTC_FREQUENCY - 1 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Sets the next deadline and enables its interrupt.
+ *
+ * @param[in] counter the RTC counter to fire at.
+ */
+static void arm(std::uint32_t counter);
+
+/**
+ * Disables the deadline interrupt and clears any deadline that already fired.
+ */
+static void disarm();
+
+/**
+ * Converts milliseconds to RTC ticks, rounding up so deadlines are never early.
+ */
+static std::uint32_t ms_to_ticks(std::uint32_t ms);
+
+/**
+ * Converts RTC ticks to milliseconds.
+ */
+static std::uint32_t ticks_to_ms(std::uint32_t ticks);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Called with each step of a ramp. */
+static StepCallback g_step;
+
+/**< Latest connection interval, in milliseconds. */
+static std::uint32_t g_conn_interval_ms;
+
+/**< RTC counter at the latest sample, valid if g_is_armed. */
+static std::uint32_t g_fed_counter;
+static bool g_is_armed;
+
+/**< RTC counter when the watchdog tripped, valid if g_is_ramping. */
+static std::uint32_t g_trip_counter;
+static bool g_is_ramping;
+
+/**< Watchdog statistics. */
+static Stats g_stats;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init(StepCallback step) {
+    g_step = step;
+
+    nrf_rtc_prescaler_set(g_rtc, RTC_PRESCALER);
+    disarm();
+
+    NVIC_ClearPendingIRQ(RTC2_IRQn);
+    NVIC_SetPriority(RTC2_IRQn, APP_IRQ_PRIORITY_LOW);
+    NVIC_EnableIRQ(RTC2_IRQn);
+
+    nrf_rtc_task_trigger(g_rtc, NRF_RTC_TASK_START);
+}
+
+void set_conn_interval(std::uint32_t interval_ms) {
+    taskENTER_CRITICAL();
+    g_conn_interval_ms = interval_ms;
+    taskEXIT_CRITICAL();
+}
+
+void feed() {
+    const std::uint32_t counter = nrf_rtc_counter_get(g_rtc);
+    std::uint32_t resumed_ms = { 0 };
+    bool was_ramping;
+
+    /* Masks the RTC interrupt, so a step is either queued before this sample or not at all */
+    taskENTER_CRITICAL();
+    const std::uint32_t gap_ms =
+        g_is_armed ? ticks_to_ms((counter - g_fed_counter) & RTC_COUNTER_MASK) : 0;
+
+    was_ramping = g_is_ramping;
+    if (g_is_ramping) {
+        resumed_ms = ticks_to_ms((counter - g_trip_counter) & RTC_COUNTER_MASK);
+        g_is_ramping = false;
+        ++g_stats.resumed;
+    } else {
+        g_stats.worst_gap_ms = std::max(g_stats.worst_gap_ms, gap_ms);
+    }
+
+    g_fed_counter = counter;
+    g_is_armed = true;
+    arm(counter + ms_to_ticks(timeout_ms(gap_ms, g_conn_interval_ms)));
+    taskEXIT_CRITICAL();
+
+    if (was_ramping) {
+        logger::log<Level::WARNING>("Samples resumed %u ms into a ramp"_fmt, resumed_ms);
+    }
+}
+
+void stop() {
+    taskENTER_CRITICAL();
+    disarm();
+    g_is_armed = false;
+    g_is_ramping = false;
+    taskEXIT_CRITICAL();
+}
+
+Stats stats() {
+    taskENTER_CRITICAL();
+    Stats stats = g_stats;
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void arm(std::uint32_t counter) {
+    nrf_rtc_event_clear(g_rtc, NRF_RTC_EVENT_COMPARE_0);
+    nrf_rtc_cc_set(g_rtc, 0, counter & RTC_COUNTER_MASK);
+    nrf_rtc_int_enable(g_rtc, NRF_RTC_INT_COMPARE0_MASK);
+}
+
+static void disarm() {
+    nrf_rtc_int_disable(g_rtc, NRF_RTC_INT_COMPARE0_MASK);
+    nrf_rtc_event_clear(g_rtc, NRF_RTC_EVENT_COMPARE_0);
+    NVIC_ClearPendingIRQ(RTC2_IRQn);
+}
+
+static std::uint32_t ms_to_ticks(std::uint32_t ms) {
+    return (ms * RTC_FREQUENCY + 999) / 1000;
+}
+
+static std::uint32_t ticks_to_ms(std::uint32_t ticks) {
+    return static_cast<std::uint32_t>((static_cast<std::uint64_t>(ticks) * 1000) / RTC_FREQUENCY);
+}
+
+}  // namespace link_watchdog
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Interrupt Handlers
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+extern "C"
+void RTC2_IRQHandler(void) {
+    using namespace link_watchdog;
+
+    if (!nrf_rtc_event_pending(g_rtc, NRF_RTC_EVENT_COMPARE_0)) {
+        return;
+    }
+
+    nrf_rtc_event_clear(g_rtc, NRF_RTC_EVENT_COMPARE_0);
+
+    const std::uint32_t counter = nrf_rtc_counter_get(g_rtc);
+
+    if (!g_is_ramping) {
+        g_trip_counter = counter;
+        g_is_ramping = true;
+
+        ++g_stats.trips;
+        g_stats.last_timeout_ms = ticks_to_ms((counter - g_fed_counter) & RTC_COUNTER_MASK);
+    }
+
+    const std::uint32_t elapsed_ms = ticks_to_ms((counter - g_trip_counter) & RTC_COUNTER_MASK);
+
+    if (g_step != nullptr) {
+        g_step(elapsed_ms);
+    }
+
+    /* Neutral is held from the last step until a sample or the disconnection */
+    if (elapsed_ms < LINK_WATCHDOG_RAMP_MS) {
+        arm(counter + ms_to_ticks(LINK_WATCHDOG_RAMP_STEP_MS));
+    } else {
+        disarm();
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * link_watchdog.hpp - ramps the throttle down when the remote's samples stop arriving.
+ *
+ * Until the supervision timeout (BLE_PERIPHERAL_CONN_SUP_TIMEOUT, seconds) ends a lost link, the
+ * board would hold whatever throttle it was last sent. The watchdog notices long before: each
+ * valid throttle sample re-arms a deadline LINK_WATCHDOG_MISSED_INTERVALS expected intervals
+ * away, and if no sample arrives by then it trips, ramping the throttle from where it was down to
+ * DRIVE_CONTROL_NEUTRAL_THROTTLE over LINK_WATCHDOG_RAMP_MS. The next sample ends the ramp, and a
+ * disconnection hands over to the drive_control failsafe.
+ *
+ * The expected interval is the longer of the connection interval, since samples arrive no more
+ * often than connection events, and the remote's next sample period. sample_rate at most doubles
+ * the period per sample, up to SAMPLE_RATE_SLOW_PERIOD_MS, so the remote slowing down never trips
+ * the watchdog.
+ *
+ * Deadlines and ramp steps are timed by RTC2 off the 32.768 kHz LFCLK, which the SoftDevice keeps
+ * running, so they fire whatever the tasks are doing. Each step is queued to drive_control from the
+ * RTC interrupt and output in order with the samples around it.
+ *
+ * timeout_ms() and ramp_throttle() are constexpr and need no SDK headers, so they can be checked on
+ * the host (see tools/ramp_check).
+ *
+ * Usage:
+ *     link_watchdog::init(drive_control::on_ramp_step);
+ *
+ *     link_watchdog::set_conn_interval(interval_ms);  // on connection and parameter updates
+ *     link_watchdog::feed();                          // on each valid throttle sample
+ *     link_watchdog::stop();                          // on disconnection
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "config/app_config.h"
+#include "hall_sensor.hpp"
+
+namespace link_watchdog {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Watchdog statistics since boot. */
+struct Stats {
+    std::uint32_t trips;                    /**< Silences that started a ramp. */
+    std::uint32_t resumed;                  /**< Ramps ended by a sample, not a disconnection. */
+    std::uint32_t last_timeout_ms;          /**< Silence the latest trip was detected after. */
+    std::uint32_t worst_gap_ms;             /**< Longest gap between samples that didn't trip. */
+};
+
+/**
+ * Called from the RTC interrupt with each step of a ramp, the first when the watchdog trips.
+ *
+ * @param[in] elapsed_ms the time since the watchdog tripped (see ramp_throttle()).
+ */
+using StepCallback = void (*)(std::uint32_t elapsed_ms);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns how long a silence after a sample trips the watchdog.
+ *
+ * @param[in] gap_ms           the gap between that sample and the one before it.
+ * @param[in] conn_interval_ms the connection interval.
+ */
+constexpr std::uint32_t timeout_ms(std::uint32_t gap_ms, std::uint32_t conn_interval_ms) {
+    /* The remote's next sample period is at most twice the last one */
+    const std::uint32_t period_ms =
+        std::min<std::uint32_t>(2 * std::min<std::uint32_t>(gap_ms, SAMPLE_RATE_SLOW_PERIOD_MS),
+                                SAMPLE_RATE_SLOW_PERIOD_MS);
+    const std::uint32_t interval_ms = std::max(period_ms, conn_interval_ms);
+
+    return std::max<std::uint32_t>(LINK_WATCHDOG_MISSED_INTERVALS * interval_ms,
+                                   LINK_WATCHDOG_MIN_TIMEOUT_MS);
+}
+
+/**
+ * Returns the throttle output a step into a ramp: it falls linearly from the throttle when the
+ * watchdog tripped to DRIVE_CONTROL_NEUTRAL_THROTTLE, and stays there once LINK_WATCHDOG_RAMP_MS
+ * have passed. Only acceleration is ramped, a throttle at or below neutral (coasting or braking)
+ * is held, since it can't add speed and the rider can't brake again without the link.
+ *
+ * @param[in] from       the throttle when the watchdog tripped.
+ * @param[in] elapsed_ms the time since the watchdog tripped.
+ */
+constexpr HallSensor::type ramp_throttle(HallSensor::type from, std::uint32_t elapsed_ms) {
+    if (from <= DRIVE_CONTROL_NEUTRAL_THROTTLE) {
+        return from;
+    }
+
+    if (elapsed_ms >= LINK_WATCHDOG_RAMP_MS) {
+        return DRIVE_CONTROL_NEUTRAL_THROTTLE;
+    }
+
+    const std::uint32_t span = from - DRIVE_CONTROL_NEUTRAL_THROTTLE;
+
+    return static_cast<HallSensor::type>(from - (span * elapsed_ms) / LINK_WATCHDOG_RAMP_MS);
+}
+
+/**
+ * Sets up RTC2. The watchdog is armed by the first sample after each connection.
+ *
+ * @param[in] step called with each step of a ramp.
+ */
+void init(StepCallback step);
+
+/**
+ * Sets the connection interval. Must be called from the SoftDevice task on connection and on
+ * each connection parameter update.
+ *
+ * @param[in] interval_ms the connection interval, in milliseconds.
+ */
+void set_conn_interval(std::uint32_t interval_ms);
+
+/**
+ * Re-arms the deadline and ends any ramp. Must be called from the SoftDevice task on each valid
+ * throttle sample, before the sample is queued to drive_control.
+ */
+void feed();
+
+/**
+ * Disarms the watchdog and ends any ramp. Must be called from the SoftDevice task on disconnection.
+ */
+void stop();
+
+/**
+ * Returns watchdog statistics since boot.
+ */
+Stats stats();
+
+}  // namespace link_watchdog
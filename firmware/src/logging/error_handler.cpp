@@ -8,13 +8,38 @@
 #include "error_handler.hpp"
 
 #include <hardfault.h>
+#include <nordic_common.h>
 #include <nrf52.h>
+#include <nrf_log_ctrl.h>
 
-// TODO(CMK) 07/01/20: call NRF_LOG_FINAL_FLUSH as needed
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "logger.hpp"
+
+using logger::Level;
+using logger::operator""_fmt;
 
-// TODO(CMK) 06/19/20: implement hard fault error handling
 extern "C"
 void HardFault_process(HardFault_stack_t *p_stack) {
+    logger::log<Level::ERROR>("HardFault: PC 0x%08X LR 0x%08X PSR 0x%08X"_fmt,
+                              p_stack->pc, p_stack->lr, p_stack->psr);
+
+    /* Process everything still buffered; the flash backend writes it out synchronously */
+    NRF_LOG_FINAL_FLUSH();
+
+    NVIC_SystemReset();
+}
+
+extern "C"
+void vApplicationStackOverflowHook(TaskHandle_t task, char *name) {
+    UNUSED_PARAMETER(name);
+
+    /* The name is in RAM, which tokenized logs can't resolve, so log the handle */
+    logger::log<Level::ERROR>("Stack overflow: task %p"_fmt, task);
+
+    NRF_LOG_FINAL_FLUSH();
+
     NVIC_SystemReset();
 }
 
@@ -9,6 +9,8 @@
 
 #include <cstddef>
 
+#include "logger_format.hpp"
+
 namespace logger {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Definitions
@@ -41,9 +43,13 @@ void idle();
 
 /**
  * Log info at a given level. Specializations per log level are in platform-specific header.
+ *
+ * The format string is a "..."_fmt literal so that the arguments can be checked against it at
+ * compile time, e.g. log<Level::INFO>("value: %d"_fmt, value). Strings passed as (non-const)
+ * char * are pushed automatically, const char * strings are assumed to be constant.
  */
-template<Level level, Option ... options, typename ... Args>
-void log(const char *fmt, Args ... args);
+template<Level level, Option ... options, typename Fmt, typename ... Args>
+void log(Fmt fmt, Args ... args);
 
 /**
  * Log a hexdump of bytes.
@@ -64,6 +70,9 @@ char const *push(char *str);
 #ifdef NRF52840_XXAA
 /* Logger header implementation with nRF specific implementation. */
 #   include "logger_nrf_log.hpp"
+#elif defined(LOGGER_HOST)
+/* Logger header implementation for host builds (see tools/flash_emulator). */
+#   include "logger_host.hpp"
 #else
 #   warning "Application specific logging header(s) not found"
 #endif
@@ -0,0 +1,424 @@
+/*
+ * logger_flash.cpp - persistent flash log ring backend for nRF's log library.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "logger_flash.hpp"
+
+#include <app_error.h>
+#include <nordic_common.h>
+#include <nrf.h>
+#include <nrf_fstorage.h>
+#include <nrf_fstorage_nvmc.h>
+#include <nrf_fstorage_sd.h>
+#include <nrf_log_backend_interface.h>
+#include <nrf_log_backend_serial.h>
+#include <nrf_log_ctrl.h>
+#include <nrf_section.h>
+#include <sdk_config.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace logger::flash {
+#if LOGGER_USE_FLASH_BACKEND
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Types
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Header written at the start of every page in the ring.
+ */
+struct PageHeader {
+    std::uint32_t magic;    /**< PAGE_MAGIC if the page has been written. */
+    std::uint32_t seq;      /**< Incremented each time a new page is started. */
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Marks a page as part of the log ring ("LOG1"). */
+static constexpr std::uint32_t PAGE_MAGIC = { 0x31474F4C };
+
+/**< Number of pages in the ring. */
+static constexpr std::uint32_t PAGE_COUNT = { LOGGER_FLASH_PAGES };
+
+/**< Number of log bytes that fit in a page. */
+static constexpr std::uint32_t PAGE_DATA_SIZE = { PAGE_SIZE - PAGE_HEADER_SIZE };
+
+/**< Size of a chunk in words. */
+static constexpr std::size_t CHUNK_WORDS = { CHUNK_SIZE / sizeof(std::uint32_t) };
+
+static_assert(sizeof(PageHeader) == PAGE_HEADER_SIZE, "Unexpected page header size");
+static_assert(PAGE_HEADER_SIZE < CHUNK_SIZE, "Page header must fit in the first chunk");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * nRF log backend API: formats a log entry into the staging chunk.
+ *
+ * @param[in] p_backend the backend instance.
+ * @param[in] p_msg     the log entry.
+ */
+static void put(nrf_log_backend_t const *p_backend, nrf_log_entry_t *p_msg);
+
+/**
+ * nRF log backend API: switches to synchronous NVMC writes after a fault.
+ *
+ * @param[in] p_backend the backend instance.
+ */
+static void panic_set(nrf_log_backend_t const *p_backend);
+
+/**
+ * nRF log backend API: nothing to do, partial chunks are only written in panic mode.
+ *
+ * @param[in] p_backend the backend instance.
+ */
+static void flush(nrf_log_backend_t const *p_backend);
+
+/**
+ * Output function for the serial formatter, appends formatted text to the staging chunk.
+ *
+ * @param[in] p_context unused.
+ * @param[in] buffer    formatted text.
+ * @param[in] len       length of the text.
+ */
+static void flash_tx(void const *p_context, char const *buffer, std::size_t len);
+
+/** Finds the newest page and the first unwritten chunk in it. */
+static void find_write_position();
+
+/** Starts filling the current staging chunk, moving to the next page if needed. */
+static void begin_chunk();
+
+/** Pads the current staging chunk and queues it to be written to flash. */
+static void commit_chunk();
+
+/**
+ * Handles fstorage completion events.
+ *
+ * @param[in] p_evt the fstorage event.
+ */
+static void fstorage_evt_handler(nrf_fstorage_evt_t *p_evt);
+
+/**
+ * Returns the address of a page in the ring.
+ *
+ * @param[in] page index of the page in the ring.
+ */
+static std::uint32_t page_addr(std::uint32_t page);
+
+/**
+ * Returns a pointer to the header of a page in the ring.
+ *
+ * @param[in] page index of the page in the ring.
+ */
+static const PageHeader *page_header(std::uint32_t page);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< API for the nRF log backend. */
+static const nrf_log_backend_api_t g_backend_api = {
+    .put       = put,
+    .panic_set = panic_set,
+    .flush     = flush,
+};
+
+/* NRF_LOG_BACKEND_DEF's designated initializers are out of declaration order, which C++ does not
+   allow, so the backend instance is defined by hand. */
+
+/**< Control block for the nRF log backend. */
+static nrf_log_backend_cb_t g_backend_cb = {
+    .p_next  = nullptr,
+    .id      = NRF_LOG_BACKEND_INVALID_ID,
+    .enabled = false,
+};
+
+/**< nRF log backend instance. */
+NRF_SECTION_ITEM_REGISTER(log_backends, static const nrf_log_backend_t g_backend) = {
+    .p_api  = &g_backend_api,
+    .p_ctx  = nullptr,
+    .p_name = const_cast<char *>("flash"),
+    .p_cb   = &g_backend_cb,
+};
+
+/**< fstorage instance covering the log ring. */
+NRF_FSTORAGE_DEF(static nrf_fstorage_t g_fstorage) = {
+    .evt_handler = fstorage_evt_handler,
+    .start_addr  = LOGGER_FLASH_START_ADDR,
+    .end_addr    = LOGGER_FLASH_START_ADDR + (LOGGER_FLASH_PAGES * PAGE_SIZE),
+};
+
+/**< Buffer the serial formatter formats into. */
+static std::uint8_t g_string_buff[LOGGER_FLASH_STRING_BUFFER_SIZE];
+
+/**< Double-buffered staging chunks; one can be filled while the other is being written. */
+static std::uint32_t g_chunks[2][CHUNK_WORDS];
+
+/**< Whether each staging chunk has a write in progress. */
+static volatile bool g_chunk_busy[2];
+
+/**< Index of the staging chunk being filled. */
+static std::size_t g_chunk;
+
+/**< Whether the current staging chunk has been started (see begin_chunk()). */
+static bool g_chunk_started;
+
+/**< Number of bytes in the current staging chunk. */
+static std::size_t g_chunk_fill;
+
+/**< Page currently being written. */
+static std::uint32_t g_page { PAGE_COUNT - 1 };
+
+/**< Offset of the next chunk to write in the current page. */
+static std::uint32_t g_page_offset { PAGE_SIZE };
+
+/**< Sequence number of the current page. */
+static std::uint32_t g_seq;
+
+/**< Number of log fragments dropped because flash writes could not keep up. */
+static volatile std::uint32_t g_dropped;
+
+/**< Whether a fault has occurred and writes are now synchronous. */
+static bool g_in_panic;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init() {
+    APP_ERROR_CHECK(nrf_fstorage_init(&g_fstorage, &nrf_fstorage_sd, nullptr));
+
+    find_write_position();
+
+    if (nrf_log_backend_add(&g_backend, NRF_LOG_SEVERITY_INFO) < 0) {
+        APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
+    }
+
+    nrf_log_backend_enable(&g_backend);
+}
+
+std::size_t read(std::uint32_t offset, std::uint8_t *buffer, std::size_t len) {
+    std::size_t total = { 0 };
+
+    /* Pages are written in order, so the page after the current one holds the oldest data */
+    for (std::uint32_t i = 1; i <= PAGE_COUNT && len > 0; ++i) {
+        auto page = (g_page + i) % PAGE_COUNT;
+
+        if (page_header(page)->magic != PAGE_MAGIC) {
+            continue;
+        }
+
+        std::uint32_t data_len = { PAGE_DATA_SIZE };
+        if (page == g_page) {
+            data_len = g_page_offset > PAGE_HEADER_SIZE ? g_page_offset - PAGE_HEADER_SIZE : 0;
+        }
+
+        if (offset >= data_len) {
+            offset -= data_len;
+            continue;
+        }
+
+        auto read_len = std::min<std::size_t>(len, data_len - offset);
+        memcpy(&buffer[total],
+               reinterpret_cast<const void *>(page_addr(page) + PAGE_HEADER_SIZE + offset),
+               read_len);
+
+        total += read_len;
+        len -= read_len;
+        offset = 0;
+    }
+
+    return total;
+}
+
+std::uint32_t dropped() {
+    return g_dropped;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void put(nrf_log_backend_t const *p_backend, nrf_log_entry_t *p_msg) {
+    nrf_log_backend_serial_put(p_backend, p_msg, g_string_buff, sizeof(g_string_buff), flash_tx);
+
+    /* Nothing is buffered after a fault - the system is about to reset */
+    if (g_in_panic && g_chunk_started) {
+        commit_chunk();
+    }
+}
+
+static void panic_set(nrf_log_backend_t const *p_backend) {
+    UNUSED_PARAMETER(p_backend);
+
+    /* The SoftDevice can no longer service flash requests, write synchronously instead */
+    if (nrf_fstorage_init(&g_fstorage, &nrf_fstorage_nvmc, nullptr) != NRF_SUCCESS) {
+        return;
+    }
+
+    /* The MWU may otherwise block NVMC access while the SoftDevice is enabled */
+    NVIC_DisableIRQ(MWU_IRQn);
+
+    /* Any write still queued with the SoftDevice will never complete */
+    g_chunk_busy[0] = false;
+    g_chunk_busy[1] = false;
+    g_in_panic = true;
+
+    if (g_chunk_started) {
+        commit_chunk();
+    }
+}
+
+static void flush(nrf_log_backend_t const *p_backend) {
+    UNUSED_PARAMETER(p_backend);
+}
+
+static void flash_tx(void const *p_context, char const *buffer, std::size_t len) {
+    UNUSED_PARAMETER(p_context);
+
+    while (len > 0) {
+        if (!g_chunk_started) {
+            if (g_chunk_busy[g_chunk]) {
+                ++g_dropped;
+                return;
+            }
+
+            begin_chunk();
+        }
+
+        auto copy_len = std::min<std::size_t>(len, CHUNK_SIZE - g_chunk_fill);
+        memcpy(reinterpret_cast<std::uint8_t *>(g_chunks[g_chunk]) + g_chunk_fill, buffer, copy_len);
+
+        g_chunk_fill += copy_len;
+        buffer += copy_len;
+        len -= copy_len;
+
+        if (g_chunk_fill == CHUNK_SIZE) {
+            commit_chunk();
+        }
+    }
+}
+
+static void find_write_position() {
+    bool found = { false };
+
+    for (std::uint32_t page = 0; page < PAGE_COUNT; ++page) {
+        const auto *header = page_header(page);
+
+        if (header->magic != PAGE_MAGIC) {
+            continue;
+        }
+
+        /* Compare as a signed difference so the sequence number may wrap */
+        if (!found || static_cast<std::int32_t>(header->seq - g_seq) > 0) {
+            found = true;
+            g_page = page;
+            g_seq = header->seq;
+        }
+    }
+
+    if (!found) {
+        /* Empty ring; the first chunk will start page 0 */
+        return;
+    }
+
+    /* Written chunks never start with an erased word (the first has the header, others text).
+       A write that was queued but lost at reset (or panic) leaves an erased hole before later
+       chunks, so resume after the last written chunk rather than at the first erased one. */
+    std::uint32_t last_chunk = { PAGE_SIZE - CHUNK_SIZE };
+
+    for (; last_chunk > 0; last_chunk -= CHUNK_SIZE) {
+        auto first_word = *reinterpret_cast<const std::uint32_t *>(page_addr(g_page) + last_chunk);
+
+        if (first_word != 0xFFFFFFFF) {
+            break;
+        }
+    }
+
+    g_page_offset = last_chunk + CHUNK_SIZE;
+}
+
+static void begin_chunk() {
+    g_chunk_fill = 0;
+    g_chunk_started = true;
+
+    if (g_page_offset == PAGE_SIZE) {
+        g_page = (g_page + 1) % PAGE_COUNT;
+        g_page_offset = 0;
+    }
+
+    if (g_page_offset == 0) {
+        PageHeader header = {
+            .magic = PAGE_MAGIC,
+            .seq   = ++g_seq,
+        };
+
+        memcpy(g_chunks[g_chunk], &header, sizeof(header));
+        g_chunk_fill = sizeof(header);
+    }
+}
+
+static void commit_chunk() {
+    auto *chunk = reinterpret_cast<std::uint8_t *>(g_chunks[g_chunk]);
+    memset(&chunk[g_chunk_fill], 0xFF, CHUNK_SIZE - g_chunk_fill);
+
+    /* Starting a new page; erase the oldest page in the ring. fstorage executes in order. */
+    if (g_page_offset == 0) {
+        if (nrf_fstorage_erase(&g_fstorage, page_addr(g_page), 1, nullptr) != NRF_SUCCESS) {
+            ++g_dropped;
+        }
+    }
+
+    g_chunk_busy[g_chunk] = true;
+    if (nrf_fstorage_write(&g_fstorage, page_addr(g_page) + g_page_offset, chunk, CHUNK_SIZE,
+                           reinterpret_cast<void *>(g_chunk)) != NRF_SUCCESS) {
+        /* Nothing was queued, so the next chunk reuses this slot rather than leaving a hole */
+        g_chunk_busy[g_chunk] = false;
+        g_chunk_started = false;
+        ++g_dropped;
+        return;
+    }
+
+    g_page_offset += CHUNK_SIZE;
+    g_chunk ^= 1;
+    g_chunk_started = false;
+}
+
+static void fstorage_evt_handler(nrf_fstorage_evt_t *p_evt) {
+    if (p_evt->id != NRF_FSTORAGE_EVT_WRITE_RESULT) {
+        return;
+    }
+
+    g_chunk_busy[reinterpret_cast<std::uintptr_t>(p_evt->p_param)] = false;
+
+    if (p_evt->result != NRF_SUCCESS) {
+        ++g_dropped;
+    }
+}
+
+static std::uint32_t page_addr(std::uint32_t page) {
+    return LOGGER_FLASH_START_ADDR + (page * PAGE_SIZE);
+}
+
+static const PageHeader *page_header(std::uint32_t page) {
+    return reinterpret_cast<const PageHeader *>(page_addr(page));
+}
+
+#else  // !LOGGER_USE_FLASH_BACKEND
+
+void init() {}
+std::size_t read(std::uint32_t offset, std::uint8_t *buffer, std::size_t len) { return 0; }
+std::uint32_t dropped() { return 0; }
+
+#endif  // LOGGER_USE_FLASH_BACKEND
+
+}  // namespace logger::flash
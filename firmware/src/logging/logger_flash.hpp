@@ -0,0 +1,69 @@
+/*
+ * logger_flash.hpp - persistent flash log ring backend for nRF's log library.
+ *
+ * Formatted log output is staged in RAM and written to flash in whole, page-aligned chunks from
+ * the logger thread, so flash operations never happen on the control path. The ring cycles
+ * through its pages in order (each erase goes to the least recently erased page), and each page
+ * starts with a sequence number so the write position and the oldest data can be found again
+ * after a reset.
+ *
+ * On a fault the backend switches to synchronous NVMC writes so the final log flush makes it to
+ * flash before the system resets.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config/app_config.h"
+
+namespace logger::flash {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Size of a flash page on the nRF52840. */
+inline constexpr std::uint32_t PAGE_SIZE = { 0x1000 };
+
+/**< Size of the header at the start of each page (magic + sequence number). */
+inline constexpr std::uint32_t PAGE_HEADER_SIZE = { 8 };
+
+/**< Size of each flash write. */
+inline constexpr std::uint32_t CHUNK_SIZE = { LOGGER_FLASH_CHUNK_SIZE };
+
+static_assert(PAGE_SIZE % CHUNK_SIZE == 0, "Chunks must evenly divide a flash page");
+static_assert(CHUNK_SIZE % sizeof(std::uint32_t) == 0, "Chunks must be word-aligned");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initializes flash storage, finds the current write position and registers the backend with
+ * nRF's log library.
+ */
+void init();
+
+/**
+ * Reads logged bytes from the ring, oldest first.
+ *
+ * Unused bytes at the end of chunks flushed early (e.g. on a fault) are 0xFF and can be skipped.
+ *
+ * @param[in]  offset byte offset into the logged data, starting from the oldest data.
+ * @param[out] buffer buffer to read into.
+ * @param[in]  len    maximum number of bytes to read.
+ *
+ * @return the number of bytes read, 0 once offset is past the end of the logged data.
+ */
+std::size_t read(std::uint32_t offset, std::uint8_t *buffer, std::size_t len);
+
+/**
+ * Returns the number of log fragments dropped because flash writes could not keep up.
+ */
+std::uint32_t dropped();
+
+}  // namespace logger::flash
@@ -0,0 +1,285 @@
+/*
+ * logger_format.hpp - compile-time format string parsing for the logger.
+ *
+ * Format strings are written as "..."_fmt literals, which turn the string into a type so that it
+ * can be parsed at compile time. Each log's arguments are checked against the conversion
+ * specifiers in its format string, and the backends use the parsed specifiers to decide how each
+ * argument is passed on (64-bit and floating point arguments don't fit in a single word). All of
+ * this is resolved at compile time.
+ *
+ * Supported conversions are d, i, u, o, x, X, c, s, p and f, F, e, E, g, G with the usual flags,
+ * widths, precisions and length modifiers. Argument widths ('*'), %n and long double are not
+ * supported.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace logger {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class Conversion {
+    INT,        /**< Integer that fits in 32 bits (d, i, u, o, x, X, c) */
+    INT64,      /**< 64-bit integer (ll or j length modifier) */
+    DOUBLE,     /**< Floating point (f, F, e, E, g, G) */
+    STRING,     /**< Null-terminated string (s) */
+    POINTER,    /**< Pointer (p) */
+    INVALID,    /**< Unsupported or malformed conversion specifier */
+};
+
+/**
+ * A parsed conversion specifier.
+ */
+struct Spec {
+    Conversion type;        /**< What kind of argument the specifier takes */
+    char conversion;        /**< The conversion character, e.g. 'd' */
+    bool left_justify;      /**< '-' flag was given */
+    bool zero_pad;          /**< '0' flag was given */
+    std::size_t width;      /**< Minimum field width, 0 if not given */
+    int precision;          /**< Precision, -1 if not given */
+    std::size_t begin;      /**< Index of the '%' in the format string */
+    std::size_t end;        /**< Index one past the conversion character */
+};
+
+/**
+ * A format string as a type. Created with the _fmt literal.
+ */
+template<char ... chars>
+struct Format {
+    static constexpr char str[] = { chars..., '\0' };
+};
+
+template<typename T>
+struct is_format : std::false_type {};
+
+template<char ... chars>
+struct is_format<Format<chars...>> : std::true_type {};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Creates a format string type, e.g. logger::log<Level::INFO>("value: %d"_fmt, value).
+ * Uses GCC's string literal operator template extension.
+ */
+template<typename Char, Char ... chars>
+constexpr Format<chars...> operator""_fmt() {
+    return {};
+}
+
+/**
+ * Finds the next conversion specifier, skipping over "%%".
+ *
+ * @param[in] str the format string.
+ * @param[in] pos index to start searching from.
+ *
+ * @return the index of the specifier's '%', or of the null terminator if there are none left.
+ */
+constexpr std::size_t find_spec(const char *str, std::size_t pos) {
+    while (str[pos] != '\0') {
+        if (str[pos] == '%') {
+            if (str[pos + 1] != '%') {
+                return pos;
+            }
+
+            ++pos;
+        }
+
+        ++pos;
+    }
+
+    return pos;
+}
+
+/**
+ * Parses the conversion specifier starting at the given '%'.
+ *
+ * @param[in] str   the format string.
+ * @param[in] begin index of the specifier's '%'.
+ *
+ * @return the parsed specifier, with type INVALID if it is malformed or unsupported.
+ */
+constexpr Spec parse_spec(const char *str, std::size_t begin) {
+    Spec spec = { Conversion::INVALID, '\0', false, false, 0, -1, begin, begin + 1 };
+    std::size_t i = begin + 1;
+
+    /* Flags */
+    for (bool is_flag = true; is_flag; ) {
+        switch (str[i]) {
+            case '-': spec.left_justify = true; ++i; break;
+            case '0': spec.zero_pad = true;     ++i; break;
+            case '+':
+            case ' ':
+            case '#': ++i; break;
+            default: is_flag = false; break;
+        }
+    }
+
+    /* Width and precision */
+    for (; str[i] >= '0' && str[i] <= '9'; ++i) {
+        spec.width = spec.width * 10 + (str[i] - '0');
+    }
+
+    if (str[i] == '.') {
+        spec.precision = 0;
+
+        for (++i; str[i] >= '0' && str[i] <= '9'; ++i) {
+            spec.precision = spec.precision * 10 + (str[i] - '0');
+        }
+    }
+
+    /* Length modifier */
+    std::size_t int_size = { sizeof(int) };
+    bool has_length = { true };
+
+    if (str[i] == 'h') {
+        i += (str[i + 1] == 'h') ? 2 : 1;
+    } else if (str[i] == 'l' && str[i + 1] == 'l') {
+        int_size = sizeof(long long);  // NOLINT(runtime/int)
+        i += 2;
+    } else if (str[i] == 'l') {
+        int_size = sizeof(long);  // NOLINT(runtime/int)
+        ++i;
+    } else if (str[i] == 'j') {
+        int_size = sizeof(std::intmax_t);
+        ++i;
+    } else if (str[i] == 'z') {
+        int_size = sizeof(std::size_t);
+        ++i;
+    } else if (str[i] == 't') {
+        int_size = sizeof(std::ptrdiff_t);
+        ++i;
+    } else {
+        has_length = false;
+    }
+
+    /* Conversion */
+    spec.conversion = str[i];
+    spec.end = (str[i] == '\0') ? i : i + 1;
+
+    switch (str[i]) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            spec.type = (int_size > sizeof(std::uint32_t)) ? Conversion::INT64 : Conversion::INT;
+            break;
+
+        case 'c':
+            spec.type = has_length ? Conversion::INVALID : Conversion::INT;
+            break;
+
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            spec.type = has_length ? Conversion::INVALID : Conversion::DOUBLE;
+            break;
+
+        case 's':
+            spec.type = has_length ? Conversion::INVALID : Conversion::STRING;
+            break;
+
+        case 'p':
+            spec.type = has_length ? Conversion::INVALID : Conversion::POINTER;
+            break;
+
+        default:
+            spec.type = Conversion::INVALID;
+            break;
+    }
+
+    return spec;
+}
+
+/**
+ * Returns the number of conversion specifiers in a format string.
+ */
+constexpr std::size_t spec_count(const char *str) {
+    std::size_t count = { 0 };
+
+    for (std::size_t pos = find_spec(str, 0); str[pos] != '\0';
+         pos = find_spec(str, parse_spec(str, pos).end)) {
+        ++count;
+    }
+
+    return count;
+}
+
+/**
+ * Returns the conversion specifier for the argument at the given index.
+ */
+constexpr Spec get_spec(const char *str, std::size_t index) {
+    std::size_t pos = find_spec(str, 0);
+
+    for (; index > 0; --index) {
+        pos = find_spec(str, parse_spec(str, pos).end);
+    }
+
+    return parse_spec(str, pos);
+}
+
+/**
+ * Returns true if every conversion specifier in a format string is supported.
+ */
+constexpr bool specs_valid(const char *str) {
+    for (std::size_t i = 0; i < spec_count(str); ++i) {
+        if (get_spec(str, i).type == Conversion::INVALID) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Checks if an argument type can be passed to a conversion without being truncated.
+ */
+template<typename T>
+constexpr bool arg_matches(Conversion type) {
+    constexpr bool is_int = std::is_integral_v<T> ||
+                            (std::is_enum_v<T> && std::is_convertible_v<T, int>);
+
+    switch (type) {
+        case Conversion::INT:     return is_int && sizeof(T) <= sizeof(std::uint32_t);
+        case Conversion::INT64:   return is_int;
+        case Conversion::DOUBLE:  return std::is_floating_point_v<T>;
+        case Conversion::STRING:  return std::is_same_v<T, char *> ||
+                                         std::is_same_v<T, const char *>;
+        case Conversion::POINTER: return std::is_pointer_v<T> || std::is_null_pointer_v<T>;
+        default:                  return false;
+    }
+}
+
+/**
+ * Checks every argument against its conversion specifier.
+ */
+template<typename Fmt, typename ... Args, std::size_t ... indices>
+constexpr bool args_match(std::index_sequence<indices...>) {
+    return (spec_count(Fmt::str) == sizeof...(Args)) &&
+           (arg_matches<Args>(get_spec(Fmt::str, indices).type) && ...);
+}
+
+/**
+ * Fails compilation if the arguments of a log don't match its format string. Evaluate it in a
+ * static_assert so the checks happen before the format string is used.
+ *
+ * @return true (if it compiles).
+ */
+template<typename Fmt, typename ... Args>
+constexpr bool check_format() {
+    static_assert(is_format<Fmt>::value, "Format strings must be \"...\"_fmt literals");
+    static_assert(specs_valid(Fmt::str), "Unsupported conversion specifier in format string");
+    static_assert(spec_count(Fmt::str) == sizeof...(Args),
+                  "Number of arguments doesn't match the format string");
+    static_assert(args_match<Fmt, Args...>(std::index_sequence_for<Args...>{}),
+                  "Argument type doesn't match its conversion specifier");
+
+    return true;
+}
+
+}  // namespace logger
@@ -17,6 +17,13 @@
 #include <nrf_log_ctrl.h>
 #include <nrf_log_default_backends.h>
 
+#include <algorithm>
+#include <cstring>
+
+#include "logger_flash.hpp"
+#include "logger_tokenized.hpp"
+#include "timestamp.hpp"
+
 namespace logger {
 #if NRF_LOG_ENABLED
 
@@ -28,7 +35,8 @@ namespace logger {
  * Thread for handling the logger.
  *
  * This thread is responsible for processing log entries if logs are deferred.
- * Thread flushes all log entries and suspends. It is resumed by idle task hook.
+ * Thread flushes all log entries (including tokenized frames) and suspends. It is resumed by idle
+ * task hook.
  *
  * @param[in] arg context passed to the thread (nullptr).
  */
@@ -46,12 +54,15 @@ static TaskHandle_t logger_thandle;
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void init() {
-    // TODO(CMK) 06/19/20: timestamp function
-    APP_ERROR_CHECK(NRF_LOG_INIT(nullptr));
+    timestamp::init();
+    APP_ERROR_CHECK(NRF_LOG_INIT(timestamp::now, timestamp::FREQUENCY));
 
     NRF_LOG_DEFAULT_BACKENDS_INIT();
 
-    // TODO(CMK) 06/18/20: logger flash backend
+    flash::init();
+    tokenized::init();
+
+    log<Level::DBG>("Timestamp cost: %u cycles"_fmt, timestamp::measure_cycles());
 
     if (pdPASS != xTaskCreate(logger_thread, "Logger", 256, nullptr, 3, &logger_thandle)) {
         APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
@@ -62,6 +73,58 @@ void idle() {
      vTaskResume(logger_thandle);
 }
 
+char const *push_int64(std::uint64_t value, const Spec &spec) {
+    /* Fits the longest value (22 octal digits) plus sign, and limits the field width */
+    char str[32];
+
+    const bool is_negative = (spec.conversion == 'd' || spec.conversion == 'i') &&
+                             static_cast<std::int64_t>(value) < 0;
+    const std::uint64_t base = (spec.conversion == 'o') ? 8 :
+                               (spec.conversion == 'x' || spec.conversion == 'X') ? 16 : 10;
+    const char *digits = (spec.conversion == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+    const std::size_t width = std::min(spec.width, sizeof(str) - 1);
+
+    if (is_negative) {
+        value = -value;
+    }
+
+    /* Build the number backwards from the end of the buffer */
+    std::size_t pos = sizeof(str) - 1;
+    str[pos] = '\0';
+
+    do {
+        str[--pos] = digits[value % base];
+        value /= base;
+    } while (value != 0);
+
+    if (spec.zero_pad && !spec.left_justify) {
+        while (sizeof(str) - 1 - pos + (is_negative ? 1 : 0) < width) {
+            str[--pos] = '0';
+        }
+    }
+
+    if (is_negative) {
+        str[--pos] = '-';
+    }
+
+    /* The specifier was rewritten to a plain "%s", so apply the field width here */
+    const std::size_t len = sizeof(str) - 1 - pos;
+
+    if (len < width) {
+        if (spec.left_justify) {
+            std::memmove(str, &str[pos], len);
+            std::memset(&str[len], ' ', width - len);
+            str[width] = '\0';
+            pos = 0;
+        } else {
+            pos -= width - len;
+            std::memset(&str[pos], ' ', width - len);
+        }
+    }
+
+    return push(&str[pos]);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Private Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -71,6 +134,7 @@ static void logger_thread(void *arg) {
 
     while (true) {
         NRF_LOG_FLUSH();
+        tokenized::flush();
         vTaskSuspend(nullptr);
     }
 }
@@ -79,6 +143,7 @@ static void logger_thread(void *arg) {
 
 void init() {}
 void idle() {}
+char const *push_int64(std::uint64_t value, const Spec &spec) { return ""; }
 
 #endif  // NRF_LOG_ENABLED
 
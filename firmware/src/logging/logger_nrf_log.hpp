@@ -8,10 +8,14 @@
 
 #pragma once
 
+#include <nordic_common.h>
 #include <nrf_log.h>
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <type_traits>
+#include <utility>
 
 namespace logger {
 
@@ -74,35 +78,257 @@ static constexpr bool is_log_enabled() {
     return false;
 }
 
+/**
+ * Pass through to nRF SDK's macro.
+ */
+inline char const *push(char *str) {
+    if constexpr (NRF_LOG_ENABLED) {
+        return NRF_LOG_PUSH(str);
+    } else {
+        return str;
+    }
+}
+
+/**< Precision used for float conversions without one, same as printf. */
+inline constexpr int DEFAULT_FLOAT_PRECISION = { 6 };
+
+/**
+ * Formats a 64-bit integer, which nRF's formatter can't handle, and pushes the resulting string.
+ *
+ * @param[in] value the value, sign-extended if the argument was signed.
+ * @param[in] spec  the argument's conversion specifier.
+ *
+ * @ret the pushed string.
+ */
+char const *push_int64(std::uint64_t value, const Spec &spec);
+
+/**
+ * Rewrites a format string for nRF's formatter, which only takes 32-bit arguments. Floats become
+ * "%s%d.%0<precision>d" (sign, integer and fractional parts, like NRF_LOG_FLOAT_MARKER) and
+ * 64-bit integers become "%s" for a pushed string. Other specifiers are copied as is.
+ *
+ * @param[in]  str the original format string.
+ * @param[out] out buffer for the rewritten string, or nullptr to only get the length.
+ *
+ * @ret the length of the rewritten string (without the null terminator).
+ */
+constexpr std::size_t rewrite_format(const char *str, char *out) {
+    std::size_t len = { 0 };
+    auto put = [&](char c) {
+        if (out != nullptr) {
+            out[len] = c;
+        }
+        ++len;
+    };
+
+    for (std::size_t pos = 0; str[pos] != '\0'; ) {
+        const std::size_t spec_pos = find_spec(str, pos);
+
+        for (; pos < spec_pos; ++pos) {
+            put(str[pos]);
+        }
+
+        if (str[pos] == '\0') {
+            break;
+        }
+
+        const Spec spec = parse_spec(str, pos);
+        const int precision = (spec.precision < 0) ? DEFAULT_FLOAT_PRECISION : spec.precision;
+
+        if (spec.type == Conversion::DOUBLE) {
+            for (char c : "%s%d") {
+                if (c != '\0') {
+                    put(c);
+                }
+            }
+
+            if (precision > 0) {
+                for (char c : ".%0") {
+                    if (c != '\0') {
+                        put(c);
+                    }
+                }
+                put(static_cast<char>('0' + precision));
+                put('d');
+            }
+        } else if (spec.type == Conversion::INT64) {
+            put('%');
+            put('s');
+        } else {
+            for (std::size_t i = pos; i < spec.end; ++i) {
+                put(str[i]);
+            }
+        }
+
+        pos = spec.end;
+    }
+
+    if (out != nullptr) {
+        out[len] = '\0';
+    }
+
+    return len;
+}
+
+/**
+ * Returns true if a format string has to be rewritten for nRF's formatter.
+ */
+constexpr bool needs_rewrite(const char *str) {
+    for (std::size_t i = 0; i < spec_count(str); ++i) {
+        const Conversion type = get_spec(str, i).type;
+
+        if (type == Conversion::DOUBLE || type == Conversion::INT64) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Returns the number of 32-bit words the arguments of a format string are passed as.
+ */
+constexpr std::size_t word_count(const char *str) {
+    std::size_t count = { 0 };
+
+    for (std::size_t i = 0; i < spec_count(str); ++i) {
+        const Spec spec = get_spec(str, i);
+
+        if (spec.type == Conversion::DOUBLE) {
+            count += (spec.precision == 0) ? 2 : 3;
+        } else {
+            count += 1;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * The format string as passed to nRF's log library. Kept in flash since logs are deferred.
+ */
+template<typename Fmt>
+struct NrfFormat {
+    static constexpr std::size_t len = rewrite_format(Fmt::str, nullptr);
+
+    static constexpr std::array<char, len + 1> rewritten = [] {
+        std::array<char, len + 1> out = {};
+        rewrite_format(Fmt::str, out.data());
+        return out;
+    }();
+
+    static constexpr const char *str() {
+        if constexpr (needs_rewrite(Fmt::str)) {
+            return rewritten.data();
+        } else {
+            return Fmt::str;
+        }
+    }
+};
+
+/**
+ * Converts an argument to the 32-bit words passed to nRF's log library.
+ *
+ * @param[out] words where to write the argument's words.
+ * @param[in]  arg   the argument.
+ *
+ * @ret the number of words written.
+ */
+template<typename Fmt, std::size_t index, typename T>
+inline std::size_t to_words(std::uint32_t *words, T arg) {
+    constexpr Spec spec = get_spec(Fmt::str, index);
+
+    if constexpr (spec.type == Conversion::DOUBLE) {
+        constexpr int precision = (spec.precision < 0) ? DEFAULT_FLOAT_PRECISION : spec.precision;
+        static_assert(spec.conversion == 'f' || spec.conversion == 'F',
+                      "nRF's log library only supports %f style floats");
+        static_assert(precision <= 9, "Float precision must be at most 9");
+
+        constexpr T scale = [] {
+            T scale = { 1 };
+            for (int i = 0; i < precision; ++i) {
+                scale *= 10;
+            }
+            return scale;
+        }();
+
+        /* Same split as NRF_LOG_FLOAT, the integer part carries the sign unless it's 0 */
+        const std::int32_t integer = static_cast<std::int32_t>(arg);
+        const T fraction = (arg - static_cast<T>(integer)) * scale;
+
+        words[0] = (std::uint32_t) ((arg < 0 && integer == 0) ? "-" : "");
+        words[1] = (std::uint32_t) integer;
+
+        if constexpr (precision > 0) {
+            words[2] = (std::uint32_t) (fraction < 0 ? -fraction : fraction);
+            return 3;
+        } else {
+            return 2;
+        }
+    } else if constexpr (spec.type == Conversion::INT64) {
+        words[0] = (std::uint32_t) push_int64(static_cast<std::uint64_t>(arg), spec);
+        return 1;
+    } else if constexpr (std::is_same_v<T, char *>) {
+        words[0] = (std::uint32_t) push(arg);
+        return 1;
+    } else {
+        words[0] = (std::uint32_t) arg;
+        return 1;
+    }
+}
+
+/**
+ * Converts all arguments of a log to 32-bit words.
+ *
+ * @param[out] words where to write the words, must hold word_count() words.
+ * @param[in]  args  the arguments.
+ */
+template<typename Fmt, std::size_t ... indices, typename ... Args>
+inline void to_words(std::uint32_t *words, std::index_sequence<indices...>, Args ... args) {
+    std::size_t pos = { 0 };
+
+    ((pos += to_words<Fmt, indices>(&words[pos], args)), ...);
+    UNUSED_VARIABLE(pos);
+}
+
 /**
  * Implement the log template using nRF SDK's logger.
  * Note: Requires somewhat hacky usage of nRF logger internal functions
  *       instead of hte "NRF_LOG_<level>" macros, which don't play nicely
  *       with templates like this one.
  */
-template<Level level, Option ... options, typename ... Args>
-void log(const char *fmt, Args ... args) {
-    constexpr std::size_t arg_cnt = sizeof...(args);
+template<Level level, Option ... options, typename Fmt, typename ... Args>
+void log(Fmt, Args ... args) {
+    static_assert(check_format<Fmt, Args...>());
+
+    constexpr std::size_t word_cnt = word_count(Fmt::str);
     constexpr std::uint32_t severity = get_severity<level, options...>();
+    constexpr const char *str = NrfFormat<Fmt>::str();
+
+    static_assert(word_cnt < 7, "Arguments must fit in 6 words (floats take 3)");
 
-    static_assert(arg_cnt < 7, "Number of arguments must be less than 7");
-
-    if constexpr (!is_log_enabled<severity>()) {
-        /* Logging not enabled - do nothing */
-    } else if constexpr (arg_cnt == 0) {
-        nrf_log_frontend_std_0(LOG_SEVERITY_MOD_ID(severity), fmt, ((std::uint32_t) args)...);
-    } else if constexpr (arg_cnt == 1) {
-        nrf_log_frontend_std_1(LOG_SEVERITY_MOD_ID(severity), fmt, ((std::uint32_t) args)...);
-    } else if constexpr (arg_cnt == 2) {
-        nrf_log_frontend_std_2(LOG_SEVERITY_MOD_ID(severity), fmt, ((std::uint32_t) args)...);
-    } else if constexpr (arg_cnt == 3) {
-        nrf_log_frontend_std_3(LOG_SEVERITY_MOD_ID(severity), fmt, ((std::uint32_t) args)...);
-    } else if constexpr (arg_cnt == 4) {
-        nrf_log_frontend_std_4(LOG_SEVERITY_MOD_ID(severity), fmt, ((std::uint32_t) args)...);
-    } else if constexpr (arg_cnt == 5) {
-        nrf_log_frontend_std_5(LOG_SEVERITY_MOD_ID(severity), fmt, ((std::uint32_t) args)...);
-    } else if constexpr (arg_cnt == 6) {
-        nrf_log_frontend_std_6(LOG_SEVERITY_MOD_ID(severity), fmt, ((std::uint32_t) args)...);
+    if constexpr (is_log_enabled<severity>()) {
+        /* With only 32-bit arguments this optimizes down to passing them directly */
+        std::uint32_t w[word_cnt + 1] = {};
+        to_words<Fmt>(w, std::index_sequence_for<Args...>{}, args...);
+
+        if constexpr (word_cnt == 0) {
+            nrf_log_frontend_std_0(LOG_SEVERITY_MOD_ID(severity), str);
+        } else if constexpr (word_cnt == 1) {
+            nrf_log_frontend_std_1(LOG_SEVERITY_MOD_ID(severity), str, w[0]);
+        } else if constexpr (word_cnt == 2) {
+            nrf_log_frontend_std_2(LOG_SEVERITY_MOD_ID(severity), str, w[0], w[1]);
+        } else if constexpr (word_cnt == 3) {
+            nrf_log_frontend_std_3(LOG_SEVERITY_MOD_ID(severity), str, w[0], w[1], w[2]);
+        } else if constexpr (word_cnt == 4) {
+            nrf_log_frontend_std_4(LOG_SEVERITY_MOD_ID(severity), str, w[0], w[1], w[2], w[3]);
+        } else if constexpr (word_cnt == 5) {
+            nrf_log_frontend_std_5(LOG_SEVERITY_MOD_ID(severity), str,
+                                   w[0], w[1], w[2], w[3], w[4]);
+        } else if constexpr (word_cnt == 6) {
+            nrf_log_frontend_std_6(LOG_SEVERITY_MOD_ID(severity), str,
+                                   w[0], w[1], w[2], w[3], w[4], w[5]);
+        }
     }
 }
 
@@ -118,13 +344,5 @@ void hexdump(const void *ptr, std::size_t len) {
     }
 }
 
-/**
- * Pass through to nRF SDK's macro.
- */
-inline char const *push(char *str) {
-    if constexpr (NRF_LOG_ENABLED) {
-        return NRF_LOG_PUSH(str);
-    }
-}
 
 }  // namespace logger
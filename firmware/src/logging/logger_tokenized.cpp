@@ -0,0 +1,120 @@
+/*
+ * logger_tokenized.cpp - tokenized binary logging backend.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "logger_tokenized.hpp"
+
+#include <app_util_platform.h>
+#include <nordic_common.h>
+#include <SEGGER_RTT.h>
+
+namespace logger::tokenized {
+#if LOGGER_USE_TOKENIZED_BACKEND
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the number of words currently queued. Must be called within a critical region.
+ */
+static std::size_t used_words();
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Ring buffer of queued frames. One slot is kept empty to tell full from empty. */
+static std::uint32_t g_buffer[LOGGER_TOKENIZED_BUFFER_WORDS];
+
+/**< Index of the next word to be written. */
+static std::size_t g_head;
+
+/**< Index of the next word to be read. */
+static std::size_t g_tail;
+
+/**< Number of frames dropped because the ring buffer was full. */
+static volatile std::uint32_t g_dropped;
+
+/**< Storage for the RTT up-buffer. */
+static std::uint8_t g_rtt_buffer[LOGGER_TOKENIZED_RTT_BUFFER_SIZE];
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init() {
+    SEGGER_RTT_ConfigUpBuffer(LOGGER_TOKENIZED_RTT_CHANNEL, "TokLog",
+                              g_rtt_buffer, sizeof(g_rtt_buffer),
+                              SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+}
+
+void write(const std::uint32_t *words, std::size_t words_len) {
+    CRITICAL_REGION_ENTER();
+
+    if (ARRAY_SIZE(g_buffer) - 1 - used_words() < words_len) {
+        ++g_dropped;
+    } else {
+        for (std::size_t i = 0; i < words_len; ++i) {
+            g_buffer[g_head] = words[i];
+            g_head = (g_head + 1) % ARRAY_SIZE(g_buffer);
+        }
+    }
+
+    CRITICAL_REGION_EXIT();
+}
+
+void flush() {
+    std::uint32_t frame[FRAME_HEADER_WORDS + MAX_ARGS];
+
+    while (true) {
+        std::size_t frame_len = 0;
+
+        /* Pop a single frame so that logs from interrupts can keep being queued meanwhile */
+        CRITICAL_REGION_ENTER();
+
+        if (used_words() != 0) {
+            frame_len = FRAME_HEADER_WORDS + (g_buffer[g_tail] & 0xFF);
+
+            for (std::size_t i = 0; i < frame_len; ++i) {
+                frame[i] = g_buffer[g_tail];
+                g_tail = (g_tail + 1) % ARRAY_SIZE(g_buffer);
+            }
+        }
+
+        CRITICAL_REGION_EXIT();
+
+        if (frame_len == 0) {
+            return;
+        }
+
+        /* Skip mode: either the whole frame fits in the RTT buffer or none of it is written */
+        SEGGER_RTT_Write(LOGGER_TOKENIZED_RTT_CHANNEL, frame, frame_len * sizeof(frame[0]));
+    }
+}
+
+std::uint32_t dropped() {
+    return g_dropped;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::size_t used_words() {
+    return (g_head + ARRAY_SIZE(g_buffer) - g_tail) % ARRAY_SIZE(g_buffer);
+}
+
+#else  // !LOGGER_USE_TOKENIZED_BACKEND
+
+void init() {}
+void write(const std::uint32_t *words, std::size_t words_len) {}
+void flush() {}
+std::uint32_t dropped() { return 0; }
+
+#endif  // LOGGER_USE_TOKENIZED_BACKEND
+
+}  // namespace logger::tokenized
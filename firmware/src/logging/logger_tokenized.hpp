@@ -0,0 +1,202 @@
+/*
+ * logger_tokenized.hpp - tokenized binary logging backend.
+ *
+ * Instead of formatting on-device, each log is reduced to a 32-bit token (a compile-time hash of
+ * its format string) plus its raw 32-bit arguments. Frames are queued in a ring buffer and
+ * drained to a dedicated RTT channel by the logger thread. The format strings themselves are
+ * placed in the non-loaded ".log_tokens" section, so they stay in the ELF (for the host-side
+ * decoder in tools/) but never take up flash on the device.
+ *
+ * Frame layout (little-endian 32-bit words):
+ *     [0] header: magic (8 bits) | level (8 bits) | reserved (8 bits) | argument words (8 bits)
+ *     [1] token:  FNV-1a hash of the format string
+ *     [2] timestamp: microseconds (see timestamp.hpp)
+ *     [3...] arguments, 64-bit integers and doubles (floats are promoted) take two words, low first
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <nordic_common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "config/app_config.h"
+#include "logger.hpp"
+#include "timestamp.hpp"
+
+namespace logger::tokenized {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Marks the start of a frame so the decoder can resynchronize after dropped data. */
+inline constexpr std::uint32_t FRAME_MAGIC = { 0xA5 };
+
+/**< Number of non-argument words in each frame. */
+inline constexpr std::size_t FRAME_HEADER_WORDS = { 3 };
+
+/**< Maximum number of argument words in a single tokenized log. */
+inline constexpr std::size_t MAX_ARGS = { 8 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Computes the token for a format string (32-bit FNV-1a). Must match the decoder's hash.
+ *
+ * @param[in] str the null-terminated format string.
+ *
+ * @return the 32-bit token.
+ */
+constexpr std::uint32_t hash(const char *str) {
+    std::uint32_t hash = { 0x811C9DC5 };
+
+    while (*str != '\0') {
+        hash ^= static_cast<std::uint8_t>(*str++);
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/**
+ * Initializes the tokenized backend's RTT channel.
+ */
+void init();
+
+/**
+ * Queues a complete frame into the ring buffer. If there is not enough room the whole frame is
+ * dropped and counted.
+ *
+ * @param[in] words     the frame (header, token, then arguments).
+ * @param[in] words_len number of words in the frame.
+ */
+void write(const std::uint32_t *words, std::size_t words_len);
+
+/**
+ * Drains queued frames to the RTT channel. Called from the logger thread.
+ */
+void flush();
+
+/**
+ * Returns the number of frames dropped because the ring buffer was full.
+ */
+std::uint32_t dropped();
+
+/**
+ * Returns the number of 32-bit words the arguments of a format string take up in a frame.
+ */
+constexpr std::size_t word_count(const char *str) {
+    std::size_t count = { 0 };
+
+    for (std::size_t i = 0; i < spec_count(str); ++i) {
+        const Conversion type = get_spec(str, i).type;
+
+        count += (type == Conversion::INT64 || type == Conversion::DOUBLE) ? 2 : 1;
+    }
+
+    return count;
+}
+
+/**
+ * Converts an argument to the words it takes up in a frame.
+ *
+ * @param[out] words where to write the argument's words.
+ * @param[in]  arg   the argument.
+ *
+ * @return the number of words written.
+ */
+template<typename Fmt, std::size_t index, typename T>
+inline std::size_t to_words(std::uint32_t *words, T arg) {
+    constexpr Conversion type = get_spec(Fmt::str, index).type;
+
+    static_assert(!std::is_same_v<T, char *>,
+                  "Tokenized logs can't take string buffers, strings are resolved from the ELF");
+
+    if constexpr (type == Conversion::DOUBLE) {
+        const double value = { arg };
+        std::memcpy(words, &value, sizeof(value));
+        return 2;
+    } else if constexpr (type == Conversion::INT64) {
+        const std::uint64_t value = static_cast<std::uint64_t>(arg);
+        words[0] = static_cast<std::uint32_t>(value);
+        words[1] = static_cast<std::uint32_t>(value >> 32);
+        return 2;
+    } else {
+        words[0] = (std::uint32_t) arg;
+        return 1;
+    }
+}
+
+/**
+ * Converts all arguments of a log to the words they take up in a frame.
+ *
+ * @param[out] words where to write the words, must hold word_count() words.
+ * @param[in]  args  the arguments.
+ */
+template<typename Fmt, std::size_t ... indices, typename ... Args>
+inline void to_words(std::uint32_t *words, std::index_sequence<indices...>, Args ... args) {
+    std::size_t pos = { 0 };
+
+    ((pos += to_words<Fmt, indices>(&words[pos], args)), ...);
+    UNUSED_VARIABLE(pos);
+}
+
+/**
+ * Queues a tokenized log. Use the LOGGER_TOKENIZED macro rather than calling this directly so the
+ * format string gets placed in the token table.
+ *
+ * @param[in] fmt  the format string, its hash is the log's token.
+ * @param[in] args arguments for the formatted log.
+ */
+template<Level level, typename Fmt, typename ... Args>
+inline void log(Fmt, Args ... args) {
+    static_assert(check_format<Fmt, Args...>());
+
+    constexpr std::size_t word_cnt = word_count(Fmt::str);
+
+    static_assert(word_cnt <= MAX_ARGS, "Too many arguments for a tokenized log");
+
+    if constexpr (static_cast<unsigned>(level) >= LOGGER_TOKENIZED_MIN_LEVEL) {
+        std::uint32_t words[FRAME_HEADER_WORDS + word_cnt] = {
+            (FRAME_MAGIC << 24) | (static_cast<std::uint32_t>(level) << 16) | word_cnt,
+            hash(Fmt::str),
+            timestamp::now(),
+        };
+
+        to_words<Fmt>(&words[FRAME_HEADER_WORDS], std::index_sequence_for<Args...>{}, args...);
+        write(words, FRAME_HEADER_WORDS + word_cnt);
+    }
+}
+
+}  // namespace logger::tokenized
+
+/**
+ * Tokenized log, e.g. LOGGER_TOKENIZED(Level::INFO, "value: 0x%04X", value).
+ *
+ * The format string must be a string literal. When the tokenized backend is disabled this falls
+ * back to logger::log.
+ */
+#if LOGGER_USE_TOKENIZED_BACKEND
+#   define LOGGER_TOKENIZED(level, fmt, ...) \
+        do { \
+            using logger::operator""_fmt; \
+            static const char _logger_token_str[] \
+                __attribute__((section(".log_tokens"), used)) = fmt; \
+            logger::tokenized::log<level>(fmt ""_fmt, ##__VA_ARGS__); \
+        } while (0)
+#else
+#   define LOGGER_TOKENIZED(level, fmt, ...) \
+        do { \
+            using logger::operator""_fmt; \
+            logger::log<level>(fmt ""_fmt, ##__VA_ARGS__); \
+        } while (0)
+#endif
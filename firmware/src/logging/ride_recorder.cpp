@@ -0,0 +1,528 @@
+/*
+ * ride_recorder.cpp - onboard recorder for throttle traces, link RSSI and connection events.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "ride_recorder.hpp"
+
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <task.h>
+
+#include <app_error.h>
+#include <nrf_fstorage.h>
+#include <nrf_fstorage_sd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "logger.hpp"
+#include "timestamp.hpp"
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace ride_recorder {
+#if RIDE_RECORDER_ENABLED
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Types
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Header written at the start of every page in the ring.
+ */
+struct PageHeader {
+    std::uint32_t magic;    /**< PAGE_MAGIC if the page has been written. */
+    std::uint32_t seq;      /**< Incremented each time a new page is started. */
+};
+
+/**
+ * Header written at the start of every chunk.
+ */
+struct ChunkHeader {
+    std::uint32_t time_ms;      /**< Time of the first record, in ms since boot. */
+    std::uint16_t period_ms;    /**< Sample period. */
+    std::uint8_t ride;          /**< Ride number. */
+    std::uint8_t reserved;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Marks a page as part of the ride ring ("RID1"). */
+static constexpr std::uint32_t PAGE_MAGIC = { 0x31444952 };
+
+/**< Number of pages in the ring. */
+static constexpr std::uint32_t PAGE_COUNT = { RIDE_RECORDER_PAGES };
+
+/**< Size of a chunk in words. */
+static constexpr std::size_t CHUNK_WORDS = { CHUNK_SIZE / sizeof(std::uint32_t) };
+
+/**< Largest sample: type bit plus two escaped values. */
+static constexpr std::uint32_t MAX_SAMPLE_BITS = { 1 + 2 * (3 + 16) };
+
+/**< Size of an event: type bit, event and argument. */
+static constexpr std::uint32_t EVENT_BITS = { 1 + 3 + 8 };
+
+static_assert(sizeof(PageHeader) == PAGE_HEADER_SIZE, "Unexpected page header size");
+static_assert(sizeof(ChunkHeader) == CHUNK_HEADER_SIZE, "Unexpected chunk header size");
+static_assert(PAGE_HEADER_SIZE + CHUNK_HEADER_SIZE < CHUNK_SIZE,
+              "Headers must fit in the first chunk");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Finds the newest page, the first unwritten chunk in it and the last ride number. */
+static void find_write_position();
+
+/**
+ * Makes sure the current chunk has room for a record, starting a new chunk if needed.
+ *
+ * @param[in] bits size of the record.
+ *
+ * @return true if the record can be written, false if it has to be dropped.
+ */
+static bool reserve_bits(std::uint32_t bits);
+
+/** Starts filling the current staging chunk, moving to the next page if needed. */
+static void begin_chunk();
+
+/** Pads the current staging chunk and queues it to be written to flash. */
+static void commit_chunk();
+
+/**
+ * Appends bits to the current chunk, MSB first.
+ *
+ * @param[in] value the bits, right-aligned.
+ * @param[in] count number of bits, at most 24.
+ */
+static void put_bits(std::uint32_t value, std::uint32_t count);
+
+/**
+ * Appends a value coded as the difference from the previous one (see ride_recorder.hpp).
+ *
+ * @param[in] value    the value.
+ * @param[in] previous the chunk's previous value.
+ */
+static void put_value(std::int32_t value, std::int32_t previous);
+
+/**
+ * Appends an event to the current chunk.
+ *
+ * @param[in] event    the event.
+ * @param[in] argument event-specific argument.
+ */
+static void write_event(Event event, std::uint8_t argument);
+
+/**
+ * Handles fstorage completion events.
+ *
+ * @param[in] p_evt the fstorage event.
+ */
+static void fstorage_evt_handler(nrf_fstorage_evt_t *p_evt);
+
+/**
+ * Returns the address of a page in the ring.
+ *
+ * @param[in] page index of the page in the ring.
+ */
+static std::uint32_t page_addr(std::uint32_t page);
+
+/**
+ * Returns a pointer to the header of a page in the ring.
+ *
+ * @param[in] page index of the page in the ring.
+ */
+static const PageHeader *page_header(std::uint32_t page);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< fstorage instance covering the ride ring. */
+NRF_FSTORAGE_DEF(static nrf_fstorage_t g_fstorage) = {
+    .evt_handler = fstorage_evt_handler,
+    .start_addr  = RIDE_RECORDER_START_ADDR,
+    .end_addr    = RIDE_RECORDER_START_ADDR + (RIDE_RECORDER_PAGES * PAGE_SIZE),
+};
+
+/**< Guards the recorder state, samples and events come from different threads. */
+static SemaphoreHandle_t g_mutex;
+
+/**< Double-buffered staging chunks; one can be filled while the other is being written. */
+static std::uint32_t g_chunks[2][CHUNK_WORDS];
+
+/**< Whether each staging chunk has a write in progress. */
+static volatile bool g_chunk_busy[2];
+
+/**< Index of the staging chunk being filled. */
+static std::size_t g_chunk;
+
+/**< Whether the current staging chunk has been started (see begin_chunk()). */
+static bool g_chunk_started;
+
+/**< Number of whole bytes in the current staging chunk. */
+static std::size_t g_chunk_fill;
+
+/**< Bits not yet making up a whole byte, right-aligned. */
+static std::uint32_t g_bits;
+
+/**< Number of bits in g_bits. */
+static std::uint32_t g_bit_count;
+
+/**< Previous throttle sample in the current chunk. */
+static std::int32_t g_prev_throttle;
+
+/**< Previous RSSI sample in the current chunk. */
+static std::int32_t g_prev_rssi;
+
+/**< Page currently being written. */
+static std::uint32_t g_page { PAGE_COUNT - 1 };
+
+/**< Offset of the next chunk to write in the current page. */
+static std::uint32_t g_page_offset { PAGE_SIZE };
+
+/**< Sequence number of the current page. */
+static std::uint32_t g_seq;
+
+/**< Whether or not a ride is being recorded. */
+static bool g_is_recording;
+
+/**< Number of the current (or last) ride. */
+static std::uint8_t g_ride;
+
+/**< Sample period of the current ride. */
+static std::uint16_t g_period_ms;
+
+/**< Number of records dropped because flash writes could not keep up. */
+static volatile std::uint32_t g_dropped;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init() {
+    g_mutex = xSemaphoreCreateMutex();
+
+    if (g_mutex == nullptr) {
+        APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
+    }
+
+    APP_ERROR_CHECK(nrf_fstorage_init(&g_fstorage, &nrf_fstorage_sd, nullptr));
+
+    find_write_position();
+}
+
+void start(std::uint16_t period_ms) {
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+
+    if (g_is_recording) {
+        write_event(Event::CONNECTED, 0);
+    } else {
+        g_is_recording = true;
+        g_period_ms = period_ms;
+        ++g_ride;
+
+        /* Every ride starts on a fresh chunk, so its period and number are in the header */
+        if (g_chunk_started) {
+            commit_chunk();
+        }
+
+        write_event(Event::RIDE_START, g_ride);
+        logger::log<Level::INFO>("Ride %u started"_fmt, g_ride);
+    }
+
+    xSemaphoreGive(g_mutex);
+}
+
+void stop() {
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+
+    if (g_is_recording) {
+        write_event(Event::RIDE_END, g_ride);
+
+        if (g_chunk_started) {
+            commit_chunk();
+        }
+
+        g_is_recording = false;
+        logger::log<Level::INFO>("Ride %u ended (%u records dropped)"_fmt,
+                                 g_ride, static_cast<unsigned>(g_dropped));
+    }
+
+    xSemaphoreGive(g_mutex);
+}
+
+void record_sample(std::uint16_t throttle, std::int8_t rssi) {
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+
+    if (g_is_recording && reserve_bits(MAX_SAMPLE_BITS)) {
+        put_bits(0, 1);
+        put_value(throttle, g_prev_throttle);
+        put_value(rssi, g_prev_rssi);
+
+        g_prev_throttle = throttle;
+        g_prev_rssi = rssi;
+    }
+
+    xSemaphoreGive(g_mutex);
+}
+
+void record_event(Event event, std::uint8_t argument) {
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+
+    if (g_is_recording) {
+        write_event(event, argument);
+    }
+
+    xSemaphoreGive(g_mutex);
+}
+
+std::size_t read(std::uint32_t offset, std::uint8_t *buffer, std::size_t len) {
+    std::size_t total = { 0 };
+
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+
+    /* Pages are written in order, so the page after the current one holds the oldest data */
+    for (std::uint32_t i = 1; i <= PAGE_COUNT && len > 0; ++i) {
+        auto page = (g_page + i) % PAGE_COUNT;
+
+        if (page_header(page)->magic != PAGE_MAGIC) {
+            continue;
+        }
+
+        const std::uint32_t page_len = (page == g_page) ? g_page_offset : PAGE_SIZE;
+
+        if (offset >= page_len) {
+            offset -= page_len;
+            continue;
+        }
+
+        auto read_len = std::min<std::size_t>(len, page_len - offset);
+        memcpy(&buffer[total], reinterpret_cast<const void *>(page_addr(page) + offset), read_len);
+
+        total += read_len;
+        len -= read_len;
+        offset = 0;
+    }
+
+    xSemaphoreGive(g_mutex);
+
+    return total;
+}
+
+std::uint32_t dropped() {
+    return g_dropped;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void find_write_position() {
+    bool found = { false };
+
+    for (std::uint32_t page = 0; page < PAGE_COUNT; ++page) {
+        const auto *header = page_header(page);
+
+        if (header->magic != PAGE_MAGIC) {
+            continue;
+        }
+
+        /* Compare as a signed difference so the sequence number may wrap */
+        if (!found || static_cast<std::int32_t>(header->seq - g_seq) > 0) {
+            found = true;
+            g_page = page;
+            g_seq = header->seq;
+        }
+    }
+
+    if (!found) {
+        /* Empty ring; the first chunk will start page 0 */
+        return;
+    }
+
+    /* Written chunks never start with an erased word (the first has the page header, the others
+       a chunk header with a time far below 0xFFFFFFFF ms). A write that was queued but lost at
+       reset leaves an erased hole before later chunks, so resume after the last written chunk
+       rather than at the first erased one; the hole is skipped when decoding. */
+    std::uint32_t last_chunk = { PAGE_SIZE - CHUNK_SIZE };
+
+    for (; last_chunk > 0; last_chunk -= CHUNK_SIZE) {
+        auto addr = page_addr(g_page) + last_chunk;
+        auto first_word = *reinterpret_cast<const std::uint32_t *>(addr);
+
+        if (first_word != 0xFFFFFFFF) {
+            break;
+        }
+    }
+
+    g_page_offset = last_chunk + CHUNK_SIZE;
+
+    /* Carry on numbering rides from the last written chunk */
+    const auto *header = reinterpret_cast<const ChunkHeader *>(
+        page_addr(g_page) + last_chunk + (last_chunk == 0 ? PAGE_HEADER_SIZE : 0));
+
+    g_ride = header->ride;
+}
+
+static bool reserve_bits(std::uint32_t bits) {
+    if (g_chunk_started && (g_chunk_fill * 8) + g_bit_count + bits > CHUNK_SIZE * 8) {
+        commit_chunk();
+    }
+
+    if (!g_chunk_started) {
+        if (g_chunk_busy[g_chunk]) {
+            ++g_dropped;
+            return false;
+        }
+
+        begin_chunk();
+    }
+
+    return true;
+}
+
+static void begin_chunk() {
+    g_chunk_fill = 0;
+    g_chunk_started = true;
+    g_bits = 0;
+    g_bit_count = 0;
+    g_prev_throttle = 0;
+    g_prev_rssi = 0;
+
+    if (g_page_offset == PAGE_SIZE) {
+        g_page = (g_page + 1) % PAGE_COUNT;
+        g_page_offset = 0;
+    }
+
+    auto *chunk = reinterpret_cast<std::uint8_t *>(g_chunks[g_chunk]);
+
+    if (g_page_offset == 0) {
+        PageHeader header = {
+            .magic = PAGE_MAGIC,
+            .seq   = ++g_seq,
+        };
+
+        memcpy(chunk, &header, sizeof(header));
+        g_chunk_fill = sizeof(header);
+    }
+
+    ChunkHeader header = {
+        .time_ms   = timestamp::now_ms(),
+        .period_ms = g_period_ms,
+        .ride      = g_ride,
+        .reserved  = 0xFF,
+    };
+
+    memcpy(&chunk[g_chunk_fill], &header, sizeof(header));
+    g_chunk_fill += sizeof(header);
+}
+
+static void commit_chunk() {
+    auto *chunk = reinterpret_cast<std::uint8_t *>(g_chunks[g_chunk]);
+
+    /* Pad the last byte with 1s, which decodes as Event::END */
+    if (g_bit_count > 0) {
+        put_bits(0xFF, 8 - g_bit_count);
+    }
+
+    memset(&chunk[g_chunk_fill], 0xFF, CHUNK_SIZE - g_chunk_fill);
+
+    /* Starting a new page; erase the oldest page in the ring. fstorage executes in order. */
+    if (g_page_offset == 0) {
+        if (nrf_fstorage_erase(&g_fstorage, page_addr(g_page), 1, nullptr) != NRF_SUCCESS) {
+            ++g_dropped;
+        }
+    }
+
+    g_chunk_busy[g_chunk] = true;
+    if (nrf_fstorage_write(&g_fstorage, page_addr(g_page) + g_page_offset, chunk, CHUNK_SIZE,
+                           reinterpret_cast<void *>(g_chunk)) != NRF_SUCCESS) {
+        /* Nothing was queued, so the next chunk reuses this slot rather than leaving a hole */
+        g_chunk_busy[g_chunk] = false;
+        g_chunk_started = false;
+        ++g_dropped;
+        return;
+    }
+
+    g_page_offset += CHUNK_SIZE;
+    g_chunk ^= 1;
+    g_chunk_started = false;
+}
+
+static void put_bits(std::uint32_t value, std::uint32_t count) {
+    auto *chunk = reinterpret_cast<std::uint8_t *>(g_chunks[g_chunk]);
+
+    /* At most 7 bits are left over from the previous call, so this can't overflow */
+    g_bits = (g_bits << count) | (value & ((1U << count) - 1));
+    g_bit_count += count;
+
+    while (g_bit_count >= 8) {
+        g_bit_count -= 8;
+        chunk[g_chunk_fill++] = static_cast<std::uint8_t>(g_bits >> g_bit_count);
+    }
+
+    g_bits &= (1U << g_bit_count) - 1;
+}
+
+static void put_value(std::int32_t value, std::int32_t previous) {
+    const std::int32_t delta = value - previous;
+    const auto zigzag = static_cast<std::uint32_t>((delta << 1) ^ (delta >> 31));
+
+    if (zigzag == 0) {
+        put_bits(0b0, 1);
+    } else if (zigzag < (1 << 4)) {
+        put_bits((0b10 << 4) | zigzag, 2 + 4);
+    } else if (zigzag < (1 << 8)) {
+        put_bits((0b110 << 8) | zigzag, 3 + 8);
+    } else {
+        put_bits((0b111 << 16) | (static_cast<std::uint32_t>(value) & 0xFFFF), 3 + 16);
+    }
+}
+
+static void write_event(Event event, std::uint8_t argument) {
+    if (!reserve_bits(EVENT_BITS)) {
+        return;
+    }
+
+    put_bits((1 << 11) | (static_cast<std::uint32_t>(event) << 8) | argument, EVENT_BITS);
+}
+
+static void fstorage_evt_handler(nrf_fstorage_evt_t *p_evt) {
+    if (p_evt->id != NRF_FSTORAGE_EVT_WRITE_RESULT) {
+        return;
+    }
+
+    g_chunk_busy[reinterpret_cast<std::uintptr_t>(p_evt->p_param)] = false;
+
+    if (p_evt->result != NRF_SUCCESS) {
+        ++g_dropped;
+    }
+}
+
+static std::uint32_t page_addr(std::uint32_t page) {
+    return RIDE_RECORDER_START_ADDR + (page * PAGE_SIZE);
+}
+
+static const PageHeader *page_header(std::uint32_t page) {
+    return reinterpret_cast<const PageHeader *>(page_addr(page));
+}
+
+#else  // !RIDE_RECORDER_ENABLED
+
+void init() {}
+void start(std::uint16_t period_ms) {}
+void stop() {}
+void record_sample(std::uint16_t throttle, std::int8_t rssi) {}
+void record_event(Event event, std::uint8_t argument) {}
+std::size_t read(std::uint32_t offset, std::uint8_t *buffer, std::size_t len) { return 0; }
+std::uint32_t dropped() { return 0; }
+
+#endif  // RIDE_RECORDER_ENABLED
+
+}  // namespace ride_recorder
@@ -0,0 +1,128 @@
+/*
+ * ride_recorder.hpp - onboard recorder for throttle traces, link RSSI and connection events.
+ *
+ * Records are bit-packed into 256-byte chunks which are written to a dedicated flash ring
+ * (below the persistent log ring) the same way as logger_flash: double-buffered, page by page,
+ * erasing the oldest page when the ring wraps. Each chunk can be decoded on its own.
+ *
+ * Page layout:
+ *     [0..7]  page header: magic "RID1", sequence number
+ *     chunks of CHUNK_SIZE bytes (the first one shortened by the page header)
+ *
+ * Chunk layout:
+ *     [0..3]  time of the first record, in ms since boot
+ *     [4..5]  sample period in ms
+ *     [6]     ride number
+ *     [7]     reserved
+ *     [8..]   bitstream (MSB first), padded with 1s:
+ *         sample: 0, throttle, rssi
+ *         event:  1, 3-bit Event, 8-bit argument
+ *
+ * Throttle and RSSI are coded as the zigzagged difference from the chunk's previous sample:
+ *     0                   unchanged
+ *     10   + 4 bits       difference
+ *     110  + 8 bits       difference
+ *     111  + 16 bits      absolute value
+ * A steady sample costs 3 bits, so hours of rides fit in the ring.
+ *
+ * Download with the ride characteristic (see BLEESServer) and decode with tools/ride_decode.py.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config/app_config.h"
+
+namespace ride_recorder {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class Event : std::uint8_t {
+    RIDE_START,     /**< A ride started (argument: ride number) */
+    RIDE_END,       /**< A ride ended (argument: ride number) */
+    CONNECTED,      /**< Reconnected during a ride */
+    DISCONNECTED,   /**< Disconnected during a ride (argument: HCI reason) */
+    END = 7,        /**< Padding at the end of a chunk, never recorded */
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Size of a flash page on the nRF52840. */
+inline constexpr std::uint32_t PAGE_SIZE = { 0x1000 };
+
+/**< Size of the header at the start of each page (magic + sequence number). */
+inline constexpr std::uint32_t PAGE_HEADER_SIZE = { 8 };
+
+/**< Size of the header at the start of each chunk. */
+inline constexpr std::uint32_t CHUNK_HEADER_SIZE = { 8 };
+
+/**< Size of each flash write. */
+inline constexpr std::uint32_t CHUNK_SIZE = { RIDE_RECORDER_CHUNK_SIZE };
+
+static_assert(PAGE_SIZE % CHUNK_SIZE == 0, "Chunks must evenly divide a flash page");
+static_assert(CHUNK_SIZE % sizeof(std::uint32_t) == 0, "Chunks must be word-aligned");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initializes flash storage and finds the current write position. Must be called before anything
+ * is recorded.
+ */
+void init();
+
+/**
+ * Starts recording a ride. If a ride is already being recorded, a CONNECTED event is recorded
+ * instead.
+ *
+ * @param[in] period_ms the interval between samples.
+ */
+void start(std::uint16_t period_ms);
+
+/**
+ * Ends the current ride and writes out everything recorded so far.
+ */
+void stop();
+
+/**
+ * Records a sample, called from the sampling task. Never blocks on flash.
+ *
+ * @param[in] throttle the throttle (Hall sensor) reading.
+ * @param[in] rssi     the link RSSI in dBm, 0 if not connected.
+ */
+void record_sample(std::uint16_t throttle, std::int8_t rssi);
+
+/**
+ * Records an event.
+ *
+ * @param[in] event    the event.
+ * @param[in] argument event-specific argument.
+ */
+void record_event(Event event, std::uint8_t argument = 0);
+
+/**
+ * Reads raw recorded pages (including page headers), oldest first.
+ *
+ * @param[in]  offset byte offset into the recording, starting from the oldest page.
+ * @param[out] buffer buffer to read into.
+ * @param[in]  len    maximum number of bytes to read.
+ *
+ * @return the number of bytes read, 0 once offset is past the end of the recording.
+ */
+std::size_t read(std::uint32_t offset, std::uint8_t *buffer, std::size_t len);
+
+/**
+ * Returns the number of records dropped because flash writes could not keep up.
+ */
+std::uint32_t dropped();
+
+}  // namespace ride_recorder
@@ -0,0 +1,98 @@
+/*
+ * sample_stream.cpp - binary sample stream over a dedicated RTT channel.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "sample_stream.hpp"
+
+#include <app_util_platform.h>
+#include <nrf.h>
+#include <SEGGER_RTT.h>
+
+#include "logger.hpp"
+#include "timestamp.hpp"
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace sample_stream {
+#if SAMPLE_STREAM_ENABLED
+
+static_assert(SAMPLE_STREAM_RTT_CHANNEL < SEGGER_RTT_MAX_NUM_UP_BUFFERS,
+              "Not enough RTT up-buffers for the sample stream");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Storage for the RTT up-buffer. */
+static std::uint8_t g_rtt_buffer[SAMPLE_STREAM_RTT_BUFFER_SIZE];
+
+/**< Sequence number of the next record. Only changed within a critical region. */
+static std::uint8_t g_sequence;
+
+/**< Number of records dropped because the RTT buffer was full. */
+static volatile std::uint32_t g_dropped;
+
+/**< Number of writes averaged by measure_cycles(). */
+static constexpr std::uint32_t MEASURE_CALLS = { 64 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init() {
+    SEGGER_RTT_ConfigUpBuffer(SAMPLE_STREAM_RTT_CHANNEL, "Samples",
+                              g_rtt_buffer, sizeof(g_rtt_buffer),
+                              SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+
+    logger::log<Level::DBG>("Sample stream cost: %u cycles"_fmt, measure_cycles());
+}
+
+void write(Id id, std::uint16_t value) {
+    /* The host counts gaps in the sequence numbers as drops, so an interrupt writing in between
+       mustn't reuse a number or land in the buffer out of order */
+    CRITICAL_REGION_ENTER();
+
+    const std::uint32_t record[RECORD_SIZE / sizeof(std::uint32_t)] = {
+        timestamp::now(),
+        value | (static_cast<std::uint32_t>(id) << 16) |
+            (static_cast<std::uint32_t>(g_sequence++) << 24),
+    };
+
+    /* Skip mode: either the whole record is written or nothing is */
+    if (SEGGER_RTT_Write(SAMPLE_STREAM_RTT_CHANNEL, record, sizeof(record)) == 0) {
+        ++g_dropped;
+    }
+
+    CRITICAL_REGION_EXIT();
+}
+
+std::uint32_t dropped() {
+    return g_dropped;
+}
+
+std::uint32_t measure_cycles() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    const std::uint32_t start = DWT->CYCCNT;
+
+    for (std::uint32_t i = 0; i < MEASURE_CALLS; ++i) {
+        write(Id::MEASURE, static_cast<std::uint16_t>(i));
+    }
+
+    return (DWT->CYCCNT - start) / MEASURE_CALLS;
+}
+
+#else  // !SAMPLE_STREAM_ENABLED
+
+void init() {}
+void write(Id id, std::uint16_t value) {}
+std::uint32_t dropped() { return 0; }
+std::uint32_t measure_cycles() { return 0; }
+
+#endif  // SAMPLE_STREAM_ENABLED
+
+}  // namespace sample_stream
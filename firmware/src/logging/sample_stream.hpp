@@ -0,0 +1,75 @@
+/*
+ * sample_stream.hpp - binary sample stream over a dedicated RTT channel.
+ *
+ * Meant for bench tuning: every sample of interest (e.g. each raw and filtered Hall reading) is
+ * written straight into its own RTT up-buffer as a fixed-size record, without going through the
+ * logger. The buffer is in non-blocking skip mode, so if the host doesn't keep up whole records
+ * are dropped and the gap shows up in the sequence numbers.
+ *
+ * Record layout (8 bytes, little-endian):
+ *     [0..3] timestamp: microseconds (see timestamp.hpp)
+ *     [4..5] value
+ *     [6]    id:        which signal the sample belongs to (Id)
+ *     [7]    sequence:  incremented for every record, including dropped ones
+ *
+ * Capture and plot on the host with tools/sample_stream_capture.py.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config/app_config.h"
+
+namespace sample_stream {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class Id : std::uint8_t {
+    HALL_RAW,         /**< Raw Hall sensor ADC reading */
+    HALL_FILTERED,    /**< Filtered Hall sensor value */
+    MEASURE = 0xFF,   /**< Records written by measure_cycles(), ignored by the host */
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Size of each record in the stream. */
+inline constexpr std::size_t RECORD_SIZE = { 8 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Configures the RTT up-buffer for the stream and logs the measured cost per sample.
+ */
+void init();
+
+/**
+ * Writes a sample to the stream. Never blocks, safe to call from any context.
+ *
+ * @param[in] id    which signal the sample belongs to.
+ * @param[in] value the sample.
+ */
+void write(Id id, std::uint16_t value);
+
+/**
+ * Returns the number of records dropped because the RTT buffer was full.
+ */
+std::uint32_t dropped();
+
+/**
+ * Measures the average cost of write() using the DWT cycle counter. Writes MEASURE records.
+ *
+ * @return the average number of CPU cycles per sample (including call overhead).
+ */
+std::uint32_t measure_cycles();
+
+}  // namespace sample_stream
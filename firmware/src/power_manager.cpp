@@ -0,0 +1,370 @@
+/*
+ * power_manager.cpp - puts the remote to sleep when the throttle is left alone.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "power_manager.hpp"
+
+#include <app_error.h>
+#include <app_util_platform.h>
+#include <nrf.h>
+#include <nrf_lpcomp.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <timers.h>
+
+#include <cstdlib>
+
+#include "logger.hpp"
+#include "timestamp.hpp"
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace power_manager {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** An LPCOMP reference and the throttle reading it corresponds to. */
+struct WakeReference {
+    HallSensor::type threshold;
+    nrf_lpcomp_ref_t reference;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Full scale Hall sensor reading. Readings are 12-bit and, like LPCOMP, relative to VDD. */
+static constexpr std::uint32_t FULL_SCALE = { 1 << 12 };
+
+/**< The LPCOMP references (fractions of VDD) in increasing order. */
+static constexpr WakeReference WAKE_REFERENCES[] = {
+    { 1 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_1_16 },
+    { 2 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_1_8 },
+    { 3 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_3_16 },
+    { 4 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_2_8 },
+    { 5 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_5_16 },
+    { 6 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_3_8 },
+    { 7 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_7_16 },
+    { 8 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_4_8 },
+    { 9 * FULL_SCALE / 16,  NRF_LPCOMP_REF_SUPPLY_9_16 },
+    { 10 * FULL_SCALE / 16, NRF_LPCOMP_REF_SUPPLY_5_8 },
+    { 11 * FULL_SCALE / 16, NRF_LPCOMP_REF_SUPPLY_11_16 },
+    { 12 * FULL_SCALE / 16, NRF_LPCOMP_REF_SUPPLY_6_8 },
+    { 13 * FULL_SCALE / 16, NRF_LPCOMP_REF_SUPPLY_13_16 },
+    { 14 * FULL_SCALE / 16, NRF_LPCOMP_REF_SUPPLY_7_8 },
+    { 15 * FULL_SCALE / 16, NRF_LPCOMP_REF_SUPPLY_15_16 },
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Puts the remote to sleep. Called from the timer task when the inactivity timer expires.
+ */
+static void inactivity_timeout_handler(TimerHandle_t timer);
+
+/**
+ * Wakes the remote. Deferred to the timer task from the LPCOMP interrupt.
+ */
+static void wake(void *ignored, std::uint32_t ignored_too);
+
+/**
+ * Checks whether a throttle reading is at rest, within POWER_MANAGER_REST_DELTA of neutral.
+ *
+ * @param[in] value the throttle reading.
+ */
+static bool is_at_rest(HallSensor::type value);
+
+/**
+ * Finds the lowest LPCOMP reference far enough above the resting throttle.
+ *
+ * @param[in] rest the resting throttle reading.
+ *
+ * @return the reference, or nullptr if the throttle rests too high for any of them.
+ */
+static const WakeReference *find_wake_reference(HallSensor::type rest);
+
+/**
+ * Starts LPCOMP on the Hall sensor input, interrupting when the input rises above the reference.
+ *
+ * @param[in] reference the LPCOMP reference.
+ *
+ * @return true if armed, false if the input was already above the reference.
+ */
+static bool arm_lpcomp(nrf_lpcomp_ref_t reference);
+
+/**
+ * Stops LPCOMP and its interrupt.
+ */
+static void disarm_lpcomp();
+
+/**
+ * Adds the time since the last sleep or wake to the asleep or awake residency.
+ */
+static void update_residency();
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Callbacks to stop and restart the rest of the remote. */
+static Callbacks g_callbacks;
+
+/**< One-shot timer, restarted on throttle movement, that puts the remote to sleep. */
+static TimerHandle_t g_inactivity_timer;
+
+/**< The throttle reading when it last moved. */
+static HallSensor::type g_last_active_value;
+
+/**< Whether or not the remote is asleep. */
+static volatile bool g_is_asleep;
+
+/**< Timestamp when LPCOMP woke the remote. Written from the LPCOMP interrupt. */
+static volatile std::uint32_t g_wake_time;
+
+/**< Whether or not the first notification since waking is still to be sent. */
+static bool g_awaiting_notification;
+
+/**< Tick count at the last sleep or wake. */
+static TickType_t g_residency_tick;
+
+/**< Ticks spent asleep and awake. */
+static TickType_t g_asleep_ticks;
+static TickType_t g_awake_ticks;
+
+/**< Power statistics, other than residency. */
+static Stats g_stats;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init(const Callbacks &callbacks) {
+    g_callbacks = callbacks;
+
+    g_inactivity_timer = xTimerCreate("Inactivity",
+                                      pdMS_TO_TICKS(POWER_MANAGER_INACTIVITY_TIMEOUT_MS),
+                                      pdFALSE, /* one-shot */
+                                      nullptr, /* timer ID */
+                                      inactivity_timeout_handler);
+    APP_ERROR_CHECK_BOOL(g_inactivity_timer != nullptr);
+
+    /* Queued until the scheduler starts */
+    xTimerStart(g_inactivity_timer, 0);
+}
+
+void update_throttle(HallSensor::type value) {
+    if (g_is_asleep) {
+        return;
+    }
+
+    /* Compare against the last movement, so a slow drift still counts. A steady throttle away from
+       rest is being held, so it counts as well. */
+    if (std::abs(value - g_last_active_value) > POWER_MANAGER_ACTIVITY_DELTA ||
+        !is_at_rest(value)) {
+        g_last_active_value = value;
+        xTimerReset(g_inactivity_timer, 0);
+    }
+}
+
+void notification_sent() {
+    if (!g_awaiting_notification) {
+        return;
+    }
+
+    g_awaiting_notification = false;
+
+    const std::uint32_t latency = timestamp::now() - g_wake_time;
+
+    taskENTER_CRITICAL();
+    g_stats.last_wake_latency_us = latency;
+
+    if (latency > g_stats.max_wake_latency_us) {
+        g_stats.max_wake_latency_us = latency;
+    }
+    taskEXIT_CRITICAL();
+
+    logger::log<Level::INFO>("Wake to first notification: %u us"_fmt, latency);
+}
+
+bool is_asleep() {
+    return g_is_asleep;
+}
+
+Stats stats() {
+    taskENTER_CRITICAL();
+
+    update_residency();
+
+    Stats stats = g_stats;
+    stats.asleep_ms = (static_cast<std::uint64_t>(g_asleep_ticks) * 1000) / configTICK_RATE_HZ;
+    stats.awake_ms = (static_cast<std::uint64_t>(g_awake_ticks) * 1000) / configTICK_RATE_HZ;
+
+    taskEXIT_CRITICAL();
+
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void inactivity_timeout_handler(TimerHandle_t timer) {
+    const HallSensor::type rest = g_callbacks.read_throttle();
+    const WakeReference *wake_reference = find_wake_reference(rest);
+
+    /* Also checked here, as samples only reach update_throttle() while connected */
+    if (!is_at_rest(rest)) {
+        logger::log<Level::INFO>("%s: throttle held at %u, staying awake"_fmt, __func__, rest);
+        xTimerReset(timer, 0);
+        return;
+    }
+
+    if (wake_reference == nullptr) {
+        /* Nothing could wake us, stay awake rather than sleep forever */
+        logger::log<Level::WARNING>("%s: throttle resting too high to sleep (%u)"_fmt,
+                                    __func__, rest);
+        xTimerReset(timer, 0);
+        return;
+    }
+
+    logger::log<Level::INFO>("Sleeping (throttle %u, wake above %u)"_fmt,
+                             rest, wake_reference->threshold);
+
+    g_callbacks.sleep();
+
+    taskENTER_CRITICAL();
+    update_residency();
+    g_stats.sleeps++;
+    g_is_asleep = true;
+    taskEXIT_CRITICAL();
+
+    /* Release the HFCLK, the RTC keeps time while asleep */
+    timestamp::suspend();
+
+    if (!arm_lpcomp(wake_reference->reference)) {
+        /* The throttle moved while we were going to sleep */
+        timestamp::resume();
+        g_wake_time = timestamp::now();
+        wake(nullptr, 0);
+    }
+}
+
+static void wake(void *ignored, std::uint32_t ignored_too) {
+    taskENTER_CRITICAL();
+    update_residency();
+    g_is_asleep = false;
+    taskEXIT_CRITICAL();
+
+    g_awaiting_notification = true;
+    g_last_active_value = g_callbacks.read_throttle();
+
+    logger::log<Level::INFO>("Woke"_fmt);
+
+    g_callbacks.wake();
+    xTimerReset(g_inactivity_timer, 0);
+}
+
+static bool is_at_rest(HallSensor::type value) {
+    return std::abs(value - DRIVE_CONTROL_NEUTRAL_THROTTLE) <= POWER_MANAGER_REST_DELTA;
+}
+
+static const WakeReference *find_wake_reference(HallSensor::type rest) {
+    for (const auto &wake_reference : WAKE_REFERENCES) {
+        if (wake_reference.threshold >= rest + POWER_MANAGER_WAKE_DELTA) {
+            return &wake_reference;
+        }
+    }
+
+    return nullptr;
+}
+
+static bool arm_lpcomp(nrf_lpcomp_ref_t reference) {
+    /* Hysteresis keeps noise around the reference from waking us repeatedly */
+    const nrf_lpcomp_config_t config = {
+        .reference  = reference,
+        .detection  = NRF_LPCOMP_DETECT_UP,
+        .hyst       = NRF_LPCOMP_HYST_50mV,
+    };
+
+    nrf_lpcomp_configure(&config);
+    nrf_lpcomp_input_select(static_cast<nrf_lpcomp_input_t>(HALL_SENSE_AIN));
+
+    nrf_lpcomp_event_clear(NRF_LPCOMP_EVENT_READY);
+    nrf_lpcomp_event_clear(NRF_LPCOMP_EVENT_UP);
+
+    nrf_lpcomp_enable();
+    nrf_lpcomp_task_trigger(NRF_LPCOMP_TASK_START);
+
+    /* Only crossings generate UP, so check the input isn't already above the reference */
+    while (!nrf_lpcomp_event_check(NRF_LPCOMP_EVENT_READY)) {
+    }
+
+    nrf_lpcomp_task_trigger(NRF_LPCOMP_TASK_SAMPLE);
+
+    if (nrf_lpcomp_result_get() != 0) {
+        disarm_lpcomp();
+        return false;
+    }
+
+    nrf_lpcomp_int_enable(LPCOMP_INTENSET_UP_Msk);
+
+    NVIC_ClearPendingIRQ(COMP_LPCOMP_IRQn);
+    NVIC_SetPriority(COMP_LPCOMP_IRQn, APP_IRQ_PRIORITY_LOW);
+    NVIC_EnableIRQ(COMP_LPCOMP_IRQn);
+
+    return true;
+}
+
+static void disarm_lpcomp() {
+    NVIC_DisableIRQ(COMP_LPCOMP_IRQn);
+
+    nrf_lpcomp_int_disable(LPCOMP_INTENCLR_UP_Msk);
+    nrf_lpcomp_task_trigger(NRF_LPCOMP_TASK_STOP);
+    nrf_lpcomp_disable();
+
+    nrf_lpcomp_event_clear(NRF_LPCOMP_EVENT_UP);
+}
+
+static void update_residency() {
+    const TickType_t now = xTaskGetTickCount();
+
+    if (g_is_asleep) {
+        g_asleep_ticks += now - g_residency_tick;
+    } else {
+        g_awake_ticks += now - g_residency_tick;
+    }
+
+    g_residency_tick = now;
+}
+
+}  // namespace power_manager
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Interrupt Handlers
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+extern "C"
+void COMP_LPCOMP_IRQHandler(void) {
+    using namespace power_manager;
+
+    if (!nrf_lpcomp_event_check(NRF_LPCOMP_EVENT_UP)) {
+        return;
+    }
+
+    disarm_lpcomp();
+
+    timestamp::resume();
+    g_wake_time = timestamp::now();
+
+    /* Restarting BLE takes SoftDevice calls and logging, so finish waking in the timer task */
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xTimerPendFunctionCallFromISR(wake, nullptr, 0, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
@@ -0,0 +1,93 @@
+/*
+ * power_manager.hpp - puts the remote to sleep when the throttle is left alone.
+ *
+ * Once the throttle has rested at neutral without moving for POWER_MANAGER_INACTIVITY_TIMEOUT_MS,
+ * sampling and BLE are stopped and LPCOMP is armed on the Hall sensor's analog input, with a
+ * reference just above the resting throttle. The remote then stays in System ON sleep with only
+ * the RTC and LPCOMP running (the timestamp TIMER is suspended too, so the HFCLK is released)
+ * until the throttle is pushed past the reference, which wakes it straight from the LPCOMP
+ * interrupt.
+ *
+ * A throttle held away from neutral is never inactivity, however steady: the rider is cruising or
+ * braking, and going to sleep would drop the link mid-ride.
+ *
+ * Wake only detects the throttle moving up from rest, as LPCOMP has a single reference.
+ *
+ * To help correlate idle current measurements, stats() reports sleep/wake residency and the
+ * latency from wake to the first sensor notification.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "config/app_config.h"
+#include "hall_sensor.hpp"
+
+namespace power_manager {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** What the power manager calls to stop and restart the rest of the remote. */
+struct Callbacks {
+    /**< Stops sampling and BLE. Called from the timer task. */
+    void (*sleep)();
+
+    /**< Restarts BLE (sampling restarts once connected). Called from the timer task. */
+    void (*wake)();
+
+    /**< Reads the throttle. Called from the timer task, before sleep(). */
+    HallSensor::type (*read_throttle)();
+};
+
+/** Power statistics since boot. */
+struct Stats {
+    std::uint32_t sleeps;                   /**< Times the remote went to sleep. */
+    std::uint32_t asleep_ms;                /**< Time spent asleep. */
+    std::uint32_t awake_ms;                 /**< Time spent awake. */
+    std::uint32_t last_wake_latency_us;     /**< Latest wake to first notification latency. */
+    std::uint32_t max_wake_latency_us;      /**< Worst wake to first notification latency. */
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Starts the inactivity timer. Must be called before the scheduler is started.
+ *
+ * @param[in] callbacks the callbacks used to put the remote to sleep and wake it.
+ */
+void init(const Callbacks &callbacks);
+
+/**
+ * Reports a throttle sample. Moving the throttle by more than POWER_MANAGER_ACTIVITY_DELTA, or
+ * holding it away from rest (see POWER_MANAGER_REST_DELTA), restarts the inactivity timer. Must be
+ * called from a thread.
+ *
+ * @param[in] value the latest throttle sample.
+ */
+void update_throttle(HallSensor::type value);
+
+/**
+ * Reports that a sensor notification was sent, to measure the latency from waking.
+ */
+void notification_sent();
+
+/**
+ * Checks whether the remote is asleep.
+ *
+ * @return true if asleep, else false.
+ */
+bool is_asleep();
+
+/**
+ * Returns power statistics since boot.
+ */
+Stats stats();
+
+}  // namespace power_manager
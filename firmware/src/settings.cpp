@@ -0,0 +1,204 @@
+/*
+ * settings.cpp - persistent settings, loaded once into RAM.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "settings.hpp"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <nrf_strerror.h>
+
+#include <cstring>
+
+#include "es_fds.hpp"
+#include "es_fds_record.hpp"
+#include "logger.hpp"
+using logger::Level;
+using logger::operator""_fmt;
+
+namespace settings {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Dirty bits, one per setting. */
+enum Field : std::uint32_t {
+    FIELD_PAIRED_ADDR   = 1 << 0,
+
+    FIELD_ALL           = FIELD_PAIRED_ADDR,
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Layout version of Settings. Version 1 was the paired address on its own. */
+static constexpr std::uint16_t VERSION = { 2 };
+
+/**< The settings record, which took over the paired address record's file and key. */
+using SettingsRecord = es_fds::Record<Settings, SETTINGS_FDS_FILE_ID,
+                                      SETTINGS_FDS_RECORD_KEY, VERSION>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Reads the settings record into the snapshot, keeping any setting changed before it was loaded.
+ * Called from the FDS thread once FDS is ready.
+ */
+static void load();
+
+/**
+ * Converts a settings record stored by older firmware (see es_fds::Record::Migrate).
+ */
+static bool migrate(std::uint16_t version, const void *data, std::size_t size, Settings *value);
+
+/**
+ * Marks the settings dirty again if a commit failed, so the next commit retries, then calls the
+ * commit's callback.
+ */
+static void on_committed(std::uint16_t file_id, std::uint16_t record_key, ret_code_t result);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< The RAM snapshot. Guarded by critical sections, as it is read and written from any thread. */
+static Settings g_settings;
+
+/**< Settings changed since the last commit (Field bits). */
+static std::uint32_t g_dirty;
+
+/**< Whether or not the snapshot has been loaded from flash. */
+static volatile bool g_is_loaded;
+
+/**< Callback passed to the latest commit. */
+static volatile CommittedCallback g_committed_callback;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init() {
+    es_fds::on_ready(load);
+}
+
+bool is_loaded() {
+    return g_is_loaded;
+}
+
+void on_loaded(LoadedCallback callback) {
+    /* Ready callbacks are called in order, so this runs after load() */
+    es_fds::on_ready(callback);
+}
+
+ble_gap_addr_t paired_addr() {
+    taskENTER_CRITICAL();
+    const ble_gap_addr_t addr = g_settings.paired_addr;
+    taskEXIT_CRITICAL();
+
+    return addr;
+}
+
+bool is_paired() {
+    static constexpr std::uint8_t NONE[BLE_GAP_ADDR_LEN] = {};
+    const ble_gap_addr_t addr = paired_addr();
+
+    return memcmp(addr.addr, NONE, sizeof(NONE)) != 0;
+}
+
+void set_paired_addr(const ble_gap_addr_t &addr) {
+    taskENTER_CRITICAL();
+
+    if (memcmp(&g_settings.paired_addr, &addr, sizeof(addr)) != 0) {
+        g_settings.paired_addr = addr;
+        g_dirty |= FIELD_PAIRED_ADDR;
+    }
+
+    taskEXIT_CRITICAL();
+}
+
+ret_code_t commit(CommittedCallback callback) {
+    if (!g_is_loaded) {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    taskENTER_CRITICAL();
+    const Settings snapshot = g_settings;
+    const std::uint32_t dirty = g_dirty;
+    g_dirty = 0;
+    taskEXIT_CRITICAL();
+
+    if (dirty == 0) {
+        return NRF_SUCCESS;
+    }
+
+    g_committed_callback = callback;
+
+    const ret_code_t ret_code = SettingsRecord::write(snapshot, on_committed);
+
+    if (ret_code != NRF_SUCCESS) {
+        taskENTER_CRITICAL();
+        g_dirty |= dirty;
+        taskEXIT_CRITICAL();
+    }
+
+    return ret_code;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void load() {
+    Settings stored = {};
+    const ret_code_t ret_code = SettingsRecord::read(&stored, migrate);
+
+    if (ret_code != NRF_SUCCESS && ret_code != FDS_ERR_NOT_FOUND) {
+        logger::log<Level::WARNING>("%s: using defaults: %s"_fmt,
+                                    __func__, nrf_strerror_get(ret_code));
+    }
+
+    taskENTER_CRITICAL();
+
+    if (ret_code == NRF_SUCCESS && (g_dirty & FIELD_PAIRED_ADDR) == 0) {
+        g_settings.paired_addr = stored.paired_addr;
+    }
+
+    g_is_loaded = true;
+
+    taskEXIT_CRITICAL();
+}
+
+static bool migrate(std::uint16_t version, const void *data, std::size_t size, Settings *value) {
+    if (version == 1 && size == sizeof(ble_gap_addr_t)) {
+        *value = {};
+        memcpy(&value->paired_addr, data, sizeof(ble_gap_addr_t));
+        return true;
+    }
+
+    return false;
+}
+
+static void on_committed(std::uint16_t file_id, std::uint16_t record_key, ret_code_t result) {
+    if (result != NRF_SUCCESS) {
+        logger::log<Level::WARNING>("%s: failed to store settings: %s"_fmt,
+                                    __func__, nrf_strerror_get(result));
+
+        /* Later commits may have been coalesced into the failed write, retry everything */
+        taskENTER_CRITICAL();
+        g_dirty = FIELD_ALL;
+        taskEXIT_CRITICAL();
+    }
+
+    if (const CommittedCallback callback = g_committed_callback) {
+        callback(result);
+    }
+}
+
+}  // namespace settings
@@ -0,0 +1,112 @@
+/*
+ * settings.hpp - persistent settings, loaded once into RAM.
+ *
+ * All settings live in a single FDS record, read into a RAM snapshot once FDS is ready. Reads are
+ * served from the snapshot and never touch flash. Setters only change the snapshot and mark the
+ * setting dirty; commit() writes every dirty setting back in a single record update.
+ *
+ * The record replaces the paired address record written by earlier firmware, which is converted
+ * when it is first loaded.
+ *
+ * Usage:
+ *     settings::init();    // after es_fds::init()
+ *     settings::on_loaded([] { use(settings::paired_addr()); });
+ *
+ *     settings::set_paired_addr(addr);
+ *     settings::commit();
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <ble_gap.h>
+#include <sdk_errors.h>
+
+#include <cstdint>
+
+#include "config/app_config.h"
+
+namespace settings {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The stored settings. Bump VERSION and extend migrate() (see settings.cpp) whenever this
+ * changes.
+ */
+struct Settings {
+    /**< Address of the paired device, all zeros if none is paired. */
+    ble_gap_addr_t paired_addr;
+};
+
+/**
+ * Called once the settings have been loaded.
+ */
+using LoadedCallback = void (*)();
+
+/**
+ * Called once a commit has been stored, or has failed (and will be retried by the next commit).
+ *
+ * @param[in] result NRF_SUCCESS if the settings were stored, or an error code.
+ */
+using CommittedCallback = void (*)(ret_code_t result);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Loads the settings once FDS is ready. Must be called after es_fds::init(). Until the settings
+ * are loaded, reads return the defaults.
+ */
+void init();
+
+/**
+ * Checks whether the settings have been loaded from flash.
+ *
+ * @return true if the settings have been loaded, else false.
+ */
+bool is_loaded();
+
+/**
+ * Registers a callback to be called once the settings are loaded (see es_fds::on_ready()). Must
+ * be called after init().
+ *
+ * @param[in] callback the callback, called from the FDS thread.
+ */
+void on_loaded(LoadedCallback callback);
+
+/**
+ * Returns the address of the paired device, all zeros if none is paired.
+ */
+ble_gap_addr_t paired_addr();
+
+/**
+ * Returns whether or not a device is paired, i.e. paired_addr() isn't all zeros.
+ */
+bool is_paired();
+
+/**
+ * Sets the address of the paired device. Takes effect straight away, but is only stored once
+ * commit() is called.
+ *
+ * @param[in] addr the new address, all zeros to forget the paired device.
+ */
+void set_paired_addr(const ble_gap_addr_t &addr);
+
+/**
+ * Writes the dirty settings back to flash, all in one asynchronous record update. Does nothing
+ * if no setting has changed. Must be called from a thread.
+ *
+ * @param[in] callback called from the FDS thread once the update is stored (optional). If a later
+ *                     commit is coalesced into the same update, only its callback is called.
+ *
+ * @return NRF_SUCCESS if the update was staged (or wasn't needed), NRF_ERROR_INVALID_STATE if the
+ *         settings haven't been loaded yet, or an error from es_fds::write_record().
+ */
+ret_code_t commit(CommittedCallback callback = nullptr);
+
+}  // namespace settings
@@ -0,0 +1,150 @@
+/*
+ * timestamp.cpp - microsecond timestamps for logging and tracing.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "timestamp.hpp"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <app_error.h>
+#include <nordic_common.h>
+#include <nrf.h>
+#include <nrf_rtc.h>
+#include <nrf_timer.h>
+#include <nrfx_ppi.h>
+
+namespace timestamp {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the FreeRTOS tick count, using the FromISR variant when called from an interrupt.
+ */
+static std::uint32_t tick_count();
+
+#if TIMESTAMP_ENABLED
+
+#if configTICK_SOURCE != FREERTOS_USE_RTC
+#   error "Timestamps require the FreeRTOS tick to come from the RTC"
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< RTC driving the FreeRTOS tick (see port_cmsis_systick.c). */
+static NRF_RTC_Type *const g_rtc = { NRF_RTC1 };
+
+/**< The RTC's COUNTER register is 24 bits wide. */
+static constexpr std::uint32_t RTC_COUNTER_MASK = { 0x00FFFFFF };
+
+/**< PPI channel clearing the TIMER on every RTC tick, allocated in init(). */
+static nrf_ppi_channel_t g_ppi_channel;
+
+/**< Number of calls averaged by measure_cycles(). */
+static constexpr std::uint32_t MEASURE_CALLS = { 64 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init() {
+    nrf_timer_mode_set(TIMESTAMP_TIMER, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(TIMESTAMP_TIMER, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_frequency_set(TIMESTAMP_TIMER, NRF_TIMER_FREQ_1MHz);
+    nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_CLEAR);
+
+    /* Route the TICK event to PPI without an interrupt, the FreeRTOS port owns the RTC's interrupt
+       and only turns it off in tickless idle (the event keeps being generated) */
+    nrf_rtc_event_enable(g_rtc, RTC_EVTEN_TICK_Msk);
+
+    /* nrfx_ppi only hands out channels the SoftDevice doesn't reserve */
+    APP_ERROR_CHECK(nrfx_ppi_channel_alloc(&g_ppi_channel));
+    APP_ERROR_CHECK(nrfx_ppi_channel_assign(
+        g_ppi_channel,
+        nrf_rtc_event_address_get(g_rtc, NRF_RTC_EVENT_TICK),
+        nrf_timer_task_address_get(TIMESTAMP_TIMER, NRF_TIMER_TASK_CLEAR)));
+    APP_ERROR_CHECK(nrfx_ppi_channel_enable(g_ppi_channel));
+
+    nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_START);
+}
+
+std::uint32_t now() {
+    std::uint32_t counter;
+    std::uint32_t sub_tick;
+
+    /* Retry if the RTC ticked (clearing the TIMER) in between */
+    do {
+        counter = nrf_rtc_counter_get(g_rtc);
+        nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_CAPTURE0);
+        sub_tick = nrf_timer_cc_read(TIMESTAMP_TIMER, NRF_TIMER_CC_CHANNEL0);
+    } while (counter != nrf_rtc_counter_get(g_rtc));
+
+    /* Extend the 24-bit counter with the FreeRTOS tick count. The tick count can lag behind the
+       RTC (e.g. in tickless idle) but never by a whole counter period. */
+    const std::uint32_t tick = tick_count();
+    std::uint32_t ticks = (tick & ~RTC_COUNTER_MASK) | counter;
+
+    if (counter < (tick & RTC_COUNTER_MASK)) {
+        ticks += RTC_COUNTER_MASK + 1;
+    }
+
+    /* Divides by a power of two (1024 Hz tick), so this is a multiply and shift */
+    const std::uint64_t tick_us =
+        (static_cast<std::uint64_t>(ticks) * FREQUENCY) / configTICK_RATE_HZ;
+
+    return static_cast<std::uint32_t>(tick_us) + sub_tick;
+}
+
+void suspend() {
+    /* The RTC's TICK keeps clearing the stopped TIMER, so timestamps fall back to whole ticks */
+    nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_STOP);
+}
+
+void resume() {
+    nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_START);
+}
+
+std::uint32_t measure_cycles() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    const std::uint32_t start = DWT->CYCCNT;
+
+    for (std::uint32_t i = 0; i < MEASURE_CALLS; ++i) {
+        volatile std::uint32_t timestamp = now();
+        UNUSED_VARIABLE(timestamp);
+    }
+
+    return (DWT->CYCCNT - start) / MEASURE_CALLS;
+}
+
+#else  // !TIMESTAMP_ENABLED
+
+void init() {}
+std::uint32_t now() { return 0; }
+void suspend() {}
+void resume() {}
+std::uint32_t measure_cycles() { return 0; }
+
+#endif  // TIMESTAMP_ENABLED
+
+std::uint32_t now_ms() {
+    return static_cast<std::uint32_t>(
+        (static_cast<std::uint64_t>(tick_count()) * 1000) / configTICK_RATE_HZ);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::uint32_t tick_count() {
+    return (__get_IPSR() != 0) ? xTaskGetTickCountFromISR() : xTaskGetTickCount();
+}
+
+}  // namespace timestamp
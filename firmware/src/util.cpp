@@ -7,7 +7,7 @@
 
 #include "util.hpp"
 
-#include <ble_advdata.h>
+#include <ble_gap.h>
 #include <bsp.h>
 #include <bsp_btn_ble.h>
 #include <nrf.h>
@@ -15,8 +15,13 @@
 #include <nrf_soc.h>
 #include <sdk_errors.h>
 
+#include <algorithm>
+#include <cstring>
+
+#include "ble_adv_data.hpp"
 #include "logger.hpp"
 using logger::Level;
+using logger::operator""_fmt;
 using logger::Option;
 
 namespace util {
@@ -27,11 +32,11 @@ namespace util {
 /**
  * Helper to call the log function with the no header option.
  *
- * @param[in] fmt  the string format for the log
+ * @param[in] fmt  the string format for the log ("..."_fmt)
  * @param[in] args arguments for the formatted log
  */
-template <typename ... Args>
-static inline void log_raw(const char *fmt, Args ... args);
+template <typename Fmt, typename ... Args>
+static inline void log_raw(Fmt fmt, Args ... args);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
@@ -52,82 +57,60 @@ void log_uuid(const ble_uuid128_t *uuid) {
      *    # bytes:     4   - 2  - 2  - 2  -    6
      * Bytes are stored in uuid structure backwards
      */
-    log_raw("128-bit UUID: %02X%02X%02X%02X",
+    log_raw("128-bit UUID: %02X%02X%02X%02X"_fmt,
             uuid->uuid128[15], uuid->uuid128[14],
             uuid->uuid128[13], uuid->uuid128[12]);
-    log_raw("-%02X%02X", uuid->uuid128[11], uuid->uuid128[10]);
-    log_raw("-%02X%02X", uuid->uuid128[9], uuid->uuid128[8]);
-    log_raw("-%02X%02X", uuid->uuid128[7], uuid->uuid128[6]);
-    log_raw("-%02X%02X%02X%02X%02X%02X\n",
+    log_raw("-%02X%02X"_fmt, uuid->uuid128[11], uuid->uuid128[10]);
+    log_raw("-%02X%02X"_fmt, uuid->uuid128[9], uuid->uuid128[8]);
+    log_raw("-%02X%02X"_fmt, uuid->uuid128[7], uuid->uuid128[6]);
+    log_raw("-%02X%02X%02X%02X%02X%02X\n"_fmt,
             uuid->uuid128[5], uuid->uuid128[4], uuid->uuid128[3],
             uuid->uuid128[2], uuid->uuid128[1], uuid->uuid128[0]);
 }
 
 void log_ble_data(const ble_data_t *data) {
-    /* Log the device name */
-    std::uint16_t offset { 0 };
-    std::uint16_t len = ble_advdata_search(data->p_data, data->len, &offset,
-                                           BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME);
-
-    std::uint8_t *name_data = &data->p_data[offset];
-    char name[31] = {};
-    // BLE advertisement should always be smaller than this, but be sure
-    len = len < 30 ? len : 30;
-    memcpy(name, name_data, len);
-
-    log_raw("Name: %s\n", logger::push(name));
-    log_raw("Name: %s\n", logger::push(name));
-
-    /* Log any 16-bit UUIDs */
-    offset = {};
-    len = ble_advdata_search(data->p_data, data->len, &offset,
-                             BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE);
-    if (0 == offset) {  // check for other UUIDs
-        len = ble_advdata_search(data->p_data, data->len, &offset,
-                                 BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE);
-    }
-
-    if (0 != offset) {
-        std::uint8_t *uuid_data = &data->p_data[offset];
-        for (std::uint16_t uuid_offset = 0; uuid_offset < len; uuid_offset += UUID16_LEN) {
-            log_raw("16-bit UUID: 0x%02X%02X\n", uuid_data[uuid_offset + 1],
-                     uuid_data[uuid_offset]);
-        }
-    }
-
-    /* Log any 128-bit UUIDs */
-    offset = {};
-    len = ble_advdata_search(data->p_data, data->len, &offset,
-                             BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE);
-    if (0 == offset) {  // check for other UUIDs
-        len = ble_advdata_search(data->p_data, data->len, &offset,
-                                 BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE);
-    }
-
-    if (0 != offset) {
-        std::uint8_t *uuid_data = &data->p_data[offset];
-        ble_uuid128_t uuid;
-        for (std::uint16_t uuid_offset = 0; uuid_offset < len; uuid_offset += UUID128_LEN) {
-            memcpy(uuid.uuid128, &uuid_data[uuid_offset], UUID128_LEN);
-            log_uuid(&uuid);
+    /* One pass over the AD structures, each logged in place */
+    for (const auto &field : ble_adv_data::Fields(data->p_data, data->len)) {
+        switch (field.type) {
+            case BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME: {
+                /* Pushed to the log as a string, so it needs null-terminating */
+                char name[BLE_GAP_ADV_SET_DATA_SIZE_MAX] = {};
+                std::memcpy(name, field.data, std::min<std::size_t>(field.len, sizeof(name) - 1));
+
+                log_raw("Name: %s\n"_fmt, name);
+            } break;
+
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE: {
+                for (std::size_t offset = 0; offset + UUID16_LEN <= field.len;
+                     offset += UUID16_LEN) {
+                    log_raw("16-bit UUID: 0x%02X%02X\n"_fmt, field.data[offset + 1],
+                            field.data[offset]);
+                }
+            } break;
+
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE: {
+                for (std::size_t offset = 0; offset + UUID128_LEN <= field.len;
+                     offset += UUID128_LEN) {
+                    /* ble_uuid128_t is just the bytes, so point it at the report */
+                    log_uuid(reinterpret_cast<const ble_uuid128_t *>(&field.data[offset]));
+                }
+            } break;
+
+            case BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA: {
+                log_raw("MFG Data: "_fmt);
+                logger::hexdump<Level::INFO>(field.data, field.len);
+            } break;
         }
     }
-
-    /* Log MFG data */
-    offset = {};
-    len = ble_advdata_search(data->p_data, data->len, &offset,
-                             BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA);
-    if (0 != offset) {
-        log_raw("MFG Data: ");
-        logger::hexdump<Level::INFO>(&data->p_data[offset], len);
-    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public Implementations
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-template <typename ... Args>
-static inline void log_raw(const char *fmt, Args ... args) {
+template <typename Fmt, typename ... Args>
+static inline void log_raw(Fmt fmt, Args ... args) {
     logger::log<Level::INFO, Option::NO_HEADER>(fmt, args...);
 }
 
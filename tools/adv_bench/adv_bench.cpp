@@ -0,0 +1,470 @@
+/*
+ * adv_bench.cpp - Benchmarks ble_adv_data against ble_advdata_search() over advertising reports.
+ *
+ * Times the two places the remote parses advertising reports, each the way it was done with the
+ * SDK's searches and the way it is done with ble_adv_data:
+ *
+ *     filter  the UUID + appearance scan filter: ble_advdata_uuid_find() and
+ *             ble_advdata_appearance_find() as the scanning module calls them, against the single
+ *             pass in ble_central
+ *     log     the fields util::log_ble_data() logs: six ble_advdata_search() calls (and copies),
+ *             against a single pass with views into the report
+ *
+ * Both ways are checked to agree on every report before anything is timed.
+ *
+ * The built-in reports are typical of what the remote hears while scanning: its receiver, phones,
+ * beacons, earbuds and a malformed report. Others can be given as a file, one report per line as
+ * hex (e.g. copied from a sniffer), optionally followed by a description.
+ *
+ * Usage:
+ *     ./adv_bench [iterations] [reports_file]
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include <ble.h>
+#include <ble_gap.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ble_adv_data.hpp"
+#include "ble_es_common.hpp"
+
+/* From ble_advdata.h, whose app_util.h casts pointers to uint32_t, an error in C++ on a 64-bit
+   host */
+extern "C" {
+std::uint16_t ble_advdata_search(std::uint8_t const *p_encoded_data, std::uint16_t data_len,
+                                 std::uint16_t *p_offset, std::uint8_t ad_type);
+bool ble_advdata_uuid_find(std::uint8_t const *p_encoded_data, std::uint16_t data_len,
+                           ble_uuid_t const *p_target_uuid);
+bool ble_advdata_appearance_find(std::uint8_t const *p_encoded_data, std::uint16_t data_len,
+                                 std::uint16_t const *p_target_appearance);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Types
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** An advertising report. */
+struct Report {
+    std::string description;
+    std::vector<std::uint8_t> data;
+};
+
+/** What util::log_ble_data() logs from a report, reduced so the two ways can be compared. */
+struct Logged {
+    char name[BLE_GAP_ADV_SET_DATA_SIZE_MAX];   /**< Complete local name, empty if none. */
+    std::uint32_t uuid16_count;                 /**< 16-bit UUIDs. */
+    std::uint32_t uuid16_sum;                   /**< Sum of the 16-bit UUIDs. */
+    std::uint32_t uuid128_count;                /**< 128-bit UUIDs. */
+    std::uint32_t uuid128_sum;                  /**< Sum of the 128-bit UUIDs' bytes. */
+    std::uint32_t mfg_len;                      /**< Length of the manufacturer data. */
+};
+
+/** Nanoseconds per report for each way. */
+struct Timing {
+    double sdk_ns;
+    double single_pass_ns;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Built-in reports, as hex. */
+static constexpr const char *BUILT_IN_REPORTS[][2] = {
+    { "receiver, UUID + appearance", "020106031966FA11077C95FA7EBA731CB4A644128101004DE4" },
+    { "receiver, name", "0201060C0945736B382052656D6F7465" },
+    { "phone, continuity", "02011A020A0C0AFF4C001005031C2A3B4C" },
+    { "iBeacon", "0201061AFF4C000215F7826DA64FA24E988024BC5B71E0893E0001000AC5" },
+    { "Eddystone-URL", "0201060303AAFE0D16AAFE10F803676F6F676C6507" },
+    { "earbuds", "02010A05030A180F180B09427564732050726F2032" },
+    { "heart rate strap", "02010603020D180608506F6C617203194103" },
+    { "laptop, Microsoft CDP", "1BFF0600010920021B6E3A54C1D28F0077A91C5E2B3D4F60718293A4" },
+    { "tracker, other 128-bit UUID", "0201061106D1A0F3E2C4B5968778695A4B3C2D1E0F031966FA" },
+    { "receiver, UUID only", "02010611077C95FA7EBA731CB4A644128101004DE4" },
+    { "scan response, name", "0809506978656C2037020A04" },
+    { "malformed, truncated", "02010605094142" },
+};
+
+/**< The ES service UUID, as ble_central filters for it. */
+static constexpr ble_uuid_t FILTER_UUID = {
+    .uuid = ble_es_common::UUID_SERVICE,
+    .type = BLE_UUID_TYPE_VENDOR_BEGIN,
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Keeps results from being optimized away. */
+static volatile std::uint32_t g_sink;
+
+/**< FILTER_UUID as advertised, for the single pass. */
+static std::uint8_t g_filter_uuid[16];
+static std::uint8_t g_filter_uuid_len;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// SoftDevice Calls
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/* ble_advdata.c is built as is, these are the SoftDevice calls it makes */
+extern "C" {
+
+std::uint32_t sd_ble_uuid_encode(ble_uuid_t const *p_uuid, std::uint8_t *p_uuid_le_len,
+                                 std::uint8_t *p_uuid_le) {
+    if (p_uuid->type == BLE_UUID_TYPE_BLE) {
+        *p_uuid_le_len = 2;
+    } else {
+        /* The only vendor-specific base is the ES service's */
+        *p_uuid_le_len = 16;
+
+        if (p_uuid_le != nullptr) {
+            memcpy(p_uuid_le, ble_es_common::UUID_BASE.uuid128, 16);
+            p_uuid_le += 12;
+        }
+    }
+
+    if (p_uuid_le != nullptr) {
+        p_uuid_le[0] = static_cast<std::uint8_t>(p_uuid->uuid);
+        p_uuid_le[1] = static_cast<std::uint8_t>(p_uuid->uuid >> 8);
+    }
+
+    return NRF_SUCCESS;
+}
+
+std::uint32_t sd_ble_gap_addr_get(ble_gap_addr_t *p_addr) {
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+std::uint32_t sd_ble_gap_appearance_get(std::uint16_t *p_appearance) {
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+std::uint32_t sd_ble_gap_device_name_get(std::uint8_t *p_dev_name, std::uint16_t *p_len) {
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+}  // extern "C"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::uint16_t decode16(const std::uint8_t *data) {
+    return static_cast<std::uint16_t>(data[0] | (data[1] << 8));
+}
+
+static bool parse_hex(const char *hex, std::vector<std::uint8_t> *data) {
+    data->clear();
+
+    for (; hex[0] != '\0' && hex[1] != '\0'; hex += 2) {
+        char byte[3] = { hex[0], hex[1], '\0' };
+        char *end = nullptr;
+
+        data->push_back(static_cast<std::uint8_t>(strtoul(byte, &end, 16)));
+
+        if (*end != '\0') {
+            return false;
+        }
+    }
+
+    return hex[0] == '\0';
+}
+
+static std::vector<Report> load_reports(const char *path) {
+    std::vector<Report> reports;
+
+    if (path == nullptr) {
+        for (const auto &report : BUILT_IN_REPORTS) {
+            reports.push_back({ report[0], {} });
+
+            if (!parse_hex(report[1], &reports.back().data)) {
+                fprintf(stderr, "bad built-in report: %s\n", report[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        return reports;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char hex[512] = {};
+        int description = { 0 };
+
+        if (line[0] == '#' || sscanf(line, "%511s %n", hex, &description) != 1) {
+            continue;
+        }
+
+        line[strcspn(line, "\r\n")] = '\0';
+        reports.push_back({ &line[description], {} });
+
+        if (!parse_hex(hex, &reports.back().data) || reports.back().data.size() > 255) {
+            fprintf(stderr, "bad report: %s\n", hex);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    fclose(file);
+    return reports;
+}
+
+/* The filter as the scanning module ran it, both filters are always checked */
+static bool filter_sdk(const Report &report) {
+    const std::uint16_t appearance = { ble_es_common::APPEARANCE };
+    const auto len = static_cast<std::uint16_t>(report.data.size());
+
+    const bool has_uuid = ble_advdata_uuid_find(report.data.data(), len, &FILTER_UUID);
+    const bool has_appearance = ble_advdata_appearance_find(report.data.data(), len, &appearance);
+
+    return has_uuid && has_appearance;
+}
+
+/* The filter as ble_central runs it */
+static bool filter_single_pass(const Report &report) {
+    const bool is_uuid16 = (g_filter_uuid_len == 2);
+    bool has_uuid = { false };
+    bool has_appearance = { false };
+
+    for (const auto &field : ble_adv_data::Fields(report.data.data(), report.data.size())) {
+        switch (field.type) {
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE:
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE: {
+                const bool is_uuid16_list =
+                    (field.type == BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE ||
+                     field.type == BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE);
+
+                if (is_uuid16_list == is_uuid16 &&
+                    field.contains(g_filter_uuid, g_filter_uuid_len)) {
+                    has_uuid = true;
+                }
+            } break;
+
+            case BLE_GAP_AD_TYPE_APPEARANCE: {
+                has_appearance = (field.len == 2 &&
+                                  decode16(field.data) == ble_es_common::APPEARANCE);
+            } break;
+        }
+    }
+
+    return has_uuid && has_appearance;
+}
+
+/* The searches util::log_ble_data() made, in the same order and with the same copies */
+static Logged log_sdk(const Report &report) {
+    Logged logged = {};
+    std::uint8_t *data = const_cast<std::uint8_t *>(report.data.data());
+    const auto data_len = static_cast<std::uint16_t>(report.data.size());
+
+    std::uint16_t offset { 0 };
+    std::uint16_t len = ble_advdata_search(data, data_len, &offset,
+                                           BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME);
+    len = len < 30 ? len : 30;
+    memcpy(logged.name, &data[offset], len);
+
+    offset = {};
+    len = ble_advdata_search(data, data_len, &offset, BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE);
+    if (0 == offset) {
+        len = ble_advdata_search(data, data_len, &offset,
+                                 BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE);
+    }
+
+    if (0 != offset) {
+        for (std::uint16_t uuid_offset = 0; uuid_offset < len; uuid_offset += 2) {
+            ++logged.uuid16_count;
+            logged.uuid16_sum += decode16(&data[offset + uuid_offset]);
+        }
+    }
+
+    offset = {};
+    len = ble_advdata_search(data, data_len, &offset,
+                             BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE);
+    if (0 == offset) {
+        len = ble_advdata_search(data, data_len, &offset,
+                                 BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE);
+    }
+
+    if (0 != offset) {
+        ble_uuid128_t uuid;
+        for (std::uint16_t uuid_offset = 0; uuid_offset < len; uuid_offset += 16) {
+            memcpy(uuid.uuid128, &data[offset + uuid_offset], 16);
+            ++logged.uuid128_count;
+            for (auto byte : uuid.uuid128) {
+                logged.uuid128_sum += byte;
+            }
+        }
+    }
+
+    offset = {};
+    len = ble_advdata_search(data, data_len, &offset, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA);
+    if (0 != offset) {
+        logged.mfg_len = len;
+    }
+
+    return logged;
+}
+
+/* The single pass util::log_ble_data() makes */
+static Logged log_single_pass(const Report &report) {
+    Logged logged = {};
+
+    for (const auto &field : ble_adv_data::Fields(report.data.data(), report.data.size())) {
+        switch (field.type) {
+            case BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME: {
+                memcpy(logged.name, field.data,
+                       std::min<std::size_t>(field.len, sizeof(logged.name) - 1));
+            } break;
+
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE: {
+                for (std::size_t offset = 0; offset + 2 <= field.len; offset += 2) {
+                    ++logged.uuid16_count;
+                    logged.uuid16_sum += decode16(&field.data[offset]);
+                }
+            } break;
+
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE:
+            case BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE: {
+                for (std::size_t offset = 0; offset + 16 <= field.len; offset += 16) {
+                    const auto *uuid = reinterpret_cast<const ble_uuid128_t *>(&field.data[offset]);
+                    ++logged.uuid128_count;
+                    for (auto byte : uuid->uuid128) {
+                        logged.uuid128_sum += byte;
+                    }
+                }
+            } break;
+
+            case BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA: {
+                logged.mfg_len = field.len;
+            } break;
+        }
+    }
+
+    return logged;
+}
+
+static bool operator==(const Logged &a, const Logged &b) {
+    return strcmp(a.name, b.name) == 0 &&
+           a.uuid16_count == b.uuid16_count && a.uuid16_sum == b.uuid16_sum &&
+           a.uuid128_count == b.uuid128_count && a.uuid128_sum == b.uuid128_sum &&
+           a.mfg_len == b.mfg_len;
+}
+
+template <typename Function>
+static double time_ns(const Report &report, std::uint32_t iterations, Function function) {
+    const auto start = std::chrono::steady_clock::now();
+
+    for (std::uint32_t i = 0; i < iterations; ++i) {
+        function(report);
+    }
+
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / iterations;
+}
+
+static void print_timings(const char *name, const std::vector<Report> &reports,
+                          const std::vector<Timing> &timings) {
+    Timing total = {};
+
+    printf("\n%s (ns per report)\n", name);
+    printf("  %-32s %8s %8s %8s\n", "report", "sdk", "single", "speedup");
+
+    for (std::size_t i = 0; i < reports.size(); ++i) {
+        printf("  %-32.32s %8.1f %8.1f %7.1fx\n", reports[i].description.c_str(),
+               timings[i].sdk_ns, timings[i].single_pass_ns,
+               timings[i].sdk_ns / timings[i].single_pass_ns);
+
+        total.sdk_ns += timings[i].sdk_ns;
+        total.single_pass_ns += timings[i].single_pass_ns;
+    }
+
+    printf("  %-32s %8.1f %8.1f %7.1fx\n", "mean",
+           total.sdk_ns / reports.size(), total.single_pass_ns / reports.size(),
+           total.sdk_ns / total.single_pass_ns);
+}
+
+static std::uint32_t arg_or(int argc, char **argv, int index, std::uint32_t fallback) {
+    if (argc <= index) {
+        return fallback;
+    }
+
+    return static_cast<std::uint32_t>(strtoul(argv[index], nullptr, 0));
+}
+
+int main(int argc, char **argv) {
+    const std::uint32_t iterations = arg_or(argc, argv, 1, 1000000);
+    const std::vector<Report> reports = load_reports((argc > 2) ? argv[2] : nullptr);
+
+    if (iterations == 0 || reports.empty()) {
+        fprintf(stderr, "usage: %s [iterations] [reports_file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    sd_ble_uuid_encode(&FILTER_UUID, &g_filter_uuid_len, g_filter_uuid);
+
+    bool is_ok = { true };
+    std::uint32_t matches = { 0 };
+
+    for (const auto &report : reports) {
+        const bool is_match = filter_sdk(report);
+        matches += is_match;
+
+        if (is_match != filter_single_pass(report)) {
+            fprintf(stderr, "filter disagrees: %s\n", report.description.c_str());
+            is_ok = false;
+        }
+
+        if (!(log_sdk(report) == log_single_pass(report))) {
+            fprintf(stderr, "logged fields disagree: %s\n", report.description.c_str());
+            is_ok = false;
+        }
+    }
+
+    if (!is_ok) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu reports, %u matching the filter, %u iterations\n",
+           reports.size(), matches, iterations);
+
+    std::vector<Timing> filter_timings;
+    std::vector<Timing> log_timings;
+
+    for (const auto &report : reports) {
+        filter_timings.push_back({
+            time_ns(report, iterations, [](const Report &r) { g_sink = g_sink + filter_sdk(r); }),
+            time_ns(report, iterations,
+                    [](const Report &r) { g_sink = g_sink + filter_single_pass(r); }),
+        });
+
+        log_timings.push_back({
+            time_ns(report, iterations,
+                    [](const Report &r) { g_sink = g_sink + log_sdk(r).uuid16_sum; }),
+            time_ns(report, iterations,
+                    [](const Report &r) { g_sink = g_sink + log_single_pass(r).uuid16_sum; }),
+        });
+    }
+
+    print_timings("filter", reports, filter_timings);
+    print_timings("log", reports, log_timings);
+
+    return EXIT_SUCCESS;
+}
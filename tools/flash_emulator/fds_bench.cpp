@@ -0,0 +1,469 @@
+/*
+ * fds_bench.cpp - Benchmarks and power-loss checks for es_fds on the flash emulator.
+ *
+ * Runs the firmware's settings, es_fds and es_fds_record (and the SDK's FDS) against the flash
+ * emulator, storing and loading the paired address as the remote and receiver do.
+ *
+ * Usage:
+ *     ./fds_bench endurance [updates]  write amplification, GC cost and wear of repeated updates
+ *     ./fds_bench coalesce [writes]    flash writes saved by coalescing a burst of updates
+ *     ./fds_bench power [step_us]      cuts power at every step of an update followed by a GC,
+ *                                      and checks what the next boot reads
+ *     ./fds_bench all
+ *
+ * Each scenario exits non-zero if it fails: endurance if the address reads back wrong, a word is
+ * written more than nWRITE times or wear is uneven, coalesce if the burst isn't merged into fewer
+ * flash writes, and power if a boot fails, reads an address that was never written, or can't
+ * store a new one for the boot after. A missing address only means re-pairing; FDS loses it when
+ * power is cut while GC is erasing the data page that held it.
+ *
+ * Flash operations complete in the background, as they do with the SoftDevice enabled.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <fds.h>
+#include <sdk_config.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+#include "config/app_config.h"
+#include "es_fds.hpp"
+#include "flash_emulator.hpp"
+#include "logger.hpp"
+#include "settings.hpp"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Types
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * What a boot after a power cut read back.
+ */
+struct Outcomes {
+    std::uint32_t old_value;    /**< The value from before the interrupted update. */
+    std::uint32_t new_value;    /**< The value written by the interrupted update. */
+    std::uint32_t missing;      /**< No address: it is forgotten and must be re-paired. */
+    std::uint32_t wrong;        /**< An address that was never written. */
+    std::uint32_t unwritable;   /**< An address stored afterwards wasn't read by the next boot. */
+    std::uint32_t unbootable;   /**< Storage failed to start (es_fds::init() asserts). */
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Emulate the last 16 pages of flash, which hold the FDS pages. */
+static constexpr std::uint32_t FLASH_START = { 0xF0000 };
+static constexpr std::uint32_t FLASH_END = { 0x100000 };
+
+/**< Speeds up FreeRTOS time so coalescing and GC check delays don't dominate. */
+static constexpr std::uint32_t TIME_SCALE = { 1000 };
+
+/**< Where the power scenario keeps the flash contents to restore before each cut. */
+static constexpr const char *SNAPSHOT_PATH = { "fds_bench_snapshot.bin" };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Signals commit completions to the waiting thread. */
+static std::mutex g_commit_mutex;
+static std::condition_variable g_commit_cond;
+static std::uint32_t g_commits_done;
+static ret_code_t g_commit_result;
+
+/**< Garbage collections completed, counted from FDS events. */
+static volatile std::uint32_t g_gc_count;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Builds a distinct address for each update.
+ */
+static ble_gap_addr_t make_addr(std::uint32_t n) {
+    ble_gap_addr_t addr = {};
+
+    addr.addr_type = BLE_GAP_ADDR_TYPE_RANDOM_STATIC;
+    memcpy(addr.addr, &n, sizeof(n));
+    addr.addr[5] = 0xC0;
+
+    return addr;
+}
+
+static bool operator==(const ble_gap_addr_t &a, const ble_gap_addr_t &b) {
+    return a.addr_type == b.addr_type && memcmp(a.addr, b.addr, sizeof(a.addr)) == 0;
+}
+
+static void on_committed(ret_code_t result) {
+    {
+        std::lock_guard lock(g_commit_mutex);
+        ++g_commits_done;
+        g_commit_result = result;
+    }
+
+    g_commit_cond.notify_all();
+}
+
+static void on_fds_event(fds_evt_t const *p_evt) {
+    if (p_evt->id == FDS_EVT_GC && p_evt->result == NRF_SUCCESS) {
+        ++g_gc_count;
+    }
+}
+
+/**
+ * Runs firmware that is expected to complete, exiting if it doesn't.
+ */
+static void boot_or_exit(const std::function<void()> &firmware) {
+    if (flash_emulator::boot(firmware) != flash_emulator::BootResult::COMPLETED) {
+        fprintf(stderr, "fds_bench: firmware didn't complete\n");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Completes flash operations in the background, as the SoftDevice does while the firmware runs.
+ *
+ * @param[in] arg unused.
+ */
+static void flash_task(void *arg) {
+    for (;;) {
+        flash_emulator::run();
+        vTaskDelay(1);
+    }
+}
+
+/**
+ * Starts es_fds and settings as the firmware does, and waits until the settings are loaded.
+ */
+static void start_settings() {
+    if (xTaskCreate(flash_task, "Flash", 256, nullptr, 3, nullptr) != pdPASS) {
+        std::exit(EXIT_FAILURE);
+    }
+
+    APP_ERROR_CHECK(fds_register(on_fds_event));
+
+    es_fds::init();
+    settings::init();
+
+    while (!settings::is_loaded()) {
+        vTaskDelay(1);
+    }
+}
+
+/**
+ * Stores the paired address as the firmware does and waits until it is in flash, garbage
+ * collecting if FDS runs out of space the way the idle hook would.
+ *
+ * @return the result of the commit.
+ */
+static ret_code_t store_and_wait(const ble_gap_addr_t &addr) {
+    settings::set_paired_addr(addr);
+
+    for (;;) {
+        std::uint32_t done = {};
+
+        {
+            std::lock_guard lock(g_commit_mutex);
+            done = g_commits_done;
+        }
+
+        if (settings::commit(on_committed) != NRF_SUCCESS) {
+            vTaskDelay(1);
+            continue;
+        }
+
+        std::unique_lock lock(g_commit_mutex);
+        g_commit_cond.wait(lock, [done] { return g_commits_done != done; });
+
+        /* A failed commit leaves the settings dirty, so the next one retries */
+        if (g_commit_result != FDS_ERR_NO_SPACE_IN_FLASH) {
+            return g_commit_result;
+        }
+
+        lock.unlock();
+
+        /* es_fds requests a GC on its own, the idle hook starts it */
+        es_fds::set_gc_allowed(true);
+        es_fds::idle();
+    }
+}
+
+/**
+ * Runs firmware that checks its own results, which exits with EXIT_FAILURE if they are wrong.
+ *
+ * @return true if the firmware completed and its checks passed.
+ */
+static bool boot_and_check(const std::function<void()> &firmware) {
+    return flash_emulator::boot(firmware) == flash_emulator::BootResult::COMPLETED;
+}
+
+static bool bench_endurance(std::uint32_t updates) {
+    flash_emulator::init(FLASH_START, FLASH_END);
+
+    const bool is_ok = boot_and_check([updates] {
+        start_settings();
+        es_fds::set_gc_allowed(true);
+        flash_emulator::reset_stats();
+
+        for (std::uint32_t i = 0; i < updates; ++i) {
+            APP_ERROR_CHECK(store_and_wait(make_addr(i)));
+            es_fds::idle();
+        }
+
+        const auto &stats = flash_emulator::stats();
+        const double payload = static_cast<double>(updates) * sizeof(ble_gap_addr_t);
+
+        printf("endurance: %u updates of a %zu-byte address\n", updates, sizeof(ble_gap_addr_t));
+        printf("  words written:        %llu (%.1f bytes per payload byte)\n",
+               static_cast<unsigned long long>(stats.words_written),
+               (stats.words_written * sizeof(std::uint32_t)) / payload);
+        printf("  garbage collections:  %u (every %.1f updates)\n",
+               g_gc_count, g_gc_count ? static_cast<double>(updates) / g_gc_count : 0.0);
+        printf("  page erases:          %llu\n", static_cast<unsigned long long>(stats.erases));
+        printf("  flash busy:           %.1f ms (%.1f us per update, %.1f erases per GC)\n",
+               stats.busy_us / 1000.0, static_cast<double>(stats.busy_us) / updates,
+               g_gc_count ? static_cast<double>(stats.erases) / g_gc_count : 0.0);
+        printf("  nWRITE exceeded:      %llu words\n",
+               static_cast<unsigned long long>(stats.nwrite_exceeded));
+
+        if (!(settings::paired_addr() == make_addr(updates - 1)) || stats.nwrite_exceeded != 0) {
+            fprintf(stderr, "endurance: wrong address or nWRITE exceeded\n");
+            std::exit(EXIT_FAILURE);
+        }
+    });
+
+    std::uint32_t fewest = { UINT32_MAX };
+    std::uint32_t most = { 0 };
+
+    printf("  erases per page:     ");
+    for (std::uint32_t page = 0; page < flash_emulator::page_count(); ++page) {
+        if (flash_emulator::erase_count(page) != 0) {
+            printf(" 0x%X:%u", FLASH_START + (page * flash_emulator::PAGE_SIZE),
+                   flash_emulator::erase_count(page));
+        }
+
+        /* Only the FDS pages are written */
+        if (FLASH_START + (page * flash_emulator::PAGE_SIZE) >= ES_FDS_START_ADDR) {
+            fewest = std::min(fewest, flash_emulator::erase_count(page));
+            most = std::max(most, flash_emulator::erase_count(page));
+        }
+    }
+    printf("\n");
+
+    /* FDS rotates the swap page, so GC wears every page alike */
+    if (most - fewest > 1) {
+        fprintf(stderr, "endurance: uneven wear, %u to %u erases per page\n", fewest, most);
+        return false;
+    }
+
+    return is_ok;
+}
+
+static bool bench_coalesce(std::uint32_t writes) {
+    flash_emulator::init(FLASH_START, FLASH_END);
+
+    return boot_and_check([writes] {
+        start_settings();
+        flash_emulator::reset_stats();
+
+        /* A burst of updates, e.g. a user scrolling through a setting */
+        for (std::uint32_t i = 0; i < writes; ++i) {
+            settings::set_paired_addr(make_addr(i));
+
+            while (settings::commit(on_committed) != NRF_SUCCESS) {
+                vTaskDelay(1);
+            }
+        }
+
+        std::unique_lock lock(g_commit_mutex);
+        g_commit_cond.wait(lock, [writes] {
+            return g_commits_done + es_fds::coalesced_writes() >= writes;
+        });
+        lock.unlock();
+
+        const auto &stats = flash_emulator::stats();
+
+        printf("coalesce: burst of %u updates\n", writes);
+        printf("  coalesced:            %u\n", es_fds::coalesced_writes());
+        printf("  flash writes:         %llu (%llu words)\n",
+               static_cast<unsigned long long>(stats.writes),
+               static_cast<unsigned long long>(stats.words_written));
+
+        if (g_commit_result != NRF_SUCCESS || stats.writes >= writes) {
+            fprintf(stderr, "coalesce: commit failed or updates weren't merged\n");
+            std::exit(EXIT_FAILURE);
+        }
+    });
+}
+
+static bool bench_power(std::uint32_t step_us) {
+    flash_emulator::init(FLASH_START, FLASH_END);
+    flash_emulator::seed(1);
+
+    auto *outcomes = static_cast<Outcomes *>(mmap(nullptr, sizeof(Outcomes),
+                                                  PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    if (outcomes == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    *outcomes = {};
+
+    const ble_gap_addr_t old_addr = make_addr(1);
+    const ble_gap_addr_t new_addr = make_addr(2);
+    const ble_gap_addr_t next_addr = make_addr(3);
+
+    /* Interrupted: update the address, then garbage collect (the riskiest operation) */
+    auto update = [&] {
+        start_settings();
+        APP_ERROR_CHECK(store_and_wait(new_addr));
+        APP_ERROR_CHECK(fds_gc());
+
+        while (g_gc_count == 0) {
+            vTaskDelay(1);
+        }
+    };
+
+    /* Next boot: what the remote and receiver load, and can they store a new address? */
+    auto verify = [&] {
+        start_settings();
+
+        const ble_gap_addr_t addr = settings::paired_addr();
+
+        if (addr == ble_gap_addr_t {}) {
+            ++outcomes->missing;
+        } else if (addr == old_addr) {
+            ++outcomes->old_value;
+        } else if (addr == new_addr) {
+            ++outcomes->new_value;
+        } else {
+            ++outcomes->wrong;
+        }
+
+        if (store_and_wait(next_addr) != NRF_SUCCESS) {
+            ++outcomes->unwritable;
+        }
+    };
+
+    /* The boot after: is the new address there? */
+    auto reverify = [&] {
+        start_settings();
+
+        if (!(settings::paired_addr() == next_addr)) {
+            ++outcomes->unwritable;
+        }
+    };
+
+    /* Start with the old address stored and a few updates' worth of dirty records */
+    boot_or_exit([&] {
+        start_settings();
+        for (std::uint32_t i = 0; i < 8; ++i) {
+            APP_ERROR_CHECK(store_and_wait(make_addr(100 + i)));
+        }
+        APP_ERROR_CHECK(store_and_wait(old_addr));
+    });
+
+    if (!flash_emulator::save(SNAPSHOT_PATH)) {
+        perror(SNAPSHOT_PATH);
+        return false;
+    }
+
+    const std::uint64_t start_us = flash_emulator::now_us();
+    boot_or_exit(update);
+    const std::uint64_t duration_us = flash_emulator::now_us() - start_us;
+
+    std::uint32_t cuts = { 0 };
+    std::uint32_t reported = { 0 };
+
+    for (std::uint64_t cut_us = 0; cut_us < duration_us; cut_us += step_us) {
+        flash_emulator::load(SNAPSHOT_PATH);
+        flash_emulator::cut_power_after(cut_us);
+
+        if (flash_emulator::boot(update) != flash_emulator::BootResult::POWER_LOST) {
+            fprintf(stderr, "power: update finished before the cut at %llu us\n",
+                    static_cast<unsigned long long>(cut_us));
+            continue;
+        }
+
+        ++cuts;
+
+        const std::uint32_t unwritable = outcomes->unwritable;
+
+        if (flash_emulator::boot(verify) != flash_emulator::BootResult::COMPLETED ||
+            flash_emulator::boot(reverify) != flash_emulator::BootResult::COMPLETED) {
+            ++outcomes->unbootable;
+        }
+
+        if (outcomes->unwritable != unwritable && reported++ < 10) {
+            fprintf(stderr, "power: cut at %llu us left flash that can't store an address\n",
+                    static_cast<unsigned long long>(cut_us));
+        }
+    }
+
+    remove(SNAPSHOT_PATH);
+
+    printf("power: %u cuts every %u us during an update and GC (%.1f ms of flash activity)\n",
+           cuts, step_us, duration_us / 1000.0);
+    printf("  old address:          %u\n", outcomes->old_value);
+    printf("  new address:          %u\n", outcomes->new_value);
+    printf("  missing (re-pair):    %u\n", outcomes->missing);
+    printf("  wrong value:          %u\n", outcomes->wrong);
+    printf("  unwritable after:     %u\n", outcomes->unwritable);
+    printf("  unbootable:           %u\n", outcomes->unbootable);
+
+    /* Forgetting the address is recoverable (re-pair), anything else isn't */
+    return cuts != 0 && outcomes->wrong == 0 && outcomes->unwritable == 0 &&
+           outcomes->unbootable == 0;
+}
+
+static std::uint32_t arg_or(int argc, char **argv, int index, std::uint32_t fallback) {
+    if (argc <= index) {
+        return fallback;
+    }
+
+    return static_cast<std::uint32_t>(strtoul(argv[index], nullptr, 0));
+}
+
+int main(int argc, char **argv) {
+    const char *scenario = (argc > 1) ? argv[1] : "all";
+    const bool is_all = strcmp(scenario, "all") == 0;
+    bool is_ok = true;
+
+    freertos_host::time_scale = TIME_SCALE;
+    logger::host_min_level = logger::Level::ERROR;
+
+    if (!is_all && strcmp(scenario, "endurance") != 0 && strcmp(scenario, "coalesce") != 0 &&
+        strcmp(scenario, "power") != 0) {
+        fprintf(stderr, "usage: %s [endurance|coalesce|power|all] [count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (is_all || strcmp(scenario, "endurance") == 0) {
+        is_ok = bench_endurance(arg_or(argc, argv, 2, 2000)) && is_ok;
+    }
+
+    if (is_all || strcmp(scenario, "coalesce") == 0) {
+        is_ok = bench_coalesce(arg_or(argc, argv, 2, 50)) && is_ok;
+    }
+
+    if (is_all || strcmp(scenario, "power") == 0) {
+        is_ok = bench_power(arg_or(argc, argv, 2, flash_emulator::Timing {}.word_write_us)) &&
+                is_ok;
+    }
+
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
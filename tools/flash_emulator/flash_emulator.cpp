@@ -0,0 +1,590 @@
+/*
+ * flash_emulator.cpp - nRF52840 flash emulator for host builds of the firmware's storage code.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "flash_emulator.hpp"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <nrf_fstorage_nvmc.h>
+#include <nrf_fstorage_sd.h>
+#include <sdk_config.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <random>
+
+namespace flash_emulator {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Types
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A queued write or erase.
+ */
+struct Operation {
+    nrf_fstorage_t const *fs;   /**< The instance that queued the operation. */
+    nrf_fstorage_evt_id_t id;   /**< Write or erase. */
+    std::uint32_t addr;         /**< Destination address. */
+    const void *src;            /**< Data to write, read when the operation executes. */
+    std::uint32_t len;          /**< Bytes to write, or pages to erase. */
+    void *param;                /**< User parameter passed back in the event. */
+};
+
+/**
+ * State shared with boot() children, so it survives a power loss.
+ */
+struct Shared {
+    Timing timing;
+    Stats stats;
+    std::uint64_t now_us;
+    std::uint64_t power_cut_us;
+    bool is_power_cut_set;
+    bool is_synchronous;
+    ret_code_t fail_result;
+    std::uint32_t fail_count;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Prototypes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Allocates zeroed memory shared with child processes.
+ *
+ * @param[in] size size of the memory.
+ */
+static void *alloc_shared(std::size_t size);
+
+/**
+ * Queues an operation, completing it straight away in synchronous mode.
+ *
+ * @param[in] op the operation.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_NO_MEM if the queue is full.
+ */
+static ret_code_t enqueue(const Operation &op);
+
+/**
+ * Executes an operation on flash.
+ *
+ * @param[in] op the operation.
+ *
+ * @return the result reported in the operation's event.
+ */
+static ret_code_t execute(const Operation &op);
+
+/**
+ * Advances the clock, cutting power if the power cut time is reached.
+ *
+ * @param[in] us how long the step takes.
+ *
+ * @return true if the step completed, false if power is lost during it.
+ */
+static bool advance(std::uint32_t us);
+
+/**
+ * Returns a word with each bit set with the probability that it has changed state, part way through
+ * an operation: bits flip at random times, so the longer the operation ran the more have flipped.
+ *
+ * @param[in] elapsed_us how long the operation ran.
+ * @param[in] total_us   how long the operation takes.
+ */
+static std::uint32_t flipped_bits(std::uint64_t elapsed_us, std::uint32_t total_us);
+
+/**
+ * Ends the process after a power loss.
+ */
+[[noreturn]] static void power_lost();
+
+/**
+ * Returns a pointer to a word of emulated flash.
+ *
+ * @param[in] addr the word's address.
+ */
+static std::uint32_t *word_at(std::uint32_t addr);
+
+/**
+ * Returns the write counter of a word.
+ *
+ * @param[in] addr the word's address.
+ */
+static std::uint8_t &write_count(std::uint32_t addr);
+
+/** fstorage backend API, see nrf_fstorage.h. */
+static ret_code_t api_init(nrf_fstorage_t *p_fs, void *p_param);
+static ret_code_t api_uninit(nrf_fstorage_t *p_fs, void *p_param);
+static ret_code_t api_read(nrf_fstorage_t const *p_fs, std::uint32_t src, void *p_dest,
+                           std::uint32_t len);
+static ret_code_t api_write(nrf_fstorage_t const *p_fs, std::uint32_t dest, void const *p_src,
+                            std::uint32_t len, void *p_param);
+static ret_code_t api_erase(nrf_fstorage_t const *p_fs, std::uint32_t page_addr,
+                            std::uint32_t len, void *p_param);
+static std::uint8_t const *api_rmap(nrf_fstorage_t const *p_fs, std::uint32_t addr);
+static std::uint8_t *api_wmap(nrf_fstorage_t const *p_fs, std::uint32_t addr);
+static bool api_is_busy(nrf_fstorage_t const *p_fs);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Operations that can be queued, as in the SoftDevice backend. */
+static constexpr std::size_t QUEUE_SIZE = { NRF_FSTORAGE_SD_QUEUE_SIZE };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Flash geometry reported to fstorage instances. */
+static nrf_fstorage_info_t g_flash_info = {
+    .erase_unit   = PAGE_SIZE,
+    .program_unit = sizeof(std::uint32_t),
+    .rmap         = true,
+    .wmap         = false,
+};
+
+/**< Emulated flash region. */
+static std::uint32_t g_start_addr;
+static std::uint32_t g_end_addr;
+
+/**< State shared with boot() children. */
+static Shared *g_shared;
+
+/**< Erase counter for each page. */
+static std::uint32_t *g_erase_counts;
+
+/**< Write counter for each word, reset when its page is erased. */
+static std::uint8_t *g_write_counts;
+
+/**< Queued operations, lost with power. Guarded by g_queue_mutex, as firmware threads queue
+     operations while another completes them. */
+static std::deque<Operation> g_queue;
+static std::mutex g_queue_mutex;
+
+/**< Whether or not the queue is being processed, so event handlers queuing more don't recurse. */
+static bool g_is_processing;
+
+/**< Generator for the contents of interrupted writes and erases. */
+static std::mt19937 g_rng;
+
+}  // namespace flash_emulator
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// fstorage Backends
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/* Both backends share the emulated flash; nvmc is used synchronously by the firmware anyway */
+nrf_fstorage_api_t nrf_fstorage_sd = {
+    .init    = flash_emulator::api_init,
+    .uninit  = flash_emulator::api_uninit,
+    .read    = flash_emulator::api_read,
+    .write   = flash_emulator::api_write,
+    .erase   = flash_emulator::api_erase,
+    .rmap    = flash_emulator::api_rmap,
+    .wmap    = flash_emulator::api_wmap,
+    .is_busy = flash_emulator::api_is_busy,
+};
+
+nrf_fstorage_api_t nrf_fstorage_nvmc = nrf_fstorage_sd;
+
+namespace flash_emulator {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void init(std::uint32_t start_addr, std::uint32_t end_addr) {
+    if (start_addr % PAGE_SIZE != 0 || end_addr % PAGE_SIZE != 0 || end_addr <= start_addr) {
+        fprintf(stderr, "flash_emulator: bad region 0x%X-0x%X\n", start_addr, end_addr);
+        std::abort();
+    }
+
+    /* Calling init() again starts over with new flash */
+    if (g_shared != nullptr) {
+        const std::size_t old_size = g_end_addr - g_start_addr;
+
+        munmap(reinterpret_cast<void *>(static_cast<std::uintptr_t>(g_start_addr)), old_size);
+        munmap(g_shared, sizeof(Shared));
+        munmap(g_erase_counts, page_count() * sizeof(std::uint32_t));
+        munmap(g_write_counts, old_size / sizeof(std::uint32_t));
+    }
+
+    const std::size_t size = end_addr - start_addr;
+
+    /* Shared, so flash written by a boot() child is seen by the parent */
+    void *flash = mmap(reinterpret_cast<void *>(static_cast<std::uintptr_t>(start_addr)), size,
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                       -1, 0);
+
+    if (flash != reinterpret_cast<void *>(static_cast<std::uintptr_t>(start_addr))) {
+        fprintf(stderr, "flash_emulator: can't map 0x%X-0x%X\n", start_addr, end_addr);
+        std::abort();
+    }
+
+    memset(flash, 0xFF, size);
+
+    g_start_addr = start_addr;
+    g_end_addr = end_addr;
+
+    g_shared = new (alloc_shared(sizeof(Shared))) Shared {};
+    g_erase_counts = static_cast<std::uint32_t *>(
+        alloc_shared(page_count() * sizeof(std::uint32_t)));
+    g_write_counts = static_cast<std::uint8_t *>(alloc_shared(size / sizeof(std::uint32_t)));
+}
+
+void set_timing(const Timing &timing) {
+    g_shared->timing = timing;
+}
+
+void set_synchronous(bool synchronous) {
+    g_shared->is_synchronous = synchronous;
+}
+
+void seed(std::uint32_t seed) {
+    g_rng.seed(seed);
+}
+
+void cut_power_after(std::uint64_t us) {
+    g_shared->power_cut_us = g_shared->now_us + us;
+    g_shared->is_power_cut_set = true;
+}
+
+void cancel_power_cut() {
+    g_shared->is_power_cut_set = false;
+}
+
+void fail_next(ret_code_t result, std::uint32_t count) {
+    g_shared->fail_result = result;
+    g_shared->fail_count = count;
+}
+
+BootResult boot(const std::function<void()> &firmware) {
+    fflush(nullptr);
+
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("flash_emulator: fork");
+        std::abort();
+    }
+
+    if (pid == 0) {
+        g_queue.clear();
+        g_is_processing = false;
+
+        firmware();
+
+        fflush(nullptr);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status = {};
+    waitpid(pid, &status, 0);
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == POWER_LOST_EXIT_CODE) {
+        g_shared->is_power_cut_set = false;
+        return BootResult::POWER_LOST;
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        return BootResult::CRASHED;
+    }
+
+    return BootResult::COMPLETED;
+}
+
+bool process() {
+    std::unique_lock lock(g_queue_mutex);
+
+    if (g_queue.empty()) {
+        return false;
+    }
+
+    /* Leave the operation queued while it executes, so is_busy() is true until its event */
+    const Operation op = g_queue.front();
+    lock.unlock();
+
+    const ret_code_t result = execute(op);
+
+    lock.lock();
+    g_queue.pop_front();
+    lock.unlock();
+
+    if (op.fs->evt_handler != nullptr) {
+        nrf_fstorage_evt_t evt = {
+            .id      = op.id,
+            .result  = result,
+            .addr    = op.addr,
+            .p_src   = op.src,
+            .len     = op.len,
+            .p_param = op.param,
+        };
+
+        op.fs->evt_handler(&evt);
+    }
+
+    return true;
+}
+
+std::size_t run() {
+    std::size_t count = { 0 };
+
+    g_is_processing = true;
+
+    while (process()) {
+        ++count;
+    }
+
+    g_is_processing = false;
+
+    return count;
+}
+
+std::size_t pending() {
+    std::lock_guard lock(g_queue_mutex);
+    return g_queue.size();
+}
+
+std::uint64_t now_us() {
+    return g_shared->now_us;
+}
+
+const Stats &stats() {
+    return g_shared->stats;
+}
+
+void reset_stats() {
+    g_shared->stats = {};
+}
+
+std::uint32_t page_count() {
+    return (g_end_addr - g_start_addr) / PAGE_SIZE;
+}
+
+std::uint32_t erase_count(std::uint32_t page) {
+    return (page < page_count()) ? g_erase_counts[page] : 0;
+}
+
+bool save(const char *path) {
+    FILE *file = fopen(path, "wb");
+
+    if (file == nullptr) {
+        return false;
+    }
+
+    const std::size_t size = g_end_addr - g_start_addr;
+    const bool is_written = fwrite(word_at(g_start_addr), 1, size, file) == size;
+
+    return (fclose(file) == 0) && is_written;
+}
+
+bool load(const char *path) {
+    FILE *file = fopen(path, "rb");
+
+    if (file == nullptr) {
+        return false;
+    }
+
+    const std::size_t size = g_end_addr - g_start_addr;
+    const bool is_read = fread(word_at(g_start_addr), 1, size, file) == size;
+
+    fclose(file);
+
+    return is_read;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void *alloc_shared(std::size_t size) {
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        perror("flash_emulator: mmap");
+        std::abort();
+    }
+
+    return mem;
+}
+
+static ret_code_t enqueue(const Operation &op) {
+    {
+        std::lock_guard lock(g_queue_mutex);
+
+        if (g_queue.size() >= QUEUE_SIZE) {
+            return NRF_ERROR_NO_MEM;
+        }
+
+        g_queue.push_back(op);
+    }
+
+    if (g_shared->is_synchronous && !g_is_processing) {
+        run();
+    }
+
+    return NRF_SUCCESS;
+}
+
+static ret_code_t execute(const Operation &op) {
+    auto &stats = g_shared->stats;
+
+    if (g_shared->fail_count > 0) {
+        --g_shared->fail_count;
+        ++stats.failures;
+        return g_shared->fail_result;
+    }
+
+    if (op.id == NRF_FSTORAGE_EVT_ERASE_RESULT) {
+        for (std::uint32_t page = 0; page < op.len; ++page) {
+            const std::uint32_t page_addr = op.addr + (page * PAGE_SIZE);
+            const std::uint32_t index = (page_addr - g_start_addr) / PAGE_SIZE;
+            auto *words = word_at(page_addr);
+            const std::uint64_t start_us = g_shared->now_us;
+
+            if (!advance(g_shared->timing.page_erase_us)) {
+                /* Partially erased: bits are on their way to 1 */
+                for (std::size_t i = 0; i < PAGE_SIZE / sizeof(std::uint32_t); ++i) {
+                    words[i] |= flipped_bits(g_shared->now_us - start_us,
+                                             g_shared->timing.page_erase_us);
+                }
+                power_lost();
+            }
+
+            memset(words, 0xFF, PAGE_SIZE);
+            memset(&write_count(page_addr), 0, PAGE_SIZE / sizeof(std::uint32_t));
+            ++g_erase_counts[index];
+            ++stats.erases;
+        }
+
+        return NRF_SUCCESS;
+    }
+
+    const auto *src = static_cast<const std::uint8_t *>(op.src);
+
+    for (std::uint32_t offset = 0; offset < op.len; offset += sizeof(std::uint32_t)) {
+        const std::uint32_t addr = op.addr + offset;
+        std::uint32_t data = {};
+
+        memcpy(&data, &src[offset], sizeof(data));
+
+        const std::uint64_t start_us = g_shared->now_us;
+
+        if (!advance(g_shared->timing.word_write_us)) {
+            /* Partially programmed: only some of the bits being cleared made it */
+            *word_at(addr) &= data | ~flipped_bits(g_shared->now_us - start_us,
+                                                   g_shared->timing.word_write_us);
+            power_lost();
+        }
+
+        if (*word_at(addr) != 0xFFFFFFFF) {
+            ++stats.rewrites;
+        }
+
+        if (++write_count(addr) > NWRITE) {
+            ++stats.nwrite_exceeded;
+        }
+
+        /* NOR flash can only clear bits */
+        *word_at(addr) &= data;
+        ++stats.words_written;
+    }
+
+    ++stats.writes;
+
+    return NRF_SUCCESS;
+}
+
+static bool advance(std::uint32_t us) {
+    if (g_shared->is_power_cut_set && g_shared->now_us + us > g_shared->power_cut_us) {
+        g_shared->now_us = g_shared->power_cut_us;
+        return false;
+    }
+
+    g_shared->now_us += us;
+    g_shared->stats.busy_us += us;
+
+    return true;
+}
+
+static std::uint32_t flipped_bits(std::uint64_t elapsed_us, std::uint32_t total_us) {
+    std::bernoulli_distribution is_flipped(static_cast<double>(elapsed_us) / total_us);
+    std::uint32_t bits = { 0 };
+
+    for (std::uint32_t bit = 0; bit < 32; ++bit) {
+        if (is_flipped(g_rng)) {
+            bits |= 1u << bit;
+        }
+    }
+
+    return bits;
+}
+
+[[noreturn]] static void power_lost() {
+    fflush(nullptr);
+    _exit(POWER_LOST_EXIT_CODE);
+}
+
+static std::uint32_t *word_at(std::uint32_t addr) {
+    return reinterpret_cast<std::uint32_t *>(static_cast<std::uintptr_t>(addr));
+}
+
+static std::uint8_t &write_count(std::uint32_t addr) {
+    return g_write_counts[(addr - g_start_addr) / sizeof(std::uint32_t)];
+}
+
+static ret_code_t api_init(nrf_fstorage_t *p_fs, void *p_param) {
+    if (g_shared == nullptr ||
+        p_fs->start_addr < g_start_addr || p_fs->end_addr > g_end_addr) {
+        fprintf(stderr, "flash_emulator: instance 0x%X-0x%X is outside the emulated flash\n",
+                p_fs->start_addr, p_fs->end_addr);
+        std::abort();
+    }
+
+    p_fs->p_flash_info = &g_flash_info;
+
+    return NRF_SUCCESS;
+}
+
+static ret_code_t api_uninit(nrf_fstorage_t *p_fs, void *p_param) {
+    return NRF_SUCCESS;
+}
+
+static ret_code_t api_read(nrf_fstorage_t const *p_fs, std::uint32_t src, void *p_dest,
+                           std::uint32_t len) {
+    memcpy(p_dest, word_at(src), len);
+    return NRF_SUCCESS;
+}
+
+static ret_code_t api_write(nrf_fstorage_t const *p_fs, std::uint32_t dest, void const *p_src,
+                            std::uint32_t len, void *p_param) {
+    return enqueue({ p_fs, NRF_FSTORAGE_EVT_WRITE_RESULT, dest, p_src, len, p_param });
+}
+
+static ret_code_t api_erase(nrf_fstorage_t const *p_fs, std::uint32_t page_addr,
+                            std::uint32_t len, void *p_param) {
+    return enqueue({ p_fs, NRF_FSTORAGE_EVT_ERASE_RESULT, page_addr, nullptr, len, p_param });
+}
+
+static std::uint8_t const *api_rmap(nrf_fstorage_t const *p_fs, std::uint32_t addr) {
+    return reinterpret_cast<std::uint8_t const *>(word_at(addr));
+}
+
+static std::uint8_t *api_wmap(nrf_fstorage_t const *p_fs, std::uint32_t addr) {
+    /* Flash isn't writable through memory on the nRF52840 */
+    return nullptr;
+}
+
+static bool api_is_busy(nrf_fstorage_t const *p_fs) {
+    return pending() != 0;
+}
+
+}  // namespace flash_emulator
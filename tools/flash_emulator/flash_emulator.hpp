@@ -0,0 +1,223 @@
+/*
+ * flash_emulator.hpp - nRF52840 flash emulator for host builds of the firmware's storage code.
+ *
+ * Implements the fstorage backend API as nrf_fstorage_sd (and nrf_fstorage_nvmc), so FDS and
+ * anything else built on fstorage links against it unchanged. Flash is mapped at its real
+ * addresses, so code that reads flash through pointers works as it does on target.
+ *
+ * The emulator models:
+ *     - NOR semantics: writes can only clear bits, erases set a whole page to 0xFF.
+ *     - Timing: each word written and page erased advances a simulated clock by the nRF52840's
+ *       tWRITE and tERASEPAGE, which is also the time the CPU would be stalled.
+ *     - Asynchronous completion: operations are queued like the SoftDevice backend and complete
+ *       (delivering their events) from process()/run(), or straight away in synchronous mode.
+ *       Firmware threads can queue operations while one other thread completes them, standing in
+ *       for the SoftDevice.
+ *     - Power loss at any point in simulated time: the interrupted word is partially programmed
+ *       (or the interrupted page partially erased), with each bit that was changing done with a
+ *       probability of the fraction of the operation that ran, and the process ends like a reset
+ *       would.
+ *     - Failures: the next operations can be made to fail with a given error.
+ *     - Wear: erases per page, words written, and words written more often than nWRITE allows.
+ *
+ * Flash contents, wear and statistics live in shared memory, so they survive boot(): firmware
+ * code runs in a child process, and when power is lost it ends without touching the parent,
+ * whose static state stays as it was before the "reset".
+ *
+ * Usage:
+ *     flash_emulator::init(0xFD000, 0x100000);
+ *
+ *     flash_emulator::cut_power_after(1000);
+ *     auto result = flash_emulator::boot([] {
+ *         fds_init();
+ *         ...
+ *         flash_emulator::run();
+ *     });
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <nrf_fstorage.h>
+#include <sdk_errors.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace flash_emulator {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Flash timing, defaults from the nRF52840 product specification. */
+struct Timing {
+    std::uint32_t word_write_us { 41 };     /**< tWRITE: time to write one word. */
+    std::uint32_t page_erase_us { 85000 };  /**< tERASEPAGE: time to erase one page. */
+};
+
+/** How firmware run by boot() ended. */
+enum class BootResult {
+    COMPLETED,      /**< The firmware function returned. */
+    POWER_LOST,     /**< Power was cut. */
+    CRASHED,        /**< The firmware aborted, e.g. from APP_ERROR_CHECK(). */
+};
+
+/** Flash statistics since init() or reset_stats(). */
+struct Stats {
+    std::uint64_t writes;           /**< Write operations completed. */
+    std::uint64_t words_written;    /**< Words written. */
+    std::uint64_t erases;           /**< Pages erased. */
+    std::uint64_t rewrites;         /**< Words written when they weren't erased. */
+    std::uint64_t nwrite_exceeded;  /**< Words written more than NWRITE times between erases. */
+    std::uint64_t failures;         /**< Operations failed with fail_next(). */
+    std::uint64_t busy_us;          /**< Simulated time spent writing and erasing. */
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< Size of a flash page on the nRF52840. */
+inline constexpr std::uint32_t PAGE_SIZE = { 0x1000 };
+
+/**< Number of times a word can be written between erases (nWRITE). */
+inline constexpr std::uint32_t NWRITE = { 2 };
+
+/**< Exit code of a process that lost power. */
+inline constexpr int POWER_LOST_EXIT_CODE = { 0x50 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Maps erased flash at [start_addr, end_addr) and resets the clock, statistics and wear. Must be
+ * called before any other function, and can be called again to start over.
+ *
+ * @param[in] start_addr first address, page aligned and at least 0x10000 (below that is usually
+ *                       not mappable on Linux).
+ * @param[in] end_addr   address one past the end, page aligned.
+ */
+void init(std::uint32_t start_addr, std::uint32_t end_addr);
+
+/**
+ * Sets the time taken by writes and erases.
+ *
+ * @param[in] timing the new timing.
+ */
+void set_timing(const Timing &timing);
+
+/**
+ * Makes operations complete inside nrf_fstorage_write()/erase(), as they do while the SoftDevice
+ * is disabled, instead of from process().
+ *
+ * @param[in] synchronous whether or not operations complete straight away.
+ */
+void set_synchronous(bool synchronous);
+
+/**
+ * Seeds the generator used for the contents of interrupted writes and erases.
+ *
+ * @param[in] seed the seed.
+ */
+void seed(std::uint32_t seed);
+
+/**
+ * Cuts power once the simulated clock has advanced by the given time from now. The operation in
+ * progress at that point is left partially done and the process exits with POWER_LOST_EXIT_CODE.
+ *
+ * @param[in] us time until power is lost, in microseconds of flash activity.
+ */
+void cut_power_after(std::uint64_t us);
+
+/**
+ * Cancels a power cut set with cut_power_after().
+ */
+void cancel_power_cut();
+
+/**
+ * Makes the next operations fail with the given result, without touching flash.
+ *
+ * @param[in] result the result reported in the operations' events.
+ * @param[in] count  number of operations to fail.
+ */
+void fail_next(ret_code_t result, std::uint32_t count = 1);
+
+/**
+ * Runs firmware code in a child process, which starts with the current flash contents but
+ * otherwise as at power-on: nothing queued, and static state as it is in this process.
+ *
+ * @param[in] firmware the code to run.
+ *
+ * @return how the firmware ended.
+ */
+BootResult boot(const std::function<void()> &firmware);
+
+/**
+ * Completes the next queued operation and delivers its event.
+ *
+ * @return true if an operation was completed, false if the queue was empty.
+ */
+bool process();
+
+/**
+ * Completes queued operations, including ones queued by event handlers, until the queue is empty.
+ *
+ * @return the number of operations completed.
+ */
+std::size_t run();
+
+/**
+ * Returns the number of queued operations.
+ */
+std::size_t pending();
+
+/**
+ * Returns the simulated time, in microseconds of flash activity since init().
+ */
+std::uint64_t now_us();
+
+/**
+ * Returns flash statistics.
+ */
+const Stats &stats();
+
+/**
+ * Resets flash statistics (but not wear).
+ */
+void reset_stats();
+
+/**
+ * Returns the number of pages emulated.
+ */
+std::uint32_t page_count();
+
+/**
+ * Returns the number of times a page has been erased since init().
+ *
+ * @param[in] page index of the page, from the start address.
+ */
+std::uint32_t erase_count(std::uint32_t page);
+
+/**
+ * Saves the flash contents to a file.
+ *
+ * @param[in] path the file.
+ *
+ * @return true if the file was written.
+ */
+bool save(const char *path);
+
+/**
+ * Loads flash contents saved by save(), e.g. to start from an image read from a device.
+ *
+ * @param[in] path the file, the same size as the emulated flash.
+ *
+ * @return true if the contents were loaded.
+ */
+bool load(const char *path);
+
+}  // namespace flash_emulator
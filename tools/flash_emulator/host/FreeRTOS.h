@@ -0,0 +1,45 @@
+/*
+ * FreeRTOS.h - Host port of the parts of FreeRTOS the firmware's storage code uses.
+ *
+ * Tasks are std::threads and ticks follow the host's clock, sped up by freertos_host::time_scale
+ * so coalescing and garbage collection delays don't slow down benchmarks. Only the calls used by
+ * es_fds are provided.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstdint>
+
+using TickType_t = std::uint32_t;
+using BaseType_t = long;
+using UBaseType_t = unsigned long;
+
+#define pdFALSE (static_cast<BaseType_t>(0))
+#define pdTRUE (static_cast<BaseType_t>(1))
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY (static_cast<TickType_t>(0xFFFFFFFF))
+
+/* As in the firmware's FreeRTOSConfig.h */
+#define configTICK_RATE_HZ 1024
+
+#define pdMS_TO_TICKS(ms) \
+    (static_cast<TickType_t>((static_cast<std::uint64_t>(ms) * configTICK_RATE_HZ) / 1000))
+
+#define taskENTER_CRITICAL() freertos_host::enter_critical()
+#define taskEXIT_CRITICAL() freertos_host::exit_critical()
+
+namespace freertos_host {
+
+/**< How much faster than the host's clock ticks advance. */
+extern std::uint32_t time_scale;
+
+/** Critical sections are a process-wide recursive lock, shared with the SDK's. */
+void enter_critical();
+void exit_critical();
+
+}  // namespace freertos_host
@@ -0,0 +1,38 @@
+/*
+ * app_error.h - Error handling for host builds: report and abort.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#ifndef APP_ERROR_H__
+#define APP_ERROR_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sdk_errors.h"
+
+#define APP_ERROR_HANDLER(ERR_CODE)                                                                \
+    do {                                                                                           \
+        fprintf(stderr, "%s:%d: error 0x%X\n", __FILE__, __LINE__, (unsigned)(ERR_CODE));          \
+        abort();                                                                                   \
+    } while (0)
+
+#define APP_ERROR_CHECK(ERR_CODE)                                                                  \
+    do {                                                                                           \
+        const uint32_t LOCAL_ERR_CODE = (ERR_CODE);                                                \
+        if (LOCAL_ERR_CODE != NRF_SUCCESS) {                                                       \
+            APP_ERROR_HANDLER(LOCAL_ERR_CODE);                                                     \
+        }                                                                                          \
+    } while (0)
+
+#define APP_ERROR_CHECK_BOOL(BOOLEAN_VALUE)                                                        \
+    do {                                                                                           \
+        if (!(BOOLEAN_VALUE)) {                                                                    \
+            APP_ERROR_HANDLER(0);                                                                  \
+        }                                                                                          \
+    } while (0)
+
+#endif // APP_ERROR_H__
@@ -0,0 +1,38 @@
+/*
+ * app_util_platform.h - Platform utilities for host builds.
+ *
+ * Critical sections take the same process-wide lock as taskENTER_CRITICAL() (see FreeRTOS.h), as
+ * FDS can be called from several host threads.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#ifndef APP_UTIL_PLATFORM_H__
+#define APP_UTIL_PLATFORM_H__
+
+#include <stdint.h>
+
+#include "compiler_abstraction.h"
+#include "nordic_common.h"
+#include "nrf.h"
+#include "app_error.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void host_critical_enter(void);
+void host_critical_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define CRITICAL_REGION_ENTER() host_critical_enter()
+#define CRITICAL_REGION_EXIT() host_critical_exit()
+
+#define ANON_UNIONS_ENABLE struct semicolon_swallower
+#define ANON_UNIONS_DISABLE struct semicolon_swallower
+
+#endif // APP_UTIL_PLATFORM_H__
@@ -0,0 +1,8 @@
+/*
+ * boards_inc.h - No board for host builds; app_config.h only needs the name to resolve.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
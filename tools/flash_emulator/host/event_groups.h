@@ -0,0 +1,25 @@
+/*
+ * event_groups.h - Host port of FreeRTOS event groups (see FreeRTOS.h).
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+struct HostEventGroup;
+
+using EventGroupHandle_t = HostEventGroup *;
+using EventBits_t = TickType_t;
+
+EventGroupHandle_t xEventGroupCreate();
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit, BaseType_t wait_for_all,
+                                TickType_t ticks_to_wait);
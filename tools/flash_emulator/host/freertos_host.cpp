@@ -0,0 +1,223 @@
+/*
+ * freertos_host.cpp - Host port of the parts of FreeRTOS the firmware's storage code uses.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "FreeRTOS.h"
+#include "event_groups.h"
+#include "semphr.h"
+#include "task.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Types
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct HostTask {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::uint32_t notification {};
+    bool is_notified {};
+};
+
+struct HostMutex {
+    std::recursive_timed_mutex mutex;
+};
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable cond;
+    EventBits_t bits {};
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Data
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< When the scheduler "started", ticks count from here. */
+static const auto g_start = std::chrono::steady_clock::now();
+
+/**< Lock for critical sections. */
+static std::recursive_mutex g_critical;
+
+/**< The task running on this thread, nullptr on threads not created by xTaskCreate(). */
+static thread_local HostTask *g_current_task;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Converts ticks to a host duration, taking time_scale into account.
+ */
+static std::chrono::microseconds to_duration(TickType_t ticks) {
+    return std::chrono::microseconds(
+        (static_cast<std::uint64_t>(ticks) * 1000000) /
+        (static_cast<std::uint64_t>(configTICK_RATE_HZ) * freertos_host::time_scale));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace freertos_host {
+
+std::uint32_t time_scale = { 1 };
+
+void enter_critical() {
+    g_critical.lock();
+}
+
+void exit_critical() {
+    g_critical.unlock();
+}
+
+}  // namespace freertos_host
+
+/* Used by the SDK's CRITICAL_SECTION_ENTER/EXIT (see app_util_platform.h) */
+extern "C" void host_critical_enter() {
+    freertos_host::enter_critical();
+}
+
+extern "C" void host_critical_exit() {
+    freertos_host::exit_critical();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, std::uint16_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task) {
+    auto *task = new HostTask;
+
+    if (created_task != nullptr) {
+        *created_task = task;
+    }
+
+    std::thread([=] {
+        g_current_task = task;
+        function(parameters);
+    }).detach();
+
+    return pdPASS;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, std::uint32_t value, eNotifyAction action) {
+    {
+        std::lock_guard lock(task->mutex);
+
+        if (action == eSetBits) {
+            task->notification |= value;
+        }
+
+        task->is_notified = true;
+    }
+
+    task->cond.notify_one();
+
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(std::uint32_t clear_on_entry, std::uint32_t clear_on_exit,
+                           std::uint32_t *value, TickType_t ticks_to_wait) {
+    HostTask *task = g_current_task;
+    std::unique_lock lock(task->mutex);
+
+    if (!task->is_notified) {
+        task->notification &= ~clear_on_entry;
+
+        auto is_notified = [task] { return task->is_notified; };
+
+        if (ticks_to_wait == portMAX_DELAY) {
+            task->cond.wait(lock, is_notified);
+        } else {
+            task->cond.wait_for(lock, to_duration(ticks_to_wait), is_notified);
+        }
+    }
+
+    if (value != nullptr) {
+        *value = task->notification;
+    }
+
+    const bool was_notified = task->is_notified;
+
+    if (was_notified) {
+        task->notification &= ~clear_on_exit;
+        task->is_notified = false;
+    }
+
+    return was_notified ? pdTRUE : pdFALSE;
+}
+
+TickType_t xTaskGetTickCount() {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - g_start);
+
+    return static_cast<TickType_t>((static_cast<std::uint64_t>(elapsed.count()) *
+                                    configTICK_RATE_HZ * freertos_host::time_scale) / 1000000);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(to_duration(ticks));
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return new HostMutex;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks_to_wait) {
+    if (ticks_to_wait == portMAX_DELAY) {
+        mutex->mutex.lock();
+        return pdTRUE;
+    }
+
+    return mutex->mutex.try_lock_for(to_duration(ticks_to_wait)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex) {
+    mutex->mutex.unlock();
+    return pdTRUE;
+}
+
+EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard lock(group->mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard lock(group->mutex);
+    group->bits |= bits;
+    group->cond.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit, BaseType_t wait_for_all,
+                                TickType_t ticks_to_wait) {
+    std::unique_lock lock(group->mutex);
+
+    auto is_set = [=] {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+
+    if (ticks_to_wait == portMAX_DELAY) {
+        group->cond.wait(lock, is_set);
+    } else {
+        group->cond.wait_for(lock, to_duration(ticks_to_wait), is_set);
+    }
+
+    const EventBits_t result = group->bits;
+
+    if (clear_on_exit && is_set()) {
+        group->bits &= ~bits;
+    }
+
+    return result;
+}
@@ -0,0 +1,40 @@
+/*
+ * logger_host.hpp - logging implementation for host builds, printing to stderr.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include <cstdio>
+
+namespace logger {
+
+/**< Lowest level that is printed, raise it to quieten benchmarks. */
+inline Level host_min_level = { Level::INFO };
+
+inline void init() {}
+
+inline void idle() {}
+
+inline char const *push(char *str) {
+    return str;
+}
+
+/**
+ * Implement the log template with printf.
+ */
+template<Level level, Option ... options, typename Fmt, typename ... Args>
+void log(Fmt fmt, Args ... args) {
+    static_assert(check_format<Fmt, Args...>());
+
+    if (level < host_min_level) {
+        return;
+    }
+
+    fprintf(stderr, Fmt::str, args...);
+    fputc('\n', stderr);
+}
+
+}  // namespace logger
@@ -0,0 +1,45 @@
+/*
+ * nrf.h - Minimal nRF52840 device definitions for host builds.
+ *
+ * Provides just the registers the SDK's flash libraries read, describing a 1 MB part without a
+ * bootloader.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#ifndef NRF_H
+#define NRF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t CODEPAGESIZE;
+    uint32_t CODESIZE;
+} NRF_FICR_Type;
+
+typedef struct {
+    uint32_t NRFFW[15];
+} NRF_UICR_Type;
+
+extern NRF_FICR_Type host_ficr;
+extern NRF_UICR_Type host_uicr;
+
+#define NRF_FICR (&host_ficr)
+#define NRF_UICR (&host_uicr)
+
+#define __REV(value) __builtin_bswap32(value)
+#define __DMB() __sync_synchronize()
+#define __DSB() __sync_synchronize()
+#define __ISB() __sync_synchronize()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NRF_H
@@ -0,0 +1,15 @@
+/*
+ * nrf_assert.h - Assertions for host builds.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#ifndef NRF_ASSERT_H_
+#define NRF_ASSERT_H_
+
+#include <assert.h>
+
+#define ASSERT(expr) assert(expr)
+
+#endif // NRF_ASSERT_H_
@@ -0,0 +1,18 @@
+/*
+ * nrf_log.h - nRF logging compiled out for host builds.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#ifndef NRF_LOG_H_
+#define NRF_LOG_H_
+
+#define NRF_LOG_MODULE_REGISTER()
+#define NRF_LOG_ERROR(...)
+#define NRF_LOG_WARNING(...)
+#define NRF_LOG_INFO(...)
+#define NRF_LOG_DEBUG(...)
+#define NRF_LOG_HEXDUMP_DEBUG(...)
+
+#endif // NRF_LOG_H_
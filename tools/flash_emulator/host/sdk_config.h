@@ -0,0 +1,36 @@
+/*
+ * sdk_config.h - nRF5 SDK configuration for host builds.
+ *
+ * Only the libraries built on the host are configured, with the same settings as the firmware's
+ * src/config/sdk_config.h.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#ifndef SDK_CONFIG_H
+#define SDK_CONFIG_H
+
+#define CRC16_ENABLED 1
+
+#define FDS_ENABLED 1
+#define FDS_VIRTUAL_PAGES 3
+#define FDS_VIRTUAL_PAGE_SIZE 1024
+#define FDS_VIRTUAL_PAGES_RESERVED 0
+#define FDS_BACKEND 2
+#define FDS_OP_QUEUE_SIZE 4
+#define FDS_CRC_CHECK_ON_READ 0
+#define FDS_CRC_CHECK_ON_WRITE 0
+#define FDS_MAX_USERS 4
+
+#define NRF_FSTORAGE_ENABLED 1
+#define NRF_FSTORAGE_PARAM_CHECK_DISABLED 0
+#define NRF_FSTORAGE_SD_QUEUE_SIZE 4
+#define NRF_FSTORAGE_SD_MAX_RETRIES 8
+#define NRF_FSTORAGE_SD_MAX_WRITE_SIZE 4096
+
+#define NRF_STRERROR_ENABLED 1
+
+#define NRF_LOG_ENABLED 0
+
+#endif // SDK_CONFIG_H
@@ -0,0 +1,116 @@
+/*
+ * sdk_host.cpp - Host implementations of the nRF5 SDK pieces the flash libraries depend on.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include <nrf.h>
+#include <nrf_atfifo.h>
+#include <nrf_fstorage.h>
+
+#include <cstddef>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Registers
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/* 256 pages of 4 kB, so FDS sits at the end of the 1 MB part as on target */
+NRF_FICR_Type host_ficr = {
+    .CODEPAGESIZE = 0x1000,
+    .CODESIZE     = 256,
+};
+
+/* No bootloader */
+NRF_UICR_Type host_uicr = {
+    .NRFFW = { 0xFFFFFFFF },
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Section Variables
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/* The linker only defines section bounds for sections named like identifiers, fs_data isn't */
+extern "C" {
+nrf_fstorage_t *__start_fs_data;
+void *__stop_fs_data;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Atomic FIFO
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/* The SDK's implementation uses Cortex-M exclusive accesses. Host builds are single-threaded, so
+   this one only keeps track of positions: tail.pos.wr is the next item to allocate, tail.pos.rd
+   the end of the items put, head.pos.wr the end of the item being read and head.pos.rd the next
+   item to read. */
+
+static std::uint16_t next_pos(const nrf_atfifo_t *p_fifo, std::uint16_t pos) {
+    pos += p_fifo->item_size;
+    return (pos == p_fifo->buf_size) ? 0 : pos;
+}
+
+extern "C" ret_code_t nrf_atfifo_init(nrf_atfifo_t * const p_fifo, void *p_buf,
+                                      std::uint16_t buf_size, std::uint16_t item_size) {
+    if (p_buf == nullptr || item_size == 0 || buf_size % item_size != 0) {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    p_fifo->p_buf = p_buf;
+    p_fifo->tail.tag = 0;
+    p_fifo->head.tag = 0;
+    p_fifo->buf_size = buf_size;
+    p_fifo->item_size = item_size;
+
+    return NRF_SUCCESS;
+}
+
+extern "C" ret_code_t nrf_atfifo_clear(nrf_atfifo_t * const p_fifo) {
+    p_fifo->tail.tag = 0;
+    p_fifo->head.tag = 0;
+
+    return NRF_SUCCESS;
+}
+
+extern "C" void *nrf_atfifo_item_alloc(nrf_atfifo_t * const p_fifo,
+                                       nrf_atfifo_item_put_t *p_context) {
+    const std::uint16_t pos = p_fifo->tail.pos.wr;
+
+    if (next_pos(p_fifo, pos) == p_fifo->head.pos.rd) {
+        return nullptr;
+    }
+
+    p_context->last_tail = p_fifo->tail;
+    p_fifo->tail.pos.wr = next_pos(p_fifo, pos);
+
+    return static_cast<std::uint8_t *>(p_fifo->p_buf) + pos;
+}
+
+extern "C" bool nrf_atfifo_item_put(nrf_atfifo_t * const p_fifo,
+                                    nrf_atfifo_item_put_t *p_context) {
+    p_fifo->tail.pos.rd = p_fifo->tail.pos.wr;
+
+    return true;
+}
+
+extern "C" void *nrf_atfifo_item_get(nrf_atfifo_t * const p_fifo,
+                                     nrf_atfifo_item_get_t *p_context) {
+    const std::uint16_t pos = p_fifo->head.pos.rd;
+
+    if (pos == p_fifo->tail.pos.rd) {
+        return nullptr;
+    }
+
+    p_context->last_head = p_fifo->head;
+    p_fifo->head.pos.wr = next_pos(p_fifo, pos);
+
+    return static_cast<std::uint8_t *>(p_fifo->p_buf) + pos;
+}
+
+extern "C" bool nrf_atfifo_item_free(nrf_atfifo_t * const p_fifo,
+                                     nrf_atfifo_item_get_t *p_context) {
+    p_fifo->head.pos.rd = p_fifo->head.pos.wr;
+
+    return true;
+}
@@ -0,0 +1,20 @@
+/*
+ * semphr.h - Host port of FreeRTOS recursive mutexes (see FreeRTOS.h).
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+struct HostMutex;
+
+using SemaphoreHandle_t = HostMutex *;
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks_to_wait);
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex);
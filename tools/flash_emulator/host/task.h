@@ -0,0 +1,32 @@
+/*
+ * task.h - Host port of FreeRTOS tasks and task notifications (see FreeRTOS.h).
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+struct HostTask;
+
+using TaskHandle_t = HostTask *;
+using TaskFunction_t = void (*)(void *);
+
+enum eNotifyAction {
+    eNoAction,
+    eSetBits,
+};
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, std::uint16_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task);
+
+BaseType_t xTaskNotify(TaskHandle_t task, std::uint32_t value, eNotifyAction action);
+
+BaseType_t xTaskNotifyWait(std::uint32_t clear_on_entry, std::uint32_t clear_on_exit,
+                           std::uint32_t *value, TickType_t ticks_to_wait);
+
+TickType_t xTaskGetTickCount();
+
+void vTaskDelay(TickType_t ticks);
@@ -0,0 +1,32 @@
+/*
+ * timestamp_host.cpp - timestamp implementation for host builds, from the host's clock.
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include "timestamp.hpp"
+
+#include <chrono>
+
+namespace timestamp {
+
+/**< When the firmware "booted". */
+static const auto g_start = std::chrono::steady_clock::now();
+
+void init() {}
+
+std::uint32_t now() {
+    return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - g_start).count());
+}
+
+void suspend() {}
+
+void resume() {}
+
+std::uint32_t measure_cycles() {
+    return 0;
+}
+
+}  // namespace timestamp
@@ -0,0 +1,221 @@
+/*
+ * ramp_check.cpp - Checks the link watchdog's timeout and ramp (see link_watchdog.hpp).
+ *
+ *     timeout  replays the remote's sample schedule as sample_rate produces it (fast while
+ *              moving, backing off to SAMPLE_RATE_SLOW_PERIOD_MS once steady, fast again on
+ *              motion) over connections of every interval the remote uses, with samples delayed
+ *              by up to LINK_WATCHDOG_MISSED_INTERVALS - 2 connection events as retransmissions
+ *              do. Fails if any gap between samples would have tripped the watchdog, or if the
+ *              longest time to detect a silence isn't well inside the supervision timeout.
+ *     ramp     checks link_watchdog::ramp_throttle() for every throttle: it starts at the throttle,
+ *              never rises, never goes below neutral, reaches neutral after LINK_WATCHDOG_RAMP_MS
+ *              and holds coasting and braking as they were.
+ *
+ * Usage:
+ *     ./ramp_check [timeout|ramp|all]
+ *
+ * Copyright (c) 2020 Cameron Kluza
+ * Distributed under the MIT license (see LICENSE or https://opensource.org/licenses/MIT)
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "link_watchdog.hpp"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Constants
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**< BLE_PERIPHERAL_CONN_SUP_TIMEOUT, in ms. */
+static constexpr std::uint32_t SUPERVISION_TIMEOUT_MS = { 4000 };
+
+/**< Connection intervals the remote uses (ConnProfile::ACTIVE and IDLE bounds), in us. */
+static constexpr std::uint32_t CONN_INTERVALS_US[] = { 7500, 15000, 30000, 62500, 100000, 125000 };
+
+/**< Largest throttle checked, the Hall sensor reading is 12 bits. */
+static constexpr std::uint32_t THROTTLE_MAX = { 0x0FFF };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Private Implementations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the times the remote samples at, in us: bursts of motion at SAMPLE_RATE_FAST_PERIOD_MS
+ * separated by steady stretches, which back off by doubling the period after SAMPLE_RATE_HOLD_MS.
+ */
+static std::vector<std::uint64_t> remote_samples() {
+    static constexpr std::uint32_t MOTION_MS[] = { 600, 50, 2000, 5, 300 };
+    static constexpr std::uint32_t STEADY_MS[] = { 3000, 700, 510, 4000, 1500 };
+
+    std::vector<std::uint64_t> samples;
+    std::uint64_t now_us = { 0 };
+
+    for (std::size_t i = 0; i < sizeof(MOTION_MS) / sizeof(MOTION_MS[0]); ++i) {
+        for (std::uint64_t end_us = now_us + MOTION_MS[i] * 1000ull; now_us < end_us;) {
+            samples.push_back(now_us);
+            now_us += SAMPLE_RATE_FAST_PERIOD_MS * 1000;
+        }
+
+        /* Steady: fast until the hold passes, then the period doubles per sample */
+        const std::uint64_t steady_us = now_us;
+        std::uint32_t period_ms = SAMPLE_RATE_FAST_PERIOD_MS;
+
+        while (now_us < steady_us + STEADY_MS[i] * 1000ull) {
+            samples.push_back(now_us);
+
+            if (now_us - steady_us >= SAMPLE_RATE_HOLD_MS * 1000ull) {
+                period_ms = std::min<std::uint32_t>(period_ms * 2, SAMPLE_RATE_SLOW_PERIOD_MS);
+            }
+
+            now_us += period_ms * 1000ull;
+        }
+    }
+
+    return samples;
+}
+
+/**
+ * Replays the remote's samples over each connection interval.
+ *
+ * @return true if no gap tripped the watchdog and silences are detected in time.
+ */
+static bool check_timeout() {
+    const auto samples = remote_samples();
+    std::uint32_t seed = { 1 };
+    bool is_ok = true;
+
+    printf("timeout: %zu samples over %.1f s, up to %u events late\n", samples.size(),
+           samples.back() / 1e6, LINK_WATCHDOG_MISSED_INTERVALS - 2);
+    printf("  %-12s %-14s %-18s %s\n", "interval", "longest gap", "detection", "trips");
+
+    for (const std::uint32_t interval_us : CONN_INTERVALS_US) {
+        /* As BLEESClient converts it, rounding up */
+        const std::uint32_t interval_ms = (interval_us + 999) / 1000;
+        std::uint64_t last_us = { 0 };
+        std::uint32_t gap_ms = { 0 };
+        std::uint32_t longest_gap_ms = { 0 };
+        std::uint32_t fastest_detection_ms = { UINT32_MAX };
+        std::uint32_t worst_detection_ms = { 0 };
+        std::uint32_t trips = { 0 };
+        bool is_first = { true };
+
+        for (const std::uint64_t sample_us : samples) {
+            /* Sent in the next connection event, or a few later when retransmitted */
+            seed = seed * 1103515245 + 12345;
+            const std::uint32_t late = ((seed >> 16) % 10 == 0) ?
+                                       1 + (seed >> 8) % (LINK_WATCHDOG_MISSED_INTERVALS - 2) : 0;
+            const std::uint64_t event = (sample_us + interval_us - 1) / interval_us + late;
+            const std::uint64_t arrival_us = std::max(event * interval_us, last_us);
+
+            if (!is_first) {
+                const std::uint32_t timeout_ms = link_watchdog::timeout_ms(gap_ms, interval_ms);
+                const std::uint32_t next_gap_ms =
+                    static_cast<std::uint32_t>((arrival_us - last_us) / 1000);
+
+                fastest_detection_ms = std::min(fastest_detection_ms, timeout_ms);
+                worst_detection_ms = std::max(worst_detection_ms, timeout_ms);
+                longest_gap_ms = std::max(longest_gap_ms, next_gap_ms);
+
+                if (arrival_us - last_us > timeout_ms * 1000ull) {
+                    ++trips;
+                }
+
+                gap_ms = next_gap_ms;
+            }
+
+            last_us = arrival_us;
+            is_first = false;
+        }
+
+        printf("  %-9.1f ms %-11u ms %4u - %-8u ms %u\n", interval_us / 1000.0, longest_gap_ms,
+               fastest_detection_ms, worst_detection_ms, trips);
+
+        /* Leaves the link time to ramp down fully before the supervision timeout ends it */
+        if (trips != 0 ||
+            worst_detection_ms + LINK_WATCHDOG_RAMP_MS > SUPERVISION_TIMEOUT_MS / 2) {
+            is_ok = false;
+        }
+    }
+
+    return is_ok;
+}
+
+/**
+ * Checks the ramp from every throttle.
+ *
+ * @return true if every ramp behaves.
+ */
+static bool check_ramp() {
+    const std::uint32_t end_ms = LINK_WATCHDOG_RAMP_MS + 2 * LINK_WATCHDOG_RAMP_STEP_MS;
+    std::uint32_t failures = { 0 };
+    std::uint32_t largest_step = { 0 };
+
+    for (std::uint32_t from = 0; from <= THROTTLE_MAX; ++from) {
+        const auto throttle = static_cast<HallSensor::type>(from);
+        HallSensor::type previous = throttle;
+
+        for (std::uint32_t elapsed_ms = 0; elapsed_ms <= end_ms; ++elapsed_ms) {
+            const HallSensor::type value = link_watchdog::ramp_throttle(throttle, elapsed_ms);
+            const HallSensor::type expected_end =
+                std::min<HallSensor::type>(throttle, DRIVE_CONTROL_NEUTRAL_THROTTLE);
+
+            const bool is_bad =
+                (elapsed_ms == 0 && value != throttle) ||
+                (value > previous) ||
+                (value < expected_end) ||
+                (elapsed_ms >= LINK_WATCHDOG_RAMP_MS && value != expected_end) ||
+                (throttle <= DRIVE_CONTROL_NEUTRAL_THROTTLE && value != throttle);
+
+            if (is_bad && failures++ < 10) {
+                fprintf(stderr, "ramp: from 0x%04X at %u ms: 0x%04X\n", from, elapsed_ms, value);
+            }
+
+            if (elapsed_ms % LINK_WATCHDOG_RAMP_STEP_MS == 0 && elapsed_ms != 0) {
+                const HallSensor::type before = link_watchdog::ramp_throttle(
+                    throttle, elapsed_ms - LINK_WATCHDOG_RAMP_STEP_MS);
+                largest_step = std::max<std::uint32_t>(largest_step, before - value);
+            }
+
+            previous = value;
+        }
+    }
+
+    printf("ramp: 0x0000-0x%04X to 0x%04X over %u ms in %u ms steps, largest step %u, "
+           "%u failures\n", THROTTLE_MAX, DRIVE_CONTROL_NEUTRAL_THROTTLE, LINK_WATCHDOG_RAMP_MS,
+           LINK_WATCHDOG_RAMP_STEP_MS, largest_step, failures);
+
+    printf("  full throttle:");
+    for (std::uint32_t elapsed_ms = 0; elapsed_ms <= LINK_WATCHDOG_RAMP_MS;
+         elapsed_ms += LINK_WATCHDOG_RAMP_MS / 10) {
+        printf(" 0x%04X", link_watchdog::ramp_throttle(THROTTLE_MAX, elapsed_ms));
+    }
+    printf("\n");
+
+    return failures == 0;
+}
+
+int main(int argc, char **argv) {
+    const char *check = (argc > 1) ? argv[1] : "all";
+    const bool is_all = strcmp(check, "all") == 0;
+    bool is_ok = true;
+
+    if (!is_all && strcmp(check, "timeout") != 0 && strcmp(check, "ramp") != 0) {
+        fprintf(stderr, "usage: %s [timeout|ramp|all]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (is_all || strcmp(check, "timeout") == 0) {
+        is_ok = check_timeout() && is_ok;
+    }
+
+    if (is_all || strcmp(check, "ramp") == 0) {
+        is_ok = check_ramp() && is_ok;
+    }
+
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+
+#
+# Decoder for rides downloaded from the firmware's ride recorder (src/logging/ride_recorder.*).
+#
+# Download the ride characteristic (E44D0004-...) by enabling notifications, writing a 4-byte
+# little-endian offset (0 for everything) and appending each notification to a file until an
+# empty one arrives. Then:
+#   ./ride_decode.py rides.bin
+#   ./ride_decode.py rides.bin --csv rides.csv
+#   ./ride_decode.py rides.bin --ride 12
+#
+# Sample times are reconstructed from each chunk's start time and the sample period; events are
+# stamped with the time of the next sample.
+#
+
+import argparse
+import csv
+import struct
+import sys
+
+PAGE_SIZE = 0x1000
+CHUNK_SIZE = 256
+
+PAGE_HEADER = struct.Struct("<II")
+PAGE_MAGIC = 0x31444952
+
+CHUNK_HEADER = struct.Struct("<IHBB")
+
+EVENTS = {0: "ride_start", 1: "ride_end", 2: "connected", 3: "disconnected"}
+EVENT_END = 7
+
+
+class Bits:
+    """Reads bits MSB first, raises EOFError past the end of the data."""
+
+    def __init__(self, data):
+        self.data = data
+        self.position = 0
+
+    def read(self, count):
+        value = 0
+        for _ in range(count):
+            if self.position >= len(self.data) * 8:
+                raise EOFError
+            byte = self.data[self.position // 8]
+            value = (value << 1) | ((byte >> (7 - self.position % 8)) & 1)
+            self.position += 1
+        return value
+
+
+def read_value(bits, previous, signed):
+    """Reads a value coded as the zigzagged difference from the previous one."""
+    if bits.read(1) == 0:
+        return previous
+
+    if bits.read(1) == 0:
+        zigzag = bits.read(4)
+    elif bits.read(1) == 0:
+        zigzag = bits.read(8)
+    else:
+        value = bits.read(16)
+        if signed and value >= 0x8000:
+            value -= 0x10000
+        return value
+
+    return previous + ((zigzag >> 1) ^ -(zigzag & 1))
+
+
+def decode_chunk(chunk):
+    """Yields (ride, seconds, kind, throttle, rssi, event, argument) for each record in a chunk."""
+    time_ms, period_ms, ride, _ = CHUNK_HEADER.unpack_from(chunk)
+    bits = Bits(chunk[CHUNK_HEADER.size:])
+    throttle = 0
+    rssi = 0
+
+    try:
+        while True:
+            if bits.read(1) == 0:
+                throttle = read_value(bits, throttle, signed=False)
+                rssi = read_value(bits, rssi, signed=True)
+                yield ride, time_ms / 1000, "sample", throttle, rssi, "", ""
+                time_ms += period_ms
+                continue
+
+            event = bits.read(3)
+            if event == EVENT_END:
+                return
+
+            argument = bits.read(8)
+            yield ride, time_ms / 1000, "event", "", "", EVENTS.get(event, event), argument
+    except EOFError:
+        return
+
+
+def decode(data, stats):
+    """Yields records from a download: whole pages, oldest first, the newest one truncated."""
+    for page_start in range(0, len(data), PAGE_SIZE):
+        page = data[page_start:page_start + PAGE_SIZE]
+
+        if len(page) < PAGE_HEADER.size:
+            break
+
+        magic, seq = PAGE_HEADER.unpack_from(page)
+        if magic != PAGE_MAGIC:
+            print("Skipping page at offset %d: bad magic 0x%08X" % (page_start, magic),
+                  file=sys.stderr)
+            continue
+
+        stats["pages"] += 1
+
+        for chunk_start in range(0, len(page), CHUNK_SIZE):
+            chunk = page[chunk_start:chunk_start + CHUNK_SIZE]
+            if chunk_start == 0:
+                chunk = chunk[PAGE_HEADER.size:]
+
+            if len(chunk) < CHUNK_HEADER.size or chunk[:4] == b"\xff\xff\xff\xff":
+                continue
+
+            stats["chunks"] += 1
+            yield from decode_chunk(chunk)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode rides downloaded from the remote")
+    parser.add_argument("file", help="raw download from the ride characteristic")
+    parser.add_argument("--csv", help="write records to a CSV file instead of stdout")
+    parser.add_argument("--ride", type=int, help="only output records from this ride")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+
+    out = open(args.csv, "w", newline="") if args.csv else sys.stdout
+    writer = csv.writer(out)
+    writer.writerow(["ride", "time_s", "kind", "throttle", "rssi", "event", "argument"])
+
+    stats = {"pages": 0, "chunks": 0, "records": 0}
+    for record in decode(data, stats):
+        if args.ride is not None and record[0] != args.ride:
+            continue
+        writer.writerow(record)
+        stats["records"] += 1
+
+    if out is not sys.stdout:
+        out.close()
+
+    print("%d pages, %d chunks, %d records" % (stats["pages"], stats["chunks"], stats["records"]),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
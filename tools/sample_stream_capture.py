@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+
+#
+# Capture tool for the firmware's RTT sample stream (src/logging/sample_stream.*).
+#
+# Build the firmware with SAMPLE_STREAM_ENABLED set in app_config.h (off by default), then record
+# the RTT channel with e.g.:
+#   JLinkRTTLogger -Device NRF52840_XXAA -If SWD -Speed 4000 -RTTChannel 2 samples.bin
+# then, while it is running (or afterwards without --follow):
+#   ./sample_stream_capture.py samples.bin --follow --plot
+#   ./sample_stream_capture.py samples.bin --csv samples.csv
+#
+# Plotting needs matplotlib.
+#
+
+import argparse
+import collections
+import csv
+import struct
+import sys
+import time
+
+RECORD = struct.Struct("<IHBB")
+TIMESTAMP_FREQUENCY = 1000000
+
+IDS = {0: "hall_raw", 1: "hall_filtered"}
+MEASURE_ID = 0xFF
+
+PLOT_WINDOW = 2000
+
+
+class Stream:
+    """Parses records and keeps track of sequence gaps."""
+
+    def __init__(self):
+        self.pending = b""
+        self.last_sequence = None
+        self.dropped = 0
+        self.counts = collections.Counter()
+
+    def feed(self, data):
+        """Yields (seconds, name, value) for each complete record in data."""
+        self.pending += data
+        complete = len(self.pending) - len(self.pending) % RECORD.size
+
+        for offset in range(0, complete, RECORD.size):
+            timestamp, value, sample_id, sequence = RECORD.unpack_from(self.pending, offset)
+
+            if self.last_sequence is not None:
+                self.dropped += (sequence - self.last_sequence - 1) % 256
+            self.last_sequence = sequence
+
+            if sample_id == MEASURE_ID:
+                continue
+
+            name = IDS.get(sample_id, "id_%d" % sample_id)
+            self.counts[name] += 1
+            yield timestamp / TIMESTAMP_FREQUENCY, name, value
+
+        self.pending = self.pending[complete:]
+
+
+def read_chunks(f, follow):
+    while True:
+        data = f.read(4096)
+        if data:
+            yield data
+        elif follow:
+            time.sleep(0.05)
+        else:
+            return
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Capture and plot the RTT sample stream.")
+    parser.add_argument("capture", nargs="?", help="raw RTT capture (default: stdin)")
+    parser.add_argument("--follow", action="store_true", help="keep reading as the file grows")
+    parser.add_argument("--csv", help="write samples to a CSV file")
+    parser.add_argument("--plot", action="store_true", help="plot samples (live with --follow)")
+    args = parser.parse_args()
+
+    f = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+    stream = Stream()
+    series = collections.defaultdict(lambda: ([], []))
+
+    writer = None
+    if args.csv:
+        csv_file = open(args.csv, "w", newline="")
+        writer = csv.writer(csv_file)
+        writer.writerow(["time_s", "signal", "value"])
+
+    if args.plot:
+        import matplotlib.pyplot as plt
+        if args.follow:
+            plt.ion()
+        figure, axes = plt.subplots()
+        axes.set_xlabel("time (s)")
+
+    try:
+        for data in read_chunks(f, args.follow):
+            for seconds, name, value in stream.feed(data):
+                if writer:
+                    writer.writerow(["%.6f" % seconds, name, value])
+                if args.plot:
+                    times, values = series[name]
+                    times.append(seconds)
+                    values.append(value)
+
+            if args.plot and args.follow:
+                axes.clear()
+                for name, (times, values) in series.items():
+                    axes.plot(times[-PLOT_WINDOW:], values[-PLOT_WINDOW:], label=name)
+                axes.legend(loc="upper left")
+                plt.pause(0.01)
+    except KeyboardInterrupt:
+        pass
+
+    counts = ", ".join("%s: %d" % item for item in sorted(stream.counts.items()))
+    print("samples (%s), dropped: %d" % (counts or "none", stream.dropped), file=sys.stderr)
+
+    if args.plot and not args.follow:
+        for name, (times, values) in series.items():
+            axes.plot(times, values, label=name)
+        axes.legend(loc="upper left")
+        plt.show()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+
+#
+# Decoder for the firmware's tokenized log backend (src/logging/logger_tokenized.*).
+#
+# Format strings are recovered from the ".log_tokens" section of the firmware ELF and matched to
+# frames by re-computing their FNV-1a hash. String arguments ("%s") are resolved by reading the
+# pointed-to string out of the ELF's loaded sections, so constant strings decode fine.
+#
+# Capture the RTT channel with e.g.:
+#   JLinkRTTLogger -Device NRF52840_XXAA -If SWD -Speed 4000 -RTTChannel 1 capture.bin
+# then decode with:
+#   ./tokenized_log_decoder.py ../firmware/ses/Output/Debug/Exe/remote.elf capture.bin
+#
+
+import argparse
+import re
+import struct
+import sys
+
+FRAME_MAGIC = 0xA5
+FRAME_HEADER_WORDS = 3
+TIMESTAMP_FREQUENCY = 1000000
+MAX_ARGS = 8
+
+LEVELS = ["DBG", "INFO", "WARNING", "ERROR"]
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 0x2
+
+FORMAT_SPEC = re.compile(r"%([-+ #0]*)(\d+)?(?:\.(\d+))?(hh|h|ll|l|j|z|t)?([diouxXcspfFeEgG%])")
+
+
+def fnv1a(data):
+    """32-bit FNV-1a, must match logger::tokenized::hash()."""
+    value = 0x811C9DC5
+    for byte in data:
+        value ^= byte
+        value = (value * 0x01000193) & 0xFFFFFFFF
+    return value
+
+
+class Elf:
+    """Minimal little-endian ELF32 section reader (enough for Cortex-M images)."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            raise ValueError("%s is not an ELF32 file" % path)
+
+        (shoff,) = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data, 0x2E)
+
+        headers = [struct.unpack_from("<IIIIIIIIII", self.data, shoff + i * shentsize)
+                   for i in range(shnum)]
+        names_offset = headers[shstrndx][4]
+
+        self.sections = []
+        for name, sh_type, flags, addr, offset, size, *_ in headers:
+            end = self.data.index(b"\0", names_offset + name)
+            self.sections.append({
+                "name": self.data[names_offset + name:end].decode(),
+                "type": sh_type,
+                "flags": flags,
+                "addr": addr,
+                "bytes": self.data[offset:offset + size],
+            })
+
+    def section(self, name):
+        for section in self.sections:
+            if section["name"] == name:
+                return section
+        return None
+
+    def read_string(self, addr):
+        for section in self.sections:
+            if (section["type"] == SHT_PROGBITS and section["flags"] & SHF_ALLOC and
+                    section["addr"] <= addr < section["addr"] + len(section["bytes"])):
+                start = addr - section["addr"]
+                end = section["bytes"].find(b"\0", start)
+                return section["bytes"][start:end].decode(errors="replace")
+        return None
+
+
+def load_tokens(elf):
+    section = elf.section(".log_tokens")
+    if section is None:
+        raise ValueError("ELF has no .log_tokens section (is the tokenized backend enabled?)")
+
+    tokens = {}
+    for raw in section["bytes"].split(b"\0"):
+        if raw:
+            tokens[fnv1a(raw)] = raw.decode(errors="replace")
+    return tokens
+
+
+def format_log(fmt, args, elf):
+    """Applies argument words to a C format string. 64-bit integers and doubles take two words."""
+    args = list(args)
+
+    def convert(match):
+        flags, width, precision, length, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+
+        wide = conversion in "fFeEgG" or length in ("ll", "j")
+        if len(args) < (2 if wide else 1):
+            return "<missing>"
+
+        value = args.pop(0)
+        spec = "%" + flags + (width or "") + ("." + precision if precision else "")
+
+        if conversion in "fFeEgG":
+            (value,) = struct.unpack("<d", struct.pack("<II", value, args.pop(0)))
+            return (spec + conversion) % value
+        if wide:
+            value |= args.pop(0) << 32
+            if conversion in "di" and value & (1 << 63):
+                value -= 1 << 64
+            return (spec + ("d" if conversion in "diu" else conversion)) % value
+
+        if conversion in "di":
+            return (spec + "d") % (value - (1 << 32) if value & 0x80000000 else value)
+        if conversion == "u":
+            return (spec + "d") % value
+        if conversion in "oxX":
+            return (spec + conversion) % value
+        if conversion == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if conversion == "p":
+            return "0x%08X" % value
+        # conversion == "s"
+        string = elf.read_string(value)
+        return (spec + "s") % (string if string is not None else "<str@0x%08X>" % value)
+
+    return FORMAT_SPEC.sub(convert, fmt)
+
+
+def decode(stream, tokens, elf):
+    """Yields decoded lines from a buffer of raw frames, resynchronizing on bad headers."""
+    offset = 0
+    while offset + FRAME_HEADER_WORDS * 4 <= len(stream):
+        header, token, timestamp = struct.unpack_from("<III", stream, offset)
+        magic, level, arg_cnt = header >> 24, (header >> 16) & 0xFF, header & 0xFF
+
+        if magic != FRAME_MAGIC or level >= len(LEVELS) or arg_cnt > MAX_ARGS:
+            offset += 1
+            continue
+
+        frame_len = (FRAME_HEADER_WORDS + arg_cnt) * 4
+        if offset + frame_len > len(stream):
+            break
+
+        args = struct.unpack_from("<%dI" % arg_cnt, stream, offset + FRAME_HEADER_WORDS * 4)
+        offset += frame_len
+
+        if token in tokens:
+            text = format_log(tokens[token], args, elf)
+        else:
+            text = "<unknown token 0x%08X> %s" % (token, " ".join("0x%08X" % a for a in args))
+
+        seconds = timestamp / TIMESTAMP_FREQUENCY
+        yield "[%11.6f] <%s> %s" % (seconds, LEVELS[level], text.rstrip("\n"))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode tokenized firmware logs.")
+    parser.add_argument("elf", help="firmware ELF the logs were captured from")
+    parser.add_argument("capture", nargs="?", help="raw RTT capture (default: stdin)")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    tokens = load_tokens(elf)
+
+    if args.capture:
+        with open(args.capture, "rb") as f:
+            stream = f.read()
+    else:
+        stream = sys.stdin.buffer.read()
+
+    for line in decode(stream, tokens, elf):
+        print(line)
+
+
+if __name__ == "__main__":
+    main()